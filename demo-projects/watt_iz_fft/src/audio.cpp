@@ -7,34 +7,557 @@ AUDIO audio;
 
 // Audio Capture task queue handle
 TaskHandle_t h_taskAudioCapture = nullptr; // creat task handle for mic capture task
+TaskHandle_t h_taskCaptureIO = nullptr;   // capture I/O stage, woken by the mic DMA
 QueueHandle_t qAudioRecCmds;              // queue command handle
-QueueHandle_t qAudioRecStatus;            // queue status handle
+EventGroupHandle_t egAudioCapture = nullptr;  // capture state & event bits
+SeqLock<capture_status_t> capture_status;    // latest capture status snapshot
+SeqLock<capture_latency_t> capture_latency;  // latency of the last delivered frame
 
-// Tone task queu handle
-TaskHandle_t h_playTone = nullptr;        // creat a task handle for mic bg task
-QueueHandle_t h_QueueToneTask;            // queue command handle
+// Audio engine task: owns the tone, WAV & stream voices
+TaskHandle_t h_AudioEngine = nullptr;
+static QueueHandle_t qAudioEngine = nullptr;       // engine_cmd_t commands
+static EventGroupHandle_t egAudioEngine = nullptr; // ENGINE_xxx busy/done bits
+static SemaphoreHandle_t semStreamOwner = nullptr;  // held by the task that owns the stream source
 
-// Play WAV file task queue handle
-TaskHandle_t h_taskAudioPlayWAV = nullptr;   // creat task handle for play WAV task
-QueueHandle_t h_QueueAudioPlayWAVCmd;     // queue command handle
-QueueHandle_t h_QueueAudioPlayWAVStat;    // queue status handle
+// WAV track loader: opens playlist files & reads them ahead of the engine
+TaskHandle_t h_WavPrefetch = nullptr;
 
 // Audio Play background Task
 TaskHandle_t h_AudioPlay = nullptr;
 QueueHandle_t qAudioPlay = nullptr;                 // queue command handle
+ChunkRingFifo mix_fifo[MIX_NUM_SOURCES];  // chunks waiting for the mixer, one fifo per source
+static SemaphoreHandle_t semMixSpace[MIX_NUM_SOURCES];   // given each time the mixer frees a slot
+static SemaphoreHandle_t semPlayData = nullptr;    // given each time a producer commits a slot
+static SemaphoreHandle_t semClipLock = nullptr;    // one playClip() producer at a time
+static SemaphoreHandle_t semSfxLock = nullptr;     // one playSfx() producer at a time
+static SemaphoreHandle_t semSpeakerSent = nullptr; // given by the speaker channel per DMA buffer sent
+static std::atomic<uint8_t> play_stream_depth{PLAY_FIFO_DEPTH};   // stream chunks a producer may queue
+static QueueSetHandle_t setPlayEvents = nullptr;   // player sleeps on all of the above + qAudioPlay
+
+// ChunkRingFifo rounds its depth up to a power of two: keep these exact
+static_assert(FIFO_IS_POW2(CAPTURE_PIPE_DEPTH) && FIFO_IS_POW2(PLAY_FIFO_DEPTH) &&
+         FIFO_IS_POW2(CLIP_FIFO_DEPTH) && FIFO_IS_POW2(SFX_FIFO_DEPTH) &&
+         FIFO_IS_POW2(WAV_PREFETCH_DEPTH), "fifo depths must be powers of 2");
+static_assert(ENGINE_DRAINED(MIX_NUM_SOURCES - 1) < 0x01000000, "event groups hold 24 bits");
+
+SeqLock<play_stats_t> play_stats;
+
+// I2S channels (std driver)
+static i2s_chan_handle_t mic_chan = nullptr;
+static i2s_chan_handle_t spkr_chan = nullptr;
+
+// Mic DMA buffers handed to the capture I/O stage by the RX callback. Samples 
+// are converted where DMA left them - there is no read copy.
+static struct {
+   void *bufs[MIC_DMA_MAX_DESC];          // filled buffers in arrival order (ISR writes)
+   std::atomic<uint32_t> head;            // buffers received (ISR)
+   uint32_t tail;                         // buffers consumed (capture I/O stage)
+   uint32_t desc;                         // DMA buffers in the channel
+   uint32_t samples;                      // samples per DMA buffer
+   uint32_t rate;
+   uint16_t frame;                        // capture frame the channel is sized for
+   uint8_t frames;                        // DMA depth in capture frames
+   bool enabled;
+   uint32_t overruns;                     // buffers overwritten before they were read
+   std::atomic<bool> flush;               // drop what was received so far (clearReadBuffer)
+} mic_dma;
+
+// Sample clocks of the two DMA streams, stamped by the channel callbacks
+static ESP32S3_DMA_CLOCK mic_clock;
+static ESP32S3_DMA_CLOCK spkr_clock;
+
+// Header of a frame in the capture pipe, followed by float pcm[len] [, ref[len]]
+typedef struct {
+   int64_t time_us;                       // first sample
+   int64_t read_us;                       // read from DMA
+} pipe_frame_t ;
+
+// Capture pipeline. The I/O stage (core 0) commits frames to 'fifo', the 
+// analysis stage (capture task, core 1) takes them through pipeSource().
+static SemaphoreHandle_t semPipeFrame = nullptr;   // given each time the I/O stage commits a frame
+static struct {
+   ChunkRingFifo fifo;                    // CAPTURE_PIPE_DEPTH frames
+   pipe_frame_t *scratch;                 // frame read while the fifo is full, then dropped
+   uint16_t len;                          // samples per frame
+   bool use_ref;                          // frames carry the echo reference
+   float gain;                            // applied while converting
+   std::atomic<bool> run;                 // I/O stage reads frames (set by the capture task)
+   std::atomic<bool> idle;                // I/O stage is outside the fifo
+   std::atomic<uint32_t> drops;           // frames dropped by the I/O stage
+   uint8_t max_lag;                       // most frames waiting (analysis stage)
+   int64_t read_us;                       // read time of the frame taken last (analysis stage)
+} capture_pipe;
+
+// Echo reference read position (capture I/O stage)
+static struct {
+   double ref_pos;                        // speaker sample of the next mic sample
+   bool synced;
+   uint32_t resyncs;
+} duplex;
+
+// DMA buffer of an I2S event. Before IDF 5.4 'data' points to the buffer pointer.
+#if ESP_IDF_VERSION >= ESP_IDF_VERSION_VAL(5, 4, 0)
+#define I2S_EVENT_BUF(evt)    ((evt)->dma_buf)
+#else
+#define I2S_EVENT_BUF(evt)    (*(void **)(evt)->data)
+#endif
+
+static void publishCaptureStatus(const capture_status_t *cap_stat);
+static BaseType_t engineSend(const engine_cmd_t &cmd, TickType_t ticks);
+static int32_t wavFileRead(void *ctx, uint8_t *buf, uint32_t len, uint32_t offset);
+static bool wavPrefetchInit(void);
+static void wavTrackHeard(playlist_track_t &t, uint32_t offset);
+
+// Far-end (speaker) reference for the echo canceller
+ESP32S3_AEC_REF aec_ref;
+
+// Clip bank in the 'clips' flash partition
+ESP32S3_CLIPS clip_bank;
 
 
 /********************************************************************
- * @brief Read and discard read dma buffer contents
+ * @brief Convert a float sample to int16 with saturation
  */
-void AUDIO::clearReadBuffer(void)
+static inline int16_t floatToSample(float fs)
+{
+   if(fs > 32767.0f) return 32767;
+   if(fs < -32768.0f) return -32768;
+   return int16_t(fs);
+}
+
+
+/********************************************************************
+ * @brief Mic RX callback (ISR): queue the filled DMA buffer & wake the 
+ * capture I/O stage.
+ */
+static bool IRAM_ATTR micRecvDone(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+   BaseType_t woken = pdFALSE;
+   uint32_t head = mic_dma.head.load(std::memory_order_relaxed);
+
+   mic_dma.bufs[head % MIC_DMA_MAX_DESC] = I2S_EVENT_BUF(event);
+   mic_dma.head.store(head + 1, std::memory_order_release);
+   mic_clock.stamp(event->size / sizeof(int16_t));
+   if(h_taskCaptureIO)
+      vTaskNotifyGiveFromISR(h_taskCaptureIO, &woken);
+   return woken == pdTRUE;
+}
+
+
+/********************************************************************
+ * @brief Speaker TX callback (ISR): one DMA buffer was sent. Its samples 
+ * (as played, before auto clear) become echo reference, then the player
+ * is woken.
+ */
+static bool IRAM_ATTR spkrSentDone(i2s_chan_handle_t handle, i2s_event_data_t *event, void *user_ctx)
+{
+   BaseType_t woken = pdFALSE;
+   uint32_t n = event->size / sizeof(int16_t);
+
+   aec_ref.push((const int16_t *)I2S_EVENT_BUF(event), n);
+   spkr_clock.stamp(n);
+   xSemaphoreGiveFromISR(semSpeakerSent, &woken);
+   return woken == pdTRUE;
+}
+
+
+/********************************************************************
+ * @brief Start the mic channel for a capture. The channel is rebuilt 
+ * when the frame size or DMA depth changes. Capture task only.
+ */
+static bool micStart(uint16_t samples_frame, uint8_t dma_frames)
+{
+   if(!mic_chan || samples_frame != mic_dma.frame || dma_frames != mic_dma.frames) {
+      if(!audio.initMicrophone(mic_dma.rate, samples_frame, dma_frames))
+         return false;
+   }
+   else if(mic_dma.enabled)
+      return true;
+   mic_dma.head.store(0);                 // buffer count * samples == mic clock count
+   mic_dma.tail = 0;
+   mic_dma.overruns = 0;                  // counted per capture
+   mic_dma.flush.store(false);
+   mic_clock.reset(float(mic_dma.rate));
+   duplex.synced = false;
+   mic_dma.enabled = (i2s_channel_enable(mic_chan) == ESP_OK);
+   return mic_dma.enabled;
+}
+
+
+/********************************************************************
+ * @brief Stop the mic DMA between captures.
+ */
+static void micStop(void)
+{
+   if(mic_chan && mic_dma.enabled)
+      i2s_channel_disable(mic_chan);
+   mic_dma.enabled = false;
+}
+
+
+/********************************************************************
+ * @brief Convert the next frame of mic audio to float, reading the DMA 
+ * buffers passed by micRecvDone() in place. Capture I/O stage only.
+ * @param gain - applied while converting.
+ * @return false if the mic DMA stalled or the pipe was stopped.
+ */
+static bool micReadFrame(float *out, uint16_t len, float gain)
+{
+   uint32_t head, j, done = 0;
+   const int16_t *dma;
+
+   if(mic_dma.flush.exchange(false))
+      mic_dma.tail = mic_dma.head.load();
+   while(done < len) {
+      while((head = mic_dma.head.load(std::memory_order_acquire)) == mic_dma.tail) {
+         if(!capture_pipe.run.load() || ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(MIC_DMA_TIMEOUT_MS)) == 0)
+            return false;
+      }
+      if(head - mic_dma.tail >= mic_dma.desc) {   // DMA has lapped the oldest buffers
+         mic_dma.overruns += head - mic_dma.tail - (mic_dma.desc - 1);
+         mic_dma.tail = head - (mic_dma.desc - 1);
+      }
+      dma = (const int16_t *)mic_dma.bufs[mic_dma.tail % MIC_DMA_MAX_DESC];
+      mic_dma.tail++;
+      for(j = 0; j < mic_dma.samples && done < len; j++)
+         out[done++] = float(dma[j]) * gain;
+   }
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Fill the echo reference for the mic frame just read with the 
+ * speaker samples played while it was captured. The frame start is 
+ * mapped to a speaker sample through the two DMA clocks, and the 
+ * reference steps at the speaker / mic rate ratio. The read position 
+ * runs on between frames and is only re-aligned when it strays more than 
+ * DUPLEX_RESYNC_SAMPLES (start, overruns). Capture I/O stage only.
+ * @return esp_timer time of the frame's first sample.
+ */
+static int64_t duplexReference(float *dst, uint16_t n)
+{
+   double mic_rate = mic_clock.rate();
+   double step = spkr_clock.rate() / mic_rate;
+   int64_t t0 = mic_clock.timeOf(uint64_t(mic_dma.tail) * mic_dma.samples) - 
+            int64_t(double(n) * 1e6 / mic_rate);
+   double target;
+
+   if(!dst)
+      return t0;
+   if(!spkr_clock.position(t0, &target)) {
+      memset(dst, 0, n * sizeof(float));
+      return t0;
+   }
+   if(!duplex.synced || fabs(target - duplex.ref_pos) > DUPLEX_RESYNC_SAMPLES) {
+      if(duplex.synced)
+         duplex.resyncs++;
+      duplex.ref_pos = target;
+      duplex.synced = true;
+   }
+   aec_ref.read(dst, n, duplex.ref_pos, float(step));
+   duplex.ref_pos += double(n) * step;
+   return t0;
+}
+
+
+/********************************************************************
+ * @brief Stage times of a frame in the capture ring
+ */
+typedef struct {
+   int64_t time_us;                       // first sample
+   int64_t read_us;                       // read from DMA (I/O stage)
+   int64_t ready_us;                      // taken from the pipe (analysis stage)
+   int64_t done_us;                       // DSP graph done
+} frame_stamp_t ;
+
+
+/********************************************************************
+ * @brief Account one delivered frame, from its first sample to the 
+ * FRAME_AVAIL status just published, and publish the snapshot.
+ * @param deliver_us - time the frame's delivery started.
+ * @param sum_us - running total of 'total_us', reset with 'lat'.
+ */
+static void captureLatency(capture_latency_t &lat, uint64_t &sum_us, const frame_stamp_t &st, 
+         int64_t deliver_us)
+{
+   int64_t now = esp_timer_get_time();
+   int64_t last = st.time_us + lat.frame_us;   // last sample of the frame
+
+   if(st.time_us == 0)
+      return;                             // no mic clock yet
+   lat.dma_us = (st.read_us > last) ? uint32_t(st.read_us - last) : 0;
+   lat.pipe_us = uint32_t(st.ready_us - st.read_us);
+   lat.dsp_us = uint32_t(st.done_us - st.ready_us);
+   lat.queue_us = uint32_t(deliver_us - st.done_us);
+   lat.deliver_us = uint32_t(now - deliver_us);
+   lat.total_us = uint32_t(now - st.time_us);
+   lat.frames++;
+   sum_us += lat.total_us;
+   lat.avg_total_us = uint32_t(sum_us / lat.frames);
+   if(lat.total_us > lat.max_total_us)
+      lat.max_total_us = lat.total_us;
+   if(lat.budget_us && lat.total_us > lat.budget_us)
+      lat.over_budget++;
+   capture_latency.write(lat);
+}
+
+
+/********************************************************************
+ * @brief Capture DSP graph. Every node exists, a capture command adds 
+ * only the ones it uses. The graph is declared last so it is destroyed 
+ * before its nodes.
+ */
+typedef struct {
+   DSP_SOURCE_NODE source;
+   DSP_CONVERT_NODE convert;
+   DSP_AEC_NODE aec;
+   DSP_LP_NODE lowpass;
+   DSP_NS_NODE ns;
+   DSP_VAD_NODE vad;
+   DSP_AGC_NODE agc;
+   DSP_ENCODE_NODE encode;
+   DSP_TAP_NODE kws_tap;
+   ESP32S3_DSP_GRAPH graph;
+} capture_graph_t ;
+
+#define MIC_GAIN_FACTOR      16.0f        // fixed mic gain used when AGC is disabled
+
+
+/********************************************************************
+ * @brief Stop the capture I/O stage and wait until it is outside the 
+ * pipe. Capture task only.
+ */
+static void pipeStop(void)
+{
+   capture_pipe.run.store(false);
+   if(h_taskCaptureIO)
+      xTaskNotifyGive(h_taskCaptureIO);   // leave a mic DMA wait
+   while(!capture_pipe.idle.load())
+      vTaskDelay(1);
+}
+
+
+/********************************************************************
+ * @brief Size the pipe for a capture and start the I/O stage. Frames 
+ * hold the samples converted with 'gain', and the echo reference if 
+ * 'use_ref'. Capture task only.
+ * @return false if the frames don't fit a pipe slot or allocation failed.
+ */
+static bool pipeStart(uint16_t len, bool use_ref, float gain)
+{
+   uint32_t bytes = sizeof(pipe_frame_t) + uint32_t(len) * sizeof(float) * (use_ref ? 2 : 1);
+
+   pipeStop();
+   if(capture_pipe.scratch)
+      heap_caps_free(capture_pipe.scratch);
+   capture_pipe.scratch = nullptr;
+   if(bytes > UINT16_MAX - sizeof(SlotHdr) || !capture_pipe.fifo.create(CAPTURE_PIPE_DEPTH, bytes))
+      return false;
+   capture_pipe.scratch = (pipe_frame_t *)heap_caps_malloc(bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+   if(!capture_pipe.scratch)
+      return false;
+   capture_pipe.len = len;
+   capture_pipe.use_ref = use_ref;
+   capture_pipe.gain = gain;
+   capture_pipe.drops.store(0);
+   capture_pipe.max_lag = 0;
+   capture_pipe.run.store(true);
+   xTaskNotifyGive(h_taskCaptureIO);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Resume the I/O stage after a pause, without the frames read 
+ * before it. Capture task only.
+ */
+static void pipeResume(void)
+{
+   capture_pipe.fifo.clear();
+   mic_dma.flush.store(true);             // resume with fresh audio
+   capture_pipe.run.store(true);
+   xTaskNotifyGive(h_taskCaptureIO);
+}
+
+
+/********************************************************************
+ * @brief Capture I/O stage. Runs in core 0 above the audio engine, so the 
+ * mic DMA is drained however long the analysis takes: each frame is 
+ * converted where DMA left it, gets its echo reference & time, and is 
+ * committed to the pipe. While the analysis stage is CAPTURE_PIPE_DEPTH 
+ * frames behind, frames are read into scratch and dropped (counted).
+ */
+void taskCaptureIO(void *params)
+{
+   pipe_frame_t *pf;
+   float *pcm;
+   bool drop;
+
+   while(true) {
+      capture_pipe.idle.store(false);     // before 'run' is checked, see pipeStop()
+      if(!capture_pipe.run.load()) {
+         capture_pipe.idle.store(true);
+         ulTaskNotifyTake(pdTRUE, portMAX_DELAY);   // mic DMA or pipeStart()
+         continue;
+      }
+      pf = (pipe_frame_t *)capture_pipe.fifo.acquire();
+      drop = (pf == nullptr);
+      if(drop)
+         pf = capture_pipe.scratch;
+      pcm = (float *)(pf + 1);
+      if(!micReadFrame(pcm, capture_pipe.len, capture_pipe.gain))
+         continue;                        // stalled or stopped
+      pf->time_us = duplexReference((capture_pipe.use_ref) ? pcm + capture_pipe.len : nullptr, 
+               capture_pipe.len);         // nullptr: time only
+      pf->read_us = esp_timer_get_time();
+      if(drop) {
+         capture_pipe.drops++;
+         continue;
+      }
+      capture_pipe.fifo.commit(capture_pipe.fifo.chunkBytes());
+      xSemaphoreGive(semPipeFrame);
+   }
+}
+
+
+/********************************************************************
+ * @brief Graph source of the analysis stage: the oldest frame in the 
+ * capture pipe, and its echo reference when the graph has one.
+ */
+static bool pipeSource(dsp_frame_t &f, void *ctx)
+{
+   const pipe_frame_t *pf;
+   const float *pcm;
+   uint16_t bytes, waiting;
+
+   while(!(pf = (const pipe_frame_t *)capture_pipe.fifo.front(bytes))) {
+      if(xSemaphoreTake(semPipeFrame, pdMS_TO_TICKS(MIC_DMA_TIMEOUT_MS)) != pdTRUE)
+         return false;
+   }
+   waiting = capture_pipe.fifo.count();
+   if(waiting > capture_pipe.max_lag)
+      capture_pipe.max_lag = waiting;
+   pcm = (const float *)(pf + 1);
+   memcpy(f.pcm, pcm, f.len * sizeof(float));
+   if(f.ref && capture_pipe.use_ref)
+      memcpy(f.ref, pcm + f.len, f.len * sizeof(float));
+   else if(f.ref)
+      memset(f.ref, 0, f.len * sizeof(float));
+   f.time_us = pf->time_us;
+   capture_pipe.read_us = pf->read_us;
+   capture_pipe.fifo.release();
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Graph tap: keyword spotter features are computed continuously 
+ * so speech onset is kept.
+ */
+static void kwsTap(const dsp_frame_t &f, void *ctx)
+{
+   kws.pushAudio(f.pcm, f.len, f.time_us);
+}
+
+
+/********************************************************************
+ * @brief DSP features a command asks for, CAPTURE_DSP_xxx bits.
+ */
+static uint8_t captureFeatures(const capture_cmd_t &cmd)
+{
+   return ((cmd.use_echo_cancel) ? CAPTURE_DSP_AEC : 0) | 
+            ((cmd.use_lowpass_filter) ? CAPTURE_DSP_LOWPASS : 0) | 
+            ((cmd.use_noise_suppress) ? CAPTURE_DSP_NS : 0) | 
+            ((cmd.enab_vad) ? CAPTURE_DSP_VAD : 0) | 
+            ((cmd.use_agc) ? CAPTURE_DSP_AGC : 0) | 
+            ((cmd.use_kws) ? CAPTURE_DSP_KWS : 0);
+}
+
+
+/********************************************************************
+ * @brief Build the capture graph for a command:
+ * source > [convert] > [aec] > [lowpass] > [ns] > [vad] > [agc] > encode > [kws]
+ * The VAD runs ahead of the AGC so it sees ungained audio. Features 
+ * whose node can't run (mode, frame size, memory) are cleared in 'cmd' 
+ * and reported in 'dropped', never left out silently.
+ * @param dropped - CAPTURE_DSP_xxx asked for but not in the graph.
+ * @param source_ports - DSP_PORT_PCM (mic) or DSP_PORT_I16 (file).
+ * @param gain - fixed gain of the convert node.
+ * @return false if a required node can't be allocated.
+ */
+static bool buildCaptureGraph(capture_graph_t &cg, capture_cmd_t &cmd, DspSource_cb source, 
+         void *ctx, uint8_t source_ports, float gain, uint8_t *dropped)
 {
-#define BUFR_DEPTH      (1024 * sizeof(uint16_t) * 2)   // clear two 1K buffers
-   size_t bytes_read;
-   uint8_t *junk_bufr = (uint8_t *)heap_caps_malloc(BUFR_DEPTH, MALLOC_CAP_SPIRAM);  
-   i2s_read(I2S_MICROPHONE, (uint8_t *)junk_bufr, BUFR_DEPTH, &bytes_read, portMAX_DELAY);  
+   uint32_t len = cmd.samples_per_frame;
+   uint8_t asked = captureFeatures(cmd);
+
+   *dropped = 0;
+
+   cg.graph.begin(len, float(AUDIO_SAMPLE_RATE));
+
+   // Echo canceller (intercom only) needs the speaker reference from the source
+   if(cmd.use_echo_cancel && (cmd.mode != CAPTURE_MODE_INTERCOM || (len % AEC_BLOCK_SIZE) != 0))
+      cmd.use_echo_cancel = false;
+   if(cmd.use_echo_cancel)
+      source_ports |= DSP_PORT_REF;
+   cg.source.setup(source, ctx, source_ports);
+   if(!cg.graph.add(&cg.source))
+      return false;
+   if(!(source_ports & DSP_PORT_PCM)) {
+      cg.convert.setup(gain);
+      if(!cg.graph.add(&cg.convert))
+         return false;
+   }
+   if(cmd.use_echo_cancel)
+      cmd.use_echo_cancel = cg.graph.add(&cg.aec);
+
+   // IIR low pass, optimized DSP function unique to the ESP32-S3 mcu
+   if(cmd.use_lowpass_filter) {
+      cg.lowpass.setup(cmd.filter_cutoff_freq, cmd.qfactor);
+      cmd.use_lowpass_filter = cg.graph.add(&cg.lowpass);
+   }
 
-   heap_caps_free(junk_bufr);
+   // Noise suppressor: frame size must be a multiple of NS_HOP_SIZE (256 samples)
+   if(cmd.use_noise_suppress)
+      cmd.use_noise_suppress = cg.graph.add(&cg.ns);
+
+   // VAD: frames shorter than DSP_VAD_FFT_SIZE use a sliding window
+   if(cmd.enab_vad)
+      cmd.enab_vad = cg.graph.add(&cg.vad);
+
+   // AGC tuning per capture mode
+   if(cmd.use_agc) {
+      cg.agc.setup(audio.getAgcConfig(cmd.mode));
+      cmd.use_agc = cg.graph.add(&cg.agc);
+   }
+
+   cg.encode.target(nullptr);
+   if(!cg.graph.add(&cg.encode))
+      return false;
+
+   // Keyword spotter needs the VAD for segmentation. Templates are loaded from SD on first use.
+   if(cmd.use_kws) {
+      cmd.use_kws = cmd.enab_vad && (kws.isReady() || kws.init(KWS_LIBRARY_FILE));
+      if(cmd.use_kws) {
+         cg.kws_tap.setup("kws", DSP_PORT_PCM, kwsTap, nullptr);
+         cmd.use_kws = cg.graph.add(&cg.kws_tap);
+      }
+   }
+   *dropped = asked & ~captureFeatures(cmd);
+   if(*dropped)
+      Serial.printf("Capture DSP features 0x%02X dropped at %u samples/frame\n", *dropped, len);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Drop mic audio received but not yet read (e.g. speaker noise).
+ * The capture I/O stage skips ahead before its next frame - never blocks.
+ */
+void AUDIO::clearReadBuffer(void)
+{
+   mic_dma.flush.store(true);
 }
 
 
@@ -44,6 +567,10 @@ void AUDIO::clearReadBuffer(void)
  */
 bool AUDIO::init(uint32_t sample_rate)
 {
+   // Reference ring for the intercom echo canceller, fed by the speaker channel
+   if(!aec_ref.create(AEC_REF_RING_SAMPLES))
+      return false;
+
    // Initialize Microphone I2S driver for ICS43434 mems mic
    if(!initMicrophone(sample_rate))
       return false;
@@ -59,7 +586,7 @@ bool AUDIO::init(uint32_t sample_rate)
     * @brief Start background task to perform microphone data collection.
     */      
    qAudioRecCmds = xQueueCreate(5, sizeof(capture_cmd_t));  // commands to capture task
-   qAudioRecStatus = xQueueCreate(1, sizeof(capture_status_t)); // status from capture task
+   egAudioCapture = xEventGroupCreate();   // status from capture task
 
    static capture_cmd_t rec_cmd;
    rec_cmd.data_dest = nullptr;
@@ -71,23 +598,64 @@ bool AUDIO::init(uint32_t sample_rate)
    rec_cmd.samples_per_frame = DEFAULT_SAMPLES_PER_FRAME;
    rec_cmd.use_lowpass_filter = false;
    rec_cmd.enab_vad = true;
+   rec_cmd.use_noise_suppress = false;
+   rec_cmd.use_echo_cancel = false;
+   rec_cmd.use_agc = true;
+   rec_cmd.use_kws = false;
 
    /**
-    * @brief Start audio capture background task running in core 0
+    * @brief Start the capture pipeline: the I/O stage in core 0 drains the 
+    * mic DMA, the capture (analysis) task in core 1 runs the DSP graph.
     */
+   semPipeFrame = xSemaphoreCreateBinary();
+   capture_pipe.idle.store(true);
+   xTaskCreatePinnedToCore(
+      taskCaptureIO,
+      "capture_io",
+      2048,          // Stack size in words
+      nullptr,
+      4,             // > audio engine - the mic DMA is never starved
+      &h_taskCaptureIO,
+      0);            // run this task in core 0
+
    xTaskCreatePinnedToCore(
       taskCaptureAudio,                   // Function to implement the task 
       "audio_capture",                    // Name of the task (optional)
       5000,                               // Stack size in words. Use printTaskHighWaterMark() to calc.
       &rec_cmd,                           // Task input parameter struct
-      1,                                  // Priority of the task - higher number = higher priority
+      2,                                  // Priority of the task - higher number = higher priority (> loopTask / LVGL)
       &h_taskAudioCapture,                // Task handle. 
-      0);                                 // this task runs in Core 0. 
+      1);                                 // this task runs in Core 1. 
 
    /**
     * @brief Start the audio play task running in core 1.
     */     
    qAudioPlay = xQueueCreate(3, sizeof(audio_play_t));   // queue for sending audio frames
+   semPlayData = xSemaphoreCreateBinary();
+   for(uint8_t i = 0; i < MIX_NUM_SOURCES; i++) {
+      semMixSpace[i] = xSemaphoreCreateBinary();
+      if(i == MIX_SRC_CLIP || i == MIX_SRC_SFX)   // regions, not audio
+         continue;
+      if(!mix_fifo[i].create(PLAY_FIFO_DEPTH, PLAY_FIFO_CHUNK_BYTES))
+         return false;
+   }
+   if(!mix_fifo[MIX_SRC_CLIP].create(CLIP_FIFO_DEPTH, sizeof(mix_region_t), 
+            MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT) || 
+            !mix_fifo[MIX_SRC_SFX].create(SFX_FIFO_DEPTH, sizeof(mix_region_t), 
+            MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT))
+      return false;
+   semClipLock = xSemaphoreCreateMutex();
+   semSfxLock = xSemaphoreCreateMutex();
+   if(!clip_bank.begin())                 // optional - only playClip() needs it
+      Serial.println("No clip bank in flash");
+
+   // The player wakes on a command, a committed chunk, or a finished DMA buffer
+   setPlayEvents = xQueueCreateSet(3 + 1 + PLAY_DMA_BUF_COUNT * 2);
+   xQueueAddToSet(qAudioPlay, setPlayEvents);
+   xQueueAddToSet(semPlayData, setPlayEvents);
+   while(xQueueAddToSet(semSpeakerSent, setPlayEvents) != pdPASS) {
+      xQueueReset(semSpeakerSent);        // only an empty semaphore can join a set
+   }
 
    xTaskCreatePinnedToCore(
       taskPlayAudio,
@@ -98,12 +666,45 @@ bool AUDIO::init(uint32_t sample_rate)
       &h_AudioPlay,
       1);            // run this task in core 1
 
+   /**
+    * @brief Start the audio engine (tone & WAV voices) in core 0.
+    */
+   qAudioEngine = xQueueCreate(4, sizeof(engine_cmd_t));
+   egAudioEngine = xEventGroupCreate();
+   semStreamOwner = xSemaphoreCreateBinary();
+   xSemaphoreGive(semStreamOwner);        // stream source starts free
+
+   xTaskCreatePinnedToCore(
+      taskAudioEngine,
+      "audio_engine",
+      4096,          // Stack size in words (SD reads)
+      nullptr,
+      2,             // > WAV prefetch so playback starts promptly
+      &h_AudioEngine,
+      0);            // run this task in core 0
+
+   /**
+    * @brief Start the WAV read-ahead task in core 0.
+    */
+   if(!wavPrefetchInit())
+      return false;
+   xTaskCreatePinnedToCore(
+      taskWavPrefetch,
+      "wav_prefetch",
+      3072,          // Stack size in words (SD reads)
+      nullptr,
+      1,             // low - SD reads are paced by the buffer, not by time
+      &h_WavPrefetch,
+      0);
+
    return true;
 }
 
 
 /********************************************************************
-*  @brief Audio capture background task. Runs in core 0.
+*  @brief Audio capture background task. Runs in core 1 as the analysis 
+*  stage of the capture pipeline: frames read by taskCaptureIO() in core 0 
+*  are taken from the pipe, run through the DSP graph and delivered.
 *  @note 
 *  1) Capture control is managed by sending a 'capture_cmd_t'
 *  structure to the command queue.   
@@ -120,7 +721,6 @@ bool AUDIO::init(uint32_t sample_rate)
 */
 void taskCaptureAudio(void * params)
 {
-#define MIC_GAIN_FACTOR      16           // normalize mic gain
    // pointer to task params
    capture_cmd_t *rec_cmd = (capture_cmd_t *)params;
 
@@ -130,8 +730,6 @@ void taskCaptureAudio(void * params)
    memcpy(&primary_cmd, rec_cmd, sizeof(capture_cmd_t)); // copy passed params to local struct
 
    // misc variables
-   uint32_t i, j, k;
-   int16_t sample16; 
    // uint16_t capture_stop = 0;
    // float fl;
    size_t bytes_read;  
@@ -145,20 +743,18 @@ void taskCaptureAudio(void * params)
 
    capture_status_t cap_status;
    cap_status.state = CAPTURE_STATE_NONE;   // status struct returned on request
+   cap_status.keyword_index = -1;
+   cap_status.keyword[0] = 0;
+   kws_result_t kws_result;               // keyword spotter result
    uint8_t wav_hdr[WAV_HEADER_SIZE + 4];  // wav file header
 
    /**
-    * @brief Create an FFT object for VAD analysis
+    * @brief Create the capture DSP graph. Its nodes are allocated per 
+    * capture command, unused nodes hold no memory.
     */
-#define CAPTURE_FFT_SIZE             512      
-   ESP32S3_FFT afft;                      // FFT object
-   fft_table_t *fft_table;
-   fft_table = afft.init(CAPTURE_FFT_SIZE, CAPTURE_FFT_SIZE, SPECTRAL_AVERAGE); //DEFAULT_SAMPLES_PER_FRAME, SPECTRAL_AVERAGE); 
-
-   /**
-    * @brief Create a low pass filter object
-    */
-   ESP32S3_LP_FILTER lp_filter;
+   capture_graph_t cg;
+   dsp_frame_t frame;
+   float mic_gain = MIC_GAIN_FACTOR;
 
    /**
     * @brief Create a Ring (circular) Buffer for VAD
@@ -171,6 +767,7 @@ void taskCaptureAudio(void * params)
       int16_t head               = 0;     // next write index
       int16_t tail               = 0;     // next read index
       int16_t count              = 0;     // number of frames available
+      frame_stamp_t stamp[RB_FRAME_DEPTH];   // stage times of each frame
    } RingBufr ;
 
    uint32_t cap_frame_count      = 0;     // frame progress counter
@@ -178,56 +775,43 @@ void taskCaptureAudio(void * params)
    uint32_t file_sz              = 0;
    // uint16_t pre_cap_frame_count  = 0;
 
-   // Variables for Formant analysis of speech detection
-   float E_all[3];
-   float E_low[3];
-   float E_high[3];
-   float E_ratio[3];
-   float D_all[3];      
-   float noise_baseline          = 0.0f;
-   bool noise_baseline_init      = false;
-   uint8_t hit_count             = 0;
-   bool detect_hit               = false;
-   bool in_speech                = false;   
-   uint8_t start_hits            = 0;
-   uint8_t stop_misses           = 0;
-   uint8_t missed_frames         = 0;
-
-   // Formant band defines. A bin == 31.25 Hz
-#define FFT_BIN_LOW              4        // 125 hz
-#define FFT_BIN_MID              21       // 660 hz
-#define FFT_BIN_HIGH             64       // 2000 hz
-
-   const uint8_t START_HITS_REQUIRED = 2;   // attack: frames (≈200 ms)
-   const uint8_t STOP_MISSES_REQUIRED = 4;  // hangover: frames (≈400 ms)   
-   constexpr float EPSILON       = 1e-6f;   // small value to prevent div by zero
+   bool in_speech                = false;   // VAD state of the last frame
 
    uint8_t *pframe               = nullptr;
    uint16_t rb_frame_bytes       = 0;
    uint32_t rb_total             = 0;
    bool vad_detected = true;              // assume VAD not enabled
    int16_t quiet_frame_count     = 0;
-   // Quiet frame interval in frames (96ms / frame)   
+   // Quiet interval that ends a VAD capture, converted to frames per capture
+#define CAPTURE_QUIET_MS_RECORD      1920     // 20 frames of 96ms
+#define CAPTURE_QUIET_MS_INTERCOM    576      // 6 frames of 96ms
    uint16_t max_quiet_frames     = 20;
    uint32_t riff_size;
+   int16_t slot;                          // ring slot written by the last frame
+   int64_t deliver_us;
+   TickType_t wait;                       // command queue wait, 0 while capturing
+
+   // Per stage latency of delivered frames
+   capture_latency_t cap_latency = {};
+   uint64_t latency_sum_us       = 0;
 
    // Various internal frame buffer pointers (allocated when capture cmd rcvd)
-   uint8_t *mic_raw_data_bufr    = nullptr; 
-   float *mic_float_bufr         = nullptr; 
-   float *mic_output             = nullptr;
-   float *fft_output_buf         = nullptr; 
+   uint8_t *mic_raw_data_bufr    = nullptr;  // WAV file copy buffer 
    
    uint32_t tmo = millis();
 
    /**
-    * @brief Infinite loop to capture frames of mic data. 
+    * @brief Infinite loop to capture frames of mic data. While capturing 
+    * the graph's source blocks on the capture pipe, otherwise the task 
+    * sleeps on the command queue.
     */
    while(true) {
 
       /**
        * @brief Check task command queue for mode changes
        */
-      if(xQueueReceive(qAudioRecCmds, &shadow_cmd, 0) == pdTRUE) {    // check for commands
+      wait = (exec_capture && !pause_capture && !stop_capture) ? 0 : portMAX_DELAY;
+      if(xQueueReceive(qAudioRecCmds, &shadow_cmd, wait) == pdTRUE) {    // check for commands
          if(shadow_cmd.mode == CAPTURE_MODE_RECORD || shadow_cmd.mode == CAPTURE_MODE_INTERCOM) {
             if(!pause_capture) {
                // Copy parameters from shadow cmd struct
@@ -236,7 +820,6 @@ void taskCaptureAudio(void * params)
                stop_capture = false;
                cap_status.state = CAPTURE_STATE_NONE;   // no status yet
                cap_status.bufr_sel = 0;
-               vad_detected = (!primary_cmd.enab_vad); // enab = !detected
 
                /**
                 * @brief Convert capture duration to number of frames to capture.
@@ -248,24 +831,44 @@ void taskCaptureAudio(void * params)
                } else {
                   max_frames = primary_cmd.num_frames;
                }
-               // 
-               if(shadow_cmd.mode == CAPTURE_MODE_INTERCOM)
-                  max_quiet_frames = 6;
-               else 
-                  max_quiet_frames = 20; 
+               max_quiet_frames = (uint32_t((shadow_cmd.mode == CAPTURE_MODE_INTERCOM) ? 
+                        CAPTURE_QUIET_MS_INTERCOM : CAPTURE_QUIET_MS_RECORD) * AUDIO_SAMPLE_RATE) / 
+                        (1000 * uint32_t(primary_cmd.samples_per_frame));
 
                quiet_frame_count = 0;
                cap_frame_count = 0;
                // pre_cap_frame_count = 0;
 
                /**
-                * @brief Initialize the IIR low pass audio filter. 
-                * @note: DSP functions are unique to the ESP32-S3 mcu variant!
+                * @brief Build the DSP graph for this command. Its source is the capture 
+                * pipe: the I/O stage converts in place; with AGC enabled the raw level 
+                * is kept, else the fixed mic gain is applied. The speaker feeds the 
+                * echo reference once enabled.
                 */
-               if(primary_cmd.use_lowpass_filter) {
-                  // *** Last parameter 'Qfactor' == 0.5 <smoother cutoff rate>, 1.0 <sharper cutoff rate>
-                  lp_filter.init(primary_cmd.filter_cutoff_freq, float(AUDIO_SAMPLE_RATE), primary_cmd.qfactor);
+               pipeStop();                   // I/O stage off the mic DMA & the pipe
+               mic_gain = (primary_cmd.use_agc) ? 1.0f : MIC_GAIN_FACTOR;
+               if(!buildCaptureGraph(cg, primary_cmd, pipeSource, nullptr, DSP_PORT_PCM, mic_gain, 
+                        &cap_status.dsp_dropped)) {
+                  Serial.println("Error: capture graph allocation failed");
+                  stop_capture = true;
                }
+               aec_ref.enable(primary_cmd.use_echo_cancel);
+               vad_detected = (!primary_cmd.enab_vad); // enab = !detected
+               cap_status.keyword_index = -1;
+               cap_status.pipe_drops = 0;
+               cap_status.pipe_max_lag = 0;
+
+               /**
+                * @brief Low latency intercom: short playback queue for the far end, 
+                * and a fresh latency budget.
+                */
+               if(primary_cmd.low_latency)
+                  audio.setPlayLowLatency(true);
+               memset(&cap_latency, 0, sizeof(capture_latency_t));
+               cap_latency.frame_us = uint32_t((uint64_t(primary_cmd.samples_per_frame) * 1000000) / AUDIO_SAMPLE_RATE);
+               cap_latency.budget_us = (primary_cmd.low_latency) ? INTERCOM_LL_BUDGET_US : 0;
+               latency_sum_us = 0;
+               capture_latency.write(cap_latency);
 
                /**
                 * @brief If writing to a file: delete old file, open new file, & write WAV header to file
@@ -291,11 +894,6 @@ void taskCaptureAudio(void * params)
                }
                // Clear ringbufr for new use
                RingBufr.head = RingBufr.tail = RingBufr.count = 0;
-               noise_baseline = 0.0f;
-               noise_baseline_init = false;
-               hit_count = 0;
-               missed_frames = 0;
-               detect_hit = false;
                in_speech = false;
                               
                /**
@@ -303,26 +901,28 @@ void taskCaptureAudio(void * params)
                 */
                if(mic_raw_data_bufr)
                   heap_caps_free(mic_raw_data_bufr);   // free previous buffer
-               mic_raw_data_bufr = (uint8_t *)heap_caps_malloc((primary_cmd.samples_per_frame * sizeof(int32_t)) + 256, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);  
-
-               if(mic_float_bufr)
-                  heap_caps_free(mic_float_bufr);
-               mic_float_bufr = (float *)heap_caps_malloc((primary_cmd.samples_per_frame * sizeof(float)) + 256, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
-
-               if(mic_output)
-                  heap_caps_free(mic_output);
-               mic_output = (float *) heap_caps_aligned_alloc(32, (primary_cmd.samples_per_frame * sizeof(float)) + 256, MALLOC_CAP_SPIRAM);                
-
-               if(fft_output_buf)
-                  heap_caps_free(fft_output_buf);
-               fft_output_buf = (float *) heap_caps_aligned_alloc(32, (CAPTURE_FFT_SIZE * sizeof(float)) + 256, MALLOC_CAP_SPIRAM);           
+               mic_raw_data_bufr = (uint8_t *)heap_caps_malloc(rb_frame_bytes + 256, MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);  
 
+               /**
+                * @brief Size the mic DMA for this frame & mode and start it
+                */
+               if(!micStart(primary_cmd.samples_per_frame, (primary_cmd.low_latency) ? MIC_DMA_FRAMES_LOW_LATENCY : 
+                        (primary_cmd.mode == CAPTURE_MODE_INTERCOM) ? MIC_DMA_FRAMES_INTERCOM : MIC_DMA_FRAMES_RECORD)) {
+                  Serial.println("Error: mic channel start failed");
+                  stop_capture = true;
+               }
+               else if(!pipeStart(primary_cmd.samples_per_frame, primary_cmd.use_echo_cancel, mic_gain)) {
+                  Serial.println("Error: capture pipe allocation failed");
+                  stop_capture = true;
+               }
             // *** END > CAPTURE_MODE_RECORD          
             } else {
                pause_capture = false;
+               pipeResume();                 // with fresh audio
             }
          } else if(shadow_cmd.mode == CAPTURE_MODE_PAUSE) {
             pause_capture = true;
+            pipeStop();
          } else if(shadow_cmd.mode == CAPTURE_MODE_STOP) {  // stop capture 
             exec_capture = false;
             stop_capture = true;
@@ -331,7 +931,7 @@ void taskCaptureAudio(void * params)
          }
 
          /**
-          * @brief Update status - push status into queue
+          * @brief Update status - publish status snapshot & event bits
           */
          // Clear rec, pause, & frame avail bits. No other bits are affected
          cap_status.state &= ~(CAPTURE_STATE_RECORDING | CAPTURE_STATE_PAUSED | CAPTURE_STATE_FRAME_AVAIL);
@@ -347,33 +947,29 @@ void taskCaptureAudio(void * params)
             cap_status.state |= CAPTURE_STATE_IN_SPEECH;
          else 
             cap_status.state |= CAPTURE_STATE_IN_QUIET;
-         // Send the combined (or'ed) status back via status queue
-         xQueueOverwrite(qAudioRecStatus, &cap_status);  // always the latest status in the queue
+         // Publish the combined (or'ed) status snapshot & state bits
+         publishCaptureStatus(&cap_status);  // always the latest status in the snapshot
       }     // *** END Queue Command Receive
 
       /**
-       * Read audio samples from the mic I2S bus
+       * @brief Run one frame through the DSP graph: mic source, echo canceller, 
+       * LP filter, noise suppressor, VAD, AGC, and the encoder that converts 
+       * float data back to signed 16 bit integer and <PUSH>es it into RingBufr.
        */
-      if(exec_capture && !pause_capture) {
-         // Read one frame of mic data from I2S bus
-         i2s_read(I2S_MICROPHONE, (uint8_t *)mic_raw_data_bufr, primary_cmd.samples_per_frame * sizeof(int32_t), 
-               &bytes_read, portMAX_DELAY);  
-         uint16_t num_samples = bytes_read / sizeof(int32_t);
-
-         /**
-         * @brief Crunch 24 bit mic audio samples into signed 16 bit values 
-         */     
-         pframe = RingBufr.pFrames + (RingBufr.head * rb_frame_bytes); // Get next avail frame
-         // <PUSH> data into new RingBufr space. If RingBufr full, overwrites oldest frame
-         for (j = 0; j < num_samples; j++) {    // Mic samples are 24 bits in 32 bit value
-            sample16 = mic_raw_data_bufr[(j*4)+3];                 // MSB of 24 bit data
-            sample16 = sample16 << 8 | mic_raw_data_bufr[(j*4)+2];  // LSB "  "    
-            sample16 *= MIC_GAIN_FACTOR;   // Normalize Mic gain for audio volume    
-            // Save mic audio as int16_t data in the RingBufr
-            reinterpret_cast<int16_t*>(pframe)[j] = sample16; 
-            // Also, save as float data for LP filter & FFT functions
-            mic_float_bufr[j] = float(sample16);   
-         }
+      if(exec_capture && !pause_capture && !stop_capture) {
+         slot = RingBufr.head;
+         pframe = RingBufr.pFrames + (slot * rb_frame_bytes); // Get next avail frame
+         cg.encode.target((int16_t *)pframe);
+      }
+      if(exec_capture && !pause_capture && !stop_capture && cg.graph.run(frame)) {
+         cap_status.dma_overruns = mic_dma.overruns;
+         cap_status.pipe_drops = capture_pipe.drops.load();
+         cap_status.pipe_max_lag = capture_pipe.max_lag;
+         cap_status.frame_time_us = frame.time_us;
+         RingBufr.stamp[slot].time_us = frame.time_us;
+         RingBufr.stamp[slot].read_us = capture_pipe.read_us;
+         RingBufr.stamp[slot].ready_us = frame.ready_us;
+         RingBufr.stamp[slot].done_us = esp_timer_get_time();
 
          /** 
           * @brief Update RingBufr pointer to next available frame 
@@ -388,103 +984,35 @@ void taskCaptureAudio(void * params)
          }         
 
          /**
-          * @brief Apply butterworth LP audio filter to mic data. This uses an optimized 
-          * DSP function that is unique to the ESP32-S3 MCU.
-          */
-         if(primary_cmd.use_lowpass_filter) {
-            lp_filter.apply(mic_float_bufr, mic_output, num_samples);
-
-            // Convert float data back to signed 16 bit integer and save in RingBufr
-            for(j=0; j<primary_cmd.samples_per_frame; j++) {
-               reinterpret_cast<int16_t*>(pframe)[j] = int16_t(mic_output[j]);
-            }
-         }         
-
-         /**
-          * @brief If VAD (Valid Audio Detect) feature is enabled, use Formant 
-          * analysis to detect speech and trigger VAD (Valid Audio Detect). The 
-          * feature will also auto-end the capture after a short period of
-          * non-speech (approx 2 secs).
+          * @brief If VAD (Valid Audio Detect) feature is enabled, the VAD node's 
+          * Formant analysis triggers VAD (Valid Audio Detect). The feature will 
+          * also auto-end the capture after a short period of non-speech 
+          * (approx 2 secs).
           */ 
          if(primary_cmd.enab_vad) {
-            hit_count = 0;
-            for(j=0; j<3; j++) {       // iterate through 3 subframes of 512 samples
-               if(primary_cmd.use_lowpass_filter) {
-                  // Perform 512 point FFT on the mic float data.  
-                  afft.compute(mic_output + (j*512), fft_output_buf, true);
-               } else { 
-                  afft.compute(mic_float_bufr + (j*512), fft_output_buf, true); 
-               }
-               // Clear the energy variables
-               E_low[j]                   = 0.0;
-               E_high[j]                  = 0.0;
-               E_all[j]                   = 0.0;
-
-               // Tuneables for VAD detector
-               const float T_D_START      = 0.8f;
-               const float T_D_CONT       = 0.4f;  // hysteresis value            
-               const float T_BAL_START    = 1.2f;  // BAL less than 1.0 is quite, neg is HF    
-               const float T_BAL_CONT     = 1.0f;  // hysteeysis value  
-               
-               // Apply hysteresis to energy & LF/HF ratio thresholds
-               float td   = (in_speech) ? T_D_CONT   : T_D_START;
-               float tbal = (in_speech) ? T_BAL_CONT : T_BAL_START;      
-
-               // Each FFT bin == 31.25 Hz
-               for(k=FFT_BIN_LOW; k<FFT_BIN_HIGH; k++) {    // avg energy bands from 125 - 1500 hz
-                  float v = fft_output_buf[k];
-                  E_all[j] += v; // sum of the spectrum (BIN_LOW to BIN_HIGH)
-                  if(k < FFT_BIN_MID)  E_low[j] += v;
-                  else                 E_high[j] += v;
-               }
-               // Normalize the total energy spectrum: Log of E_all
-               E_all[j] = logf((E_all[j] / float(FFT_BIN_HIGH - FFT_BIN_LOW)) + EPSILON);   // avg sound energy across spectrum
-
-               // Do once after capture starts
-               if(!noise_baseline_init) {
-                  noise_baseline = E_all[j]; // baseline snapshot of first frame
-                  noise_baseline_init = true;
-               } 
-               // Running avg of noise floor
-               D_all[j] = E_all[j] - noise_baseline;
-
-               // Tuneables for noise floor averaging
-               const float VAD_BASE_GATE =   0.30f;   // starting point; *tuneable*
-               const float VAD_BASE_ALPHA =  0.05f;   // quiet tracking speed *tuneable*
-
-               // Gate the 'D' value to track noise floor (self adjusting)
-               if(D_all[j] < VAD_BASE_GATE && !in_speech) {
-                  noise_baseline = (1.0f - VAD_BASE_ALPHA) * noise_baseline +
-                        VAD_BASE_ALPHA * E_all[j];
-               }
-               // Calc band energy for this subframe
-               E_low[j] = logf((E_low[j] / float(FFT_BIN_MID - FFT_BIN_LOW)) + EPSILON); 
-               E_high[j] = logf((E_high[j] / float(FFT_BIN_HIGH - FFT_BIN_MID)) + EPSILON);    
-               E_ratio[j] = E_low[j] - E_high[j]; // LOG(LF/HF)
-
-               // Analyse rolling noise floor avg 'D' and the LF/HF ratio for possible speech
-               if(D_all[j] > td && E_ratio[j] > tbal) hit_count++;
-            }
-            // Frame speech evidence
-            bool start_hit = (hit_count >= 2);   // start: 2-out-of-3
-            bool cont_hit  = (hit_count >= 1);   // continue: 1-out-of-3
-
-            if(!in_speech) {
-               // Start immediately when start criterion is met (keep your behavior)
-               in_speech = start_hit;
-               missed_frames = 0;
-            } else {
-               // In speech: require several consecutive misses to drop out (hangover)
-               if(cont_hit) {
-                  missed_frames = 0;
-                  in_speech = true;
-               } else {
-                  if(++missed_frames >= STOP_MISSES_REQUIRED) {
-                     in_speech = false;
-                     missed_frames = 0;
-                  } else {
-                     in_speech = true; // stay latched during hangover
-                  }
+            in_speech = frame.speech;
+
+            /**
+             * @brief Keyword spotter: the VAD start edge opens a segment, the 
+             * spotter ends it a few hops after the last speech frame (or the VAD 
+             * end edge does). An ended segment is matched (or enrolled).
+             */
+            if(primary_cmd.use_kws) {
+               bool matched;
+               if(frame.speech_edge && in_speech) 
+                  kws.speechStart();
+               if(frame.speech_edge && !in_speech)
+                  matched = kws.speechEnd(&kws_result);
+               else
+                  matched = kws.poll(&kws_result);
+               if(matched) {
+                  cap_status.keyword_index = kws_result.index;
+                  strncpy(cap_status.keyword, kws_result.word, KWS_WORD_LEN);
+                  cap_status.keyword_distance = kws_result.distance;
+                  cap_status.keyword_match_us = kws_result.end_us;
+                  cap_status.state |= CAPTURE_STATE_KEYWORD;
+                  publishCaptureStatus(&cap_status);
+                  cap_status.state &= ~CAPTURE_STATE_KEYWORD;
                }
             }
 
@@ -500,17 +1028,19 @@ void taskCaptureAudio(void * params)
 
             // VAD found, now search for quiet interval to auto-end capture
             if(primary_cmd.enab_vad && vad_detected) {   // only works if VAD feature is enabled
-               if(hit_count == 0) 
+               if(frame.hits == 0) 
                   quiet_frame_count++;    // if quiet frame incr
-               else if(hit_count >= 2) 
+               else if(frame.strong) 
                   quiet_frame_count--;    // if strong speech decr
                if(quiet_frame_count < 0) 
                   quiet_frame_count = 0;  // constrain to positive value
             }
          }
 
-         // Get pointer to oldest frame in the ring buffer
-         pframe = RingBufr.pFrames + (RingBufr.tail * rb_frame_bytes); 
+         // Get pointer to oldest frame in the ring buffer. Low latency sends the newest.
+         if(!primary_cmd.low_latency)
+            slot = RingBufr.tail;
+         pframe = RingBufr.pFrames + (slot * rb_frame_bytes); 
 
          /** 
           * @brief If VAD detected, check for finite capture complete.
@@ -530,6 +1060,7 @@ void taskCaptureAudio(void * params)
           */   
          if(!stop_capture) {                         
             if(!primary_cmd.enab_vad || primary_cmd.mode == CAPTURE_MODE_INTERCOM) { // RingBufr <PEEK> 
+               deliver_us = esp_timer_get_time();
                if(file_ready) {              // output to file?
                   sd.fwrite(file_obj, (uint8_t *)pframe, rb_frame_bytes);
                } 
@@ -545,12 +1076,14 @@ void taskCaptureAudio(void * params)
                // Alert caller that a new frame has been transferred to caller's memory
                cap_status.captured_frames = ++cap_frame_count;   
                cap_status.elapsed_secs = cap_status.time_per_frame * cap_status.captured_frames;                       
-               xQueueOverwrite(qAudioRecStatus, &cap_status);
+               publishCaptureStatus(&cap_status);
                cap_status.state &= ~CAPTURE_STATE_FRAME_AVAIL;  // reset frame avail
+               captureLatency(cap_latency, latency_sum_us, RingBufr.stamp[slot], deliver_us);
 
             } else if(vad_detected) {     // RingBufr <POP>
                uint8_t *_pframe = pframe; // frame ptr temp copy 
                while(RingBufr.count > 0) {   // empty the ring bufr (pre-roll data)
+                  deliver_us = esp_timer_get_time();
                   if(file_ready) {           // write pre-roll frames to sd card
                      sd.fwrite(file_obj, (uint8_t *)_pframe, rb_frame_bytes); 
                   }
@@ -562,8 +1095,9 @@ void taskCaptureAudio(void * params)
                   cap_status.state |= CAPTURE_STATE_FRAME_AVAIL;   // notify data ready  
                   cap_status.captured_frames = ++cap_frame_count;   
                   cap_status.elapsed_secs = cap_status.time_per_frame * cap_status.captured_frames;                             
-                  xQueueOverwrite(qAudioRecStatus, &cap_status); 
+                  publishCaptureStatus(&cap_status); 
                   cap_status.state &= ~CAPTURE_STATE_FRAME_AVAIL;  // clear frame avail                                        
+                  captureLatency(cap_latency, latency_sum_us, RingBufr.stamp[RingBufr.tail], deliver_us);
                
                   // POP ringbufr to next oldest frame in the ring buffer
                   RingBufr.tail = (RingBufr.tail + 1) % RB_FRAME_DEPTH;
@@ -582,6 +1116,11 @@ void taskCaptureAudio(void * params)
        */
       if(stop_capture) {
          stop_capture = false;          // do only once
+         pipeStop();                    // I/O stage idle
+         micStop();                     // no mic DMA between captures
+         aec_ref.enable(false);         // speaker stops feeding the reference
+         if(primary_cmd.low_latency)
+            audio.setPlayLowLatency(false);
          exec_capture = false;          // capture stopped
          pause_capture = false;
          primary_cmd.mode = CAPTURE_MODE_IDLE;   // redundant ?
@@ -591,7 +1130,7 @@ void taskCaptureAudio(void * params)
          // Inform caller that recording is completed
          cap_status.state &= ~CAPTURE_STATE_RECORDING; // not capturing
          cap_status.state |= CAPTURE_STATE_COMPLETE;  // capture complete 
-         xQueueOverwrite(qAudioRecStatus, &cap_status);  
+         publishCaptureStatus(&cap_status);  
 
          /**
           * @brief If capturing to a file, resize the file header with actual length
@@ -629,53 +1168,92 @@ void taskCaptureAudio(void * params)
             }
          }
       }
-      vTaskDelay(1);
    }                 // ***end*** while(true)       
 
    /**
     * Kill the background task - release used buffer & queue memory
     */ 
    heap_caps_free(mic_raw_data_bufr);     // free internal buffers in PSRAM
-   heap_caps_free(mic_float_bufr);        // used for LP filter and FFT
-   heap_caps_free(mic_output);            // "    "
-   heap_caps_free(fft_output_buf);        // "    "
+   pipeStop();
+   micStop();
+   aec_ref.enable(false);
+   if(primary_cmd.low_latency)
+      audio.setPlayLowLatency(false);
+   cg.graph.end();                        // free DSP node memory
    heap_caps_free(RingBufr.pFrames);      // free PSRAM ringbuffer
-   vQueueDelete(qAudioRecStatus);         // free status queue memory 
+   vEventGroupDelete(egAudioCapture);     // free status event group 
+   egAudioCapture = nullptr;
    vQueueDelete(qAudioRecCmds);           // free command queue memory  
-   afft.end();                            // free fft memory
    vTaskDelay(10);                        // wait a tad
    vTaskDelete(NULL);                     // remove this task
 }
 
 
 /********************************************************************
- * @brief Check if audio capture is running
+ * @brief Publish capture status from the capture task. The snapshot is
+ * written first so a task woken by an event bit always reads the status 
+ * that caused it.
+ * @note Level bits (RECORDING, PAUSED, IN_SPEECH, IN_QUIET, COMPLETE) 
+ * track the state. Event bits (FRAME_AVAIL, KEYWORD) are pulsed: every 
+ * task waiting on them is released, then they are cleared again.
+ */
+static void publishCaptureStatus(const capture_status_t *cap_stat)
+{
+   capture_status.write(*cap_stat);
+   if(!egAudioCapture) return;
+   EventBits_t level = cap_stat->state & CAPTURE_LEVEL_BITS;
+   EventBits_t events = cap_stat->state & CAPTURE_EVENT_BITS;
+   xEventGroupClearBits(egAudioCapture, CAPTURE_LEVEL_BITS & ~level);
+   if(level | events)
+      xEventGroupSetBits(egAudioCapture, level | events);
+   if(events)
+      xEventGroupClearBits(egAudioCapture, events);
+}
+
+
+/********************************************************************
+ * @brief Check if audio capture is running. Has no side effects on 
+ * other status readers.
  */
 bool AUDIO::isCapturing(void)
 {
-   capture_status_t cap_stat;
-   getCaptureStatus(&cap_stat, false);
-   return ((cap_stat.state & CAPTURE_STATE_RECORDING) > 0) ? true : false;
+   if(!egAudioCapture) return false;
+   return (xEventGroupGetBits(egAudioCapture) & CAPTURE_STATE_RECORDING) != 0;
 }
 
 
 /********************************************************************
- * @brief Request current state of the audio capture background task.
+ * @brief Copy the current state of the audio capture background task.
+ * Any number of tasks may call this - status is never consumed.
  * @param cap_stat - pointer to callers status struct
- * @param block - if true, wait for queue to receive status
- * @return True if valid status
+ * @param blocking - if true, first wait (up to 1000 ticks) for the next 
+ * new frame, keyword, or capture complete event.
+ * @return True if valid status. With blocking, false on timeout.
  */
 bool AUDIO::getCaptureStatus(capture_status_t *cap_stat, bool blocking)
 {   
-   uint32_t tick_wait_delay = 0;       
-   // If non-blocking, return status immediately
    if(blocking) {
-      tick_wait_delay = 1000;             // wait long enough for audio frames but not forever
-   }
-   if(xQueueReceive( qAudioRecStatus, cap_stat, ( TickType_t ) tick_wait_delay ) == pdTRUE) { 
-      return true;
+      EventBits_t bits = waitCaptureEvents(CAPTURE_STATE_FRAME_AVAIL | CAPTURE_STATE_KEYWORD | 
+            CAPTURE_STATE_COMPLETE, 1000);
+      if(bits == 0)
+         return false;                    // timed out
    }
-   return false;                          // status invalid   
+   capture_status.read(cap_stat);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Block until any of the requested capture state bits is set.
+ * @param bits - or'ed CAPTURE_STATE_xxx flags to wait for.
+ * @param ticks - max wait time. portMAX_DELAY waits forever.
+ * @return The requested bits that were set, 0 on timeout.
+ */
+EventBits_t AUDIO::waitCaptureEvents(EventBits_t bits, TickType_t ticks)
+{
+   if(!egAudioCapture) return 0;
+   EventBits_t got = xEventGroupWaitBits(egAudioCapture, bits, pdFALSE, pdFALSE, ticks);
+   return got & bits;
 }
 
 
@@ -685,9 +1263,24 @@ bool AUDIO::getCaptureStatus(capture_status_t *cap_stat, bool blocking)
  *  @param duration_secs - number of seconds to capture audio
  *  @param output - pointer to callers buffer. If NULL, no mem output.
  *  @param filepath - pointer to path/filename to write data to sd card.
+ *  @param enab_noise_suppress - if true, apply STFT noise suppression after the
+ *    LP filter. Requires samples_frame to be a multiple of NS_HOP_SIZE.
+ *  @param enab_echo_cancel - if true and mode is CAPTURE_MODE_INTERCOM, cancel 
+ *    speaker echo. Requires samples_frame to be a multiple of AEC_BLOCK_SIZE.
+ *  @param enab_agc - if true (default), automatic gain control replaces the 
+ *    fixed mic gain. Tuning per mode is set with setAgcConfig().
+ *  @param enab_kws - if true (requires enab_vad), each speech segment is matched 
+ *    against the keyword templates. Matches set CAPTURE_STATE_KEYWORD.
+ *    Frames are at most KWS_MAX_CAPTURE_FRAME samples, so a match comes
+ *    within 100ms of the end of the word.
+ *  @param low_latency - intercom only, INTERCOM_LL_xxx profile. Frames are 
+ *    INTERCOM_LL_DSP_SAMPLES_PER_FRAME when echo cancel or NS is asked for.
+ *  @note Features that can't run with these settings are left out of the 
+ *    graph and flagged in capture_status_t 'dsp_dropped'.
  */
 void AUDIO::startCapture(uint16_t mode, float duration_secs, bool enab_vad, bool enab_lp_filter, 
-      const char *filepath, int16_t *output, uint32_t num_frames, uint16_t samples_frame, float lp_cutoff_freq) 
+      const char *filepath, int16_t *output, uint32_t num_frames, uint16_t samples_frame, float lp_cutoff_freq,
+      bool enab_noise_suppress, bool enab_echo_cancel, bool enab_agc, bool enab_kws, bool low_latency) 
 {
    static capture_cmd_t _rec_cmd;
    _rec_cmd.mode = mode;                        // modes - see CAPTURE_MODE_xxx below.
@@ -700,11 +1293,70 @@ void AUDIO::startCapture(uint16_t mode, float duration_secs, bool enab_vad, bool
    _rec_cmd.filter_cutoff_freq = lp_cutoff_freq;
    _rec_cmd.qfactor = DEFAULT_LP_FILTER_Q;
    _rec_cmd.enab_vad = enab_vad;                // begin capture when voice is detected      
+   _rec_cmd.use_noise_suppress = enab_noise_suppress; // STFT noise suppression after LP filter
+   _rec_cmd.use_echo_cancel = enab_echo_cancel; // speaker echo cancel, intercom mode only
+   _rec_cmd.use_agc = enab_agc;                 // AGC replaces the fixed mic gain
+   _rec_cmd.use_kws = enab_kws;                 // keyword spotting on VAD segments
+   _rec_cmd.low_latency = low_latency && (mode == CAPTURE_MODE_INTERCOM);
+   if(_rec_cmd.low_latency)               // 10ms frames, 16ms if the AEC / NS must run
+      _rec_cmd.samples_per_frame = (enab_echo_cancel || enab_noise_suppress) ? 
+               INTERCOM_LL_DSP_SAMPLES_PER_FRAME : INTERCOM_LL_SAMPLES_PER_FRAME;
+   if(enab_kws && _rec_cmd.samples_per_frame > KWS_MAX_CAPTURE_FRAME)
+      _rec_cmd.samples_per_frame = KWS_MAX_CAPTURE_FRAME;   // the word's end waits for its frame
    // send start cmd & params to the background task
    xQueueSend( qAudioRecCmds, ( void * ) &_rec_cmd, 100 ); // command start  
 }
 
 
+/********************************************************************
+ * @brief Copy the latency of the last delivered capture frame. Stages 
+ * add up to 'total_us': frame + dma + dsp + queue + deliver. Reset at 
+ * each capture start.
+ */
+void AUDIO::getCaptureLatency(capture_latency_t *lat)
+{
+   capture_latency.read(lat);
+}
+
+
+/********************************************************************
+ *  @brief Set the AGC tuning used by a capture mode. Takes effect on the 
+ *  next startCapture().
+ *  @param mode - CAPTURE_MODE_RECORD or CAPTURE_MODE_INTERCOM.
+ *  @param config - see agc_config_t. AGC_CONFIG_RECORD & AGC_CONFIG_INTERCOM
+ *  are the defaults.
+ */
+void AUDIO::setAgcConfig(uint16_t mode, const agc_config_t &config)
+{
+   if(mode == CAPTURE_MODE_INTERCOM)
+      _agc_intercom = config;
+   else 
+      _agc_record = config;
+}
+
+
+/********************************************************************
+ *  @brief Return the AGC tuning for a capture mode.
+ */
+const agc_config_t & AUDIO::getAgcConfig(uint16_t mode)
+{
+   return (mode == CAPTURE_MODE_INTERCOM) ? _agc_intercom : _agc_record;
+}
+
+
+/********************************************************************
+ *  @brief Enroll a keyword. The next speech segment detected by a capture 
+ *  started with enab_kws is saved to the SD template library as 'word'.
+ *  @return false if the library is full or the word is empty.
+ */
+bool AUDIO::enrollKeyword(const char *word)
+{
+   if(!kws.isReady() && !kws.init(KWS_LIBRARY_FILE))
+      return false;
+   return kws.enroll(word);
+}
+
+
 /********************************************************************
  *  @brief Stop a current audio capture. If no capture is executing, this 
  *  command is ignored.
@@ -735,80 +1387,134 @@ void AUDIO::pauseCapture(void)
 
 /********************************************************************
 *  @brief Initialize the I2S microphone - ICS43434
-*       Uses I2S chnl 0
+*       Uses I2S chnl 0. The channel is left disabled - a capture starts it.
+*  @param samples_frame - capture frame. DMA buffers are the largest equal 
+*       parts of it that fit MIC_DMA_MAX_SAMPLES.
+*  @param dma_frames - DMA depth in capture frames.
 */
-bool AUDIO::initMicrophone(uint32_t sample_rate)
-{
-   // Remove previous mic I2S driver (if installed)
-   i2s_driver_uninstall(I2S_MICROPHONE);     // uninstall any previous mic driver 
-
-   i2s_config_t i2s_config = {
-      .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_RX),
-      .sample_rate = sample_rate,
-      .bits_per_sample = I2S_BITS_PER_SAMPLE_32BIT,
-      .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT,          //I2S_CHANNEL_FMT_RIGHT_LEFT
-      .communication_format = I2S_COMM_FORMAT_STAND_I2S,  
-      .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-      .dma_buf_count = 4, 
-      .dma_buf_len = 1024, 
-      .use_apll = false,
-      .tx_desc_auto_clear = false,
-      .fixed_mclk = I2S_PIN_NO_CHANGE,
+bool AUDIO::initMicrophone(uint32_t sample_rate, uint16_t samples_frame, uint8_t dma_frames)
+{
+   uint32_t parts;
+
+   // Remove previous mic channel (if any)
+   if(mic_chan) {
+      if(mic_dma.enabled)
+         i2s_channel_disable(mic_chan);
+      i2s_del_channel(mic_chan);
+      mic_chan = nullptr;
+      mic_dma.enabled = false;
+   }
+   if(samples_frame == 0 || dma_frames == 0)
+      return false;
+   parts = (samples_frame + MIC_DMA_MAX_SAMPLES - 1) / MIC_DMA_MAX_SAMPLES;
+   while(samples_frame % parts)           // whole DMA buffers per frame
+      parts++;
+   if(parts * dma_frames > MIC_DMA_MAX_DESC)
+      return false;
+
+   i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_MICROPHONE, I2S_ROLE_MASTER);
+   chan_cfg.dma_desc_num = parts * dma_frames;
+   chan_cfg.dma_frame_num = samples_frame / parts;
+
+   i2s_std_config_t std_cfg = {
+      .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(sample_rate),
+      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+      .gpio_cfg = {
+         .mclk = I2S_GPIO_UNUSED,
+         .bclk = (gpio_num_t)PIN_MIC_I2S_BCLK,
+         .ws = (gpio_num_t)PIN_MIC_I2S_WS,
+         .dout = I2S_GPIO_UNUSED,         // no connect
+         .din = (gpio_num_t)PIN_MIC_I2S_DOUT,
+         .invert_flags = { .mclk_inv = false, .bclk_inv = false, .ws_inv = false },
+      },
    };
-   static i2s_pin_config_t pin_config;
-   pin_config.bck_io_num = PIN_MIC_I2S_BCLK;
-   pin_config.ws_io_num = PIN_MIC_I2S_WS;
-   pin_config.data_out_num = I2S_PIN_NO_CHANGE;   // no connect
-   pin_config.data_in_num = PIN_MIC_I2S_DOUT; 
-
-   if(i2s_driver_install(I2S_MICROPHONE, &i2s_config, 0, NULL) == ESP_OK) {
-      if(i2s_set_pin(I2S_MICROPHONE, &pin_config) == ESP_OK) {
-         return true;
-      }
+   std_cfg.clk_cfg.clk_src = I2S_SHARED_CLK_SRC;   // same source & MCLK as the speaker
+   std_cfg.clk_cfg.mclk_multiple = I2S_SHARED_MCLK_MULTIPLE;
+   // 24 bit samples in 32 bit slots - DMA keeps the top 16 bits
+   std_cfg.slot_cfg.slot_bit_width = I2S_SLOT_BIT_WIDTH_32BIT;
+   std_cfg.slot_cfg.slot_mask = I2S_STD_SLOT_LEFT;
+
+   i2s_event_callbacks_t cbs = {
+      .on_recv = micRecvDone,
+      .on_recv_q_ovf = nullptr,
+      .on_sent = nullptr,
+      .on_send_q_ovf = nullptr,
+   };
+
+   if(i2s_new_channel(&chan_cfg, nullptr, &mic_chan) != ESP_OK)
+      return false;
+   if(i2s_channel_init_std_mode(mic_chan, &std_cfg) != ESP_OK || 
+            i2s_channel_register_event_callback(mic_chan, &cbs, nullptr) != ESP_OK) {
+      i2s_del_channel(mic_chan);
+      mic_chan = nullptr;
+      return false;
    }
-   return false;
+   mic_dma.desc = chan_cfg.dma_desc_num;
+   mic_dma.samples = chan_cfg.dma_frame_num;
+   mic_dma.rate = sample_rate;
+   mic_dma.frame = samples_frame;
+   mic_dma.frames = dma_frames;
+   mic_dma.head.store(0);
+   mic_dma.tail = 0;
+   return true;
 }
 
 
 /********************************************************************
 *  @brief Initialize the I2S speaker driver - MAX98357
-*  Uses I2S chnl 1
+*  Uses I2S chnl 1. Each sent DMA buffer gives 'semSpeakerSent'.
 */
 bool AUDIO::initSpeaker(uint32_t sample_rate)
 {
-    
-   i2s_driver_uninstall(I2S_SPEAKER);     // uninstall any previous driver 
-
-   i2s_config_t i2s_config = {
-      .mode = (i2s_mode_t)(I2S_MODE_MASTER | I2S_MODE_TX),
-      .sample_rate = sample_rate,         // SAMPLE_RATE     
-      .bits_per_sample = I2S_BITS_PER_SAMPLE_16BIT,
-      .channel_format = I2S_CHANNEL_FMT_ONLY_LEFT, // mono - dma bufr size = 16 bits / sample
-      .communication_format = (i2s_comm_format_t)(I2S_COMM_FORMAT_STAND_I2S),
-      .intr_alloc_flags = ESP_INTR_FLAG_LEVEL1,
-      .dma_buf_count = 2,
-      .dma_buf_len = I2S_DMA_BUFR_LEN,
-      .use_apll = false,
-      .tx_desc_auto_clear = true,
-      .fixed_mclk = I2S_PIN_NO_CHANGE};
-
-   // and don't mess around with this
-   i2s_pin_config_t i2s_spkr_pins;
-      i2s_spkr_pins.mck_io_num = I2S_PIN_NO_CHANGE;    // make sure this is set to -1, else IO0 will output fixed clk
-      i2s_spkr_pins.bck_io_num = PIN_SPKR_I2S_BCLK;
-      i2s_spkr_pins.ws_io_num = PIN_SPKR_I2S_WS;
-      i2s_spkr_pins.data_out_num = PIN_SPKR_I2S_DIN;
-      i2s_spkr_pins.data_in_num = I2S_PIN_NO_CHANGE;
-
-   // start up the I2S peripheral
-   if(i2s_driver_install(I2S_SPEAKER, &i2s_config, 1, NULL) != ESP_OK)
-      return false;
+   // Remove previous speaker channel (if any)
+   if(spkr_chan) {
+      i2s_channel_disable(spkr_chan);
+      i2s_del_channel(spkr_chan);
+      spkr_chan = nullptr;
+   }
+   if(!semSpeakerSent)
+      semSpeakerSent = xSemaphoreCreateCounting(PLAY_DMA_BUF_COUNT * 2, 0);
+
+   i2s_chan_config_t chan_cfg = I2S_CHANNEL_DEFAULT_CONFIG(I2S_SPEAKER, I2S_ROLE_MASTER);
+   chan_cfg.dma_desc_num = PLAY_DMA_BUF_COUNT;
+   chan_cfg.dma_frame_num = PLAY_DMA_BUF_LEN;
+   chan_cfg.auto_clear = true;            // DMA sends zeros when starved
+
+   // mono - dma bufr size = 16 bits / sample
+   i2s_std_config_t std_cfg = {
+      .clk_cfg = I2S_STD_CLK_DEFAULT_CONFIG(sample_rate),
+      .slot_cfg = I2S_STD_PHILIPS_SLOT_DEFAULT_CONFIG(I2S_DATA_BIT_WIDTH_16BIT, I2S_SLOT_MODE_MONO),
+      .gpio_cfg = {
+         .mclk = I2S_GPIO_UNUSED,         // make sure this is unused, else IO0 will output fixed clk
+         .bclk = (gpio_num_t)PIN_SPKR_I2S_BCLK,
+         .ws = (gpio_num_t)PIN_SPKR_I2S_WS,
+         .dout = (gpio_num_t)PIN_SPKR_I2S_DIN,
+         .din = I2S_GPIO_UNUSED,
+         .invert_flags = { .mclk_inv = false, .bclk_inv = false, .ws_inv = false },
+      },
+   };
+   std_cfg.clk_cfg.clk_src = I2S_SHARED_CLK_SRC;   // same source & MCLK as the mic
+   std_cfg.clk_cfg.mclk_multiple = I2S_SHARED_MCLK_MULTIPLE;
+
+   i2s_event_callbacks_t cbs = {
+      .on_recv = nullptr,
+      .on_recv_q_ovf = nullptr,
+      .on_sent = spkrSentDone,
+      .on_send_q_ovf = nullptr,
+   };
 
-   if(i2s_set_pin(I2S_SPEAKER, &i2s_spkr_pins) != ESP_OK)
+   // start up the I2S peripheral. Sample counts restart with the stream.
+   spkr_clock.reset(float(sample_rate));
+   aec_ref.reset();
+   if(!semSpeakerSent || i2s_new_channel(&chan_cfg, &spkr_chan, nullptr) != ESP_OK)
       return false;
-
-   i2s_zero_dma_buffer(I2S_SPEAKER);        // clear out spkr dma bufr
-
+   if(i2s_channel_init_std_mode(spkr_chan, &std_cfg) != ESP_OK || 
+            i2s_channel_register_event_callback(spkr_chan, &cbs, nullptr) != ESP_OK || 
+            i2s_channel_enable(spkr_chan) != ESP_OK) {
+      i2s_del_channel(spkr_chan);
+      spkr_chan = nullptr;
+      return false;
+   }
    return true;
 }
 
@@ -871,178 +1577,120 @@ void AUDIO::CreateWavHeader(byte* header, int waveDataSize)
  */
 void AUDIO::playTone(float tone_freq, uint8_t ring_mode, float volume, float duration_sec, bool blocking)
 {
-   h_QueueToneTask = xQueueCreate(1, sizeof(tone_cmd_queue_t));    // create cmd queue
-   play_tone_params_t play_tone_params = {tone_freq, ring_mode, volume, duration_sec};
-
-   setAudioVolume(int16_t(volume));    // 0 - 100%
-
-   // Start background audio task 
-   xTaskCreate(
-      taskPlayTone,                       // Function to implement the task 
-      "Play Tone Task",                   // Name of the task (optional)
-      2048,                               // Stack size in words. 
-      &play_tone_params,                  // Task input parameter struct
-      1,                                  // Priority of the task - higher number = higher priority
-      &h_playTone);                       // Task handle. 
-
-   vTaskDelay(10);
-   uint32_t tmo = millis();     
-   if(blocking) {                         // if blocking - wait for tone func to complete      
-      while((millis() - tmo) < (duration_sec * 1000)) {
-         if(!h_playTone)
-            break;   
-         vTaskDelay(10);                    
-      }
-   }
+   play_tone_params_t params = {};
+   params.tone_freq[0] = tone_freq;
+   params.ring_mode = ring_mode;
+   params.volume = volume;
+   params.duration_sec = duration_sec;
+   startTone(params, blocking);
 }
 
 
 /********************************************************************
- * Play Tone task
+ * @brief Play up to SYNTH_MAX_VOICES tones at once (e.g. a chord).
+ * @param freqs - tone frequencies in Hz.
+ * @param num_freqs - number of freqs.
  */
-void taskPlayTone(void * params)
+void AUDIO::playChord(const float *freqs, uint8_t num_freqs, uint8_t ring_mode, float volume, 
+         float duration_sec, bool blocking)
 {
-   // Get params passed by reference and save in local variables
-   play_tone_params_t *play_params = (play_tone_params_t *)params;
-   float tone_freq = play_params->tone_freq;
-   float duration_sec = play_params->duration_sec;
-   float sample_rate = AUDIO_SAMPLE_RATE; 
-   float volume = play_params->volume;
-   uint8_t ring_mode = play_params->ring_mode;
-   uint16_t ring_count = 0;
-   uint16_t ring_interval = 0;
-   bool ring_on_off = true;
-   audio_play_t audio_play;
-#define VOL_NORM        30.0   
+   play_tone_params_t params = {};
+   for(uint8_t i = 0; i < num_freqs && i < SYNTH_MAX_VOICES; i++)
+      params.tone_freq[i] = freqs[i];
+   params.ring_mode = ring_mode;
+   params.volume = volume;
+   params.duration_sec = duration_sec;
+   startTone(params, blocking);
+}
 
-   // Variables for building sinewave
-   uint32_t i, j;
-   int32_t idx;
-   int16_t ismpl;
-   float samples_per_cycle = sample_rate / tone_freq; // number of 16 bit samples per cycle
 
-   tone_cmd_queue_t tone_cmd;
+/********************************************************************
+ * @brief Play a tone that glides from f_start to f_end.
+ * @param sweep_secs - glide time.
+ * @param repeat - true: glide again from f_start when done (siren).
+ */
+void AUDIO::playSweep(float f_start, float f_end, float sweep_secs, bool repeat, float volume, 
+         float duration_sec, bool blocking)
+{
+   play_tone_params_t params = {};
+   params.tone_freq[0] = f_start;
+   params.sweep_to_freq = f_end;
+   params.sweep_secs = sweep_secs;
+   params.sweep_repeat = repeat;
+   params.ring_mode = RING_MODE_STEADY;
+   params.volume = volume;
+   params.duration_sec = duration_sec;
+   startTone(params, blocking);
+}
 
-   // Calc number of bytes for sinewave of the specified duration
-   float total_samples;
-   if(duration_sec > 0.0) {
-      total_samples = (sample_rate * duration_sec);
-   } else {
-      total_samples = I2S_DMA_BUFR_LEN;   // minimum samples == 1 bufr
-   }
-   float total_bytes = total_samples * sizeof(int16_t);     // bytes = samples * 2
 
-   // Create a 1K sample buffer
-   uint8_t *sample_buf = (uint8_t *)heap_caps_malloc(I2S_DMA_BUFR_LEN * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT); 
-   esp_err_t err;
-   float ratio = (PI * 2) * tone_freq / sample_rate;  // constant for sinewave
-
-   memset(sample_buf, 0x0, I2S_DMA_BUFR_LEN * sizeof(int16_t));   // clear sample bufr 
-   idx = 0;
-   j = 0;
-   ring_interval = 0;
-   ring_on_off = true;
-   // Generate a sinewave and write to I2S device   
-   while(true) {
-      // Fill the sample bufr with repetative sinewave cycles
-      for (i = 0; i < int(total_samples); i++) {
-         if(ring_mode == RING_MODE_STEADY || 
-               (ring_mode == RING_MODE_CALLING && ring_count < 512 && ring_on_off) || 
-               (ring_mode == RING_MODE_ALARM && ring_on_off)) {
-            ismpl = int16_t(volume * sin(j * ratio) * VOL_NORM); // Build data with positive and negative values
-            if(++j >= int(round(samples_per_cycle))) 
-               j = 0;
-         } else {
-            ismpl = 0;
-         }
-         sample_buf[idx] = ismpl & 0xFF;     // LSB
-         sample_buf[idx+1] = ismpl >> 8;     // MSB
-         idx += 2;
-
-         // If buffer is full, send to the BG play audio task 
-         if(idx >= I2S_DMA_BUFR_LEN * sizeof(int16_t)) {
-            // while (uxQueueMessagesWaiting(qAudioPlay) > 1) { 
-            //    vTaskDelay(pdMS_TO_TICKS(1));   
-            // }                       
-            audio_play.cmd = PLAY_AUDIO;
-            audio_play.chunk_bytes = I2S_DMA_BUFR_LEN * sizeof(int16_t);
-            audio_play.chunk_depth = 4;
-            audio_play.pChunk = (uint16_t *)sample_buf;
-            audio_play.bytes_to_write = I2S_DMA_BUFR_LEN * sizeof(int16_t);
-            audio_play.volume = volume;         
-            xQueueSend(qAudioPlay, &audio_play, 125);   // play this chunk   
-            // Wait for BG task to read the queue - msg ack                      
-            while (uxQueueMessagesWaiting(qAudioPlay) > 0) { 
-                     // Serial.print("x");  
-               vTaskDelay(pdMS_TO_TICKS(1)); 
-            }  
-
-            idx = 0;
-            // Check queue for stop cmd
-            if(xQueueReceive(h_QueueToneTask, &tone_cmd, 0) == pdTRUE) { 
-               if(tone_cmd.cmd == TONE_CMD_CLOSE) {
-                  break;
-               }
-            } else 
-               tone_cmd.cmd = TONE_CMD_NONE;
-         } 
+/********************************************************************
+ * @brief Dial a string of DTMF digits ('0'-'9', '*', '#', 'A'-'D').
+ * @param on_ms - tone time per digit.
+ * @param off_ms - silent gap after each digit.
+ */
+void AUDIO::playDtmf(const char *digits, float volume, uint16_t on_ms, uint16_t off_ms, bool blocking)
+{
+   if(!digits || !digits[0]) 
+      return;
+   play_tone_params_t params = {};
+   strncpy(params.dtmf, digits, TONE_MAX_DTMF);
+   params.dtmf_on_ms = on_ms;
+   params.dtmf_off_ms = off_ms;
+   params.volume = volume;
+   params.duration_sec = strlen(params.dtmf) * (on_ms + off_ms) / 1000.0;
+   startTone(params, blocking);
+}
 
-         ring_count++;
-         // Make old style phone call ring sound
-         if(ring_mode == RING_MODE_CALLING && ring_count >= 1024) {
-            ring_count = 0;
-            // Short interval creates a 'warbling' sound
-            if(++ring_interval > RING_MODE_CALLING_INTERVAL) {
-               ring_interval = 0;
-               ring_on_off ^= true;    // toggle silent period
-            }
-         }
-         else if(ring_mode == RING_MODE_ALARM && ring_count >= 1024) {
-            ring_count = 0;            
-            if(++ring_interval > RING_MODE_ALARM_INTERVAL) {
-               ring_interval = 0;
-               ring_on_off ^= true;    // toggle silent period
-            }
-         }
-      }   
-      if(tone_cmd.cmd == TONE_CMD_CLOSE) {  // if closing break from while loop
-         break;
-      }
 
-      // Write odd remainder of data
-      if(idx > 0) {  
-         // wait for space in the queue
-         // while (uxQueueMessagesWaiting(qAudioPlay) > 1) { 
-         //    vTaskDelay(pdMS_TO_TICKS(1));   
-         // }                       
-         audio_play.cmd = PLAY_AUDIO;
-         audio_play.chunk_bytes = I2S_DMA_BUFR_LEN * sizeof(int16_t);
-         audio_play.chunk_depth = 4;
-         audio_play.pChunk = (uint16_t *)sample_buf;
-         audio_play.bytes_to_write = idx; 
-         audio_play.volume = sys_utils.getVolume();       
-         xQueueSend(qAudioPlay, &audio_play, 0);  
-         // Wait for BG task to read the queue - msg ack    
-         while (uxQueueMessagesWaiting(qAudioPlay) > 0) { 
-                  Serial.print("y");             
-            vTaskDelay(pdMS_TO_TICKS(1));   
-         }                         
-      }
-      // Close task if finite duration or if I2S write error
-      if(duration_sec > 0.0) 
-         break;
+/********************************************************************
+ * @brief Hand a tone to the audio engine. The params are copied into 
+ * the command, so the callers struct may go out of scope.
+ */
+void AUDIO::startTone(const play_tone_params_t &params, bool blocking)
+{
+   engine_cmd_t cmd = {};
+   cmd.cmd = ENGINE_TONE_START;
+   cmd.tone = params;
 
-      vTaskDelay(1);                      // pet the watchdog
-   } 
+   setAudioVolume(int16_t(params.volume));    // 0 - 100%
 
-   /**
-    * @brief Free memory & exit this task. 
-    */
-   vTaskDelay(120);                       // let the BG player finish
-   vQueueDelete(h_QueueToneTask);         // free command queue memory      
-   heap_caps_free(sample_buf);            // free internal 1k sample bufr in PSRAM
-   h_playTone = nullptr;                  // task handle null   
-   vTaskDelete(NULL);                     // outahere!   
+   // Busy from now on - the engine clears it when the tone ends
+   xEventGroupClearBits(egAudioEngine, ENGINE_TONE_DONE);
+   xEventGroupSetBits(egAudioEngine, ENGINE_TONE_BUSY);
+   engineSend(cmd, portMAX_DELAY);
+
+   // if blocking - wait for tone to complete. Continuous tones don't block.
+   if(blocking && params.duration_sec > 0.0) 
+      waitPlayDone(ENGINE_TONE_DONE, MIX_SRC_TONE, pdMS_TO_TICKS(uint32_t(params.duration_sec * 1000) + 1000));
+}
+
+
+/********************************************************************
+ * @brief Wait for a voice to finish, then for the mixer to drain the 
+ * voice's fifo so the audio has actually been heard.
+ */
+void AUDIO::waitPlayDone(EventBits_t done_bit, uint8_t source, TickType_t ticks)
+{
+   xEventGroupWaitBits(egAudioEngine, done_bit, pdFALSE, pdTRUE, ticks);
+   waitMixDrained(source, pdMS_TO_TICKS(1000));
+}
+
+
+/********************************************************************
+ * @brief Sleep until the mixer has taken every queued chunk (or region)
+ * of 'source'. The player sets ENGINE_DRAINED(source) when it frees the
+ * last slot, so there is no polling.
+ * @return false on timeout.
+ */
+bool AUDIO::waitMixDrained(uint8_t source, TickType_t ticks)
+{
+   const EventBits_t bit = ENGINE_DRAINED(source);
+
+   xEventGroupClearBits(egAudioEngine, bit);
+   if(mix_fifo[source].isEmpty())         // drained before the clear
+      return true;
+   return (xEventGroupWaitBits(egAudioEngine, bit, pdTRUE, pdTRUE, ticks) & bit) != 0;
 }
 
 
@@ -1051,34 +1699,31 @@ void taskPlayTone(void * params)
  */
 void AUDIO::stopTone(void)
 {
-   uint32_t tmo = millis();
-   if(!h_playTone) return;
-  
-   tone_cmd_queue_t tone_cmd;
-   tone_cmd.cmd = TONE_CMD_CLOSE;
-   xQueueOverwrite( h_QueueToneTask, ( void * ) &tone_cmd); 
-   // Block until playTone has finished
-   while(h_playTone) {
-      if((millis() - tmo) > 1000) break;
-   }
+   if(!(xEventGroupGetBits(egAudioEngine) & ENGINE_TONE_BUSY)) 
+      return;
+
+   engine_cmd_t cmd = {};
+   cmd.cmd = ENGINE_TONE_STOP;
+   engineSend(cmd, portMAX_DELAY);
+   // Block until the tone has finished
+   xEventGroupWaitBits(egAudioEngine, ENGINE_TONE_DONE, pdFALSE, pdTRUE, pdMS_TO_TICKS(1000));
 }
 
 
 /********************************************************************
-*  @brief Send a command to the PlayWAV background task.
+*  @brief Send a command to the WAV voice of the audio engine.
+*  @param cmd - PLAY_WAV_STOP, PLAY_WAV_PAUSE, PLAY_WAV_CONTINUE.
 */
 bool AUDIO::sendPlayWavCommand(uint8_t cmd)
 {
-   play_wav_t play_wav {
-      .cmd = cmd,
-      .filename = nullptr,
-      .volume = 0
-   };   
-   if(isWavPlaying()) {    // make sure player is running
-      xQueueSend( h_QueueAudioPlayWAVCmd, ( void * ) &play_wav, ( TickType_t ) 100 );  // send cmd
-      return true;
-   }
-   return false;
+   if(!isWavPlaying())                    // make sure player is running
+      return false;
+
+   engine_cmd_t ecmd = {};
+   ecmd.cmd = ENGINE_WAV_CTRL;
+   ecmd.wav_cmd = cmd;
+   engineSend(ecmd, 100);
+   return true;
 }
 
 
@@ -1087,357 +1732,1579 @@ bool AUDIO::sendPlayWavCommand(uint8_t cmd)
 */
 bool AUDIO::isWavPlaying(void) 
 {
-   return (h_taskAudioPlayWAV == NULL) ? false : true;
+   return (xEventGroupGetBits(egAudioEngine) & ENGINE_WAV_BUSY) != 0;
 }
 
 
 /********************************************************************
  * @brief Get PlayWav progress 0 - 100%
- * @return -1 if no status (progress) available.
+ * @return -1 if no WAV file is playing.
  */
+static volatile int8_t wav_progress = -1;
+
 int8_t AUDIO::getWavPlayProgress(void)
 {
-   play_wav_status_t stat;
-   // make sure player is running
-   if(xQueueReceive(h_QueueAudioPlayWAVStat, &stat, 100) == pdTRUE)
-      return stat.progress;
-   return -1;        // return this if busy
+   return (isWavPlaying()) ? wav_progress : -1;
 }   
 
 
+/********************************************************************
+ * @brief Read the format & duration of a WAV file without playing it.
+ * Only the RIFF chunk headers are read.
+ * @return false if the file is missing or not a supported WAV file.
+ */
+bool AUDIO::getWavInfo(const char *filename, wav_info_t *info)
+{
+   ESP32S3_WAV wav;
+   bool ok;
+
+   if(sd.fsize(filename) <= 0)
+      return false;
+   File file = sd.fopen(filename, FILE_READ, false);
+   if(!file)
+      return false;
+   ok = wav.parse(wavFileRead, &file, file.size());
+   sd.fclose(file);
+   if(ok)
+      *info = wav.info();
+   return ok;
+}
+
+
 /********************************************************************
 *  @brief Play audio clips from a WAV file stored in SD card.
 * 
 *  @param filename - C string name of file on SD card to play.
 *  @param volume - 0 - 100%
+*  @param blocking - true: return when the file has played.
+*  @param cb - optional, called from the engine task each time the 
+*     progress (0 - 100%) changes.
 */
 bool AUDIO::playWavFile(const char *filename, uint16_t volume, bool blocking, PlayWav_cb cb) 
 {
-   if(volume == 0 || (!filename))   // sanity check
+   return playWavList(&filename, 1, volume, 0, blocking, cb);
+}
+
+
+/********************************************************************
+*  @brief Play several WAV files back to back with no gap. The next file
+*  is opened and read ahead while the current one is still playing, and
+*  the tracks are spliced sample accurately (or crossfaded).
+* 
+*  @param filenames - array of C string names of files on SD card.
+*  @param num_files - 1 to WAV_PLAYLIST_MAX.
+*  @param volume - 0 - 100%
+*  @param xfade_ms - crossfade between tracks, 0 = plain splice.
+*  @param blocking - true: return when the last file has played.
+*  @param cb - optional, progress (0 - 100%) of the playing file.
+*/
+bool AUDIO::playWavList(const char * const *filenames, uint8_t num_files, uint16_t volume, 
+         uint16_t xfade_ms, bool blocking, PlayWav_cb cb)
+{
+   uint8_t i;
+
+   if(volume == 0 || !filenames || num_files == 0 || num_files > WAV_PLAYLIST_MAX)   // sanity check
       return false;
+   for(i = 0; i < num_files; i++) {
+      if(!filenames[i] || strlen(filenames[i]) >= ENGINE_PATH_LEN)
+         return false;
+   }
 
    setAudioVolume(volume);
+   clearReadBuffer();                     // clear noise from mic dma bufr
 
-   /**
-    * @brief Start background task to play WAV files from SD Card.
-    */     
-   h_QueueAudioPlayWAVCmd = xQueueCreate(3, sizeof(play_wav_t));    // commands to capture task
-   h_QueueAudioPlayWAVStat = xQueueCreate(1, sizeof(play_wav_status_t)); // status from capture task
+   engine_cmd_t cmd = {};
+   cmd.cb = cb;
+   cmd.xfade_ms = xfade_ms;
+
+   // Busy from now on - the engine clears it when the list ends (or fails to open)
+   xEventGroupClearBits(egAudioEngine, ENGINE_WAV_DONE);
+   xEventGroupSetBits(egAudioEngine, ENGINE_WAV_BUSY);
+   for(i = 0; i < num_files; i++) {
+      cmd.cmd = (i == 0) ? ENGINE_WAV_START : ENGINE_WAV_QUEUE;
+      strcpy(cmd.path, filenames[i]);
+      engineSend(cmd, portMAX_DELAY);
+   }
 
-   static play_wav_t play_wav_params;
-   play_wav_params.cmd = PLAY_WAV_CONTINUE;  // play immediate
-   play_wav_params.volume = volume;
-   play_wav_params.filename = filename;
-   play_wav_params.cb = cb;
+   // if blocking is true, wait for play to complete
+   if(blocking) 
+      waitPlayDone(ENGINE_WAV_DONE, MIX_SRC_WAV, portMAX_DELAY);
+   return true;
+}
 
-   h_taskAudioPlayWAV = nullptr;
-   clearReadBuffer();                     // clear noise from mic dma bufr
 
-   // Start background audio task running in core 0
-   xTaskCreatePinnedToCore( 
-      taskPlayWAV,                        // Function to implement the task 
-      "Play WAV File",                    // Name of the task (optional)
-      4096,                               // Stack size in words. 
-      &play_wav_params,                   // Task input parameter struct
-      1,                                  // Priority of the task - higher number = higher priority
-      &h_taskAudioPlayWAV,                // Task handle. 
-      0);                                 // core to run in
+/********************************************************************
+*  @brief Append a WAV file to the playing list. If nothing is playing
+*  it starts a new list (no crossfade, no callback).
+*  @return false if the name is too long. A full playlist drops the file.
+*/
+bool AUDIO::queueWavFile(const char *filename)
+{
+   if(!filename || strlen(filename) >= ENGINE_PATH_LEN)
+      return false;
 
-   vTaskDelay(10);
+   engine_cmd_t cmd = {};
+   cmd.cmd = ENGINE_WAV_QUEUE;
+   strcpy(cmd.path, filename);
+   xEventGroupClearBits(egAudioEngine, ENGINE_WAV_DONE);
+   xEventGroupSetBits(egAudioEngine, ENGINE_WAV_BUSY);
+   return engineSend(cmd, portMAX_DELAY) == pdTRUE;
+}
 
-   // if blocking is true, wait for play to complete
-   if(blocking) {
-      while(h_taskAudioPlayWAV != NULL) {
-         vTaskDelay(10);
-      }
-   }
+
+/********************************************************************
+ * @brief Open the stream source. The calling task becomes the producer
+ * of the MIX_SRC_STREAM fifo until streamEnd(). Tones & WAV files keep
+ * playing and are mixed with the stream (see setMixConfig()).
+ * Use streamWrite(), or playAcquire() / playCommit() for zero copy.
+ * @param ticks - max time to wait for another stream owner to finish.
+ */
+bool AUDIO::streamBegin(TickType_t ticks)
+{
+   if(xSemaphoreTake(semStreamOwner, ticks) != pdTRUE)
+      return false;
+   xEventGroupSetBits(egAudioEngine, ENGINE_STREAM_BUSY);
    return true;
 }
 
 
 /********************************************************************
- * @brief Play WAV file in background
+ * @brief Copy 16 bit mono samples into the playback fifo.
+ * @param ticks - max wait for each free fifo slot.
+ * @return number of samples queued.
  */
-void taskPlayWAV(void *params)
+uint32_t AUDIO::streamWrite(const int16_t *samples, uint32_t len, TickType_t ticks)
 {
-   // audio play struct
-   audio_play_t audio_play;
-   // pointer to task params
-   play_wav_t *play_wav = (play_wav_t *)params;
-   // copy params to local struct
-   play_wav_t play_wav_queue;         // shadow command struct
+   const uint32_t slot_samples = PLAY_FIFO_CHUNK_BYTES / sizeof(int16_t);
+   uint32_t n, done = 0;
+   int16_t *slot;
 
-   play_wav_status_t play_wav_status;
-   play_wav_status.progress = 0;
-   int32_t bytesRead;
-   // uint32_t bytesWritten = 0;
-   uint32_t bytesToRead;
-   uint32_t i, idx = 0;
-   uint8_t num_chnls;
-   int32_t total_data_bytes;
-   File _file;
-   // float newvol;
-   bool play_loop = true; 
-   bool file_ready = false;
-   bool pause_play = (play_wav->cmd == PLAY_WAV_PAUSE);  // start in pause mode?
+   while(done < len) {
+      slot = playAcquire(ticks);
+      if(!slot)
+         break;
+      n = (len - done < slot_samples) ? len - done : slot_samples;
+      memcpy(slot, samples + done, n * sizeof(int16_t));
+      playCommit(n * sizeof(int16_t));
+      done += n;
+   }
+   return done;
+}
+
+
+/********************************************************************
+ * @brief Close the stream source. Queued stream audio still plays out.
+ */
+void AUDIO::streamEnd(void)
+{
+   if(!(xEventGroupGetBits(egAudioEngine) & ENGINE_STREAM_BUSY))
+      return;
+   xEventGroupClearBits(egAudioEngine, ENGINE_STREAM_BUSY);
+   xSemaphoreGive(semStreamOwner);
+}
+
+
+/********************************************************************
+ * @brief Play a clip from the flash clip bank. Only a pointer & length
+ * are queued: the mixer reads the audio from mapped flash, so there is
+ * no SD access and no copy. Clips queue behind each other.
+ * @param name - clip name given to tools/pack_clips.py.
+ * @param blocking - wait until the clip has been mixed.
+ * @return false if the clip is missing, not 16KHz mono, or the clip 
+ *    fifo stays full.
+ */
+bool AUDIO::playClip(const char *name, bool blocking)
+{
+   clip_t clip;
+   mix_region_t region;
+
+   if(!clip_bank.find(name, &clip) || clip.channels != 1 || clip.sample_rate != AUDIO_SAMPLE_RATE)
+      return false;
+   region.pcm = clip.pcm;
+   region.len = clip.samples;
+   region.stamp = 0;
 
-   #define WAV_BUFR_SIZE      (DEFAULT_SAMPLES_PER_FRAME * sizeof(uint16_t))   // frame size in bytes
+   // The region fifo has one producer - serialize callers
+   xSemaphoreTake(semClipLock, portMAX_DELAY);
+   bool ok = false;
+   uint32_t tmo = millis();
+   while(!(ok = mix_fifo[MIX_SRC_CLIP].push(&region, sizeof(mix_region_t))) && 
+            (millis() - tmo) < 1000)
+      xSemaphoreTake(semMixSpace[MIX_SRC_CLIP], pdMS_TO_TICKS(50));
+   xSemaphoreGive(semClipLock);
+   if(!ok)
+      return false;
+   xSemaphoreGive(semPlayData);           // wake the player
 
-   // Create temp buffer in PSRAM
-   uint8_t *play_buffer = (uint8_t *)heap_caps_malloc(WAV_BUFR_SIZE + 16, MALLOC_CAP_SPIRAM); 
-   if(!play_buffer) {                     // out of memory - exit
-      h_taskAudioPlayWAV = nullptr;
-      vTaskDelay(10);
-      vTaskDelete(NULL);  
+   if(blocking) {                         // this clip & any queued ahead of it
+      uint32_t max_ms = (clip.samples / (AUDIO_SAMPLE_RATE / 1000)) * CLIP_FIFO_DEPTH + 1000;
+      waitMixDrained(MIX_SRC_CLIP, pdMS_TO_TICKS(max_ms));
    }
+   return true;
+}
 
-   /**
-    * @brief Get WAV file size to calc progress
-    */
-   int32_t file_sz = sd.fsize(play_wav->filename);  // get size & validate file
-   if(play_buffer && file_sz > 0) {    // if file exists, continue
-      /**
-       * @brief Open file for multiple chunk reads if all is OK so far
-       */
-      _file = sd.fopen(play_wav->filename, FILE_READ, false);
-      file_ready = (_file);
-      if(file_ready) {
-         bytesRead = sd.fread(_file, play_buffer, WAV_HEADER_SIZE, 0); // read WAV header 
-         play_loop = (bytesRead > 0) ? true : false;  // is there any data to play?
-      } else {
-         play_loop = false;
-      }
 
-      // Validate that file is a WAV file - signature == RIFF
-      if(play_loop) {
-         if(strncmp((const char *)play_buffer, "RIFF", 4) != 0) {
-            play_loop = false;            // remove self    
-         }
+/********************************************************************
+ * Ring cadences. Calling is an old style warbling ring: 15 cycles of
+ * 32ms on / 32ms off, then 960ms silent.
+ */
+#define WARBLE          {32, 1}, {32, 0}
+#define WARBLE_X5       WARBLE, WARBLE, WARBLE, WARBLE, WARBLE
+static const synth_step_t CADENCE_CALLING[] = { WARBLE_X5, WARBLE_X5, WARBLE_X5, {960, 0} };
+static const synth_step_t CADENCE_ALARM[] = { {384, 1}, {384, 0} };
+
+#define VOL_NORM              30.0   
+#define TONE_CHUNK_SAMPLES    I2S_DMA_BUFR_LEN
+#define TONE_RELEASE_SAMPLES  (AUDIO_SAMPLE_RATE * SYNTH_ENV_MS / 1000)
+#define WAV_READ_BYTES        4096                    // raw file bytes per decode (max)
+#define WAV_PCM_SAMPLES       (PLAY_FIFO_CHUNK_BYTES / sizeof(int16_t))   // decoded samples per block
+#define ENGINE_SLOT_WAIT      pdMS_TO_TICKS(100)      // max wait for a fifo slot per pass
+#define WAV_MARKS             4                       // track starts remembered for position
 
-         num_chnls = play_buffer[22];          // get num channels from header
+/********************************************************************
+ * Engine voices. Allocated once and reused for every tone / file.
+ */
+typedef struct {
+   play_tone_params_t params;
+   ESP32S3_SYNTH synth;
+   synth_step_t dtmf_steps[2];
+   const char *digit;                     // next DTMF digit
+   uint32_t seg_samples;                  // samples left in this segment
+   bool continuous;                       // play until stopped
+   bool started;                          // first segment set up
+   int16_t amp;                           // peak level
+   bool active;
+} tone_voice_t ;
 
-         // Search for tag 'data' which points to start of audio data
-         for(i=32; i<WAV_HEADER_SIZE; i++) {
-            if(strncmp((char *)play_buffer+i, "data", 4) == 0) {
-               idx = i;
-               break;
-            }
-         }
-         play_loop = (idx > 0);           // exit if 'data' substring not found   
-         idx += 4;                        // ptr to embedded data size
-
-         // extract data size from WAV header                         // advance index to start of sampled data         
-         memcpy(&total_data_bytes, (uint8_t *)play_buffer+idx, 4); // get data size
-         idx += 4;                        // point to start of audio data (44)
-         if(total_data_bytes <= 0) 
-            play_loop = false;
-      }
-   } else 
-      play_loop = false;
+/********************************************************************
+ * WAV tracks. Two track slots ping-pong (ESP32S3_PLAYLIST): the engine
+ * plays one while taskWavPrefetch opens and reads ahead the next file 
+ * of the playlist into the other. 'wav_file' is the loader's side of 
+ * each slot: the open file and the read position.
+ */
+typedef struct {
+   char path[ENGINE_PATH_LEN];            // to reload after a seek
+   File file;
+   uint32_t pos;                          // next file offset to read
+   uint32_t end;                          // file offset past the audio data
+} wav_file_t ;
+
+typedef struct {
+   QueueHandle_t qPlaylist;               // paths waiting to be loaded
+   std::atomic<bool> run;                 // engine -> loader: load & read tracks
+   uint8_t load;                          // loader: slot of the track being loaded
+   SemaphoreHandle_t semIdle;             // given when the loader stops touching files
+} wav_loader_t ;
+
+typedef struct {
+   PlayWav_cb cb;
+   uint32_t out;                          // samples committed to the WAV fifo (wraps)
+   bool active;
+   bool paused;
+} wav_voice_t ;
 
-   /**
-   *  @brief Loop processing audio data and writing to output device (speaker)
-   */
-   while(play_loop) { 
-      /**
-       * @brief Check command queue for play changes
-       */
-      if(xQueueReceive(h_QueueAudioPlayWAVCmd, &play_wav_queue, 0) == pdTRUE) { 
-         switch(play_wav_queue.cmd) {
-            case PLAY_WAV_STOP:
-               play_loop = false;
-               break;
+/********************************************************************
+ * Play position. The player counts WAV fifo samples handed to I2S (or 
+ * dropped by a flush) in 'wav_played'. The engine counts the samples it
+ * commits in 'wav_voice.out', and records a mark each time a track (or
+ * a seek) starts: the 'out' count of its first sample and the track 
+ * position there. The track being heard is the one with the latest mark
+ * that 'wav_played' has passed, so the position stays right while the
+ * engine already decodes the next track.
+ */
+typedef struct {
+   uint32_t base;                         // 'wav_voice.out' of the first sample
+   uint32_t pos;                          // track position there, samples
+   uint32_t length;                       // track length, samples. 0 = unused
+} wav_mark_t ;
+
+typedef struct {
+   wav_mark_t mark[WAV_MARKS];
+   uint8_t head;                          // newest mark
+} wav_marks_t ;
+
+static tone_voice_t tone_voice;
+static wav_voice_t wav_voice;
+static ESP32S3_PLAYLIST wav_playlist;
+static wav_file_t wav_file[PLAYLIST_SLOTS];
+static wav_loader_t wav_loader;
+static wav_marks_t wav_marks_eng;         // engine copy of 'wav_marks'
+static SeqLock<wav_marks_t> wav_marks;    // snapshot for getWavPosition()
+static std::atomic<uint32_t> wav_played(0);   // WAV fifo samples handed to I2S or dropped (wraps)
 
-            case PLAY_WAV_PAUSE:
-               pause_play = true;
-               break;
 
-            case PLAY_WAV_CONTINUE:
-               pause_play = false;
-               play_loop = true;
-               break;               
+/********************************************************************
+ * @brief Playlist callback: a ring slot or a track slot is free again.
+ */
+static void wavLoaderWake(void)
+{
+   xTaskNotifyGive(h_WavPrefetch);
+}
 
-            case PLAY_WAV_SEND_STATUS:    // send progress
-               play_wav_status.progress = map(idx, 0, file_sz-WAV_BUFR_SIZE, 0, 100); // progress from 0 - 100%  
-               xQueueOverwrite( h_QueueAudioPlayWAVStat, ( void * ) &play_wav_status);  // send status 
-               break;
-         }
-      }
 
-      /**
-       * @brief Read one frame of audio from file and send to speaker driver
-       */
-      if(play_loop && !pause_play) {
+/********************************************************************
+ * @brief Allocate the read-ahead rings (PSRAM) and the playlist.
+ */
+static bool wavPrefetchInit(void)
+{
+   wav_loader.qPlaylist = xQueueCreate(WAV_PLAYLIST_MAX, ENGINE_PATH_LEN);
+   wav_loader.semIdle = xSemaphoreCreateBinary();
+   wav_loader.run = false;
+   wav_loader.load = 0;
+   return wav_playlist.init(AUDIO_SAMPLE_RATE, WAV_PCM_SAMPLES, WAV_READ_BYTES, WAV_PREFETCH_DEPTH,
+            WAV_PREFETCH_BYTES, wavLoaderWake, wavTrackHeard);
+}
 
-         bytesToRead = (total_data_bytes < WAV_BUFR_SIZE) ? total_data_bytes : WAV_BUFR_SIZE;
-         bytesRead = sd.fread(_file, play_buffer, bytesToRead, idx);  
-         if(bytesRead <= 0) {             // all done?
-            break;
-         }
 
-         total_data_bytes -= bytesRead;   // calc remaining bytes in file
-         if(total_data_bytes <= 0) {      // all done?
-            break;
-         }
+/********************************************************************
+ * @brief Start loading tracks. Engine side.
+ */
+static void wavLoaderStart(void)
+{
+   xSemaphoreTake(wav_loader.semIdle, 0); // drop a stale idle ack
+   wav_loader.run = true;
+   xTaskNotifyGive(h_WavPrefetch);
+}
 
-         idx += bytesRead;                // move seek position towards end of file
-         // // Keep a running tab on play progress
-         // play_wav_status.progress = map(idx, 0, file_sz-48, 0, 100); // progress from 0 - 100%         
 
-         // if file is stereo, convert to mono
-         if(num_chnls > 1) {              // stereo data?
-            for(i=0; i<bytesRead; i+=2) { // compress data using only L chnl data (mono)
-               play_buffer[i] = play_buffer[(i*2)+2];
-               play_buffer[i+1] = play_buffer[(i*2)+3];            
-            }
-            bytesRead /= 2;               // mono data = (stereo data / 2)
-         }
-         // Send audio struct to the background play task                   
-         audio_play.cmd = PLAY_AUDIO;
-         audio_play.chunk_bytes = WAV_BUFR_SIZE;   // max chunk size in bytes
-         audio_play.chunk_depth = 4;               // # chunks to allocate
-         audio_play.pChunk = (uint16_t *)play_buffer;
-         audio_play.bytes_to_write = bytesRead;    // actual data bytes to play
-         audio_play.volume = play_wav->volume; //sys_utils.getVolume();
-         xQueueSend(qAudioPlay, &audio_play, 200); // play this chunk      
-         // Wait for the BG task to read the struct 
-         while (uxQueueMessagesWaiting(qAudioPlay) > 0) { 
-            vTaskDelay(pdMS_TO_TICKS(1));   
-         }      
-         
-         /**
-          * @brief Report progress to caller
-          */
-            play_wav_status.progress = map(idx, 0, file_sz-WAV_BUFR_SIZE, 0, 100); // progress from 0 - 100%  
-            xQueueOverwrite( h_QueueAudioPlayWAVStat, ( void * ) &play_wav_status);  // send status 
-      }
-      vTaskDelay(2);                      // keep the watchdog happy!
+/********************************************************************
+ * @brief Stop the loader and wait until it has let go of the files. The
+ * engine may then change the track slots. Engine side.
+ */
+static void wavLoaderPause(void)
+{
+   if(wav_loader.run) {
+      wav_loader.run = false;
+      xTaskNotifyGive(h_WavPrefetch);
+      xSemaphoreTake(wav_loader.semIdle, portMAX_DELAY);   // at most one SD read
    }
+}
 
-   /**
-    * @brief Play WAV complete. Close file, free memory used, and kill the task
-    */
-   vTaskDelay(120);                       // make sure bg player is done
-   if(file_ready)
-      sd.fclose(_file);                   // close file if it was previously opened 
-   heap_caps_free(play_buffer);   
-   vQueueDelete(h_QueueAudioPlayWAVCmd);  // free cmd queue memory 
-   vQueueDelete(h_QueueAudioPlayWAVStat); // free status queue memory    
-   h_taskAudioPlayWAV = nullptr;          // tell task has stopped
-   vTaskDelete(NULL);                     // remove this task 
+
+/********************************************************************
+ * @brief Stop the loader, close the files and empty both slots and the
+ * playlist. Engine side.
+ */
+static void wavLoaderStop(void)
+{
+   wavLoaderPause();
+   for(uint8_t i = 0; i < PLAYLIST_SLOTS; i++) {
+      if(wav_file[i].file)
+         sd.fclose(wav_file[i].file);
+   }
+   wav_playlist.clear();
+   xQueueReset(wav_loader.qPlaylist);
+   wav_loader.load = 0;
 }
 
 
 /********************************************************************
- * @brief Play Audio Task. This is the background task responsible for 
- * playing audio to the I2S sink (speaker) device. The task is 
- * activated by sending a 'audio_play_t' struct through the queue. 
- * The struct elements are defined here:
- * cmd - 8 bit command defines the action of the struct. 
- *    PLAY_AUDIO - Play raw audio.
- *    PLAY_CLOSE - Kill this task.
- *    PLAY_CONFIG - Config only. Audio is ignored. Fifo is cleared.
- * pChunk - Pointer to data to be played.
- * bytes_to_write - Number of actual bytes to write to the I2S device.
- * volume - Audio volume (0-100%) is appplied to the data.
- * chunk_bytes - Maximum 'bytes_to_write' per chunk.
- * chunk_depth - Number of chunks allocated to the fifo.
+ * @brief Open & parse a playlist file into a FREE slot. Loader side.
  */
-void taskPlayAudio(void * params)
+static void trackOpen(uint8_t slot, const char *path)
 {
-   ChunkRingFifo fifo;
-   audio_play_t primary_params;
-   audio_play_t sec_params;
-   primary_params.pChunk = nullptr;     // no data yet
-   primary_params.cmd = PLAY_NONE;
-   uint32_t i;
-   size_t bytes_written;
-   uint16_t bytes_read;
-   esp_err_t err;
-   uint32_t chunk_depth = 24;
-   uint32_t chunk_bytes = 240;
-   primary_params.chunk_bytes = chunk_bytes;
-   primary_params.chunk_depth = chunk_depth;
-   memcpy(&sec_params, &primary_params, sizeof(audio_play_t));
-   int16_t volume = 33;    // default volume level
+   playlist_track_t &t = wav_playlist.track(slot);
+   wav_file_t &f = wav_file[slot];
+
+   strncpy(f.path, path, ENGINE_PATH_LEN - 1);
+   if(sd.fsize(path) > 0)
+      f.file = sd.fopen(path, FILE_READ, false);
+   // Walk the RIFF chunks & set up conversion to mono at the playback rate
+   if(!wav_playlist.open(slot, (f.file) ? wavFileRead : nullptr, &f.file, (f.file) ? f.file.size() : 0)) {
+      if(f.file)
+         sd.fclose(f.file);
+      return;                             // slot is TRACK_FAILED
+   }
+   f.pos = t.wav.info().data_offset;
+   f.end = f.pos + t.wav.info().data_bytes;
+}
 
-   // Create a default fifo 
-   fifo.create(chunk_depth, chunk_bytes);  // Initial fifo config 
 
-   // Create a default one-chunk buffer in PSRAM
-   int16_t *_buf = (int16_t*)heap_caps_malloc(chunk_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-   memset(_buf, 0, chunk_bytes);
-   bool pause_task = false;
+/********************************************************************
+ * @brief WAV track loader & read-ahead task. Takes paths from the 
+ * playlist in order, opens each one into the next track slot and keeps
+ * its ring full with reads of up to WAV_PREFETCH_BYTES that end on a
+ * WAV_PREFETCH_BYTES file offset, so after the first one every read is
+ * one aligned, cluster sized block. When a file has been read to the 
+ * end it is closed and the next file is opened into the other slot as
+ * soon as the engine frees it - i.e. while the current track is still
+ * playing from its ring.
+ * Sleeps (task notify) while the rings are full or nothing is queued.
+ * Runs at low priority: each ring holds seconds of audio, which covers 
+ * SD stalls from other tasks (e.g. the file explorer listing folders).
+ */
+void taskWavPrefetch(void *params)
+{
+   wav_loader_t &ld = wav_loader;
+   char path[ENGINE_PATH_LEN];
+   uint32_t len;
+   int32_t bytesRead;
+   uint8_t *slot;
 
-   /**
-    * @brief Infinite loop to write audio to the I2S sink device (MAX89357)
-    */
    while(true) {
-      // Check if incomming data/cmd
-      if(xQueueReceive(qAudioPlay, &sec_params, 0) == pdTRUE) {  
-         if(sec_params.cmd == PLAY_SET_VOLUME) {   // only change volume?
-            volume = sec_params.volume;   // only modify primary volume 
-         } else {
-            memcpy(&primary_params, &sec_params, sizeof(audio_play_t)); // new primary params
-            // fifo is reconfigured if chunk size & depth have changed  
-            if(primary_params.chunk_bytes != chunk_bytes || 
-                  primary_params.chunk_depth != chunk_depth) {   // reconfigure?
-               chunk_bytes = primary_params.chunk_bytes;  // save new chunk config
-               chunk_depth = primary_params.chunk_depth;
-               if(_buf) {
-                  heap_caps_free(_buf);      // free current PSRAM bufr
-               }
-               // Create new one chunk buffer in PSRAM
-               _buf = (int16_t*)heap_caps_malloc(chunk_bytes, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
-               memset(_buf, 0, chunk_bytes); // zero the new bufr           
-               fifo.reconfigure(chunk_depth, chunk_bytes);   // reconfigure the fifo
+      ulTaskNotifyTake(pdTRUE, portMAX_DELAY);   // start, stop, queued path or a slot freed
+
+      while(ld.run) {
+         playlist_track_t &t = wav_playlist.track(ld.load);
+         wav_file_t &f = wav_file[ld.load];
+
+         if(t.state == TRACK_FREE) {      // next track of the playlist
+            if(xQueueReceive(ld.qPlaylist, path, 0) != pdTRUE)
+               break;
+            trackOpen(ld.load, path);
+            if(t.state == TRACK_FAILED) 
+               ld.load ^= 1;
+            xTaskNotifyGive(h_AudioEngine);
+         }
+         else if(t.state == TRACK_READY && !t.eof) {
+            if((slot = (uint8_t *)t.ring.acquire()) == nullptr)
+               break;                     // ring full
+            len = WAV_PREFETCH_BYTES - (f.pos % WAV_PREFETCH_BYTES);
+            if(len > f.end - f.pos) len = f.end - f.pos;
+            bytesRead = sd.fread(f.file, slot, len, f.pos);
+            if(bytesRead > 0) {
+               t.ring.commit(bytesRead);
+               f.pos += bytesRead;
+               t.buffered += bytesRead;
             }
-            // If fifo has space, push callers chunk into fifo. Otherwise this chunk is dropped.
-            if(!fifo.isFull() && primary_params.cmd == PLAY_AUDIO && primary_params.pChunk) {  // fifo must have space and caller src is valid
-               fifo.push(primary_params.pChunk, primary_params.bytes_to_write); // push chunk into the fifo
+            if(bytesRead <= 0 || f.pos >= f.end) {   // end of data (or a short file)
+               sd.fclose(f.file);
+               t.eof = true;
+               ld.load ^= 1;              // next file goes in the other slot
             }
+            xTaskNotifyGive(h_AudioEngine);  // data for a waiting wavStep()
          }
-      } 
-
-      // Close task?
-      if(primary_params.cmd == PLAY_CLOSE) {  // if closing, exit the forever loop 
-         break;
+         else                             // slot still playing an earlier track
+            break;
       }
+      if(!ld.run)
+         xSemaphoreGive(ld.semIdle);
+   }
+}
 
-      // Stop playing, clear fifo, and idle
-      else if(primary_params.cmd == PLAY_CLEAR) {
-         fifo.clear();
-         audio.clearReadBuffer();
-         primary_params.cmd == PLAY_NONE;
-      }
 
-      /**
-       * @brief Pop a chunk from the fifo and write it to the I2S device
-       */
-      else if(!fifo.isEmpty() && primary_params.cmd == PLAY_AUDIO) {
-         fifo.pop(_buf, bytes_read);      // move a chunk to our local buffer
-         // Apply audio volume
-         for(i=0; i<bytes_read/2; i++) {
-            _buf[i] = (_buf[i] * volume) / 100;  // use integer math (faster)
-         }
-               // Serial.print("p");
+/********************************************************************
+ * @brief ESP32S3_WAV read callback. 'ctx' is a File.
+ */
+static int32_t wavFileRead(void *ctx, uint8_t *buf, uint32_t len, uint32_t offset)
+{
+   return sd.fread(*(File *)ctx, buf, len, offset);
+}
 
-         // Write one audio chunk to the I2S sink device
-         err = i2s_write(I2S_SPEAKER, (uint16_t *)_buf, bytes_read, &bytes_written, portMAX_DELAY);
-         if(err != ESP_OK || bytes_written == 0) {
-            Serial.printf("Error: i2s_write err=%d\n", err);
-         }   
+
+/********************************************************************
+ * @brief Set up the next tone segment: one DTMF digit, or the whole 
+ * tone. Returns false when there is nothing left to play.
+ */
+static bool toneSegment(tone_voice_t &t)
+{
+   uint8_t i, num_tones;
+
+   t.synth.clear();
+   if(t.params.dtmf[0]) {
+      if(*t.digit == '\0')                // all digits dialed
+         return false;
+      t.synth.addDtmf(*t.digit++, t.amp);
+      t.dtmf_steps[0] = { t.params.dtmf_on_ms, 1 };
+      t.dtmf_steps[1] = { t.params.dtmf_off_ms, 0 };
+      t.synth.setCadence(t.dtmf_steps, 2);
+      t.seg_samples = uint32_t(t.params.dtmf_on_ms + t.params.dtmf_off_ms) * AUDIO_SAMPLE_RATE / 1000;
+   } else {
+      if(t.started)                       // plain tones are one segment
+         return false;
+      for(num_tones = 0; num_tones < SYNTH_MAX_VOICES && t.params.tone_freq[num_tones] > 0.0; num_tones++)
+         ;
+      for(i = 0; i < num_tones; i++) {    // voices share the peak level
+         if(i == 0 && t.params.sweep_to_freq > 0.0)
+            t.synth.addSweep(t.params.tone_freq[0], t.params.sweep_to_freq, t.params.sweep_secs, 
+                     t.amp / num_tones, t.params.sweep_repeat);
+         else
+            t.synth.addTone(t.params.tone_freq[i], t.amp / num_tones);
       }
-      vTaskDelay(2);
+      if(t.params.ring_mode == RING_MODE_CALLING)
+         t.synth.setCadence(CADENCE_CALLING, sizeof(CADENCE_CALLING) / sizeof(synth_step_t));
+      else if(t.params.ring_mode == RING_MODE_ALARM)
+         t.synth.setCadence(CADENCE_ALARM, sizeof(CADENCE_ALARM) / sizeof(synth_step_t));
+      t.seg_samples = (t.continuous) ? TONE_CHUNK_SAMPLES : uint32_t(t.params.duration_sec * AUDIO_SAMPLE_RATE);
    }
+   t.started = true;
+   return (t.seg_samples > 0);
+}
 
-   /**
-    * @brief Close (destroy) task and free associated memory
-    */
-   if(_buf) 
-      heap_caps_free(_buf);               // free chunk buffer memory
-   fifo.destroy();                        // destroy the fifo
-   vTaskDelete(NULL);                     // kill this task
+
+/********************************************************************
+ * @brief End the tone voice.
+ * @param ramp - true: stopped early, fade out so it doesn't click.
+ * @param signal - false when a new tone replaces this one.
+ */
+static void toneFinish(bool ramp, bool signal)
+{
+   tone_voice_t &t = tone_voice;
+   int16_t *slot;
+
+   if(ramp && (slot = audio.mixAcquire(MIX_SRC_TONE, ENGINE_SLOT_WAIT)) != nullptr) {
+      t.synth.noteOff();
+      t.synth.render(slot, TONE_RELEASE_SAMPLES);
+      audio.mixCommit(MIX_SRC_TONE, TONE_RELEASE_SAMPLES * sizeof(int16_t));
+   }
+   t.active = false;
+   if(signal) {
+      xEventGroupClearBits(egAudioEngine, ENGINE_TONE_BUSY);
+      xEventGroupSetBits(egAudioEngine, ENGINE_TONE_DONE);
+   }
+}
+
+
+/********************************************************************
+ * @brief Start the tone voice.
+ */
+static void toneStart(const play_tone_params_t &params)
+{
+   tone_voice_t &t = tone_voice;
+
+   t.params = params;
+   t.params.dtmf[TONE_MAX_DTMF] = '\0';
+   t.synth.init(AUDIO_SAMPLE_RATE);
+   t.digit = t.params.dtmf;
+   t.continuous = (t.params.duration_sec <= 0.0 && !t.params.dtmf[0]);
+   t.amp = int16_t(constrain(t.params.volume, 0.0f, 100.0f) * VOL_NORM);
+   t.started = false;
+   t.active = toneSegment(t);
+   if(!t.active)                          // nothing to play
+      toneFinish(false, true);
+}
+
+
+/********************************************************************
+ * @brief Render one chunk of the tone voice into its mixer fifo.
+ * @return false if the fifo was full and nothing was done.
+ */
+static bool toneStep(void)
+{
+   tone_voice_t &t = tone_voice;
+   uint32_t n;
+
+   if(t.seg_samples == 0 && !toneSegment(t)) {
+      toneFinish(false, true);
+      return true;
+   }
+   int16_t *slot = audio.mixAcquire(MIX_SRC_TONE, 0);
+   if(!slot)                              // fifo full - try when the mixer frees a slot
+      return false;
+   n = (t.seg_samples < TONE_CHUNK_SAMPLES) ? t.seg_samples : TONE_CHUNK_SAMPLES;
+   t.synth.render(slot, n);
+   audio.mixCommit(MIX_SRC_TONE, n * sizeof(int16_t));
+   if(!t.continuous)
+      t.seg_samples -= n;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Audio buffered ahead of the WAV play position in the read-ahead
+ * ring of the current track, in ms. Drops toward 0 if the SD can't keep
+ * up.
+ */
+uint32_t AUDIO::getWavBufferedMs(void)
+{
+   if(!isWavPlaying())
+      return 0;
+   playlist_track_t &t = wav_playlist.track(wav_playlist.current());
+   const wav_info_t &info = t.wav.info();
+   if(t.state != TRACK_READY || info.block_align == 0 || info.sample_rate == 0)
+      return 0;
+   uint64_t frames = uint64_t(t.buffered) * info.frames_per_block / info.block_align;
+   return uint32_t(frames * 1000 / info.sample_rate);
+}
+
+
+/********************************************************************
+ * @brief Find the mark of the track being heard.
+ * @param heard - samples of that track heard since the mark.
+ * @return false if no track has been heard yet.
+ */
+static bool wavHeardMark(wav_mark_t *mark, uint32_t *heard)
+{
+   wav_marks_t m;
+   uint32_t played, d, best = UINT32_MAX;
+
+   wav_marks.read(&m);
+   played = wav_played.load();
+   for(uint8_t i = 0; i < WAV_MARKS; i++) {
+      if(m.mark[i].length == 0)
+         continue;
+      d = played - m.mark[i].base;
+      if(int32_t(d) >= 0 && d < best) {   // passed, and the latest so far
+         best = d;
+         *mark = m.mark[i];
+      }
+   }
+   *heard = best;
+   return best != UINT32_MAX;
+}
+
+
+/********************************************************************
+ * @brief Play position of the WAV track being heard: samples (at
+ * AUDIO_SAMPLE_RATE) handed to I2S, not bytes read. Queued and read
+ * ahead audio doesn't count. Lock free - OK to poll from the UI.
+ */
+uint32_t AUDIO::getWavPosition(void)
+{
+   wav_mark_t mark;
+   uint32_t heard;
+
+   if(!wavHeardMark(&mark, &heard))
+      return 0;
+   heard += mark.pos;
+   return (heard < mark.length) ? heard : mark.length;
+}
+
+
+/********************************************************************
+ * @brief Length of the WAV track being heard, samples at AUDIO_SAMPLE_RATE.
+ */
+uint32_t AUDIO::getWavLength(void)
+{
+   wav_mark_t mark;
+   uint32_t heard;
+
+   return (wavHeardMark(&mark, &heard)) ? mark.length : 0;
+}
+
+
+/********************************************************************
+ * @brief Jump to a position in the playing track. Playback continues
+ * from there (or stays paused) - the playlist isn't restarted.
+ * @param ms - from the start of the track. Past the end ends the track.
+ */
+bool AUDIO::seekWav(uint32_t ms)
+{
+   if(!isWavPlaying())
+      return false;
+
+   engine_cmd_t cmd = {};
+   cmd.cmd = ENGINE_WAV_SEEK;
+   cmd.seek_ms = ms;
+   return engineSend(cmd, 100) == pdTRUE;
+}
+
+
+/********************************************************************
+ * @brief End the WAV voice: drop the playlist and close the files.
+ * @param signal - false when a new playlist replaces this one.
+ */
+static void wavFinish(bool signal)
+{
+   wav_voice_t &w = wav_voice;
+
+   wavLoaderStop();                       // loader lets go of the files
+   w.active = false;
+   w.paused = false;
+   wav_progress = -1;
+   if(signal) {
+      xEventGroupClearBits(egAudioEngine, ENGINE_WAV_BUSY);
+      xEventGroupSetBits(egAudioEngine, ENGINE_WAV_DONE);
+   }
+}
+
+
+/********************************************************************
+ * @brief Add a file to the playlist. Starts the WAV voice if it is idle.
+ * @param xfade_ms - crossfade between tracks when starting, 0 = gapless.
+ * @return false if the playlist is full.
+ */
+static bool wavQueue(const char *path, PlayWav_cb cb, uint16_t xfade_ms)
+{
+   wav_voice_t &w = wav_voice;
+
+   if(!w.active) {
+      w.cb = cb;
+      w.paused = false;
+      wav_playlist.begin(uint32_t(xfade_ms) * AUDIO_SAMPLE_RATE / 1000);
+      wav_progress = 0;
+   }
+   if(xQueueSend(wav_loader.qPlaylist, path, 0) != pdTRUE)
+      return false;
+   wav_playlist.queued();
+   if(!w.active) {
+      w.active = true;
+      wavLoaderStart();
+   }
+   else
+      xTaskNotifyGive(h_WavPrefetch);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Record that the next sample of track 't' is committed at 
+ * 'offset' of the slot being filled (see getWavPosition()).
+ */
+static void wavMark(playlist_track_t &t, uint32_t offset)
+{
+   wav_marks_t &m = wav_marks_eng;
+
+   m.head = (m.head + 1) % WAV_MARKS;
+   m.mark[m.head].base = wav_voice.out + offset;
+   m.mark[m.head].pos = t.start;
+   m.mark[m.head].length = wav_playlist.length(t);
+   wav_marks.write(m);
+   t.marked = true;
+}
+
+
+/********************************************************************
+ * @brief Playlist callback: track 't' is heard from 'offset' of the
+ * slot being filled - a new track starts (or fades in).
+ */
+static void wavTrackHeard(playlist_track_t &t, uint32_t offset)
+{
+   wavMark(t, offset);
+   wav_progress = 0;
+}
+
+
+/********************************************************************
+ * @brief Drop the WAV audio queued in the mixer fifo and wait for the 
+ * player to confirm. The player counts the dropped samples as played,
+ * so afterwards 'wav_played' == 'wav_voice.out'. Engine side.
+ */
+static void wavFlush(void)
+{
+   audio_play_t params = {};
+
+   xEventGroupClearBits(egAudioEngine, ENGINE_FLUSH_DONE);
+   params.cmd = PLAY_FLUSH;
+   params.source = MIX_SRC_WAV;
+   xQueueSend(qAudioPlay, &params, portMAX_DELAY);
+   xEventGroupWaitBits(egAudioEngine, ENGINE_FLUSH_DONE, pdTRUE, pdTRUE, pdMS_TO_TICKS(200));
+}
+
+
+/********************************************************************
+ * @brief Jump to 'ms' in the current track without stopping the 
+ * playlist. The read-ahead restarts at the block holding 'ms', the 
+ * decoded audio still queued is flushed, and a next track that was 
+ * already loaded goes back to the head of the playlist.
+ */
+static void wavSeek(uint32_t ms)
+{
+   uint8_t cur = wav_playlist.current();
+   playlist_track_t &a = wav_playlist.track(cur);
+   playlist_track_t &b = wav_playlist.track(cur ^ 1);
+   wav_file_t &fa = wav_file[cur];
+   wav_file_t &fb = wav_file[cur ^ 1];
+
+   if(a.state != TRACK_READY)
+      return;
+   wavLoaderPause();                      // loader lets go of the slots
+
+   // The next track is loaded again after the seek
+   if(b.state != TRACK_FREE) {
+      if(fb.file)
+         sd.fclose(fb.file);
+      if(xQueueSendToFront(wav_loader.qPlaylist, fb.path, 0) != pdTRUE)
+         wav_playlist.unqueue();          // playlist refilled meanwhile - drop it
+      wav_playlist.reset(cur ^ 1);
+   }
+
+   // Restart the current track at the block holding 'ms'
+   fa.pos = a.wav.info().data_offset + wav_playlist.seek(ms);
+   if(!fa.file)                           // read to the end already
+      fa.file = sd.fopen(fa.path, FILE_READ, false);
+   a.eof = (!fa.file || fa.pos >= fa.end);
+   if(a.eof && fa.file)                   // seek to the end: nothing to read
+      sd.fclose(fa.file);
+   wav_loader.load = (a.eof) ? cur ^ 1 : cur;
+
+   wavFlush();                            // old position leaves the mixer
+   wavMark(a, 0);                         // new position is the next sample
+   wavLoaderStart();
+}
+
+
+/********************************************************************
+ * @brief Fill one mixer fifo slot from the playlist: tracks spliced
+ * sample accurately, or crossfaded (see ESP32S3_PLAYLIST::fill()).
+ * @return false if the fifo was full or no data was buffered yet.
+ */
+static bool wavStep(void)
+{
+   wav_voice_t &w = wav_voice;
+   uint32_t n;
+   int8_t progress;
+
+   // Borrow a slot of the WAV fifo
+   int16_t *slot = audio.mixAcquire(MIX_SRC_WAV, 0);
+   if(!slot)                              // fifo full - try when the mixer frees a slot
+      return false;
+
+   n = wav_playlist.fill(slot, WAV_PCM_SAMPLES);
+   if(n > 0) {
+      audio.mixCommit(MIX_SRC_WAV, n * sizeof(int16_t));   // queue the filled slot for the mixer
+      w.out += n;
+   }
+
+   if(wav_playlist.pending() == 0) {      // playlist done
+      wavFinish(true);
+      return true;
+   }
+
+   /**
+    * @brief Report progress of the current track to caller
+    */
+   uint32_t len = audio.getWavLength();
+   if(len > 0) {
+      progress = int8_t(uint64_t(audio.getWavPosition()) * 100 / len);
+      if(progress != wav_progress) {
+         wav_progress = progress;
+         if(w.cb)
+            w.cb(progress);
+      }
+   }
+   return (n > 0);
+}
+
+
+/********************************************************************
+ * @brief Queue a command for the audio engine and wake it.
+ */
+static BaseType_t engineSend(const engine_cmd_t &cmd, TickType_t ticks)
+{
+   BaseType_t ret = xQueueSend(qAudioEngine, &cmd, ticks);
+   if(ret == pdTRUE)
+      xTaskNotifyGive(h_AudioEngine);
+   return ret;
+}
+
+
+/********************************************************************
+ * @brief Audio engine task. Long lived producer for the tone & WAV 
+ * mixer fifos. Commands arrive as 'engine_cmd_t' structs through 
+ * 'qAudioEngine' and start/stop preallocated voices - no tasks or queues
+ * are created per tone or file. Each pass renders one chunk of every 
+ * active voice into its own fifo, so a tone plays over a WAV file and 
+ * the mixer ducks the file. When every fifo is full the task sleeps 
+ * until the mixer frees a slot or a command arrives (task notify).
+ * Busy/done state is reported in 'egAudioEngine'.
+ */
+void taskAudioEngine(void *params)
+{
+   engine_cmd_t cmd;
+   bool busy, rendered;
+
+   tone_voice.active = false;
+   wav_voice.active = false;
+
+   while(true) {
+      while(xQueueReceive(qAudioEngine, &cmd, 0) == pdTRUE) {
+         switch(cmd.cmd) {
+            case ENGINE_TONE_START:
+               if(tone_voice.active)      // replace the current tone
+                  toneFinish(false, false);
+               toneStart(cmd.tone);
+               break;
+
+            case ENGINE_TONE_STOP:
+               if(tone_voice.active)
+                  toneFinish(true, true);
+               break;
+
+            case ENGINE_WAV_START:
+               if(wav_voice.active)       // replace the current playlist
+                  wavFinish(false);
+               if(!wavQueue(cmd.path, cmd.cb, cmd.xfade_ms)) 
+                  wavFinish(true);        // failed - caller sees done
+               break;
+
+            case ENGINE_WAV_QUEUE:        // append to the playlist (starts it if idle)
+               if(!wavQueue(cmd.path, cmd.cb, cmd.xfade_ms)) {
+                  Serial.println("Error: WAV playlist full");
+                  if(!wav_voice.active)
+                     wavFinish(true);
+               }
+               break;
+
+            case ENGINE_WAV_SEEK:
+               if(wav_voice.active)
+                  wavSeek(cmd.seek_ms);
+               break;
+
+            case ENGINE_WAV_CTRL:
+               if(!wav_voice.active)
+                  break;
+               if(cmd.wav_cmd == PLAY_WAV_STOP)
+                  wavFinish(true);
+               else if(cmd.wav_cmd == PLAY_WAV_PAUSE)
+                  wav_voice.paused = true;
+               else if(cmd.wav_cmd == PLAY_WAV_CONTINUE)
+                  wav_voice.paused = false;
+               break;                     // PLAY_WAV_SEND_STATUS: progress is always current
+         }
+      }
+
+      /**
+       * @brief Render one chunk of each active voice
+       */
+      rendered = false;
+      if(tone_voice.active) 
+         rendered |= toneStep();
+      if(wav_voice.active && !wav_voice.paused) 
+         rendered |= wavStep();
+
+      // Sleep until a slot frees or a command arrives. Idle: sleep until a command.
+      busy = tone_voice.active || (wav_voice.active && !wav_voice.paused);
+      if(!rendered)
+         ulTaskNotifyTake(pdTRUE, (busy) ? ENGINE_SLOT_WAIT : portMAX_DELAY);
+   }
+}
+
+
+/********************************************************************
+ * @brief Mixer callback: a slot of 'source' is free again. Wakes a 
+ * producer waiting in mixAcquire(), a caller waiting for the source to
+ * drain and the audio engine.
+ */
+static void mixSlotFreed(uint8_t source)
+{
+   xSemaphoreGive(semMixSpace[source]);
+   if(mix_fifo[source].isEmpty())
+      xEventGroupSetBits(egAudioEngine, ENGINE_DRAINED(source));   // see waitMixDrained()
+   if(h_AudioEngine)
+      xTaskNotifyGive(h_AudioEngine);
+}
+
+
+/********************************************************************
+ * Sound effect bank. Effects are decoded once into PSRAM at the playback
+ * format, so playSfx() has no file, decode or copy work: it queues a 
+ * region on the MIX_SRC_SFX fifo and wakes the player. The player 
+ * measures the time from the trigger to the effect's first sample being
+ * handed to I2S (see play_stats_t).
+ */
+typedef struct {
+   int16_t *pcm;                          // PSRAM, nullptr = empty slot
+   uint32_t len;                          // samples
+} sfx_clip_t ;
+
+static sfx_clip_t sfx_bank[SFX_MAX_CLIPS];
+static uint8_t sfx_count = 0;             // slots used
+
+
+/********************************************************************
+ * @brief Decode a WAV file into a PSRAM buffer at the playback format.
+ */
+static bool sfxDecode(const char *filename, sfx_clip_t &clip)
+{
+   ESP32S3_WAV wav;
+   uint32_t pos, end, max_len, len = 0;
+   uint8_t *in = nullptr;
+   int16_t *pcm = nullptr;
+   int32_t got;
+
+   clip.pcm = nullptr;
+   clip.len = 0;
+   if(sd.fsize(filename) <= 0)
+      return false;
+   File file = sd.fopen(filename, FILE_READ, false);
+   if(!file)
+      return false;
+   if(!wav.open(wavFileRead, &file, AUDIO_SAMPLE_RATE, WAV_READ_BYTES, WAV_PCM_SAMPLES, file.size()) || 
+            wav.info().duration_ms > SFX_MAX_MS || wav.info().data_bytes == 0) {
+      sd.fclose(file);
+      return false;
+   }
+
+   // Room for the resampled length plus one decode block of slack
+   max_len = uint32_t((uint64_t(wav.info().total_frames) * AUDIO_SAMPLE_RATE) / wav.info().sample_rate) + 
+            WAV_PCM_SAMPLES;
+   pcm = (int16_t *)heap_caps_malloc(max_len * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+   in = (uint8_t *)heap_caps_malloc(WAV_READ_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+   if(pcm && in) {
+      pos = wav.info().data_offset;
+      end = pos + wav.info().data_bytes;
+      while(pos < end && len + WAV_PCM_SAMPLES <= max_len) {
+         got = wavFileRead(&file, in, (end - pos < wav.readSize()) ? end - pos : wav.readSize(), pos);
+         if(got <= 0)
+            break;
+         pos += got;
+         len += wav.decode(in, got, pcm + len);
+      }
+   }
+   sd.fclose(file);
+   if(in)
+      heap_caps_free(in);
+   if(!pcm || len == 0) {
+      if(pcm)
+         heap_caps_free(pcm);
+      return false;
+   }
+   clip.pcm = pcm;
+   clip.len = len;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Load one effect into the next free slot of the bank.
+ * @param filename - WAV file on the SD card, up to SFX_MAX_MS long.
+ * @return effect id for playSfx(), -1 if the bank is full or the file 
+ *    can't be decoded.
+ */
+int8_t AUDIO::loadSfx(const char *filename)
+{
+   if(sfx_count >= SFX_MAX_CLIPS || !sfxDecode(filename, sfx_bank[sfx_count]))
+      return -1;
+   return sfx_count++;
+}
+
+
+/********************************************************************
+ * @brief Load a set of effects (e.g. SFX_BOOT_FILES at boot). Effect 
+ * ids follow the order of 'filenames' even if a file fails to load - 
+ * its id stays empty and playSfx() returns false for it.
+ * @return number of effects loaded.
+ */
+uint8_t AUDIO::loadSfxBank(const char * const *filenames, uint8_t num_files)
+{
+   uint8_t loaded = 0;
+
+   for(uint8_t i = 0; i < num_files && sfx_count < SFX_MAX_CLIPS; i++) {
+      if(sfxDecode(filenames[i], sfx_bank[sfx_count]))
+         loaded++;
+      else
+         Serial.printf("Error: can't load effect %s\n", filenames[i]);
+      sfx_count++;
+   }
+   return loaded;
+}
+
+
+/********************************************************************
+ * @brief Queue a region on the effect source. The region fifo has one 
+ * producer - callers are serialized. Never waits for space: a UI sound 
+ * that can't play now is dropped.
+ * @param stamp - trigger time, handed back by the mixer when it starts.
+ */
+static bool sfxQueue(const int16_t *pcm, uint32_t len, uint32_t stamp)
+{
+   mix_region_t region;
+   bool ok;
+
+   region.pcm = pcm;
+   region.len = len;
+   region.stamp = stamp;
+   xSemaphoreTake(semSfxLock, portMAX_DELAY);
+   ok = mix_fifo[MIX_SRC_SFX].push(&region, sizeof(mix_region_t));
+   xSemaphoreGive(semSfxLock);
+   return ok;
+}
+
+
+/********************************************************************
+ * @brief Play a preloaded effect. Only a pointer & length are queued, 
+ * so the effect reaches I2S on the next player wakeup. An effect 
+ * triggered while another one plays starts when it ends.
+ * @param id - from loadSfx() / loadSfxBank().
+ * @return false if the id is empty or the effect fifo is full.
+ */
+bool AUDIO::playSfx(uint8_t id)
+{
+   if(id >= sfx_count || !sfx_bank[id].pcm)
+      return false;
+   uint32_t now = uint32_t(esp_timer_get_time()) | 1;   // 0 = no stamp
+   if(!sfxQueue(sfx_bank[id].pcm, sfx_bank[id].len, now))
+      return false;
+   xSemaphoreGive(semPlayData);           // wake the player
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free the effect bank. No effect may be playing.
+ */
+void AUDIO::freeSfx(void)
+{
+   for(uint8_t i = 0; i < sfx_count; i++) {
+      if(sfx_bank[i].pcm)
+         heap_caps_free(sfx_bank[i].pcm);
+      sfx_bank[i].pcm = nullptr;
+      sfx_bank[i].len = 0;
+   }
+   sfx_count = 0;
+}
+
+
+/********************************************************************
+ * @brief Wait for the next captured frame.
+ * @return its frame count, 0 on timeout.
+ */
+static uint32_t latencyNextFrame(void)
+{
+   capture_status_t st;
+
+   if(audio.waitCaptureEvents(CAPTURE_STATE_FRAME_AVAIL, pdMS_TO_TICKS(1000)) == 0)
+      return 0;
+   capture_status.read(&st);
+   return st.captured_frames;
+}
+
+
+/********************************************************************
+ * @brief Measure the speaker -> mic latency of the intercom path. Each 
+ * trial plays a chirp on the SFX source as soon as a capture frame is 
+ * delivered, then finds it in the frames that follow (ESP32S3_LATENCY). 
+ * The lag covers mixer, speaker DMA, air, mic DMA & the capture ring - 
+ * what the intercom adds to a round trip. Blocks about 
+ * trials * (LATENCY_MAX_MS + LATENCY_GAP_MS + 200) ms.
+ * @param result - samples from the end of the trigger frame to the 
+ *    chirp onset in the mic stream: mean, range & jitter.
+ * @param trials - 1 .. LATENCY_MAX_TRIALS.
+ * @param samples_frame - capture frame size to measure with.
+ * @return false if a capture is running or no trial found the chirp.
+ */
+bool AUDIO::measureLatency(latency_result_t *result, uint8_t trials, uint16_t samples_frame)
+{
+   ESP32S3_LATENCY lat;
+   float lags[LATENCY_MAX_TRIALS];
+   int16_t *frame = nullptr, *window = nullptr;
+   uint32_t win_len, win_frames, gap_frames, first, got, n;
+   uint16_t valid = 0, run = 0;
+   bool ok = true;
+   float lag;
+
+   memset(result, 0, sizeof(latency_result_t));
+   if(isCapturing() || trials == 0 || samples_frame == 0)
+      return false;
+   if(trials > LATENCY_MAX_TRIALS) 
+      trials = LATENCY_MAX_TRIALS;
+   if(!lat.init(float(AUDIO_SAMPLE_RATE), LATENCY_CHIRP_LEVEL))
+      return false;
+   win_len = lat.windowLength(LATENCY_MAX_MS * AUDIO_SAMPLE_RATE / 1000);
+   win_frames = (win_len + samples_frame - 1) / samples_frame;
+   gap_frames = (LATENCY_GAP_MS * AUDIO_SAMPLE_RATE / 1000 + samples_frame - 1) / samples_frame;
+   frame = (int16_t *)heap_caps_malloc(samples_frame * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+   window = (int16_t *)heap_caps_malloc(win_frames * samples_frame * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+
+   if(frame && window) {
+      // Raw mic: no VAD, filter, NS, AEC or AGC
+      startCapture(CAPTURE_MODE_INTERCOM, 0.0, false, false, nullptr, frame, 0, samples_frame, 
+               FILTER_CUTOFF_FREQ, false, false, false, false);
+      for(n = 0; ok && n < LATENCY_SETTLE_FRAMES; n++)
+         ok = latencyNextFrame() != 0;
+
+      while(ok && run < trials) {
+         // Trigger right after a frame is delivered
+         if((first = latencyNextFrame()) == 0) {
+            ok = false;
+            break;
+         }
+         if(!sfxQueue(lat.chirp(), lat.chirpLength(), 0)) {
+            vTaskDelay(pdMS_TO_TICKS(LATENCY_GAP_MS));   // effects playing, try again
+            continue;
+         }
+         xSemaphoreGive(semPlayData);
+         run++;
+
+         // Collect the following frames, a missed frame voids the trial
+         for(n = 0; n < win_frames; n++) {
+            if((got = latencyNextFrame()) == 0) {
+               ok = false;
+               break;
+            }
+            if(got != first + n + 1)
+               break;
+            memcpy(window + n * samples_frame, frame, samples_frame * sizeof(int16_t));
+         }
+         if(n == win_frames && lat.locate(window, win_len, &lag))
+            lags[valid++] = lag;
+
+         // Let the echo die away
+         for(n = 0; ok && n < gap_frames; n++)
+            ok = latencyNextFrame() != 0;
+      }
+      stopCapture();                      // 'frame' is written until the capture ends
+      waitCaptureEvents(CAPTURE_STATE_COMPLETE, pdMS_TO_TICKS(1000));
+   }
+   // The chirp plays from 'lat' - let the effect fifo drain before it goes
+   for(n = 0; run > 0 && n < 50 && !mix_fifo[MIX_SRC_SFX].isEmpty(); n++)
+      vTaskDelay(pdMS_TO_TICKS(20));
+   if(frame)
+      heap_caps_free(frame);
+   if(window)
+      heap_caps_free(window);
+   lat.end();
+
+   ESP32S3_LATENCY::summarize(lags, valid, run, result);
+   return valid > 0;
+}
+
+
+/********************************************************************
+ * @brief WAV file source of benchCaptureGraph(). Decoded blocks are 
+ * collected until they fill a frame, the rest carries over.
+ */
+typedef struct {
+   File file;
+   ESP32S3_WAV wav;
+   uint8_t *in;                           // raw file block
+   int16_t *pcm;                          // decoded samples, frame + one block
+   uint32_t fill;                         // samples in 'pcm'
+   uint32_t pos;                          // file offset of the next read
+   uint32_t end;                          // end of the audio data
+} wav_source_t ;
+
+static bool wavSource(dsp_frame_t &f, void *ctx)
+{
+   wav_source_t *src = (wav_source_t *)ctx;
+   int32_t got;
+
+   while(src->fill < f.len) {
+      if(src->pos >= src->end)
+         return false;                    // a partial last frame is dropped
+      got = wavFileRead(&src->file, src->in, (src->end - src->pos < src->wav.readSize()) ? 
+               src->end - src->pos : src->wav.readSize(), src->pos);
+      if(got <= 0)
+         return false;
+      src->pos += got;
+      src->fill += src->wav.decode(src->in, got, src->pcm + src->fill);
+   }
+   memcpy(f.i16, src->pcm, f.len * sizeof(int16_t));
+   src->fill -= f.len;
+   memmove(src->pcm, src->pcm + f.len, src->fill * sizeof(int16_t));
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Run the capture graph of a command on a WAV file instead of the 
+ * mic and time each node. Nothing is written. The echo canceller (no 
+ * speaker reference) and keyword spotter are left out. Runs in the 
+ * calling task, not while capturing.
+ * @param cmd - mode, samples_per_frame & the DSP options are used.
+ * @param stats - DSP_GRAPH_MAX_NODES entries, filled in graph order.
+ * @param num_nodes - entries filled.
+ * @return frames run, 0 on error.
+ */
+uint32_t AUDIO::benchCaptureGraph(const char *filename, const capture_cmd_t &cmd, 
+         dsp_node_stats_t *stats, uint8_t *num_nodes)
+{
+   capture_cmd_t bench_cmd = cmd;
+   capture_graph_t cg;
+   wav_source_t src = {};
+   dsp_frame_t frame;
+   uint32_t frames = 0;
+   uint8_t dropped;
+
+   *num_nodes = 0;
+   if(isCapturing() || cmd.samples_per_frame == 0 || sd.fsize(filename) <= 0)
+      return 0;
+   src.file = sd.fopen(filename, FILE_READ, false);
+   if(!src.file)
+      return 0;
+   if(src.wav.open(wavFileRead, &src.file, AUDIO_SAMPLE_RATE, WAV_READ_BYTES, WAV_PCM_SAMPLES, 
+            src.file.size())) {
+      src.pos = src.wav.info().data_offset;
+      src.end = src.pos + src.wav.info().data_bytes;
+      src.in = (uint8_t *)heap_caps_malloc(WAV_READ_BYTES, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      src.pcm = (int16_t *)heap_caps_malloc((cmd.samples_per_frame + WAV_PCM_SAMPLES) * sizeof(int16_t), 
+               MALLOC_CAP_SPIRAM);
+   }
+   bench_cmd.use_echo_cancel = false;
+   bench_cmd.use_kws = false;
+   if(src.in && src.pcm && 
+            buildCaptureGraph(cg, bench_cmd, wavSource, &src, DSP_PORT_I16, 1.0f, &dropped)) {
+      while(cg.graph.run(frame))
+         frames++;
+      *num_nodes = cg.graph.stats(stats, DSP_GRAPH_MAX_NODES);
+   }
+   cg.graph.end();
+   sd.fclose(src.file);
+   if(src.in)
+      heap_caps_free(src.in);
+   if(src.pcm)
+      heap_caps_free(src.pcm);
+   return frames;
+}
+
+
+/********************************************************************
+ * @brief Play Audio Task. This is the background task responsible for 
+ * playing audio to the I2S sink (speaker) device. Audio arrives in the
+ * 'mix_fifo' rings, one per source (tone, WAV, stream). Producers fill 
+ * fifo slots in place using mixAcquire() / mixCommit(). 
+ * ESP32S3_MIXER sums the sources into DMA sized blocks with per source 
+ * level, priority & ducking, and bends sums above PLAY_LIMITER_KNEE
+ * through a soft knee rather than clipping them. Master volume is then
+ * ramped (ESP32S3_GAIN).
+ * The task sleeps until a command, a committed chunk, or a speaker DMA
+ * TX_DONE event arrives, then tops DMA up to PLAY_DMA_TARGET_FILL 
+ * buffers (PLAY_DMA_LL_FILL in low latency). If all sources run dry mid 
+ * stream, silence is written to hold the fill level. Underruns and the fill histogram go to 'play_stats'.
+ * 
+ * Control is sent with a 'audio_play_t' struct through the queue:
+ * cmd - 8 bit command defines the action of the struct. 
+ *    PLAY_AUDIO - Copy 'pChunk' into the stream fifo (callers without a 
+ *       slot). The player is then the fifo producer, so don't mix with 
+ *       playAcquire() producers.
+ *    PLAY_SET_VOLUME - Change the master volume.
+ *    PLAY_SET_MIX - Change the mixing rules of 'source' to 'mix'.
+ *    PLAY_CLEAR - Drop all queued chunks.
+ *    PLAY_FLUSH - Drop the queued chunks of 'source' (WAV seek).
+ *    PLAY_SET_LATENCY - Keep 'dma_fill' speaker DMA buffers queued.
+ *    PLAY_CLOSE - Kill this task.
+ * pChunk - Pointer to data to be played.
+ * bytes_to_write - Number of actual bytes (<= PLAY_FIFO_CHUNK_BYTES).
+ * volume - Audio volume (0-100%) is appplied to the data.
+ */
+void taskPlayAudio(void * params)
+{
+   audio_play_t play_params;
+   play_stats_t stats;
+   size_t n, bytes_written;
+   esp_err_t err;
+   static int16_t mix_block[PLAY_DMA_BUF_LEN];
+   uint32_t mix_off = PLAY_DMA_BUF_BYTES; // bytes of 'mix_block' already written (none pending)
+   int32_t dma_queued = 0;                // bytes handed to DMA & not yet sent
+   uint16_t pad_bufs = PLAY_UNDERRUN_PAD_BUFS;  // silence bufs since last audio (idle at start)
+   uint16_t fill;
+   uint8_t target_fill = PLAY_DMA_TARGET_FILL;   // DMA buffers kept queued (PLAY_SET_LATENCY)
+   uint32_t trig_us = 0, lat_us;          // playSfx() time of an effect starting in 'mix_block', 0 = none
+   uint32_t wav_blk = 0, s0, s1;          // leading WAV samples in 'mix_block'
+   bool close_task = false;
+   ESP32S3_GAIN play_gain;                // ramped master volume
+   play_gain.init(AUDIO_SAMPLE_RATE, PLAY_VOLUME_RAMP_MS);
+   play_gain.jumpGain((33 * GAIN_UNITY_Q15) / 100);  // default volume level
+
+   ESP32S3_MIXER mixer;
+   const mix_source_cfg_t mix_cfg[MIX_NUM_SOURCES] = { MIX_CONFIG_TONE, MIX_CONFIG_WAV, 
+            MIX_CONFIG_STREAM, MIX_CONFIG_CLIP, MIX_CONFIG_SFX };
+   if(!mixer.init(mix_fifo, MIX_NUM_SOURCES, PLAY_DMA_BUF_LEN, AUDIO_SAMPLE_RATE, mixSlotFreed)) {
+      Serial.println("Error: mixer init failed");
+      vTaskDelete(NULL);
+   }
+   mixer.setLimiter(true, PLAY_LIMITER_KNEE);   // limit the sum itself, before int16
+   mixer.useRegions(MIX_SRC_CLIP);        // clips are read straight from mapped flash
+   mixer.useRegions(MIX_SRC_SFX);         // effects are read straight from PSRAM
+   for(uint8_t i = 0; i < MIX_NUM_SOURCES; i++)
+      mixer.setSource(i, mix_cfg[i]);
+
+   memset(&stats, 0, sizeof(play_stats_t));
+
+   /**
+    * @brief Infinite loop to write audio to the I2S sink device (MAX89357)
+    */
+   while(true) {
+      // Sleep until a command, a committed chunk, or a DMA buffer completes
+      xQueueSelectFromSet(setPlayEvents, pdMS_TO_TICKS(40));
+      xSemaphoreTake(semPlayData, 0);
+
+      // Check if incomming data/cmd
+      while(xQueueReceive(qAudioPlay, &play_params, 0) == pdTRUE) {  
+         if(play_params.cmd == PLAY_SET_VOLUME) {
+            play_gain.setVolume(play_params.volume);   // ramps - no zipper noise
+         } 
+         else if(play_params.cmd == PLAY_SET_MIX) {
+            mixer.setSource(play_params.source, play_params.mix);
+         }
+         else if(play_params.cmd == PLAY_CLOSE) {  // if closing, exit the forever loop 
+            close_task = true;
+         }
+         else if(play_params.cmd == PLAY_CLEAR) {  // stop playing & clear fifos
+            // Dropped WAV samples count as played (see getWavPosition())
+            s0 = mix_off / sizeof(int16_t);
+            wav_played += mixer.clear(MIX_SRC_WAV) + ((wav_blk > s0) ? wav_blk - s0 : 0);
+            wav_blk = 0;
+            mixer.clear();
+            mix_off = PLAY_DMA_BUF_BYTES;
+            pad_bufs = PLAY_UNDERRUN_PAD_BUFS;
+            trig_us = 0;
+            audio.clearReadBuffer();
+         }
+         else if(play_params.cmd == PLAY_FLUSH) {  // drop one source, the mixed block still plays
+            if(play_params.source == MIX_SRC_WAV) {
+               s0 = mix_off / sizeof(int16_t);
+               wav_played += mixer.clear(MIX_SRC_WAV) + ((wav_blk > s0) ? wav_blk - s0 : 0);
+               if(wav_blk > s0) wav_blk = s0;
+            }
+            else
+               mixer.clear(play_params.source);
+            xEventGroupSetBits(egAudioEngine, ENGINE_FLUSH_DONE);
+         }
+         else if(play_params.cmd == PLAY_SET_LATENCY) {
+            target_fill = constrain(play_params.dma_fill, 2, PLAY_DMA_BUF_COUNT);   // 1 would gap
+         }
+         // If fifo has space, copy callers chunk into fifo. Otherwise this chunk is dropped.
+         else if(play_params.cmd == PLAY_AUDIO && play_params.pChunk) {
+            mix_fifo[MIX_SRC_STREAM].push(play_params.pChunk, play_params.bytes_to_write);
+         }
+      } 
+      if(close_task)
+         break;
+
+      // Account for DMA buffers the speaker has finished with
+      while(xSemaphoreTake(semSpeakerSent, 0) == pdTRUE) {
+         dma_queued -= PLAY_DMA_BUF_BYTES;
+         if(dma_queued < 0) dma_queued = 0;
+      }
+      fill = dma_queued / PLAY_DMA_BUF_BYTES;
+      stats.fill_hist[(fill > PLAY_DMA_BUF_COUNT) ? PLAY_DMA_BUF_COUNT : fill]++;
+
+      /**
+       * @brief Top up DMA to the target fill level, one mixed block at a
+       * time. Never blocks.
+       */
+      while(dma_queued < target_fill * PLAY_DMA_BUF_BYTES) {
+         if(mix_off >= PLAY_DMA_BUF_BYTES) {
+            uint32_t filled = mixer.mix(mix_block, PLAY_DMA_BUF_LEN);
+            wav_blk = mixer.pulled(MIX_SRC_WAV);
+            trig_us = mixer.started(MIX_SRC_SFX);   // trigger time of an effect starting here
+            if(filled > 0) {
+               if(pad_bufs > 0 && pad_bufs < PLAY_UNDERRUN_PAD_BUFS)
+                  stats.underruns++;      // stream resumed after a gap
+               pad_bufs = 0;
+               stats.blocks++;
+            }
+            // Underrun mid stream: keep DMA at the target fill with silence 
+            else if(pad_bufs < PLAY_UNDERRUN_PAD_BUFS) {
+               pad_bufs++;
+               stats.silence_bufs++;
+            }
+            else                          // idle: DMA auto clear plays zeros
+               break;
+            play_gain.apply(mix_block, PLAY_DMA_BUF_LEN);   // master volume
+            mix_off = 0;
+         }
+
+         n = PLAY_DMA_BUF_BYTES - mix_off;
+         err = i2s_channel_write(spkr_chan, (uint8_t *)mix_block + mix_off, n, &bytes_written, 0);
+         if(err != ESP_OK && err != ESP_ERR_TIMEOUT) {   // timeout = DMA full
+            Serial.printf("Error: i2s_channel_write err=%d\n", err);
+         }   
+         if(trig_us && mix_off == 0 && bytes_written > 0) {   // effect's first sample is in DMA
+            lat_us = uint32_t(esp_timer_get_time()) - trig_us;
+            stats.sfx_triggers++;
+            stats.sfx_latency_us = lat_us;
+            if(lat_us > stats.sfx_latency_max_us) 
+               stats.sfx_latency_max_us = lat_us;
+            stats.sfx_dma_ahead_us = (dma_queued / sizeof(int16_t)) * 1000 / (AUDIO_SAMPLE_RATE / 1000);
+            trig_us = 0;
+         }
+         s0 = mix_off / sizeof(int16_t);     // count the WAV samples just handed over
+         s1 = (mix_off + bytes_written) / sizeof(int16_t);
+         if(wav_blk > s0)
+            wav_played += ((wav_blk < s1) ? wav_blk : s1) - s0;
+         mix_off += bytes_written;
+         dma_queued += bytes_written;
+         if(bytes_written < n)            // DMA full
+            break;
+      }
+      play_stats.write(stats);
+   }
+
+   /**
+    * @brief Close (destroy) task. The fifos belong to AUDIO and are kept.
+    */
+   mixer.clear();
+   mixer.end();
+   vTaskDelete(NULL);                     // kill this task
+}
+
+
+/********************************************************************
+ * @brief Borrow the next free slot of a mixer source fifo. The caller
+ * fills up to PLAY_FIFO_CHUNK_BYTES of 16 bit mono samples in place and
+ * then calls mixCommit(). Only one producer per source may hold a slot.
+ * @param source - MIX_SRC_xxx.
+ * @param ticks - max time to wait for a free slot, 0 = don't wait.
+ * @return ptr to the slot payload, nullptr if none freed in time.
+ */
+int16_t *AUDIO::mixAcquire(uint8_t source, TickType_t ticks)
+{
+   if(source >= MIX_NUM_SOURCES || source == MIX_SRC_CLIP || source == MIX_SRC_SFX)   // regions
+      return nullptr;
+   TickType_t start = xTaskGetTickCount();
+   void *slot = nullptr;
+   while((source == MIX_SRC_STREAM && mix_fifo[source].count() >= play_stream_depth.load()) || 
+            (slot = mix_fifo[source].acquire()) == nullptr) {
+      TickType_t waited = xTaskGetTickCount() - start;
+      if(waited >= ticks) 
+         return nullptr;
+      xSemaphoreTake(semMixSpace[source], ticks - waited);   // given when the mixer frees a slot
+   }
+   return (int16_t *)slot;
+}
+
+
+/********************************************************************
+ * @brief Queue the slot returned by mixAcquire() for mixing.
+ * @param len_bytes - valid bytes written into the slot.
+ */
+bool AUDIO::mixCommit(uint8_t source, uint16_t len_bytes)
+{
+   if(source >= MIX_NUM_SOURCES || !mix_fifo[source].commit(len_bytes))
+      return false;
+   xSemaphoreGive(semPlayData);           // wake the player
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Change the level, priority & ducking of a mixer source.
+ * @param source - MIX_SRC_xxx.
+ * @param cfg - gain_db (<= 0), priority (higher ducks lower), duck_db.
+ */
+void AUDIO::setMixConfig(uint8_t source, const mix_source_cfg_t &cfg)
+{
+   audio_play_t audio_params = {};
+
+   audio_params.cmd = PLAY_SET_MIX;
+   audio_params.source = source;
+   audio_params.mix = cfg;
+   xQueueSend(qAudioPlay, &audio_params, portMAX_DELAY);
+}
+
+
+/********************************************************************
+ * @brief Copy the playback health counters (cumulative since boot).
+ */
+void AUDIO::getPlayStats(play_stats_t *stats)
+{
+   play_stats.read(stats);
+}
+
+
+/********************************************************************
+ * @brief Shorten the playback queue for low latency intercom: stream 
+ * producers may queue PLAY_FIFO_LL_DEPTH chunks and the player keeps 
+ * PLAY_DMA_LL_FILL speaker DMA buffers queued. Less jitter is absorbed, 
+ * so expect more underruns on a busy system (see getPlayStats()).
+ */
+void AUDIO::setPlayLowLatency(bool enable)
+{
+   audio_play_t audio_params = {};
+
+   play_stream_depth.store((enable) ? PLAY_FIFO_LL_DEPTH : PLAY_FIFO_DEPTH);
+   audio_params.cmd = PLAY_SET_LATENCY;
+   audio_params.dma_fill = (enable) ? PLAY_DMA_LL_FILL : PLAY_DMA_TARGET_FILL;
+   xQueueSend(qAudioPlay, &audio_params, portMAX_DELAY);
+}
+
+
+/********************************************************************
+ * @brief Copy the mic & speaker DMA clock state. The mic clock restarts
+ * with each capture, rates are nominal for the first second.
+ */
+void AUDIO::getDuplexStats(duplex_stats_t *stats)
+{
+   stats->mic_rate = mic_clock.rate();
+   stats->spkr_rate = spkr_clock.rate();
+   stats->drift_ppm = float((stats->mic_rate / stats->spkr_rate - 1.0) * 1e6);
+   mic_clock.last(&stats->mic_last);
+   spkr_clock.last(&stats->spkr_last);
+   stats->ref_resyncs = duplex.resyncs;
+   stats->ref_misses = aec_ref.misses();
 }
 
 
@@ -1450,9 +3317,5 @@ void AUDIO::setAudioVolume(uint8_t vol)
    
    audio_params.cmd = PLAY_SET_VOLUME;
    audio_params.volume = vol; //sys_utils.getVolume();
-   // Wait for space available in the queue   
-   while (uxQueueMessagesWaiting(qAudioPlay) > 2) { 
-      vTaskDelay(pdMS_TO_TICKS(1));   
-   }    
-   xQueueSend(qAudioPlay, &audio_params, 200); // play this chunk
+   xQueueSend(qAudioPlay, &audio_params, portMAX_DELAY);   // sleeps while the queue is full
 }
\ No newline at end of file
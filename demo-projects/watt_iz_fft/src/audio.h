@@ -7,17 +7,35 @@
 #pragma once
 
 #include <Arduino.h>
-#include "driver/i2s.h"
+#include "driver/i2s_std.h"
+#include "esp_idf_version.h"
 #include "config.h"
 #include "esp_dsp.h"
 #include "dsps_fir.h"
 #include "dsps_biquad.h"
 #include "sd_lvgl_fs.h"
 #include "esp32s3_fft.h"
+#include "esp32s3_ns.h"
+#include "esp32s3_aec.h"
+#include "esp32s3_agc.h"
+#include "esp32s3_kws.h"
+#include "esp32s3_gain.h"
+#include "esp32s3_synth.h"
+#include "esp32s3_mixer.h"
+#include "esp32s3_wav.h"
+#include "esp32s3_playlist.h"
+#include "esp32s3_clips.h"
+#include "esp32s3_latency.h"
+#include "esp32s3_dma_clock.h"
+#include "esp32s3_dsp_graph.h"
 #include "utils.h"
 #include <stdint.h>
 #include <string.h>
 #include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "freertos/event_groups.h"
+#include "seqlock.h"
+#include "chunk_fifo.h"
 
 // misc defines
 #define I2S_MICROPHONE                    I2S_NUM_0
@@ -30,6 +48,97 @@
 
 #define I2S_DMA_BUFR_LEN                  1024
 
+// Mic & speaker take their bit clocks from one source with the same MCLK 
+// multiple, so both run at the same rate. Any residual drift is measured
+// by the DMA clocks and compensated in the echo reference.
+#define I2S_SHARED_CLK_SRC                I2S_CLK_SRC_PLL_160M
+#define I2S_SHARED_MCLK_MULTIPLE          I2S_MCLK_MULTIPLE_256
+#define DUPLEX_RESYNC_SAMPLES             2.0      // echo reference re-aligned if it strays this far
+
+// Mic DMA. Buffers are sized so whole buffers make up a capture frame, the 
+// depth (in capture frames) is set per capture mode.
+#define MIC_DMA_MAX_SAMPLES               2046     // 16 bit mono samples in one DMA buffer (4092 bytes max)
+#define MIC_DMA_MAX_DESC                  16       // DMA buffers per channel
+#define MIC_DMA_FRAMES_RECORD             3        // capture frames buffered in DMA
+#define MIC_DMA_FRAMES_INTERCOM           2
+#define MIC_DMA_FRAMES_LOW_LATENCY        4        // 10ms frames: one DMA buffer each
+#define MIC_DMA_TIMEOUT_MS                500      // no mic buffer this long = DMA stalled
+
+// Capture pipeline: an I/O stage (core 0) reads mic frames into a frame ring, 
+// the analysis stage (capture task, core 1) runs the DSP graph & delivery.
+#define CAPTURE_PIPE_DEPTH                4        // frames the analysis stage may lag behind (power of 2)
+
+// Low latency intercom profile (startCapture 'low_latency'): 10ms frames (16ms with 
+// echo cancel or NS), the newest frame is delivered at once, and a short playback 
+// queue while it runs.
+#define INTERCOM_LL_SAMPLES_PER_FRAME     160      // 10ms @ 16KHz
+#define INTERCOM_LL_DSP_SAMPLES_PER_FRAME 256      // 16ms, with echo cancel or noise suppression (256 blocks)
+#define INTERCOM_LL_BUDGET_US             40000    // first sample to frame available
+#define PLAY_FIFO_LL_DEPTH                2        // stream chunks queued ahead
+#define PLAY_DMA_LL_FILL                  2        // speaker DMA buffers queued
+
+// Playback fifo geometry (one fifo per mixer source). Producers fill 
+// slots in place (see AUDIO::mixAcquire).
+#define PLAY_FIFO_CHUNK_BYTES             (DEFAULT_SAMPLES_PER_FRAME * sizeof(int16_t))
+#define PLAY_FIFO_DEPTH                   4        // chunks per source (power of 2)
+
+// Mixer sources
+enum {
+   MIX_SRC_TONE=0,                           // tone voice of the audio engine
+   MIX_SRC_WAV,                              // WAV voice of the audio engine
+   MIX_SRC_STREAM,                           // raw audio from a caller (streamBegin)
+   MIX_SRC_CLIP,                             // clips played from mapped flash (playClip)
+   MIX_SRC_SFX,                              // sound effects preloaded in PSRAM (playSfx)
+   MIX_NUM_SOURCES,
+};
+
+// Default mixing rules { gain_db, priority, duck_db }: tones duck WAV & stream
+#define MIX_CONFIG_TONE       { 0.0f, 2, 0.0f }
+#define MIX_CONFIG_WAV        { 0.0f, 1, 12.0f }
+#define MIX_CONFIG_STREAM     { 0.0f, 1, 12.0f }
+#define MIX_CONFIG_CLIP       { 0.0f, 2, 0.0f }
+#define MIX_CONFIG_SFX        { 0.0f, 1, 0.0f }    // UI sounds don't duck & aren't ducked by WAV
+
+#define CLIP_FIFO_DEPTH                   4        // clips queued ahead (regions, not audio, power of 2)
+
+// Sound effect bank: short WAV files decoded into PSRAM by loadSfx()
+#define SFX_MAX_CLIPS                     16
+#define SFX_MAX_MS                        3000     // longest effect
+#define SFX_FIFO_DEPTH                    4        // effects queued ahead (regions, not audio, power of 2)
+
+// Effects preloaded at boot (main.cpp), ids are the SFX_xxx order
+enum {
+   SFX_CLICK=0,
+   SFX_CONFIRM,
+   SFX_ERROR,
+   SFX_NUM_BOOT,
+};
+#define SFX_BOOT_FILES        { "/sfx/click.wav", "/sfx/confirm.wav", "/sfx/error.wav" }
+
+// Loopback latency measurement (measureLatency): the chirp is played on the
+// SFX source while the mic is captured in intercom mode
+#define LATENCY_TRIALS                    8
+#define LATENCY_MAX_TRIALS                32
+#define LATENCY_MAX_MS                    400      // longest latency searched
+#define LATENCY_GAP_MS                    300      // echo decay between trials
+#define LATENCY_SETTLE_FRAMES             4        // frames skipped after capture starts
+#define LATENCY_CHIRP_LEVEL               0.5      // fraction of full scale
+
+// Speaker DMA. The player keeps PLAY_DMA_TARGET_FILL buffers queued.
+#define PLAY_DMA_BUF_COUNT                4
+#define PLAY_DMA_BUF_LEN                  512      // samples (32ms @ 16KHz)
+#define PLAY_DMA_BUF_BYTES                (PLAY_DMA_BUF_LEN * sizeof(int16_t))
+#define PLAY_DMA_TARGET_FILL              3
+#define PLAY_UNDERRUN_PAD_BUFS            4        // silence bufs written before a stream counts as ended
+#define PLAY_VOLUME_RAMP_MS               20       // volume change time
+
+// WAV read-ahead. Reads are aligned to WAV_PREFETCH_BYTES file offsets so 
+// each one stays inside an SD cluster run.
+#define WAV_PREFETCH_BYTES                16384    // bytes per SD read
+#define WAV_PREFETCH_DEPTH                8        // reads buffered ahead per track (power of 2, PSRAM)
+#define WAV_PLAYLIST_MAX                  8        // files queued ahead of the playing one
+#define PLAY_LIMITER_KNEE                 0.9      // soft limiter knee (fraction of full scale)
+
 // FFT 
 #define FFT_SIZE                          1024  //512
 
@@ -55,12 +164,22 @@ enum {
    CAPTURE_STATE_COMPLETE=0x0010,            // capture has ended
    CAPTURE_STATE_IN_SPEECH=0x0020,           // in speech detected
    CAPTURE_STATE_IN_QUIET=0x0040,            // in quiet 
+   CAPTURE_STATE_KEYWORD=0x0080,             // keyword spotter matched a command word
 };
 
-// Playtone commands
+// Capture state flags are also the bits of the capture event group
+#define CAPTURE_LEVEL_BITS    (CAPTURE_STATE_RECORDING | CAPTURE_STATE_PAUSED | CAPTURE_STATE_IN_SPEECH | \
+                               CAPTURE_STATE_IN_QUIET | CAPTURE_STATE_COMPLETE)   // held while true
+#define CAPTURE_EVENT_BITS    (CAPTURE_STATE_FRAME_AVAIL | CAPTURE_STATE_KEYWORD) // pulsed per event
+
+// Capture DSP features (bit mask), see capture_status_t 'dsp_dropped'
 enum {
-   TONE_CMD_NONE=0,
-   TONE_CMD_CLOSE,
+   CAPTURE_DSP_AEC=0x01,                     // echo canceller: intercom, frame multiple of AEC_BLOCK_SIZE
+   CAPTURE_DSP_LOWPASS=0x02,
+   CAPTURE_DSP_NS=0x04,                      // noise suppressor: frame multiple of NS_HOP_SIZE
+   CAPTURE_DSP_VAD=0x08,
+   CAPTURE_DSP_AGC=0x10,
+   CAPTURE_DSP_KWS=0x20,                     // keyword spotter: needs the VAD & a template library
 };
 
 // Playtone ring modes
@@ -70,8 +189,7 @@ enum {
    RING_MODE_ALARM,
 };
 
-#define RING_MODE_CALLING_INTERVAL     14 // make calling sound like old school ring
-#define RING_MODE_ALARM_INTERVAL       5  // make alarm sound 
+#define TONE_MAX_DTMF                  16 // max digits per playDtmf() call
 
 // Wav player commands
 enum {
@@ -89,13 +207,17 @@ enum {
    PLAY_SET_VOLUME,
    PLAY_CLEAR,
    PLAY_CLOSE,
+   PLAY_SET_MIX,                             // mixing rules for 'source'
+   PLAY_FLUSH,                               // drop the queued audio of 'source'
+   PLAY_SET_LATENCY,                         // speaker DMA fill target 'dma_fill'
 };
 
 // non-class function prototypes
 void taskCaptureAudio( void * params );
+void taskCaptureIO(void *params);
 void taskPlayAudio(void * params);
-void taskPlayTone(void * params);
-void taskPlayWAV(void *params);
+void taskAudioEngine(void *params);
+void taskWavPrefetch(void *params);
 // bool playRawAudio(uint8_t *audio_in, uint32_t len, uint16_t volume); 
 
 // Template for the playwav callback that takes an int and returns nothing
@@ -107,6 +229,16 @@ using PlayWav_cb = void (*)(int16_t progress);
 #define DISAB_VAD                         false
 #define ENAB_LP_FILTER                    true
 #define DISAB_LP_FILTER                   false
+#define ENAB_NOISE_SUPPRESS               true
+#define DISAB_NOISE_SUPPRESS              false
+#define ENAB_ECHO_CANCEL                  true
+#define DISAB_ECHO_CANCEL                 false
+#define ENAB_AGC                          true
+#define DISAB_AGC                         false
+#define ENAB_KWS                          true
+#define DISAB_KWS                         false
+#define ENAB_LOW_LATENCY                  true
+#define DISAB_LOW_LATENCY                 false
 
 // Structure passed to 'taskCaptureAudio' to perform audio capture
 typedef struct {
@@ -120,6 +252,11 @@ typedef struct {
    float qfactor = DEFAULT_LP_FILTER_Q;   // default q factor. 0.5 gives 
    float filter_cutoff_freq = FILTER_CUTOFF_FREQ;  // cutoff freq (3db point) of LP filter in HZ
    bool enab_vad = true;                  // if true, capture begins when voice is detected
+   bool use_noise_suppress = false;       // true enables STFT noise suppression after the LP filter
+   bool use_echo_cancel = false;          // true enables speaker echo cancel (CAPTURE_MODE_INTERCOM only)
+   bool use_agc = true;                   // true: automatic gain control, false: fixed mic gain
+   bool use_kws = false;                  // true: match VAD speech segments against keyword templates
+   bool low_latency = false;              // intercom: INTERCOM_LL_xxx profile
 } capture_cmd_t ;
 
 typedef struct {
@@ -130,30 +267,100 @@ typedef struct {
    float time_per_frame;                  // time in secs of one frame (typ 0.096)
    float elapsed_secs;                    // num seconds since start of capture
    float max_secs;                        // maximum seconds in a finite capture
+   int16_t keyword_index;                 // last matched keyword template, -1 if none
+   char keyword[KWS_WORD_LEN];            // last matched keyword
+   float keyword_distance;                // DTW distance of last match
+   uint32_t keyword_match_us;             // time from end of speech to match result
+   uint32_t dma_overruns;                 // mic DMA buffers overwritten before they were read
+   int64_t frame_time_us;                 // esp_timer time of the first sample of the last frame
+   uint32_t pipe_drops;                   // frames dropped, analysis > CAPTURE_PIPE_DEPTH frames behind
+   uint8_t pipe_max_lag;                  // most frames waiting for the analysis stage
+   uint8_t dsp_dropped;                   // CAPTURE_DSP_xxx asked for but left out of the graph
 } capture_status_t ;
 
+// Latency of the last delivered capture frame, see AUDIO::getCaptureLatency()
 typedef struct {
-   uint8_t cmd;
-   const char *filename;
-   uint16_t volume;
-   PlayWav_cb cb;
-} play_wav_t ;
+   uint32_t frame_us;                     // frame length, first sample to last
+   uint32_t dma_us;                       // last sample to frame read (DMA buffer, ISR, I/O stage wake)
+   uint32_t pipe_us;                      // waiting in the frame ring for the analysis stage
+   uint32_t dsp_us;                       // DSP graph after the source
+   uint32_t queue_us;                     // held in the capture ring
+   uint32_t deliver_us;                   // SD / memory write & status publish
+   uint32_t total_us;                     // first sample to CAPTURE_STATE_FRAME_AVAIL
+   uint32_t avg_total_us;                 // since capture start
+   uint32_t max_total_us;
+   uint32_t budget_us;                    // INTERCOM_LL_BUDGET_US (low latency), 0 = none
+   uint32_t over_budget;                  // frames with total_us > budget_us
+   uint32_t frames;
+} capture_latency_t ;
 
 typedef struct {
-   uint8_t status;
-   uint8_t progress;
-} play_wav_status_t ;
-
-typedef struct {
-   float tone_freq;
+   float tone_freq[SYNTH_MAX_VOICES];     // voices in Hz, 0 = unused
+   float sweep_to_freq;                   // > 0: tone_freq[0] glides to this freq
+   float sweep_secs;                      // glide time
+   bool sweep_repeat;                     // restart the glide when done (siren)
+   char dtmf[TONE_MAX_DTMF + 1];          // DTMF digits to dial, "" = none
+   uint16_t dtmf_on_ms;                   // tone time per digit
+   uint16_t dtmf_off_ms;                  // gap after each digit
    uint8_t ring_mode;
    float volume;
-   float duration_sec;
+   float duration_sec;                    // 0 = until stopTone()
 } play_tone_params_t ;
 
+// Audio engine commands
+enum {
+   ENGINE_NONE=0,
+   ENGINE_TONE_START,                     // start the tone voice with 'tone'
+   ENGINE_TONE_STOP,
+   ENGINE_WAV_START,                      // start the WAV voice with 'path'
+   ENGINE_WAV_CTRL,                       // PLAY_WAV_xxx in 'wav_cmd'
+   ENGINE_WAV_QUEUE,                      // append 'path' to the playlist
+   ENGINE_WAV_SEEK,                       // jump to 'seek_ms' in the playing track
+};
+
+// Audio engine event bits
+#define ENGINE_TONE_BUSY      0x0001      // held while the tone voice plays
+#define ENGINE_WAV_BUSY       0x0002      // held while the WAV voice plays (or is paused)
+#define ENGINE_STREAM_BUSY    0x0004      // held while a caller owns the stream source
+#define ENGINE_TONE_DONE      0x0010      // set when the tone voice finishes
+#define ENGINE_WAV_DONE       0x0020      // set when the WAV voice finishes
+#define ENGINE_FLUSH_DONE     0x0040      // set by the player when a PLAY_FLUSH is done
+#define ENGINE_DRAINED(src)   (0x0100 << (src))   // set by the player when source 'src' fifo empties
+#define ENGINE_PATH_LEN       64
+
+// Command sent to the audio engine task (copied by the queue)
 typedef struct {
    uint8_t cmd;
-} tone_cmd_queue_t;
+   uint8_t wav_cmd;                       // PLAY_WAV_xxx for ENGINE_WAV_CTRL
+   play_tone_params_t tone;               // ENGINE_TONE_START
+   char path[ENGINE_PATH_LEN];            // ENGINE_WAV_START / QUEUE
+   PlayWav_cb cb;                         // ENGINE_WAV_START progress callback
+   uint16_t xfade_ms;                     // ENGINE_WAV_START crossfade between tracks
+   uint32_t seek_ms;                      // ENGINE_WAV_SEEK position
+} engine_cmd_t ;
+
+// Playback health counters, see AUDIO::getPlayStats()
+typedef struct {
+   uint32_t blocks;                       // mixed blocks played
+   uint32_t underruns;                    // fifo ran dry mid stream (audible gap)
+   uint32_t silence_bufs;                 // DMA buffers of silence written on underrun
+   uint32_t fill_hist[PLAY_DMA_BUF_COUNT + 1];  // DMA fill level (buffers) at each player wakeup
+   uint32_t sfx_triggers;                 // effects measured
+   uint32_t sfx_latency_us;               // last playSfx() to its first sample handed to I2S
+   uint32_t sfx_latency_max_us;
+   uint32_t sfx_dma_ahead_us;             // audio already in DMA ahead of that sample
+} play_stats_t ;
+
+// Mic & speaker DMA clocks, see AUDIO::getDuplexStats()
+typedef struct {
+   double mic_rate;                       // measured samples / sec
+   double spkr_rate;
+   float drift_ppm;                       // mic vs speaker, + = mic faster
+   dma_stamp_t mic_last;                  // latest DMA block ends
+   dma_stamp_t spkr_last;
+   uint32_t ref_resyncs;                  // echo reference re-aligned (> DUPLEX_RESYNC_SAMPLES)
+   uint32_t ref_misses;                   // echo reference reads not (fully) held
+} duplex_stats_t ;
 
 // Audio Play structure passed in queue
 typedef struct {
@@ -161,8 +368,11 @@ typedef struct {
    uint16_t *pChunk;                      // pointer to audio data   
    uint32_t bytes_to_write;               // Actual bytes to write (may be different than fifo chunk_bytes)
    uint8_t volume;                        // volume 0 - 100%
-   uint32_t chunk_bytes;                  // number of bytes in a chunk (fifo element size)
-   uint32_t chunk_depth;                  // num chunks in the fifo (number of elements)
+   uint32_t chunk_bytes;                  // unused - fifo geometry is fixed (PLAY_FIFO_xxx)
+   uint32_t chunk_depth;                  // unused
+   uint8_t source;                        // PLAY_SET_MIX / PLAY_FLUSH: MIX_SRC_xxx
+   mix_source_cfg_t mix;                  // PLAY_SET_MIX: new rules
+   uint8_t dma_fill;                      // PLAY_SET_LATENCY: DMA buffers kept queued
 } audio_play_t ;
 
 /**
@@ -174,11 +384,18 @@ class AUDIO {
       ~AUDIO() = default;  
       // Initialization
       bool init(uint32_t sample_rate);
-      bool initMicrophone(uint32_t sample_rate);
+      bool initMicrophone(uint32_t sample_rate, uint16_t samples_frame=DEFAULT_SAMPLES_PER_FRAME, 
+               uint8_t dma_frames=MIC_DMA_FRAMES_RECORD);
       bool initSpeaker(uint32_t sample_rate);   
 
       // Tone functions
       void playTone(float tone_freq, uint8_t ring_mode, float volume, float duration_sec, bool blocking);
+      void playChord(const float *freqs, uint8_t num_freqs, uint8_t ring_mode, float volume, 
+               float duration_sec, bool blocking);
+      void playSweep(float f_start, float f_end, float sweep_secs, bool repeat, float volume, 
+               float duration_sec, bool blocking);
+      void playDtmf(const char *digits, float volume, uint16_t on_ms=100, uint16_t off_ms=100, 
+               bool blocking=true);
       void stopTone(void);  
 
       // WAV header
@@ -190,177 +407,91 @@ class AUDIO {
            
       // Play WAV file audio functions
       bool playWavFile(const char *filename, uint16_t volume=20, bool blocking=false, PlayWav_cb cb=nullptr);     
+      bool playWavList(const char * const *filenames, uint8_t num_files, uint16_t volume=20, 
+               uint16_t xfade_ms=0, bool blocking=false, PlayWav_cb cb=nullptr);
+      bool queueWavFile(const char *filename);   // append to the playing list (or start one)
       // bool playAudioMem(uint8_t *src_mem, uint32_t len, uint16_t volume);
       bool isWavPlaying(void);
       bool sendPlayWavCommand(uint8_t cmd);    
       int8_t getWavPlayProgress(void);
+      bool getWavInfo(const char *filename, wav_info_t *info);   // format & duration
+      uint32_t getWavBufferedMs(void);    // audio read ahead of the play position
+      bool seekWav(uint32_t ms);          // jump within the playing track
+      uint32_t getWavPosition(void);      // samples of the track handed to I2S
+      uint32_t getWavLength(void);        // samples in the track being heard
+
+      // Stream source: raw 16 bit mono audio from the calling task, mixed with tone & WAV
+      bool streamBegin(TickType_t ticks); // caller becomes the stream fifo producer
+      uint32_t streamWrite(const int16_t *samples, uint32_t len, TickType_t ticks);  // ret samples queued
+      void streamEnd(void);
+
+      // Clips from the flash clip bank (tools/pack_clips.py), mixed like a tone
+      bool playClip(const char *name, bool blocking=false);
+
+      // Sound effects preloaded into PSRAM - triggering one only queues a pointer
+      int8_t loadSfx(const char *filename);  // ret effect id, -1 on error
+      uint8_t loadSfxBank(const char * const *filenames, uint8_t num_files);   // ret number loaded
+      bool playSfx(uint8_t id);
+      void freeSfx(void);
+
+      // Speaker -> mic latency of the intercom path, in samples
+      bool measureLatency(latency_result_t *result, uint8_t trials=LATENCY_TRIALS, 
+               uint16_t samples_frame=DEFAULT_SAMPLES_PER_FRAME);
 
       // Audio play background task functions
       void setAudioVolume(uint8_t vol);
+      void setMixConfig(uint8_t source, const mix_source_cfg_t &cfg);  // level, priority & ducking
+      int16_t *mixAcquire(uint8_t source, TickType_t ticks);   // free slot of a source fifo, nullptr on timeout
+      bool mixCommit(uint8_t source, uint16_t len_bytes);      // queue the acquired slot for mixing
+      int16_t *playAcquire(TickType_t ticks) { return mixAcquire(MIX_SRC_STREAM, ticks); }
+      bool playCommit(uint16_t len_bytes) { return mixCommit(MIX_SRC_STREAM, len_bytes); }
+      void getPlayStats(play_stats_t *stats);   // underruns & DMA fill histogram
+      void setPlayLowLatency(bool enable); // short stream fifo & DMA queue (PLAY_xxx_LL_xxx)
+      void getDuplexStats(duplex_stats_t *stats);   // mic / speaker clock rates & drift
 
       // Audio Capture functions
-      void clearReadBuffer(void);         // clear I2S read buffer of any contents
+      void clearReadBuffer(void);         // drop mic DMA buffers not yet read
       void startCapture(uint16_t mode, float duration_secs=0.0, bool enab_vad=false, bool enab_lp_filter=false, 
                const char *filepath=nullptr, int16_t *output=nullptr, uint32_t num_frames=0, 
                uint16_t samples_frame=DEFAULT_SAMPLES_PER_FRAME, 
-               float lp_cutoff_freq=FILTER_CUTOFF_FREQ);
+               float lp_cutoff_freq=FILTER_CUTOFF_FREQ, bool enab_noise_suppress=false,
+               bool enab_echo_cancel=false, bool enab_agc=true, bool enab_kws=false, 
+               bool low_latency=false);
       bool isCapturing(void);             // return true if in capture mode         
       void stopCapture(void);           // as it says
       void pauseCapture(void);          // " "
       bool getCaptureStatus(capture_status_t *rec_stat, bool blocking); // copy status to caller struct, ret true if valid status
+      EventBits_t waitCaptureEvents(EventBits_t bits, TickType_t ticks);  // wait for CAPTURE_STATE_xxx bits
+      void getCaptureLatency(capture_latency_t *lat);   // per stage latency of the last frame
+      void setAgcConfig(uint16_t mode, const agc_config_t &config);  // AGC tuning per capture mode
+      const agc_config_t & getAgcConfig(uint16_t mode);
+      bool enrollKeyword(const char *word);  // next speech segment becomes a template for 'word'
+      uint32_t benchCaptureGraph(const char *filename, const capture_cmd_t &cmd, 
+               dsp_node_stats_t *stats, uint8_t *num_nodes);   // ret frames run
 
       // Default buffer memory for audio feedback from capture
       int16_t *default_frame_bufr = nullptr;
 
    private:
-
+      void startTone(const play_tone_params_t &params, bool blocking);
+      void waitPlayDone(EventBits_t done_bit, uint8_t source, TickType_t ticks);
+      bool waitMixDrained(uint8_t source, TickType_t ticks);
+      agc_config_t _agc_record = AGC_CONFIG_RECORD;
+      agc_config_t _agc_intercom = AGC_CONFIG_INTERCOM;
 };
 
 
-// Ring buffer header struct
-struct SlotHdr {
-   uint16_t len;   // valid payload bytes in this slot
-   uint16_t rsv;   // reserved/padding (keeps payload 32-bit aligned)
-};
-
-/**
- * @brief Ring buffer for audioplay task. 
- */
-class ChunkRingFifo {
-   public:
-      ChunkRingFifo() = default;
-      ~ChunkRingFifo() { destroy(); }
-
-      // Allocate storage and initialize FIFO
-      bool create(uint16_t nChunks,
-               uint16_t chunkBytes,
-               uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
-      {
-         destroy();  // free any existing storage
-
-         _n = nChunks;
-         _chunkBytes = chunkBytes;
-         _slotBytes = (uint16_t)(sizeof(SlotHdr) + _chunkBytes);
-
-         // uint32_t bytes = (uint32_t)_n * _slotBytes;
-         _buf = (uint8_t*)heap_caps_malloc(_n * _slotBytes, caps);
-         if (!_buf) {
-            destroy();
-            return false;
-         }
-         clear();
-         return true;
-      }
-
-      // Hard reconfigure: free old buffer, allocate new one
-      bool reconfigure(uint16_t nChunks,
-                     uint16_t chunkBytes,
-                     uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
-      {
-         return create(nChunks, chunkBytes, caps);
-      }
-
-      // Explicit destroy (optional; destructor also does this)
-      void destroy() {
-         if (_buf) {
-            heap_caps_free(_buf);
-            _buf = nullptr;
-         }
-         _n = 0;
-         _chunkBytes = 0;
-         _slotBytes = 0;
-         _w = _r = _count = 0;
-
-      }
-
-      // Clear fifo pointers and clear fifo buffer
-      void clear() {
-         _w = _r = 0;
-         _count = 0;
-         memset(_buf, 0, _n * _slotBytes);         
-      }
-
-      bool isEmpty() const { return _count == 0; }
-      bool isFull()  const { return _count == _n; }
-      uint16_t count() const { return _count; }
-      uint16_t capacity() const { return _n; }
-
-      // max payload bytes (not counting header)
-      uint16_t chunkBytes() const { return _chunkBytes; }
-
-      // total bytes per slot (header + payload)
-      uint16_t slotBytes() const { return _slotBytes; }
-
-      // Push variable-length payload (<= maxPayloadBytes)
-      bool push(const void* src, uint16_t lenBytes) {
-         if (!_buf || isFull()) return false;
-         if (lenBytes > _chunkBytes) return false;
-
-         SlotHdr* h = hdrPtr(_w);
-         h->len = lenBytes;
-         h->rsv = 0;
-
-         if (lenBytes) {
-            memcpy(payloadPtr(_w), src, lenBytes);
-         }
-
-         _w = (_w + 1) % _n;
-         _count++;
-         return true;
-      }
-
-      // Pop one fixed-size chunk (copies chunkBytes into dst)
-      bool pop(void* dst, uint16_t & outLenBytes) {
-      if (!_buf || isEmpty()) return false;
-
-      SlotHdr* h = hdrPtr(_r);
-      uint16_t lenBytes = h->len;
-
-      // Corruption guard only
-      if (lenBytes > _chunkBytes) return false;
-
-      if (lenBytes) {
-         memcpy(dst, payloadPtr(_r), lenBytes);
-      }
-
-      outLenBytes = lenBytes;
-
-      _r = (_r + 1) % _n;
-      _count--;
-      return true;
-      }
-
-   private:
-      uint8_t *_buf = nullptr;   // contiguous fifo storage
-      uint16_t _n = 0;           // number of chunks
-      uint16_t _chunkBytes = 0;  // bytes per chunk
-      uint16_t  _slotBytes = 0;  // sizeof(SlotHdr) + max payload      
-      uint16_t _w = 0;           // write index
-      uint16_t _r = 0;           // read index
-      uint16_t _count = 0;       // number of chunks in FIFO
-
-      // ===== Helper accessors (FIXED) =====
-      uint8_t* slotPtr(uint16_t idx) const {
-         return _buf + (uint32_t)idx * _slotBytes;
-      }
-
-      SlotHdr* hdrPtr(uint16_t idx) const {
-         return reinterpret_cast<SlotHdr*>(slotPtr(idx));
-      }
-
-      uint8_t* payloadPtr(uint16_t idx) const {
-         return slotPtr(idx) + sizeof(SlotHdr);
-      }      
-};
-
-
-
 extern AUDIO audio;
 extern QueueHandle_t qAudioRecCmds;       // queue command handle
-extern QueueHandle_t qAudioRecStatus;     // queue status handle
+extern EventGroupHandle_t egAudioCapture; // capture state & event bits
+extern SeqLock<capture_status_t> capture_status;   // latest capture status snapshot
 // extern QueueHandle_t qAudioRecFrameGate;  // used to sync output frames
 extern QueueHandle_t qAudioPlay; 
+extern ChunkRingFifo mix_fifo[MIX_NUM_SOURCES];  // playback chunks per mixer source, filled in place
+extern SeqLock<play_stats_t> play_stats;  // latest playback health counters
+extern ESP32S3_AEC_REF aec_ref;           // speaker samples for echo cancel
+extern ESP32S3_CLIPS clip_bank;           // memory mapped 'clips' partition
 extern TaskHandle_t h_AudioPlay;
 extern TaskHandle_t h_taskAudioRec;
-extern TaskHandle_t h_playTone;
-extern TaskHandle_t h_taskAudioPlayWAV;
\ No newline at end of file
+extern TaskHandle_t h_AudioEngine;
+extern TaskHandle_t h_WavPrefetch;
@@ -0,0 +1,202 @@
+/********************************************************************
+ * @brief chunk_fifo.h : Lock free single producer / single consumer
+ * ring of variable length audio chunks.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+#include "esp_heap_caps.h"
+
+// Ring buffer header struct
+struct SlotHdr {
+   uint16_t len;   // valid payload bytes in this slot
+   uint16_t rsv;   // reserved/padding (keeps payload 32-bit aligned)
+};
+
+#define FIFO_CACHE_LINE       64          // keeps producer & consumer indices apart
+#define FIFO_MAX_CHUNKS       32768       // largest power of two a uint16_t count holds
+#define FIFO_IS_POW2(n)       ((n) > 0 && ((n) & ((n) - 1)) == 0)
+
+/**
+ * @brief Ring buffer for audioplay task. 
+ * @note Lock free single producer / single consumer. The producer (e.g.
+ * WAV task on core 0) and consumer (player on core 1) exchange chunks
+ * directly. Head and tail are free running counters: head is only written
+ * by the producer, tail only by the consumer, each published with release
+ * ordering and read with acquire ordering by the other side. The number of 
+ * chunks is rounded up to a power of two so slots are indexed with a mask
+ * (1 .. FIFO_MAX_CHUNKS; size callers' depths as powers of two so the
+ * memory asked for is the memory used).
+ * Besides push/pop (copy in/out), slots can be loaned:
+ *    producer: acquire() -> fill payload in place -> commit(len)
+ *    consumer: front(len) -> use payload in place -> release()
+ * create/reconfigure/destroy must not run while either side is active.
+ */
+class ChunkRingFifo {
+   public:
+      ChunkRingFifo() = default;
+      ~ChunkRingFifo() { destroy(); }
+
+      // Allocate storage and initialize FIFO. False if nChunks is 0 or above 
+      // FIFO_MAX_CHUNKS (no uint16_t power of two holds it), or a slot would
+      // not fit in uint16_t.
+      bool create(uint16_t nChunks,
+               uint16_t chunkBytes,
+               uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+      {
+         destroy();  // free any existing storage
+         if (nChunks == 0 || nChunks > FIFO_MAX_CHUNKS || 
+                  chunkBytes > UINT16_MAX - sizeof(SlotHdr)) {
+            return false;
+         }
+
+         _n = 1;
+         while (_n < nChunks) _n <<= 1;   // power of two for mask indexing
+         _mask = _n - 1;
+         _chunkBytes = chunkBytes;
+         _slotBytes = (uint16_t)(sizeof(SlotHdr) + _chunkBytes);
+
+         _buf = (uint8_t*)heap_caps_malloc((uint32_t)_n * _slotBytes, caps);
+         if (!_buf) {
+            destroy();
+            return false;
+         }
+         memset(_buf, 0, (uint32_t)_n * _slotBytes);
+         _head.store(0, std::memory_order_relaxed);
+         _tail.store(0, std::memory_order_release);
+         return true;
+      }
+
+      // Hard reconfigure: free old buffer, allocate new one
+      bool reconfigure(uint16_t nChunks,
+                     uint16_t chunkBytes,
+                     uint32_t caps = MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT)
+      {
+         return create(nChunks, chunkBytes, caps);
+      }
+
+      // Explicit destroy (optional; destructor also does this)
+      void destroy() {
+         if (_buf) {
+            heap_caps_free(_buf);
+            _buf = nullptr;
+         }
+         _n = 0;
+         _mask = 0;
+         _chunkBytes = 0;
+         _slotBytes = 0;
+         _head.store(0, std::memory_order_relaxed);
+         _tail.store(0, std::memory_order_relaxed);
+      }
+
+      // Consumer: drop every queued chunk
+      void clear() {
+         _tail.store(_head.load(std::memory_order_acquire), std::memory_order_release);
+      }
+
+      uint16_t count() const {
+         return (uint16_t)(_head.load(std::memory_order_acquire) - _tail.load(std::memory_order_acquire));
+      }
+      bool isEmpty() const { return count() == 0; }
+      bool isFull()  const { return count() >= _n; }
+      uint16_t capacity() const { return _n; }
+
+      // max payload bytes (not counting header)
+      uint16_t chunkBytes() const { return _chunkBytes; }
+
+      // total bytes per slot (header + payload)
+      uint16_t slotBytes() const { return _slotBytes; }
+
+      // Producer: push variable-length payload (<= chunkBytes)
+      bool push(const void* src, uint16_t lenBytes) {
+         void* dst = acquire();
+         if (!dst || lenBytes > _chunkBytes) return false;
+         if (lenBytes) {
+            memcpy(dst, src, lenBytes);
+         }
+         return commit(lenBytes);
+      }
+
+      // Consumer: pop one chunk (copies its payload into dst)
+      bool pop(void* dst, uint16_t & outLenBytes) {
+         uint16_t lenBytes;
+         const void* src = front(lenBytes);
+         if (!src) return false;
+         if (lenBytes) {
+            memcpy(dst, src, lenBytes);
+         }
+         outLenBytes = lenBytes;
+         release();
+         return true;
+      }
+
+      // ===== Zero-copy slot loans =====
+      // Producer: payload of the next free slot (chunkBytes() long), nullptr if full.
+      // The slot is not visible to the consumer until commit().
+      void* acquire() {
+         if (!_buf) return nullptr;
+         uint32_t head = _head.load(std::memory_order_relaxed);
+         if (head - _tail.load(std::memory_order_acquire) >= _n) return nullptr;
+         return payloadPtr(head & _mask);
+      }
+
+      // Producer: publish the slot returned by acquire() with lenBytes of payload
+      bool commit(uint16_t lenBytes) {
+         if (!_buf || lenBytes > _chunkBytes) return false;
+         uint32_t head = _head.load(std::memory_order_relaxed);
+         if (head - _tail.load(std::memory_order_acquire) >= _n) return false;
+
+         SlotHdr* h = hdrPtr(head & _mask);
+         h->len = lenBytes;
+         h->rsv = 0;
+         _head.store(head + 1, std::memory_order_release);   // payload & header visible first
+         return true;
+      }
+
+      // Consumer: payload of the oldest chunk without copying, nullptr if empty.
+      // The slot stays owned by the consumer until release().
+      void* front(uint16_t & outLenBytes) {
+         if (!_buf) return nullptr;
+         uint32_t tail = _tail.load(std::memory_order_relaxed);
+         if (_head.load(std::memory_order_acquire) == tail) return nullptr;
+
+         SlotHdr* h = hdrPtr(tail & _mask);
+         if (h->len > _chunkBytes) return nullptr;   // corruption guard only
+         outLenBytes = h->len;
+         return payloadPtr(tail & _mask);
+      }
+
+      // Consumer: hand the slot returned by front() back to the producer
+      void release() {
+         uint32_t tail = _tail.load(std::memory_order_relaxed);
+         if (_head.load(std::memory_order_acquire) == tail) return;
+         _tail.store(tail + 1, std::memory_order_release);   // done reading the slot
+      }
+
+   private:
+      // Written by the producer only
+      alignas(FIFO_CACHE_LINE) std::atomic<uint32_t> _head{0};   // chunks committed (free running)
+      // Written by the consumer only
+      alignas(FIFO_CACHE_LINE) std::atomic<uint32_t> _tail{0};   // chunks released (free running)
+      // Read only while the fifo is in use
+      alignas(FIFO_CACHE_LINE) uint8_t *_buf = nullptr;   // contiguous fifo storage
+      uint16_t _n = 0;           // number of chunks (power of two)
+      uint16_t _mask = 0;        // _n - 1
+      uint16_t _chunkBytes = 0;  // bytes per chunk
+      uint16_t _slotBytes = 0;   // sizeof(SlotHdr) + max payload      
+
+      // ===== Helper accessors =====
+      uint8_t* slotPtr(uint32_t idx) const {
+         return _buf + idx * _slotBytes;
+      }
+
+      SlotHdr* hdrPtr(uint32_t idx) const {
+         return reinterpret_cast<SlotHdr*>(slotPtr(idx));
+      }
+
+      uint8_t* payloadPtr(uint32_t idx) const {
+         return slotPtr(idx) + sizeof(SlotHdr);
+      }      
+};
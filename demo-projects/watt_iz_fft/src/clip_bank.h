@@ -0,0 +1,100 @@
+/********************************************************************
+ * @brief clip_bank.h : Packed audio clip bank image format.
+ *
+ * @note The image is built by tools/pack_clips.py and written to the
+ * 'clips' data partition. Layout (little endian):
+ *    clip_bank_hdr_t                     16 bytes
+ *    clip_entry_t x num_clips            48 bytes each, sorted by name
+ *    clip audio data                     each clip 4 byte aligned
+ * Offsets are from the start of the image. Audio is stored ready to
+ * play (see 'format'), so it can be streamed straight from mapped flash.
+ *
+ * Only plain C++ on a memory pointer - no ESP-IDF - so host tools can
+ * use the same parser.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+
+#define CLIP_BANK_MAGIC          0x42504C43     // "CLPB"
+#define CLIP_BANK_VERSION        1
+#define CLIP_NAME_LEN            32             // incl. terminating nul
+
+// Clip sample formats
+enum {
+   CLIP_FMT_PCM16=1,                            // signed 16 bit, interleaved if channels > 1
+};
+
+typedef struct {
+   uint32_t magic;                              // CLIP_BANK_MAGIC
+   uint16_t version;                            // CLIP_BANK_VERSION
+   uint16_t num_clips;
+   uint32_t image_bytes;                        // total image size
+   uint32_t reserved;
+} clip_bank_hdr_t ;
+
+typedef struct {
+   char name[CLIP_NAME_LEN];                    // nul padded
+   uint32_t offset;                             // audio data, from image start
+   uint32_t bytes;                              // audio data size
+   uint32_t sample_rate;
+   uint8_t format;                              // CLIP_FMT_xxx
+   uint8_t channels;
+   uint16_t reserved;
+} clip_entry_t ;
+
+static_assert(sizeof(clip_bank_hdr_t) == 16, "clip bank header layout");
+static_assert(sizeof(clip_entry_t) == 48, "clip bank entry layout");
+
+
+/********************************************************************
+ * @brief Validate a clip bank image.
+ * @param img - start of the image (e.g. mapped flash).
+ * @param size - bytes available at 'img'.
+ * @return the header, nullptr if the image is missing or corrupt.
+ */
+static inline const clip_bank_hdr_t *clipBankParse(const uint8_t *img, uint32_t size)
+{
+   if(!img || size < sizeof(clip_bank_hdr_t))
+      return nullptr;
+   const clip_bank_hdr_t *hdr = (const clip_bank_hdr_t *)img;
+   if(hdr->magic != CLIP_BANK_MAGIC || hdr->version != CLIP_BANK_VERSION ||
+            hdr->image_bytes > size)
+      return nullptr;
+   uint32_t index_end = sizeof(clip_bank_hdr_t) + uint32_t(hdr->num_clips) * sizeof(clip_entry_t);
+   if(index_end > hdr->image_bytes)
+      return nullptr;
+
+   // Every clip must lie inside the image
+   const clip_entry_t *e = (const clip_entry_t *)(img + sizeof(clip_bank_hdr_t));
+   for(uint16_t i = 0; i < hdr->num_clips; i++, e++) {
+      if(e->name[CLIP_NAME_LEN - 1] != '\0' || e->offset < index_end || (e->offset & 3) ||
+               e->bytes > hdr->image_bytes - e->offset || e->offset > hdr->image_bytes)
+         return nullptr;
+   }
+   return hdr;
+}
+
+
+/********************************************************************
+ * @brief Find a clip by name (binary search - the index is sorted).
+ * @param img - an image accepted by clipBankParse().
+ * @return the index entry, nullptr if not found.
+ */
+static inline const clip_entry_t *clipBankFind(const uint8_t *img, const char *name)
+{
+   const clip_bank_hdr_t *hdr = (const clip_bank_hdr_t *)img;
+   const clip_entry_t *index = (const clip_entry_t *)(img + sizeof(clip_bank_hdr_t));
+   int32_t lo = 0, hi = int32_t(hdr->num_clips) - 1;
+
+   while(lo <= hi) {
+      int32_t mid = (lo + hi) / 2;
+      int c = strncmp(name, index[mid].name, CLIP_NAME_LEN);
+      if(c == 0)
+         return &index[mid];
+      if(c < 0) hi = mid - 1;
+      else lo = mid + 1;
+   }
+   return nullptr;
+}
@@ -0,0 +1,509 @@
+/********************************************************************
+ * @brief esp32s3_aec.cpp source file
+ *
+ * @note Partitioned block frequency domain NLMS echo canceller using
+ * the ESP32S3_FFT wrapper.
+ */
+#include "esp32s3_aec.h"
+
+#define AEC_REF_LINE_SAMPLES     8192     // reference delay line (power of 2, > AEC_MAX_DELAY + block)
+#define AEC_ENV_RING             256      // envelope ring points (power of 2)
+#define AEC_ENV_WINDOW           128      // envelope points correlated (~0.5 secs)
+#define AEC_ENV_LAGS             (AEC_MAX_DELAY / AEC_ENV_DECIMATE)
+
+
+/********************************************************************
+ * @brief Allocate the reference ring.
+ * @param samples - ring size. Rounded down to a power of 2.
+ */
+bool ESP32S3_AEC_REF::create(uint32_t samples)
+{
+   destroy();
+   uint32_t sz = 1;
+   while((sz << 1) <= samples) sz <<= 1;
+   if(sz <= AEC_REF_GUARD)
+      return false;
+   _buf = (int16_t *) heap_caps_malloc(sz * sizeof(int16_t), MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+   if(!_buf)
+      return false;
+   _mask = sz - 1;
+   reset();
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free the reference ring.
+ */
+void ESP32S3_AEC_REF::destroy(void)
+{
+   _enabled = false;
+   if(_buf) {
+      heap_caps_free(_buf);
+      _buf = nullptr;
+   }
+   _mask = 0;
+}
+
+
+/********************************************************************
+ * @brief Restart the sample count at 0 (speaker stream restarted). The
+ *    producer must not be running.
+ */
+void ESP32S3_AEC_REF::reset(void)
+{
+   _head.store(0);
+   _valid = 0;
+   _misses = 0;
+}
+
+
+/********************************************************************
+ * @brief Start or stop collecting reference samples. Called by the
+ *    consumer. Samples counted before enabling read as zeros.
+ */
+void ESP32S3_AEC_REF::enable(bool en)
+{
+   if(en && _buf) {
+      _valid = _head.load(std::memory_order_acquire);
+      _misses = 0;
+   }
+   _enabled = (en && _buf);
+}
+
+
+/********************************************************************
+ * @brief Append samples exactly as the speaker sent them. Called by the
+ *    speaker DMA callback only. The count advances even while disabled
+ *    so indexes stay equal to the speaker sample count.
+ */
+void IRAM_ATTR ESP32S3_AEC_REF::push(const int16_t *src, uint32_t n)
+{
+   uint32_t head = _head.load(std::memory_order_relaxed);
+   if(_enabled) {
+      for(uint32_t i = 0; i < n; i++)
+         _buf[(head + i) & _mask] = src[i];
+   }
+   _head.store(head + n, std::memory_order_release);
+}
+
+
+/********************************************************************
+ * @brief Read 'n' samples starting at speaker sample 'pos', stepping 
+ *    'step' samples per output (linear interpolation). Samples not held 
+ *    (before enabling, overwritten, or not yet sent) read as zero.
+ * @return Number of real reference samples read.
+ */
+uint32_t ESP32S3_AEC_REF::read(float *dst, uint32_t n, double pos, float step)
+{
+   uint32_t head = _head.load(std::memory_order_acquire);
+   uint32_t idx, k, i, got = 0;
+   int32_t age;
+   float frac;
+
+   if(!_buf || pos < 0.0) {
+      memset(dst, 0, n * sizeof(float));
+      _misses++;
+      return 0;
+   }
+   idx = uint32_t(uint64_t(pos));         // mod 2^32 like the head
+   frac = float(pos - floor(pos));
+   for(i = 0; i < n; i++) {
+      age = int32_t(head - idx);          // samples from idx to the newest + 1
+      if(age >= 2 && age <= int32_t(_mask + 1 - AEC_REF_GUARD) && int32_t(idx - _valid) >= 0) {
+         float s0 = float(_buf[idx & _mask]);
+         float s1 = float(_buf[(idx + 1) & _mask]);
+         dst[i] = s0 + frac * (s1 - s0);
+         got++;
+      }
+      else
+         dst[i] = 0.0f;
+      frac += step;
+      k = uint32_t(frac);
+      idx += k;
+      frac -= float(k);
+   }
+   if(got < n)
+      _misses++;
+   return got;
+}
+
+
+/********************************************************************
+ * @brief ESP32S3_ECHO_CANCEL class constructor
+ */
+ESP32S3_ECHO_CANCEL::ESP32S3_ECHO_CANCEL(void) { }
+
+
+/********************************************************************
+ * @brief ESP32S3_ECHO_CANCEL class destructor
+ */
+ESP32S3_ECHO_CANCEL::~ESP32S3_ECHO_CANCEL(void)
+{
+   end();                                 // free internal buffer memory
+}
+
+
+/********************************************************************
+ * @brief Allocate working buffers and init the FFT engine.
+ * @return true if all memory was allocated.
+ */
+bool ESP32S3_ECHO_CANCEL::init(void)
+{
+   end();
+
+   if(!_fft.init(AEC_FFT_SIZE, AEC_FFT_SIZE, SPECTRAL_AVERAGE))
+      return false;
+
+   const uint32_t caps = MALLOC_CAP_SPIRAM;
+   _ref_line = (float *) heap_caps_aligned_alloc(16, AEC_REF_LINE_SAMPLES * sizeof(float), caps);
+   _env_ref = (float *) heap_caps_aligned_alloc(16, AEC_ENV_RING * sizeof(float), caps);
+   _env_mic = (float *) heap_caps_aligned_alloc(16, AEC_ENV_RING * sizeof(float), caps);
+   _cplx = (float *) heap_caps_aligned_alloc(16, AEC_FFT_SIZE * 2 * sizeof(float), caps);
+   _tbuf = (float *) heap_caps_aligned_alloc(16, AEC_FFT_SIZE * sizeof(float), caps);
+   _xprev = (float *) heap_caps_aligned_alloc(16, AEC_BLOCK_SIZE * sizeof(float), caps);
+   _X = (float *) heap_caps_aligned_alloc(16, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float), caps);
+   _W = (float *) heap_caps_aligned_alloc(16, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float), caps);
+   _Wfg = (float *) heap_caps_aligned_alloc(16, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float), caps);
+   _efg = (float *) heap_caps_aligned_alloc(16, AEC_BLOCK_SIZE * sizeof(float), caps);
+   _Pk = (float *) heap_caps_aligned_alloc(16, AEC_NUM_BINS * sizeof(float), caps);
+
+   if(!_ref_line || !_env_ref || !_env_mic || !_cplx || !_tbuf || !_xprev || !_X || !_W || !_Wfg || !_efg || !_Pk) {
+      end();
+      return false;
+   }
+   reset();
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free internal buffer memory.
+ */
+void ESP32S3_ECHO_CANCEL::end(void)
+{
+   float **bufs[] = { &_ref_line, &_env_ref, &_env_mic, &_cplx, &_tbuf, &_xprev, &_X, &_W, &_Wfg, &_efg, &_Pk };
+   for(float **b : bufs) {
+      if(*b) {
+         free(*b);
+         *b = nullptr;
+      }
+   }
+   _fft.end();
+}
+
+
+/********************************************************************
+ * @brief Clear the adaptive filter, delay line & delay estimate.
+ */
+void ESP32S3_ECHO_CANCEL::reset(void)
+{
+   if(!_W) return;
+   memset(_ref_line, 0, AEC_REF_LINE_SAMPLES * sizeof(float));
+   memset(_env_ref, 0, AEC_ENV_RING * sizeof(float));
+   memset(_env_mic, 0, AEC_ENV_RING * sizeof(float));
+   memset(_xprev, 0, AEC_BLOCK_SIZE * sizeof(float));
+   memset(_X, 0, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float));
+   memset(_Pk, 0, AEC_NUM_BINS * sizeof(float));
+   clearFilter();
+   _ref_wr = 0;
+   _env_wr = 0;
+   _env_cnt = 0;
+   _env_acc_ref = _env_acc_mic = 0.0f;
+   _delay = 0;
+   _delay_candidate = -1;
+   _delay_locked = false;
+   _freeze_run = 0;
+   _block_count = 0;
+   _xhead = 0;
+   _d_pow = _e_pow = 0.0f;
+}
+
+
+/********************************************************************
+ * @brief Build a full conjugate symmetric spectrum from bins 0..N/2.
+ */
+void ESP32S3_ECHO_CANCEL::expand(const float *half, float *full)
+{
+   if(half != full)
+      memcpy(full, half, AEC_NUM_BINS * 2 * sizeof(float));
+   for(int k = 1; k < AEC_NUM_BINS - 1; k++) {
+      int m = AEC_FFT_SIZE - k;
+      full[2 * m] = half[2 * k];
+      full[2 * m + 1] = -half[2 * k + 1];
+   }
+}
+
+
+/********************************************************************
+ * @brief Zero the adaptive & foreground filters, the filter restarts.
+ */
+void ESP32S3_ECHO_CANCEL::clearFilter(void)
+{
+   memset(_W, 0, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float));
+   memset(_Wfg, 0, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float));
+   _diff_avg = _diff_var = 0.0f;
+   _converged = false;
+}
+
+
+/********************************************************************
+ * @brief Echo estimate Y = sum(W[p] * X[p]) of filter 'W', back to the
+ *    time domain. Sample n of the block is _cplx[2 * (AEC_BLOCK_SIZE + n)].
+ */
+void ESP32S3_ECHO_CANCEL::echoEstimate(const float *W)
+{
+   memset(_cplx, 0, AEC_NUM_BINS * 2 * sizeof(float));
+   for(int p = 0; p < AEC_PARTITIONS; p++) {
+      const float *Xp = _X + (((_xhead + p) % AEC_PARTITIONS) * AEC_NUM_BINS * 2);
+      const float *Wp = W + (p * AEC_NUM_BINS * 2);
+      for(int k = 0; k < AEC_NUM_BINS; k++) {
+         float xr = Xp[2 * k], xi = Xp[2 * k + 1];
+         float wr = Wp[2 * k], wi = Wp[2 * k + 1];
+         _cplx[2 * k] += wr * xr - wi * xi;
+         _cplx[2 * k + 1] += wr * xi + wi * xr;
+      }
+   }
+   expand(_cplx, _cplx);
+   _fft.inverse(_cplx);
+}
+
+
+/********************************************************************
+ * @brief Cancel speaker echo from a block of mic audio.
+ * @param mic - mic samples (float, int16 scale).
+ * @param ref - far-end samples popped from ESP32S3_AEC_REF, same length.
+ * @param output - echo cancelled output. May be the same as mic.
+ * @param len - number of samples, multiple of AEC_BLOCK_SIZE.
+ * @return Number of blocks processed.
+ */
+uint16_t ESP32S3_ECHO_CANCEL::process(float *mic, const float *ref, float *output, uint32_t len)
+{
+   const float PK_ALPHA       = 0.9f;     // reference power smoothing
+   const float POW_ALPHA      = 0.95f;    // ERLE smoothing
+   const float DIVERGE_RATIO  = 1.5f;     // error > 1.5x mic == divergence
+   const float DOUBLE_TALK_RATIO = 2.0f;  // converged & error > mic / 2 == near-end speech
+   const float ADOPT_VAR      = 0.5f;     // smoothed error gain vs its variance that adopts the adaptive filter
+   const float BACKTRACK      = 4.0f;     // error loss vs its variance that restores the foreground filter
+   const float DELTA          = 1e5f;     // NLMS regularization
+
+   uint32_t t0 = micros();
+   uint16_t blocks = len / AEC_BLOCK_SIZE;
+   if(!_W) return 0;
+
+   for(uint16_t b = 0; b < blocks; b++) {
+      float *d = mic + (b * AEC_BLOCK_SIZE);
+      const float *xr = ref + (b * AEC_BLOCK_SIZE);
+      float *out = output + (b * AEC_BLOCK_SIZE);
+      int n, k, p;
+
+      /**
+       * @brief Feed the delay line & the delay estimation envelopes
+       */
+      for(n = 0; n < AEC_BLOCK_SIZE; n++) {
+         _ref_line[(_ref_wr + n) & (AEC_REF_LINE_SAMPLES - 1)] = xr[n];
+         _env_acc_ref += fabsf(xr[n]);
+         _env_acc_mic += fabsf(d[n]);
+         if(++_env_cnt >= AEC_ENV_DECIMATE) {
+            _env_ref[_env_wr & (AEC_ENV_RING - 1)] = _env_acc_ref;
+            _env_mic[_env_wr & (AEC_ENV_RING - 1)] = _env_acc_mic;
+            _env_wr++;
+            _env_cnt = 0;
+            _env_acc_ref = _env_acc_mic = 0.0f;
+         }
+      }
+
+      // Overlap-save input: [previous block, delayed new block]
+      float ref_en = 0.0f;
+      memcpy(_tbuf, _xprev, AEC_BLOCK_SIZE * sizeof(float));
+      for(n = 0; n < AEC_BLOCK_SIZE; n++) {
+         float x = _ref_line[(_ref_wr + n - _delay) & (AEC_REF_LINE_SAMPLES - 1)];
+         _tbuf[AEC_BLOCK_SIZE + n] = x;
+         ref_en += x * x;
+      }
+      _ref_wr += AEC_BLOCK_SIZE;
+      memcpy(_xprev, _tbuf + AEC_BLOCK_SIZE, AEC_BLOCK_SIZE * sizeof(float));
+      bool ref_active = ref_en > (ref_active_rms * ref_active_rms * AEC_BLOCK_SIZE);
+
+      /**
+       * @brief Newest reference spectrum goes into the partition ring
+       */
+      _fft.computeComplex(_tbuf, _cplx, false);
+      _xhead = (_xhead + AEC_PARTITIONS - 1) % AEC_PARTITIONS;
+      float *Xn = _X + (_xhead * AEC_NUM_BINS * 2);
+      memcpy(Xn, _cplx, AEC_NUM_BINS * 2 * sizeof(float));
+      for(k = 0; k < AEC_NUM_BINS; k++) {
+         float pw = Xn[2 * k] * Xn[2 * k] + Xn[2 * k + 1] * Xn[2 * k + 1];
+         _Pk[k] = PK_ALPHA * _Pk[k] + (1.0f - PK_ALPHA) * pw;
+      }
+
+      /**
+       * @brief Errors = mic - echo estimate of the foreground filter (output)
+       * and of the adaptive one, padded with zeros for the gradient
+       */
+      float d_en = 0.0f, f_en = 0.0f, e_en = 0.0f, diff_en = 0.0f;
+      echoEstimate(_Wfg);
+      for(n = 0; n < AEC_BLOCK_SIZE; n++) {
+         _efg[n] = d[n] - _cplx[2 * (AEC_BLOCK_SIZE + n)];
+         d_en += d[n] * d[n];
+         f_en += _efg[n] * _efg[n];
+      }
+      echoEstimate(_W);
+      for(n = 0; n < AEC_BLOCK_SIZE; n++) {
+         float e = d[n] - _cplx[2 * (AEC_BLOCK_SIZE + n)];
+         _tbuf[n] = 0.0f;
+         _tbuf[AEC_BLOCK_SIZE + n] = e;
+         e_en += e * e;
+         diff_en += (_efg[n] - e) * (_efg[n] - e);
+      }
+
+      /**
+       * @brief The foreground filter adopts the adaptive one when its error is
+       * lower beyond chance, and restores it when it is much higher (damaged
+       * by double talk the detector missed). Not while the foreground error
+       * looks like near-end speech: large, and not explained by the filters
+       * differing.
+       */
+      float gain = f_en - e_en;
+      bool near_end = _converged && (f_en * DOUBLE_TALK_RATIO > d_en) && (diff_en * DOUBLE_TALK_RATIO < f_en);
+      _diff_avg = 0.6f * _diff_avg + 0.4f * gain;
+      _diff_var = 0.36f * _diff_var + 0.16f * f_en * diff_en;
+      if(!near_end && ((gain * fabsf(gain) > f_en * diff_en) ||
+               (_diff_avg * fabsf(_diff_avg) > ADOPT_VAR * _diff_var))) {
+         memcpy(_Wfg, _W, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float));
+         memcpy(_efg, _tbuf + AEC_BLOCK_SIZE, AEC_BLOCK_SIZE * sizeof(float));
+         f_en = e_en;
+         _diff_avg = _diff_var = 0.0f;
+      }
+      else if(-gain * fabsf(gain) > BACKTRACK * f_en * diff_en) {
+         memcpy(_W, _Wfg, AEC_PARTITIONS * AEC_NUM_BINS * 2 * sizeof(float));
+         memcpy(_tbuf + AEC_BLOCK_SIZE, _efg, AEC_BLOCK_SIZE * sizeof(float));
+         e_en = f_en;
+         _diff_avg = _diff_var = 0.0f;
+      }
+
+      // Double talk only freezes adaptation, a divergence run restarts the filter
+      bool diverged = (f_en > DIVERGE_RATIO * d_en);
+      bool double_talk = _converged && !diverged && (f_en * DOUBLE_TALK_RATIO > d_en);
+      _freeze_run = (diverged && ref_active) ? _freeze_run + 1 : 0;
+      if(_freeze_run >= AEC_DIVERGE_BLOCKS) {
+         clearFilter();                   // echo path changed, start over
+         _freeze_run = 0;
+      }
+      for(n = 0; n < AEC_BLOCK_SIZE; n++)
+         out[n] = (diverged) ? d[n] : _efg[n];
+      _d_pow = POW_ALPHA * _d_pow + (1.0f - POW_ALPHA) * d_en;
+      _e_pow = POW_ALPHA * _e_pow + (1.0f - POW_ALPHA) * ((diverged) ? d_en : f_en);
+      if(erleDb() >= AEC_LOCK_ERLE_DB)
+         _converged = true;
+
+      /**
+       * @brief NLMS update: W[p] += mu * conj(X[p]) * E / (P * Pk)
+       */
+      if(ref_active && !diverged && !double_talk) {
+         _fft.computeComplex(_tbuf, _cplx, false);
+         for(p = 0; p < AEC_PARTITIONS; p++) {
+            const float *Xp = _X + (((_xhead + p) % AEC_PARTITIONS) * AEC_NUM_BINS * 2);
+            float *Wp = _W + (p * AEC_NUM_BINS * 2);
+            for(k = 0; k < AEC_NUM_BINS; k++) {
+               float g = mu / ((AEC_PARTITIONS * _Pk[k]) + DELTA);
+               float xr_ = Xp[2 * k], xi = Xp[2 * k + 1];
+               float er = _cplx[2 * k], ei = _cplx[2 * k + 1];
+               Wp[2 * k] += g * (xr_ * er + xi * ei);
+               Wp[2 * k + 1] += g * (xr_ * ei - xi * er);
+            }
+         }
+
+         // Gradient constraint on one partition per block (round robin)
+         float *Wc = _W + ((_block_count % AEC_PARTITIONS) * AEC_NUM_BINS * 2);
+         expand(Wc, _cplx);
+         _fft.inverse(_cplx);
+         for(n = 0; n < AEC_BLOCK_SIZE; n++) {
+            _tbuf[n] = _cplx[2 * n];
+            _tbuf[AEC_BLOCK_SIZE + n] = 0.0f;
+         }
+         _fft.computeComplex(_tbuf, _cplx, false);
+         memcpy(Wc, _cplx, AEC_NUM_BINS * 2 * sizeof(float));
+      }
+      _block_count++;
+   }
+   estimateDelay();
+   _process_us = micros() - t0;
+   return blocks;
+}
+
+
+/********************************************************************
+ * @brief Find the bulk delay between reference & mic by correlating
+ *    their energy envelopes. Two agreeing estimates (within one envelope
+ *    point) are needed before the delay line is moved. Moving it resets
+ *    the adaptive filter. Stops once the filter has converged: speech
+ *    envelopes give spurious peaks, worst in double talk.
+ */
+void ESP32S3_ECHO_CANCEL::estimateDelay(void)
+{
+   const float MIN_CORR       = 0.5f;     // normalized correlation needed to accept a lag
+   const int32_t MARGIN       = 2 * AEC_ENV_DECIMATE;   // leave room for the filter to see the onset
+
+   if(_converged)
+      _delay_locked = true;
+   if(_delay_locked || _env_wr < (AEC_ENV_WINDOW + AEC_ENV_LAGS))
+      return;
+
+   // Mic window statistics
+   uint32_t m0 = _env_wr - AEC_ENV_WINDOW;
+   float mic_mean = 0.0f;
+   for(int n = 0; n < AEC_ENV_WINDOW; n++)
+      mic_mean += _env_mic[(m0 + n) & (AEC_ENV_RING - 1)];
+   mic_mean /= AEC_ENV_WINDOW;
+   float mic_var = 0.0f;
+   for(int n = 0; n < AEC_ENV_WINDOW; n++) {
+      float v = _env_mic[(m0 + n) & (AEC_ENV_RING - 1)] - mic_mean;
+      mic_var += v * v;
+   }
+   if(mic_var <= 0.0f) return;
+
+   int32_t best_lag = -1;
+   float best_corr = MIN_CORR;
+   for(int lag = 0; lag <= AEC_ENV_LAGS; lag++) {
+      uint32_t r0 = m0 - lag;
+      float ref_mean = 0.0f;
+      for(int n = 0; n < AEC_ENV_WINDOW; n++)
+         ref_mean += _env_ref[(r0 + n) & (AEC_ENV_RING - 1)];
+      ref_mean /= AEC_ENV_WINDOW;
+      float cov = 0.0f, ref_var = 0.0f;
+      for(int n = 0; n < AEC_ENV_WINDOW; n++) {
+         float r = _env_ref[(r0 + n) & (AEC_ENV_RING - 1)] - ref_mean;
+         float m = _env_mic[(m0 + n) & (AEC_ENV_RING - 1)] - mic_mean;
+         cov += r * m;
+         ref_var += r * r;
+      }
+      if(ref_var <= 0.0f) continue;
+      float corr = cov / sqrtf(ref_var * mic_var);
+      if(corr > best_corr) {
+         best_corr = corr;
+         best_lag = lag;
+      }
+   }
+   if(best_lag < 0) return;
+
+   int32_t est = (best_lag * AEC_ENV_DECIMATE) - MARGIN;
+   if(est < 0) est = 0;
+   if(_delay_candidate < 0 || abs(est - _delay_candidate) > AEC_ENV_DECIMATE) {
+      _delay_candidate = est;             // wait for a 2nd agreeing estimate
+      return;
+   }
+   if(abs(est - _delay) > AEC_BLOCK_SIZE) {
+      _delay = est;
+      clearFilter();
+   }
+}
+
+
+/********************************************************************
+ * @brief Echo return loss enhancement in db (mic power / output power).
+ */
+float ESP32S3_ECHO_CANCEL::erleDb(void)
+{
+   return 10.0f * log10f((_d_pow + 1.0f) / (_e_pow + 1.0f));
+}
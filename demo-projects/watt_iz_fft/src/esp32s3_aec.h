@@ -0,0 +1,142 @@
+/********************************************************************
+ * @brief esp32s3_aec.h : Acoustic echo canceller for the ESP32-S3 MCU.
+ *
+ * @note Method:
+ * 1) The speaker's DMA callback copies every buffer it has sent into an
+ * ESP32S3_AEC_REF history ring, indexed by speaker sample count. For
+ * each mic frame the capture task reads the speaker samples played
+ * while it was captured (matched through ESP32S3_DMA_CLOCK timestamps),
+ * stepping at the speaker / mic rate ratio, so both streams run on the
+ * mic clock and clock drift never accumulates.
+ * 2) The bulk delay between the two streams (DMA depth + acoustic path)
+ * is found by correlating 64 sample energy envelopes, then removed with
+ * a reference delay line.
+ * 3) The residual echo path is modeled with a partitioned block
+ * frequency domain NLMS filter (overlap-save, 256 sample blocks, 4
+ * partitions = 1024 taps / 64ms). One partition per block is gradient
+ * constrained (round robin) to keep the filter linear.
+ * 4) The output comes from a foreground copy of the filter. It adopts
+ * the adaptive filter when that cancels more beyond chance, and restores
+ * the adaptive filter from itself when that cancels much less: near-end
+ * speech the double talk detector missed damages the adaptive filter only.
+ * 5) Adaptation is frozen when the reference is silent, when the error
+ * exceeds the mic signal (divergence: the block passes the mic through)
+ * or, once converged, when the error is over half the mic signal (double
+ * talk). Double talk keeps the filters however long it lasts; divergence
+ * lasting AEC_DIVERGE_BLOCKS means the echo path changed, so both
+ * restart from zero.
+ * 6) Once the filter cancels AEC_LOCK_ERLE_DB the delay is locked until
+ * reset(), so near-end speech can't move it.
+ *
+ * Cost: four to six 512 point FFTs per 256 sample block. lastProcessUs()
+ * reports the measured time of the most recent process() call.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_dsp.h"
+#include "esp_heap_caps.h"
+#include "esp32s3_fft.h"
+
+// Echo canceller constants
+#define AEC_BLOCK_SIZE           256      // samples per adaptive block (16ms @ 16KHz)
+#define AEC_FFT_SIZE             (AEC_BLOCK_SIZE * 2)
+#define AEC_NUM_BINS             (AEC_BLOCK_SIZE + 1)   // DC .. Nyquist
+#define AEC_PARTITIONS           4        // filter length = partitions * block size
+#define AEC_ENV_DECIMATE         64       // samples per envelope point for delay estimate
+#define AEC_MAX_DELAY            4096     // largest bulk delay searched (256ms)
+#define AEC_REF_RING_SAMPLES     8192     // speaker -> capture reference ring (power of 2)
+#define AEC_REF_GUARD            1024     // newest-overwrite margin of the ring (> one speaker DMA buffer)
+#define AEC_DIVERGE_BLOCKS       8        // diverged blocks in a row that restart the filter (128ms)
+#define AEC_LOCK_ERLE_DB         6.0f     // ERLE that locks the bulk delay
+
+
+/**
+ * @brief Single producer (speaker DMA callback) / single consumer (capture 
+ * task) history ring of far-end reference samples. Sample n of the speaker 
+ * stream is at index n, the consumer reads any index still held.
+ */
+class ESP32S3_AEC_REF {
+   public:
+      ESP32S3_AEC_REF() = default;
+      ~ESP32S3_AEC_REF() { destroy(); }
+
+      bool create(uint32_t samples=AEC_REF_RING_SAMPLES);
+      void destroy(void);
+      void reset(void);                   // restart the count, producer stopped
+      void enable(bool en);               // consumer only. Samples from before enabling aren't held.
+      bool isEnabled(void) { return _enabled; }
+      void push(const int16_t *src, uint32_t n);  // producer only. Counts samples even while disabled.
+      uint32_t read(float *dst, uint32_t n, double pos, float step);  // consumer only
+      uint32_t misses(void) { return _misses; }
+
+   private:
+      int16_t *_buf = nullptr;
+      uint32_t _mask = 0;
+      volatile bool _enabled = false;
+      uint32_t _misses = 0;               // reads that weren't (fully) held
+      uint32_t _valid = 0;                // first index held since enabling
+      std::atomic<uint32_t> _head{0};     // samples pushed (wraps)
+};
+
+
+class ESP32S3_ECHO_CANCEL {
+   public:
+      ESP32S3_ECHO_CANCEL(void);
+      ~ESP32S3_ECHO_CANCEL(void);
+
+      bool init(void);                    // allocate buffers. Call before first process()
+      void end(void);
+      void reset(void);                   // clear filter & delay estimate - call at start of each capture
+      uint16_t process(float *mic, const float *ref, float *output, uint32_t len);  // len multiple of AEC_BLOCK_SIZE
+      int32_t delaySamples(void) { return _delay; }
+      float erleDb(void);                 // smoothed echo return loss enhancement
+      uint32_t lastProcessUs(void) { return _process_us; }
+
+      // Tuneables
+      float mu = 0.25f;                   // NLMS step size (0 < mu < 1)
+      float ref_active_rms = 40.0f;       // adapt only if reference block rms exceeds this
+
+   private:
+      ESP32S3_FFT _fft;                   // shared FFT wrapper
+      uint32_t _process_us = 0;
+      int32_t _delay = 0;                 // bulk delay applied to the reference
+      int32_t _delay_candidate = -1;      // last raw estimate, needs two agreeing estimates
+      bool _delay_locked = false;         // filter converged on _delay, stop estimating
+      bool _converged = false;            // ERLE reached AEC_LOCK_ERLE_DB since the filter was cleared
+      uint16_t _freeze_run = 0;           // consecutive diverged blocks with an active reference
+      uint32_t _block_count = 0;
+      uint8_t _xhead = 0;                 // newest partition index in _X
+      float _d_pow = 0.0f;                // smoothed mic power (ERLE)
+      float _e_pow = 0.0f;                // smoothed error power (ERLE)
+
+      // Reference delay line (power of 2 ring)
+      float *_ref_line = nullptr;
+      uint32_t _ref_wr = 0;
+
+      // Envelopes for delay estimation (power of 2 rings)
+      float *_env_ref = nullptr;
+      float *_env_mic = nullptr;
+      uint32_t _env_wr = 0;
+      float _env_acc_ref = 0.0f;
+      float _env_acc_mic = 0.0f;
+      uint16_t _env_cnt = 0;
+
+      // Adaptive filter state
+      float *_cplx = nullptr;             // full complex work spectrum (AEC_FFT_SIZE re/im pairs)
+      float *_tbuf = nullptr;             // time domain work buffer (AEC_FFT_SIZE)
+      float *_xprev = nullptr;            // previous reference block
+      float *_X = nullptr;                // [AEC_PARTITIONS][AEC_NUM_BINS] re/im reference spectra
+      float *_W = nullptr;                // [AEC_PARTITIONS][AEC_NUM_BINS] re/im filter weights
+      float *_Wfg = nullptr;              // foreground copy of _W, makes the output
+      float *_efg = nullptr;              // foreground error block (AEC_BLOCK_SIZE)
+      float _diff_avg = 0.0f;             // smoothed foreground - adaptive error energy
+      float _diff_var = 0.0f;             // its smoothed variance
+      float *_Pk = nullptr;               // smoothed reference power per bin
+
+      void expand(const float *half, float *full);
+      void clearFilter(void);
+      void echoEstimate(const float *W);
+      void estimateDelay(void);
+};
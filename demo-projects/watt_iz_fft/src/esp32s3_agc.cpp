@@ -0,0 +1,114 @@
+/********************************************************************
+ * @brief esp32s3_agc.cpp source file
+ *
+ * @note Block RMS automatic gain control with noise gate and soft
+ * limiter.
+ */
+#include "esp32s3_agc.h"
+
+#define AGC_FULL_SCALE           32767.0f
+
+
+/********************************************************************
+ * @brief ESP32S3_AGC class constructor. Defaults to the record preset.
+ */
+ESP32S3_AGC::ESP32S3_AGC(void)
+{
+   agc_config_t cfg = AGC_CONFIG_RECORD;
+   init(cfg);
+}
+
+
+/********************************************************************
+ * @brief Load a configuration and precalc the smoothing coefficients.
+ * @param config - AGC_CONFIG_RECORD, AGC_CONFIG_INTERCOM, or custom.
+ * @param sample_rate - audio sample rate in Hz.
+ */
+void ESP32S3_AGC::init(const agc_config_t &config, float sample_rate)
+{
+   _cfg = config;
+   float block_ms = 1000.0f * AGC_BLOCK_SIZE / sample_rate;
+   _attack_coef = 1.0f - expf(-block_ms / _cfg.attack_ms);
+   _release_coef = 1.0f - expf(-block_ms / _cfg.release_ms);
+   _gate_atten_lin = powf(10.0f, -_cfg.gate_atten_db / 20.0f);
+   reset();
+}
+
+
+/********************************************************************
+ * @brief Restore the initial gain. Call at the start of each capture.
+ */
+void ESP32S3_AGC::reset(void)
+{
+   _gain_db = _cfg.initial_gain_db;
+   _gain_lin = powf(10.0f, _gain_db / 20.0f);
+   _gate_lin = 1.0f;
+   _gated = false;
+}
+
+
+/********************************************************************
+ * @brief Apply AGC to a buffer of float samples (int16 scale).
+ * @param input - ptr to float input samples.
+ * @param output - ptr to float output. May be the same as input.
+ * @param len - number of samples. Any length; the gain is updated
+ *    every AGC_BLOCK_SIZE samples.
+ */
+void ESP32S3_AGC::apply(float *input, float *output, uint32_t len)
+{
+   uint32_t done = 0;
+   while(done < len) {
+      uint32_t n = len - done;
+      if(n > AGC_BLOCK_SIZE) n = AGC_BLOCK_SIZE;
+      applyBlock(input + done, output + done, n);
+      done += n;
+   }
+}
+
+
+/********************************************************************
+ * @brief Update the gain from one block's RMS and apply it with a
+ *    linear ramp and soft limiter.
+ */
+void ESP32S3_AGC::applyBlock(float *in, float *out, uint32_t n)
+{
+   constexpr float EPSILON = 1e-9f;
+
+   // Block level
+   float energy = 0.0f;
+   dsps_dotprod_f32(in, in, &energy, n);
+   float rms = sqrtf(energy / float(n)) / AGC_FULL_SCALE;
+   float level_db = 20.0f * log10f(rms + EPSILON);
+
+   // Gate: freeze the gain on noise, else chase the target level
+   _gated = (level_db < _cfg.gate_dbfs);
+   if(!_gated) {
+      float desired = _cfg.target_dbfs - level_db;
+      if(desired > _cfg.max_gain_db) desired = _cfg.max_gain_db;
+      if(desired < _cfg.min_gain_db) desired = _cfg.min_gain_db;
+      float coef = (desired < _gain_db) ? _attack_coef : _release_coef;
+      _gain_db += coef * (desired - _gain_db);
+   }
+
+   // Ramp gain & gate linearly over the block
+   float g_end = powf(10.0f, _gain_db / 20.0f) * ((_gated) ? _gate_atten_lin : 1.0f);
+   float g_start = _gain_lin * _gate_lin;
+   float g_step = (g_end - g_start) / float(n);
+   _gain_lin = powf(10.0f, _gain_db / 20.0f);
+   _gate_lin = (_gated) ? _gate_atten_lin : 1.0f;
+
+   // Soft knee limiter above 'knee' (tanh curve approaching full scale)
+   const float knee = _cfg.limiter_knee * AGC_FULL_SCALE;
+   const float span = AGC_FULL_SCALE - knee;
+   float g = g_start;
+   for(uint32_t i = 0; i < n; i++) {
+      g += g_step;
+      float y = in[i] * g;
+      float a = fabsf(y);
+      if(a > knee) {
+         a = knee + span * tanhf((a - knee) / span);
+         y = (y < 0.0f) ? -a : a;
+      }
+      out[i] = y;
+   }
+}
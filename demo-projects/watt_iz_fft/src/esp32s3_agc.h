@@ -0,0 +1,62 @@
+/********************************************************************
+ * @brief esp32s3_agc.h : Automatic gain control for mic audio.
+ *
+ * @note Method:
+ * 1) Level is measured as the RMS of each AGC_BLOCK_SIZE block.
+ * 2) The gain (in db) moves toward 'target - level' using a fast attack
+ * (level rising) or a slow release (level falling) time constant.
+ * 3) Blocks below the noise gate threshold freeze the gain so noise is
+ * never pumped up, and are attenuated by 'gate_atten_db'.
+ * 4) Gain is ramped linearly across each block (no zipper noise), then
+ * a soft knee limiter keeps peaks from clipping.
+ *
+ * Cost: one dot product, one log and one pow per block plus a multiply
+ * per sample. Limiter tanh is only evaluated above the knee.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_dsp.h"
+
+#define AGC_BLOCK_SIZE           256      // samples per gain update (16ms @ 16KHz)
+
+// AGC tuneables. All levels are in db relative to int16 full scale.
+typedef struct {
+   float target_dbfs;                     // desired block RMS level
+   float max_gain_db;                     // most gain applied to quiet talkers
+   float min_gain_db;                     // least gain applied to loud talkers
+   float attack_ms;                       // time constant when level rises (gain falls)
+   float release_ms;                      // time constant when level falls (gain rises)
+   float gate_dbfs;                       // blocks below this are treated as noise
+   float gate_atten_db;                   // attenuation applied to gated blocks
+   float limiter_knee;                    // soft limiter knee, fraction of full scale
+   float initial_gain_db;                 // gain at start of capture
+} agc_config_t ;
+
+// Recording: natural dynamics, slower release, more gain for distant talkers
+#define AGC_CONFIG_RECORD     { -20.0f, 36.0f, 0.0f, 10.0f, 600.0f, -60.0f, 6.0f, 0.80f, 24.0f }
+// Intercom: tighter level, faster release so the far end hears a steady level
+#define AGC_CONFIG_INTERCOM   { -18.0f, 30.0f, 0.0f, 5.0f, 300.0f, -55.0f, 12.0f, 0.75f, 24.0f }
+
+class ESP32S3_AGC {
+   public:
+      ESP32S3_AGC(void);
+      ~ESP32S3_AGC(void) = default;
+
+      void init(const agc_config_t &config, float sample_rate=16000.0);
+      void reset(void);                   // restore initial gain - call at start of each capture
+      void apply(float *input, float *output, uint32_t len);   // in place is OK
+      float gainDb(void) { return _gain_db; }
+      bool isGated(void) { return _gated; }
+
+   private:
+      agc_config_t _cfg;
+      float _attack_coef = 0.0f;          // per block smoothing, level rising
+      float _release_coef = 0.0f;         // per block smoothing, level falling
+      float _gain_db = 0.0f;              // current smoothed gain
+      float _gain_lin = 1.0f;             // linear gain at end of last block
+      float _gate_lin = 1.0f;             // gate gain at end of last block
+      float _gate_atten_lin = 1.0f;
+      bool _gated = false;
+      void applyBlock(float *in, float *out, uint32_t n);
+};
@@ -0,0 +1,76 @@
+/********************************************************************
+ * @brief esp32s3_clips.cpp source file
+ *
+ * @note Memory mapped clip bank partition.
+ */
+#include "esp32s3_clips.h"
+
+
+/********************************************************************
+ * @brief Map the clip partition and validate the image.
+ * @param label - partition name in esp32s3_partitions.csv.
+ * @return false if there is no partition or no valid image in it.
+ */
+bool ESP32S3_CLIPS::begin(const char *label)
+{
+   const void *ptr;
+
+   end();
+   const esp_partition_t *part = esp_partition_find_first(ESP_PARTITION_TYPE_DATA,
+            ESP_PARTITION_SUBTYPE_ANY, label);
+   if(!part)
+      return false;
+   if(esp_partition_mmap(part, 0, part->size, ESP_PARTITION_MMAP_DATA, &ptr, &_map) != ESP_OK)
+      return false;
+
+   _img = (const uint8_t *)ptr;
+   _hdr = clipBankParse(_img, part->size);
+   if(!_hdr) {                            // not flashed, or corrupt
+      end();
+      return false;
+   }
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Unmap the partition. Clips must not be playing.
+ */
+void ESP32S3_CLIPS::end(void)
+{
+   if(_img) {
+      esp_partition_munmap(_map);
+      _img = nullptr;
+   }
+   _hdr = nullptr;
+}
+
+
+/********************************************************************
+ * @brief Look up a clip by name.
+ * @return false if not found or not 16 bit PCM.
+ */
+bool ESP32S3_CLIPS::find(const char *name, clip_t *clip)
+{
+   if(!_hdr || !name)
+      return false;
+   const clip_entry_t *e = clipBankFind(_img, name);
+   if(!e || e->format != CLIP_FMT_PCM16 || e->channels == 0)
+      return false;
+   clip->pcm = (const int16_t *)(_img + e->offset);
+   clip->channels = e->channels;
+   clip->samples = e->bytes / (sizeof(int16_t) * e->channels);
+   clip->sample_rate = e->sample_rate;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Name of the idx'th clip (sorted order).
+ */
+const char *ESP32S3_CLIPS::name(uint16_t idx)
+{
+   if(!_hdr || idx >= _hdr->num_clips)
+      return nullptr;
+   return ((const clip_entry_t *)(_img + sizeof(clip_bank_hdr_t)))[idx].name;
+}
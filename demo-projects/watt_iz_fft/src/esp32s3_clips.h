@@ -0,0 +1,43 @@
+/********************************************************************
+ * @brief esp32s3_clips.h : Clip bank in a flash data partition.
+ *
+ * @note Method:
+ * 1) The whole 'clips' partition is mapped into the data address space
+ * once with esp_partition_mmap. Reads then go through the flash cache -
+ * no SD card, no file system, no copies into RAM.
+ * 2) The image (see clip_bank.h) is validated once at begin(). Lookups
+ * are a binary search of the sorted index and return a pointer to the
+ * clip audio in mapped flash, which the mixer plays directly.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_partition.h"
+#include "clip_bank.h"
+
+#define CLIP_PARTITION_LABEL     "clips"
+
+// A clip found in the bank
+typedef struct {
+   const int16_t *pcm;                    // in mapped flash
+   uint32_t samples;                      // per channel
+   uint32_t sample_rate;
+   uint8_t channels;
+} clip_t ;
+
+class ESP32S3_CLIPS {
+   public:
+      ESP32S3_CLIPS(void) = default;
+      ~ESP32S3_CLIPS(void) { end(); }
+
+      bool begin(const char *label=CLIP_PARTITION_LABEL);   // map & validate the partition
+      void end(void);
+      bool find(const char *name, clip_t *clip);
+      uint16_t count(void) { return (_hdr) ? _hdr->num_clips : 0; }
+      const char *name(uint16_t idx);     // idx < count()
+
+   private:
+      const uint8_t *_img = nullptr;      // mapped partition
+      const clip_bank_hdr_t *_hdr = nullptr;
+      esp_partition_mmap_handle_t _map = 0;
+};
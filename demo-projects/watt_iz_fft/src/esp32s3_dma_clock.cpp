@@ -0,0 +1,98 @@
+/********************************************************************
+ * @brief esp32s3_dma_clock.cpp source file
+ */
+#include "esp32s3_dma_clock.h"
+
+
+/********************************************************************
+ * @brief Restart the clock. Call while the stream's DMA is stopped.
+ * @param nominal_rate - rate reported until a baseline is measured.
+ */
+void ESP32S3_DMA_CLOCK::reset(float nominal_rate)
+{
+   _nominal = nominal_rate;
+   memset(&_w, 0, sizeof(clock_state_t));
+   _state.write(_w);
+}
+
+
+/********************************************************************
+ * @brief Record a DMA block end. Called from the channel's callback.
+ */
+void IRAM_ATTR ESP32S3_DMA_CLOCK::stamp(uint32_t samples)
+{
+   _w.last.samples += samples;
+   _w.last.time_us = esp_timer_get_time();
+   if(++_w.blocks == DMA_CLOCK_SETTLE_BLOCKS)
+      _w.anchor = _w.last;
+   _state.write(_w);
+}
+
+
+/********************************************************************
+ * @brief Copy the latest block end.
+ */
+bool ESP32S3_DMA_CLOCK::last(dma_stamp_t *st)
+{
+   clock_state_t s;
+   _state.read(&s);
+   *st = s.last;
+   return s.blocks > 0;
+}
+
+
+/********************************************************************
+ * @brief Samples / sec over the whole baseline, nominal while it is
+ * too short.
+ */
+double ESP32S3_DMA_CLOCK::rateOf(const clock_state_t &st, float nominal)
+{
+   int64_t span = st.last.time_us - st.anchor.time_us;
+   if(st.blocks <= DMA_CLOCK_SETTLE_BLOCKS || span < DMA_CLOCK_MIN_SPAN_US)
+      return double(nominal);
+   return double(st.last.samples - st.anchor.samples) * 1e6 / double(span);
+}
+
+
+double ESP32S3_DMA_CLOCK::rate(void)
+{
+   clock_state_t s;
+   _state.read(&s);
+   return rateOf(s, _nominal);
+}
+
+
+/********************************************************************
+ * @brief Fractional sample count at 'time_us', extrapolated from the
+ * latest block end.
+ * @return false if no block completed yet.
+ */
+bool ESP32S3_DMA_CLOCK::position(int64_t time_us, double *sample)
+{
+   clock_state_t s;
+   _state.read(&s);
+   if(s.blocks == 0)
+      return false;
+   *sample = double(s.last.samples) + double(time_us - s.last.time_us) * rateOf(s, _nominal) * 1e-6;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief esp_timer time of sample count 'sample'.
+ */
+int64_t ESP32S3_DMA_CLOCK::timeOf(uint64_t sample)
+{
+   clock_state_t s;
+   _state.read(&s);
+   double ds = double(int64_t(sample - s.last.samples));
+   return s.last.time_us + int64_t(ds * 1e6 / rateOf(s, _nominal));
+}
+
+
+uint32_t ESP32S3_DMA_CLOCK::blocks(void)
+{
+   clock_state_t s;
+   _state.read(&s);
+   return s.blocks;
+}
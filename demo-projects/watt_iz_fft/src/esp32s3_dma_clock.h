@@ -0,0 +1,57 @@
+/********************************************************************
+ * @brief esp32s3_dma_clock.h : Sample clock of an I2S DMA stream,
+ * measured against esp_timer.
+ *
+ * @note Method:
+ * 1) The channel's DMA callback calls stamp() for every block, giving a
+ * (sample count, time) pair at each block end.
+ * 2) The rate is the sample count over the time since the first settled
+ * stamp. The baseline grows for as long as the stream runs, so callback
+ * latency jitter (a few us at each end) fades out: ~1 ppm after 20s.
+ * 3) position() and timeOf() map between time and sample count from the
+ * latest stamp and the measured rate. With one clock per stream,
+ * samples of two streams (mic & speaker) are matched through time.
+ *
+ * Cost: one esp_timer read & a SeqLock write per DMA block.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_timer.h"
+#include "seqlock.h"
+
+#define DMA_CLOCK_SETTLE_BLOCKS     4        // stamps ignored after reset (DMA start up)
+#define DMA_CLOCK_MIN_SPAN_US       1000000  // nominal rate until the baseline is this long
+
+// One DMA block end
+typedef struct {
+   uint64_t samples;                      // samples through DMA
+   int64_t time_us;                       // esp_timer time
+} dma_stamp_t ;
+
+class ESP32S3_DMA_CLOCK {
+   public:
+      ESP32S3_DMA_CLOCK(void) = default;
+      ~ESP32S3_DMA_CLOCK(void) = default;
+
+      void reset(float nominal_rate);     // stream (re)starting, no stamp() may run
+      void stamp(uint32_t samples);       // ISR: a DMA block of 'samples' completed
+      bool last(dma_stamp_t *st);         // latest block end, false if none yet
+      double rate(void);                  // measured samples / sec
+      bool position(int64_t time_us, double *sample);   // sample count at a time
+      int64_t timeOf(uint64_t sample);    // time of a sample count
+      uint32_t blocks(void);              // blocks since reset
+
+   private:
+      typedef struct {
+         dma_stamp_t anchor;              // first stamp after settling
+         dma_stamp_t last;
+         uint32_t blocks;
+      } clock_state_t ;
+
+      SeqLock<clock_state_t> _state;
+      clock_state_t _w = {};              // writer copy (ISR only)
+      float _nominal = 16000.0f;
+
+      static double rateOf(const clock_state_t &st, float nominal);
+};
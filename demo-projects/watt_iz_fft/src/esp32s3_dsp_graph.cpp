@@ -0,0 +1,513 @@
+/********************************************************************
+ * @brief esp32s3_dsp_graph.cpp source file
+ */
+#include "esp32s3_dsp_graph.h"
+
+// VAD formant bands. A bin == 31.25 Hz
+#define FFT_BIN_LOW              4        // 125 hz
+#define FFT_BIN_MID              21       // 660 hz
+#define FFT_BIN_HIGH             64       // 2000 hz
+
+// VAD tuneables
+#define VAD_T_D_START            0.8f     // level above noise floor (log) to start
+#define VAD_T_D_CONT             0.4f     // hysteresis value
+#define VAD_T_BAL_START          1.2f     // LF/HF balance (log) to start. < 1.0 is quiet, neg is HF
+#define VAD_T_BAL_CONT           1.0f     // hysteresis value
+#define VAD_BASE_GATE            0.30f    // below this the noise floor tracks the level
+#define VAD_BASE_ALPHA           0.05f    // quiet tracking speed
+#define VAD_HANGOVER_MS          384      // no hits this long ends speech (4 frames of 96 ms)
+#define VAD_EPSILON              1e-6f    // small value to prevent div by zero
+
+
+/********************************************************************
+ * @brief Allocate a float frame buffer in PSRAM
+ */
+static float *allocFrame(uint32_t len)
+{
+   return (float *)heap_caps_aligned_alloc(32, (len * sizeof(float)) + 256, MALLOC_CAP_SPIRAM);
+}
+
+
+static void freeBufr(void *p)
+{
+   if(p)
+      heap_caps_free(p);
+}
+
+
+/********************************************************************
+ * @brief Source node
+ */
+void DSP_SOURCE_NODE::setup(DspSource_cb cb, void *ctx, uint8_t ports)
+{
+   _cb = cb;
+   _ctx = ctx;
+   _ports = ports & (DSP_PORT_PCM | DSP_PORT_REF | DSP_PORT_I16);
+}
+
+
+bool DSP_SOURCE_NODE::begin(uint32_t len, float sample_rate)
+{
+   end();
+   if(!_cb || _ports == 0)
+      return false;
+   if(_ports & DSP_PORT_PCM)
+      _pcm = allocFrame(len);
+   if(_ports & DSP_PORT_REF)
+      _ref = allocFrame(len);
+   if(_ports & DSP_PORT_I16)
+      _i16 = (int16_t *)heap_caps_malloc((len * sizeof(int16_t)) + 256, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+   if(((_ports & DSP_PORT_PCM) && !_pcm) || ((_ports & DSP_PORT_REF) && !_ref) ||
+            ((_ports & DSP_PORT_I16) && !_i16)) {
+      end();
+      return false;
+   }
+   return true;
+}
+
+
+void DSP_SOURCE_NODE::end(void)
+{
+   freeBufr(_pcm);
+   freeBufr(_ref);
+   freeBufr(_i16);
+   _pcm = _ref = nullptr;
+   _i16 = nullptr;
+}
+
+
+bool DSP_SOURCE_NODE::process(dsp_frame_t &f)
+{
+   f.pcm = _pcm;
+   f.ref = _ref;
+   f.i16 = _i16;
+   return _cb(f, _ctx);
+}
+
+
+/********************************************************************
+ * @brief Convert node
+ */
+bool DSP_CONVERT_NODE::begin(uint32_t len, float sample_rate)
+{
+   end();
+   _pcm = allocFrame(len);
+   return (_pcm != nullptr);
+}
+
+
+void DSP_CONVERT_NODE::end(void)
+{
+   freeBufr(_pcm);
+   _pcm = nullptr;
+}
+
+
+bool DSP_CONVERT_NODE::process(dsp_frame_t &f)
+{
+   for(uint32_t i = 0; i < f.len; i++)
+      _pcm[i] = float(f.i16[i]) * _gain;
+   f.pcm = _pcm;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Echo canceller node
+ */
+bool DSP_AEC_NODE::begin(uint32_t len, float sample_rate)
+{
+   if((len % AEC_BLOCK_SIZE) != 0)
+      return false;
+   return _aec.init();
+}
+
+
+bool DSP_AEC_NODE::process(dsp_frame_t &f)
+{
+   _aec.process(f.pcm, f.ref, f.pcm, f.len);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Low pass filter node
+ */
+bool DSP_LP_NODE::begin(uint32_t len, float sample_rate)
+{
+   end();
+   _filter.init(_cutoff, sample_rate, _q);
+   _out = allocFrame(len);
+   return (_out != nullptr);
+}
+
+
+void DSP_LP_NODE::end(void)
+{
+   freeBufr(_out);
+   _out = nullptr;
+}
+
+
+bool DSP_LP_NODE::process(dsp_frame_t &f)
+{
+   _filter.apply(f.pcm, _out, f.len);
+   f.pcm = _out;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Noise suppressor node. NS block (2j + 1) spans VAD block j
+ * exactly, so its cleaned spectrum is passed on for the VAD.
+ */
+bool DSP_NS_NODE::begin(uint32_t len, float sample_rate)
+{
+   end();
+   if((len % NS_HOP_SIZE) != 0 || !_ns.init(len))
+      return false;
+   _out = allocFrame(len);
+   if(!_out) {
+      _ns.end();
+      return false;
+   }
+   return true;
+}
+
+
+void DSP_NS_NODE::end(void)
+{
+   freeBufr(_out);
+   _out = nullptr;
+   _ns.end();
+}
+
+
+bool DSP_NS_NODE::process(dsp_frame_t &f)
+{
+   uint8_t j;
+
+   _ns.process(f.pcm, _out, f.len);
+   f.pcm = _out;
+   f.num_spectra = 0;
+   for(j = 0; j < DSP_MAX_SUBFRAMES && uint32_t(j + 1) * DSP_VAD_FFT_SIZE <= f.len; j++) {
+      f.spectra[j] = _ns.magnitude((j * 2) + 1);
+      if(!f.spectra[j])
+         break;
+      f.num_spectra++;
+   }
+   return true;
+}
+
+
+/********************************************************************
+ * @brief VAD node
+ */
+bool DSP_VAD_NODE::begin(uint32_t len, float sample_rate)
+{
+   end();
+   _blocks = len / DSP_VAD_FFT_SIZE;
+   if(_blocks > DSP_MAX_SUBFRAMES)
+      _blocks = DSP_MAX_SUBFRAMES;
+   if(_blocks == 0) {                     // short frames: sliding window
+      _blocks = 1;
+      _window = allocFrame(DSP_VAD_FFT_SIZE);
+      if(!_window)
+         return false;
+      memset(_window, 0, DSP_VAD_FFT_SIZE * sizeof(float));
+   }
+   // Own spectra: all blocks of a frame in one multi frame transform (split over the job lanes if parallel_frames)
+   _spectrum = allocFrame(_blocks * DSP_VAD_FFT_SIZE);
+   if(!_spectrum || !_fft.init(DSP_VAD_FFT_SIZE, _blocks * DSP_VAD_FFT_SIZE, 
+            (_window) ? SPECTRAL_AVERAGE : SPECTRAL_NO_SLIDING)) {
+      end();
+      return false;
+   }
+   _stop_misses = uint16_t(lroundf(VAD_HANGOVER_MS * 0.001f * sample_rate / float(len)));
+   if(_stop_misses == 0)
+      _stop_misses = 1;
+   _noise_baseline = 0.0f;
+   _baseline_init = false;
+   _in_speech = false;
+   _missed_frames = 0;
+   _hit_hist = 0;
+   return true;
+}
+
+
+void DSP_VAD_NODE::end(void)
+{
+   freeBufr(_spectrum);
+   freeBufr(_window);
+   _spectrum = _window = nullptr;
+   _fft.end();
+}
+
+
+/********************************************************************
+ * @brief Formant analysis of one block: log energy of 125 - 2000 Hz
+ * against the noise floor, and the LF / HF balance. Hysteresis on both
+ * thresholds while in speech.
+ */
+bool DSP_VAD_NODE::block(const float *spectrum)
+{
+   float e_all = 0.0f, e_low = 0.0f, e_high = 0.0f, d_all, ratio;
+   float td   = (_in_speech) ? VAD_T_D_CONT   : VAD_T_D_START;
+   float tbal = (_in_speech) ? VAD_T_BAL_CONT : VAD_T_BAL_START;
+   uint16_t k;
+
+   for(k = FFT_BIN_LOW; k < FFT_BIN_HIGH; k++) {
+      float v = spectrum[k];
+      e_all += v;
+      if(k < FFT_BIN_MID)  e_low += v;
+      else                 e_high += v;
+   }
+   e_all = logf((e_all / float(FFT_BIN_HIGH - FFT_BIN_LOW)) + VAD_EPSILON);
+
+   // Baseline snapshot of the first block, then a gated running average
+   if(!_baseline_init) {
+      _noise_baseline = e_all;
+      _baseline_init = true;
+   }
+   d_all = e_all - _noise_baseline;
+   if(d_all < VAD_BASE_GATE && !_in_speech)
+      _noise_baseline = (1.0f - VAD_BASE_ALPHA) * _noise_baseline + VAD_BASE_ALPHA * e_all;
+
+   e_low = logf((e_low / float(FFT_BIN_MID - FFT_BIN_LOW)) + VAD_EPSILON);
+   e_high = logf((e_high / float(FFT_BIN_HIGH - FFT_BIN_MID)) + VAD_EPSILON);
+   ratio = e_low - e_high;                // LOG(LF/HF)
+   return (d_all > td && ratio > tbal);
+}
+
+
+bool DSP_VAD_NODE::process(dsp_frame_t &f)
+{
+   uint8_t j;
+   bool use_spectra = (f.ports & DSP_PORT_SPECTRA);
+   bool prev_in_speech = _in_speech;
+
+   f.hits = 0;
+   if(_window) {
+      // Shift the frame in, analyse the latest DSP_VAD_FFT_SIZE samples
+      uint32_t keep = DSP_VAD_FFT_SIZE - f.len;
+      memmove(_window, _window + f.len, keep * sizeof(float));
+      memcpy(_window + keep, f.pcm, f.len * sizeof(float));
+      _fft.compute(_window, _spectrum, true);
+      _hit_hist = (_hit_hist << 1) | (block(_spectrum) ? 1 : 0);
+      f.hits = _hit_hist & 0x01;
+      f.strong = (__builtin_popcount(_hit_hist & 0x07) >= 2);   // 2 of the latest 3
+   } else {
+      if(!use_spectra)
+         _fft.compute(f.pcm, _spectrum, true);   // _blocks spectra of DSP_VAD_FFT_SIZE
+      for(j = 0; j < _blocks; j++) {
+         const float *spectrum = _spectrum + (j * DSP_VAD_FFT_SIZE);
+         if(use_spectra) {
+            if(j >= f.num_spectra)
+               break;
+            spectrum = f.spectra[j];
+         }
+         if(block(spectrum))
+            f.hits++;
+      }
+      f.strong = (f.hits * 3 >= _blocks * 2);   // 2 of 3 blocks
+   }
+
+   // Start on the strong criterion, continue on any hit, drop out after the hangover
+   if(!_in_speech) {
+      _in_speech = f.strong;
+      _missed_frames = 0;
+   } else if(f.hits > 0) {
+      _missed_frames = 0;
+   } else if(++_missed_frames >= _stop_misses) {
+      _in_speech = false;
+      _missed_frames = 0;
+   }
+   f.speech = _in_speech;
+   f.speech_edge = (_in_speech != prev_in_speech);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief AGC node
+ */
+bool DSP_AGC_NODE::begin(uint32_t len, float sample_rate)
+{
+   _agc.init(_cfg, sample_rate);
+   return true;
+}
+
+
+bool DSP_AGC_NODE::process(dsp_frame_t &f)
+{
+   _agc.apply(f.pcm, f.pcm, f.len);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Encoder node
+ */
+bool DSP_ENCODE_NODE::begin(uint32_t len, float sample_rate)
+{
+   end();
+   _own = (int16_t *)heap_caps_malloc((len * sizeof(int16_t)) + 256, MALLOC_CAP_SPIRAM | MALLOC_CAP_8BIT);
+   return (_own != nullptr);
+}
+
+
+void DSP_ENCODE_NODE::end(void)
+{
+   freeBufr(_own);
+   _own = nullptr;
+}
+
+
+bool DSP_ENCODE_NODE::process(dsp_frame_t &f)
+{
+   int16_t *dst = (_dst) ? _dst : _own;
+   for(uint32_t i = 0; i < f.len; i++) {
+      float fs = f.pcm[i];
+      dst[i] = (fs > 32767.0f) ? 32767 : (fs < -32768.0f) ? -32768 : int16_t(fs);
+   }
+   f.i16 = dst;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Tap node
+ */
+void DSP_TAP_NODE::setup(const char *name, uint8_t inputs, DspTap_cb cb, void *ctx)
+{
+   _name = name;
+   _inputs = inputs;
+   _cb = cb;
+   _ctx = ctx;
+}
+
+
+bool DSP_TAP_NODE::process(dsp_frame_t &f)
+{
+   if(_cb)
+      _cb(f, _ctx);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Start a new graph. Nodes of the previous graph are freed.
+ * @param len - samples per frame.
+ */
+void ESP32S3_DSP_GRAPH::begin(uint32_t len, float sample_rate)
+{
+   end();
+   _len = len;
+   _rate = sample_rate;
+}
+
+
+void ESP32S3_DSP_GRAPH::end(void)
+{
+   for(uint8_t i = 0; i < _num_nodes; i++)
+      _slots[i].node->end();
+   _num_nodes = 0;
+   _ports = 0;
+}
+
+
+/********************************************************************
+ * @brief Append a node and allocate its buffers.
+ * @return false if the graph is full, an input port is not produced by
+ *    an earlier node, or the node can't run at this frame size.
+ */
+bool ESP32S3_DSP_GRAPH::add(DSP_NODE *node)
+{
+   if(!node || _num_nodes >= DSP_GRAPH_MAX_NODES || contains(node))
+      return false;
+   if((node->inputs() & _ports) != node->inputs())
+      return false;
+   if(!node->begin(_len, _rate))
+      return false;
+   _slots[_num_nodes].node = node;
+   _slots[_num_nodes].frames = 0;
+   _slots[_num_nodes].max_us = 0;
+   _slots[_num_nodes].total_us = 0;
+   _num_nodes++;
+   _ports |= node->outputs();
+   return true;
+}
+
+
+bool ESP32S3_DSP_GRAPH::contains(DSP_NODE *node)
+{
+   for(uint8_t i = 0; i < _num_nodes; i++) {
+      if(_slots[i].node == node)
+         return true;
+   }
+   return false;
+}
+
+
+/********************************************************************
+ * @brief Pass one frame through the nodes.
+ * @return false if a node dropped the frame (source had no audio).
+ */
+bool ESP32S3_DSP_GRAPH::run(dsp_frame_t &f)
+{
+   int64_t t0, t1;
+   uint32_t us;
+   uint8_t out;
+
+   memset(&f, 0, sizeof(dsp_frame_t));
+   f.len = _len;
+   if(_num_nodes == 0)
+      return false;
+   t0 = esp_timer_get_time();
+   for(uint8_t i = 0; i < _num_nodes; i++) {
+      graph_slot_t &s = _slots[i];
+      if(!s.node->process(f))
+         return false;
+      t1 = esp_timer_get_time();
+      if(i == 0)
+         f.ready_us = t1;
+      us = uint32_t(t1 - t0);
+      t0 = t1;
+      s.frames++;
+      s.total_us += us;
+      if(us > s.max_us)
+         s.max_us = us;
+      out = s.node->outputs();
+      if((out & DSP_PORT_PCM) && !(out & DSP_PORT_SPECTRA))
+         f.ports &= ~DSP_PORT_SPECTRA;    // samples changed - spectra are stale
+      f.ports |= out;
+   }
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Copy the node timing, in graph order.
+ */
+uint8_t ESP32S3_DSP_GRAPH::stats(dsp_node_stats_t *st, uint8_t max_nodes)
+{
+   uint8_t i;
+
+   for(i = 0; i < _num_nodes && i < max_nodes; i++) {
+      st[i].name = _slots[i].node->name();
+      st[i].frames = _slots[i].frames;
+      st[i].avg_us = (_slots[i].frames) ? uint32_t(_slots[i].total_us / _slots[i].frames) : 0;
+      st[i].max_us = _slots[i].max_us;
+   }
+   return i;
+}
+
+
+void ESP32S3_DSP_GRAPH::resetStats(void)
+{
+   for(uint8_t i = 0; i < _num_nodes; i++) {
+      _slots[i].frames = 0;
+      _slots[i].max_us = 0;
+      _slots[i].total_us = 0;
+   }
+}
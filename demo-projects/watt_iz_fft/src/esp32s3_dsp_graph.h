@@ -0,0 +1,292 @@
+/********************************************************************
+ * @brief esp32s3_dsp_graph.h : Block processing graph for the capture
+ * path.
+ *
+ * @note Method:
+ * 1) A node wraps one DSP stage (source, convert, AEC, LP filter, NS,
+ * VAD, AGC, encoder, tap). It declares the ports it needs and the ports
+ * it produces as DSP_PORT_xxx bits. Ports are fields of one dsp_frame_t
+ * that travels through the nodes in order.
+ * 2) A graph is built per capture command: begin() frees the previous
+ * nodes, then add() appends the nodes the command asks for. add()
+ * rejects a node whose inputs no earlier node produces, and calls the
+ * node's begin() so every buffer is allocated before the first frame.
+ * Nodes that are not added allocate nothing and are never called.
+ * 3) A node that changes the samples (PCM) without producing spectra
+ * invalidates the SPECTRA port, so spectra always describe the current
+ * samples.
+ * 4) run() passes one frame through the nodes and times each of them
+ * with esp_timer. stats() reports frames, average & max us per node. A
+ * source that waits for audio (mic DMA) includes that wait.
+ * 5) Frames shorter than DSP_VAD_FFT_SIZE (low latency) are analysed by
+ * the VAD on a sliding window: each frame shifts in, and the latest
+ * DSP_VAD_FFT_SIZE samples are analysed once per frame. Hangover is set
+ * in ms so it holds the same time at any frame size.
+ *
+ * Cost: one esp_timer read & one virtual call per node per frame.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "esp_timer.h"
+#include "esp32s3_fft.h"
+#include "esp32s3_ns.h"
+#include "esp32s3_aec.h"
+#include "esp32s3_agc.h"
+
+#define DSP_GRAPH_MAX_NODES      12
+#define DSP_MAX_SUBFRAMES        8        // analysis blocks (spectra) per frame
+#define DSP_VAD_FFT_SIZE         512      // VAD analysis block (bin == 31.25 Hz @ 16KHz)
+
+// Port types (bit mask) - fields of dsp_frame_t
+#define DSP_PORT_PCM             0x01     // float samples 'pcm'
+#define DSP_PORT_REF             0x02     // float far end (speaker) reference 'ref'
+#define DSP_PORT_SPECTRA         0x04     // magnitude spectra of the frame's analysis blocks
+#define DSP_PORT_I16             0x08     // 16 bit samples 'i16'
+#define DSP_PORT_SPEECH          0x10     // VAD decision
+
+// One frame passing through a graph
+typedef struct {
+   uint32_t len;                          // samples in the frame
+   uint8_t ports;                         // DSP_PORT_xxx valid so far
+   float *pcm;
+   float *ref;
+   int16_t *i16;
+   float *spectra[DSP_MAX_SUBFRAMES];     // one per DSP_VAD_FFT_SIZE block
+   uint8_t num_spectra;
+   uint8_t hits;                          // VAD blocks with speech evidence
+   bool strong;                           // VAD start criterion met (2 of 3 blocks)
+   bool speech;                           // VAD state after hangover
+   bool speech_edge;                      // 'speech' changed on this frame
+   int64_t time_us;                       // esp_timer time of the first sample, 0 if unknown
+   int64_t ready_us;                      // esp_timer time the source delivered the frame
+} dsp_frame_t ;
+
+// Timing of one node
+typedef struct {
+   const char *name;
+   uint32_t frames;
+   uint32_t avg_us;
+   uint32_t max_us;
+} dsp_node_stats_t ;
+
+// Fills the ports a source node declares. Ret false: no frame (timeout, end of file)
+using DspSource_cb = bool (*)(dsp_frame_t &f, void *ctx);
+// Sees the frame without changing it
+using DspTap_cb = void (*)(const dsp_frame_t &f, void *ctx);
+
+
+/********************************************************************
+ * @brief Graph node base class
+ */
+class DSP_NODE {
+   public:
+      virtual ~DSP_NODE(void) = default;
+      virtual const char *name(void) = 0;
+      virtual uint8_t inputs(void) = 0;   // DSP_PORT_xxx required
+      virtual uint8_t outputs(void) = 0;  // DSP_PORT_xxx produced
+      virtual bool begin(uint32_t len, float sample_rate) { return true; }   // allocate & reset
+      virtual void end(void) {}           // free
+      virtual bool process(dsp_frame_t &f) = 0;   // ret false to drop the frame
+};
+
+
+// Calls a source callback with the node's own buffers
+class DSP_SOURCE_NODE : public DSP_NODE {
+   public:
+      ~DSP_SOURCE_NODE(void) { end(); }
+      void setup(DspSource_cb cb, void *ctx, uint8_t ports);   // PCM, REF and / or I16
+      const char *name(void) { return "source"; }
+      uint8_t inputs(void) { return 0; }
+      uint8_t outputs(void) { return _ports; }
+      bool begin(uint32_t len, float sample_rate);
+      void end(void);
+      bool process(dsp_frame_t &f);
+
+   private:
+      DspSource_cb _cb = nullptr;
+      void *_ctx = nullptr;
+      uint8_t _ports = DSP_PORT_PCM;
+      float *_pcm = nullptr;
+      float *_ref = nullptr;
+      int16_t *_i16 = nullptr;
+};
+
+
+// 16 bit samples to float, with gain
+class DSP_CONVERT_NODE : public DSP_NODE {
+   public:
+      ~DSP_CONVERT_NODE(void) { end(); }
+      void setup(float gain) { _gain = gain; }
+      const char *name(void) { return "convert"; }
+      uint8_t inputs(void) { return DSP_PORT_I16; }
+      uint8_t outputs(void) { return DSP_PORT_PCM; }
+      bool begin(uint32_t len, float sample_rate);
+      void end(void);
+      bool process(dsp_frame_t &f);
+
+   private:
+      float _gain = 1.0f;
+      float *_pcm = nullptr;
+};
+
+
+// Echo canceller, in place
+class DSP_AEC_NODE : public DSP_NODE {
+   public:
+      const char *name(void) { return "aec"; }
+      uint8_t inputs(void) { return DSP_PORT_PCM | DSP_PORT_REF; }
+      uint8_t outputs(void) { return DSP_PORT_PCM; }
+      bool begin(uint32_t len, float sample_rate);   // len multiple of AEC_BLOCK_SIZE
+      void end(void) { _aec.end(); }
+      bool process(dsp_frame_t &f);
+
+   private:
+      ESP32S3_ECHO_CANCEL _aec;
+};
+
+
+// Butterworth low pass filter
+class DSP_LP_NODE : public DSP_NODE {
+   public:
+      ~DSP_LP_NODE(void) { end(); }
+      void setup(float cutoff_freq, float Qfactor) { _cutoff = cutoff_freq; _q = Qfactor; }
+      const char *name(void) { return "lowpass"; }
+      uint8_t inputs(void) { return DSP_PORT_PCM; }
+      uint8_t outputs(void) { return DSP_PORT_PCM; }
+      bool begin(uint32_t len, float sample_rate);
+      void end(void);
+      bool process(dsp_frame_t &f);
+
+   private:
+      ESP32S3_LP_FILTER _filter;
+      float _cutoff = 0.0f;
+      float _q = 0.5f;
+      float *_out = nullptr;
+};
+
+
+// STFT noise suppressor. Its cleaned spectra feed the VAD
+class DSP_NS_NODE : public DSP_NODE {
+   public:
+      ~DSP_NS_NODE(void) { end(); }
+      const char *name(void) { return "ns"; }
+      uint8_t inputs(void) { return DSP_PORT_PCM; }
+      uint8_t outputs(void) { return DSP_PORT_PCM | DSP_PORT_SPECTRA; }
+      bool begin(uint32_t len, float sample_rate);   // len multiple of NS_HOP_SIZE
+      void end(void);
+      bool process(dsp_frame_t &f);
+
+   private:
+      ESP32S3_NOISE_SUPPRESS _ns;
+      float *_out = nullptr;
+};
+
+
+// Formant VAD: band energies against a tracked noise floor
+class DSP_VAD_NODE : public DSP_NODE {
+   public:
+      ~DSP_VAD_NODE(void) { end(); }
+      const char *name(void) { return "vad"; }
+      uint8_t inputs(void) { return DSP_PORT_PCM; }   // uses SPECTRA when valid
+      uint8_t outputs(void) { return DSP_PORT_SPEECH; }
+      bool begin(uint32_t len, float sample_rate);   // short frames use a sliding window
+      void end(void);
+      bool process(dsp_frame_t &f);
+
+   private:
+      ESP32S3_FFT _fft;
+      float *_spectrum = nullptr;         // own FFT output when no SPECTRA, one per block
+      float *_window = nullptr;           // sliding window, frames < DSP_VAD_FFT_SIZE
+      uint8_t _blocks = 0;                // analysis blocks per frame (1 when sliding)
+      uint8_t _hit_hist = 0;              // sliding: hits of the latest analyses, bit 0 newest
+      uint16_t _stop_misses = 0;          // hangover in frames
+      float _noise_baseline = 0.0f;
+      bool _baseline_init = false;
+      bool _in_speech = false;
+      uint16_t _missed_frames = 0;
+
+      bool block(const float *spectrum);  // ret true: speech evidence
+};
+
+
+// Automatic gain control, in place
+class DSP_AGC_NODE : public DSP_NODE {
+   public:
+      void setup(const agc_config_t &config) { _cfg = config; }
+      const char *name(void) { return "agc"; }
+      uint8_t inputs(void) { return DSP_PORT_PCM; }
+      uint8_t outputs(void) { return DSP_PORT_PCM; }
+      bool begin(uint32_t len, float sample_rate);
+      bool process(dsp_frame_t &f);
+
+   private:
+      ESP32S3_AGC _agc;
+      agc_config_t _cfg = AGC_CONFIG_RECORD;
+};
+
+
+// Float to 16 bit with saturation, into target() or an own buffer
+class DSP_ENCODE_NODE : public DSP_NODE {
+   public:
+      ~DSP_ENCODE_NODE(void) { end(); }
+      void target(int16_t *dst) { _dst = dst; }   // e.g. the next ring slot, nullptr: own buffer
+      const char *name(void) { return "encode"; }
+      uint8_t inputs(void) { return DSP_PORT_PCM; }
+      uint8_t outputs(void) { return DSP_PORT_I16; }
+      bool begin(uint32_t len, float sample_rate);
+      void end(void);
+      bool process(dsp_frame_t &f);
+
+   private:
+      int16_t *_dst = nullptr;
+      int16_t *_own = nullptr;
+};
+
+
+// Hands the frame to a callback (keyword spotter, meters)
+class DSP_TAP_NODE : public DSP_NODE {
+   public:
+      void setup(const char *name, uint8_t inputs, DspTap_cb cb, void *ctx);
+      const char *name(void) { return _name; }
+      uint8_t inputs(void) { return _inputs; }
+      uint8_t outputs(void) { return 0; }
+      bool process(dsp_frame_t &f);
+
+   private:
+      const char *_name = "tap";
+      uint8_t _inputs = DSP_PORT_PCM;
+      DspTap_cb _cb = nullptr;
+      void *_ctx = nullptr;
+};
+
+
+class ESP32S3_DSP_GRAPH {
+   public:
+      ESP32S3_DSP_GRAPH(void) = default;
+      ~ESP32S3_DSP_GRAPH(void) { end(); }
+
+      void begin(uint32_t len, float sample_rate=16000.0);   // drop old nodes, new frame size
+      void end(void);                     // free all nodes
+      bool add(DSP_NODE *node);           // append, false if inputs missing or begin failed
+      bool contains(DSP_NODE *node);
+      bool run(dsp_frame_t &f);           // one frame, false if dropped (no source frame)
+      uint8_t size(void) { return _num_nodes; }
+      uint8_t stats(dsp_node_stats_t *st, uint8_t max_nodes);   // ret nodes reported
+      void resetStats(void);
+
+   private:
+      typedef struct {
+         DSP_NODE *node;
+         uint32_t frames;
+         uint32_t max_us;
+         uint64_t total_us;
+      } graph_slot_t ;
+
+      graph_slot_t _slots[DSP_GRAPH_MAX_NODES];
+      uint8_t _num_nodes = 0;
+      uint8_t _ports = 0;                 // ports produced by the nodes added so far
+      uint32_t _len = 0;
+      float _rate = 16000.0f;
+};
@@ -16,9 +16,25 @@ ESP32S3_FFT::ESP32S3_FFT(void)
    hann_window = nullptr;
    fft_buffer = nullptr;
    fft_output = nullptr;
+   _lanes = 1;
+   for(uint8_t i = 0; i < JOBS_NUM_LANES; i++) {
+      lane_buffer[i] = nullptr;
+      lane_output[i] = nullptr;
+   }
 }
 
 
+/********************************************************************
+ * @brief One compute() split over the job lanes
+ */
+typedef struct {
+   ESP32S3_FFT *fft;
+   float *source_data;
+   float *output_data;
+   bool use_hann_window;
+} fft_job_t ;
+
+
 /********************************************************************
  * @brief ESP32S3_FFT class destructor
  */
@@ -90,6 +106,22 @@ fft_table_t * ESP32S3_FFT::init(uint32_t fft_size, uint32_t fft_samples, uint8_t
    if (!hann_window || !fft_buffer || !fft_output) {  // check if memory allocated OK
       return NULL;
    } 
+
+   // Split multi frame transforms get buffers for the other job lanes. Without them frames run serially.
+   freeLanes();
+   lane_buffer[0] = fft_buffer;
+   lane_output[0] = fft_output;
+   if(parallel_frames && _num_sliding_frames > 1) {
+      for(i = 1; i < JOBS_NUM_LANES; i++) {
+         lane_buffer[i] = (float *) heap_caps_aligned_alloc(32, ((_fft_size * 2) * sizeof(float)) + 64, MALLOC_CAP_SPIRAM);
+         lane_output[i] = (float *) heap_caps_aligned_alloc(32, _fft_size * sizeof(float), MALLOC_CAP_SPIRAM);
+         if(!lane_buffer[i] || !lane_output[i]) {
+            freeLanes();
+            break;
+         }
+         _lanes = i + 1;
+      }
+   }
    
    // init the ESP32-S3 DSP engine
    dsps_fft2r_init_fc32(NULL, _fft_size);
@@ -111,51 +143,133 @@ fft_table_t * ESP32S3_FFT::init(uint32_t fft_size, uint32_t fft_samples, uint8_t
  */
 void ESP32S3_FFT::compute(float *source_data, float *output_data, bool use_hann_window)
 {
-   uint16_t frame, start, i, j;
+   uint16_t i;
+   uint8_t lane;
+   fft_job_t job = {this, source_data, output_data, use_hann_window};
+
+   // zero the result buffers
+   for(lane = 0; lane < _lanes; lane++) {
+      for(i=0; i<_fft_size; i++)
+         lane_output[lane][i] = 0.0;
+   }
 
-   // zero the result buffer
-   for(i=0; i<_fft_size; i++)
-      fft_output[i] = 0.0;
+   // --- Sliding FFT Loop --- one frame per job, over both cores if split
+   if(_lanes > 1)
+      jobs.parallelFor(_num_sliding_frames, frameJob, &job);
+   else
+      frames(source_data, output_data, use_hann_window, 0, _num_sliding_frames, 0);
 
-   // --- Sliding FFT Loop ---         
-   for (frame = 0; frame < _num_sliding_frames; frame++) {
+   // transfer averaged FFT to 'output_data'
+   if(output_data && _spectral_select == SPECTRAL_AVERAGE) {
+      for(lane = 1; lane < _lanes; lane++) {
+         for(i=0; i < _fft_size; i++)
+            fft_output[i] += lane_output[lane][i];
+      }
+      for(i=0; i < _fft_size; i++) {
+         output_data[i] = fft_output[i] / float(_num_sliding_frames);
+      }
+   }
+}
+
+
+/********************************************************************
+ * @brief Transform frames [first, last) with the buffers of 'lane'.
+ */
+void ESP32S3_FFT::frames(float *source_data, float *output_data, bool use_hann_window, 
+         uint32_t first, uint32_t last, uint8_t lane)
+{
+   uint32_t frame, start, i, j;
+   float *buf = lane_buffer[lane];
+   float *acc = lane_output[lane];
+
+   for (frame = first; frame < last; frame++) {
       start = frame * _hop_size;
 
-      // Multiply input * Hann window directly & save into fft_buffer's real parts (even nums)
+      // Multiply input * Hann window directly & save into the buffer's real parts (even nums)
       if(use_hann_window) {
-         dsps_mul_f32(&source_data[start], hann_window, fft_buffer, _fft_size, 1, 1, 2); //_fft_size, 1, 1, 2);
+         dsps_mul_f32(&source_data[start], hann_window, buf, _fft_size, 1, 1, 2);
       }
 
       // Clear imaginary parts (odd indices) for FFT calc
       for (i = 0; i < _fft_size; i++) {
          if(!use_hann_window)
-            fft_buffer[2 * i] = source_data[start + i];  // keep real data
-         fft_buffer[2 * i + 1] = 0.0f;    // zero out imaginary data
+            buf[2 * i] = source_data[start + i];  // keep real data
+         buf[2 * i + 1] = 0.0f;           // zero out imaginary data
       }     
 
       // compute FFT
-      dsps_fft2r_fc32(fft_buffer, _fft_size);
-      dsps_bit_rev_fc32(fft_buffer, _fft_size);    
+      dsps_fft2r_fc32(buf, _fft_size);
+      dsps_bit_rev_fc32(buf, _fft_size);    
 
       // compute magnitudes
       for (j = 0; j < _fft_size; j++) {
-         float real = fft_buffer[2 * j];
-         float imag = fft_buffer[2 * j + 1];
+         float real = buf[2 * j];
+         float imag = buf[2 * j + 1];
          float mag = sqrtf(real * real + imag * imag);  // sqrt ((real sqr) + (imag sqr))
          if(_spectral_select == SPECTRAL_AVERAGE) {     // output one averaged _hop_size
-            fft_output[j] += mag;
+            acc[j] += mag;
          }
          else if(_spectral_select == SPECTRAL_NO_SLIDING || _spectral_select == SPECTRAL_SLIDING) {   // no frame averaging, output all sequential frames
             output_data[(frame * _fft_size) + j] = mag;          
          }
       }
    }   
+}
 
-   // transfer averaged FFT to 'output_data'
-   if(output_data && _spectral_select == SPECTRAL_AVERAGE) {
-      for(i=0; i < _fft_size; i++) {
-         output_data[i] = fft_output[i] / float(_num_sliding_frames);
-      }
+
+void ESP32S3_FFT::frameJob(void *ctx, uint32_t begin, uint32_t end, uint8_t lane)
+{
+   fft_job_t *job = (fft_job_t *)ctx;
+   job->fft->frames(job->source_data, job->output_data, job->use_hann_window, begin, end, lane);
+}
+
+
+/********************************************************************
+ * @brief Compute the complex spectrum of one block of _fft_size samples.
+ * @param source_data - ptr to _fft_size float samples.
+ * @param cplx_output - ptr to (_fft_size * 2) floats. Receives interleaved 
+ *    re/im pairs in natural (bit reversed) order. Must be 16 byte aligned.
+ * @param use_hann_window - if false, source data is transformed as is. 
+ *    Callers that need a different window apply it before the call.
+ */
+void ESP32S3_FFT::computeComplex(float *source_data, float *cplx_output, bool use_hann_window)
+{
+   uint16_t i;
+   if(use_hann_window) {
+      dsps_mul_f32(source_data, hann_window, cplx_output, _fft_size, 1, 1, 2);
+   } else {
+      for (i = 0; i < _fft_size; i++) 
+         cplx_output[2 * i] = source_data[i];
+   }
+   for (i = 0; i < _fft_size; i++) 
+      cplx_output[2 * i + 1] = 0.0f;      // zero out imaginary data
+
+   dsps_fft2r_fc32(cplx_output, _fft_size);
+   dsps_bit_rev_fc32(cplx_output, _fft_size);
+}
+
+
+/********************************************************************
+ * @brief In-place inverse FFT of a complex spectrum created by 
+ *    computeComplex(). Uses the conjugate trick so the forward radix-2 
+ *    tables are shared: ifft(X) = conj(fft(conj(X))) / N.
+ * @param cplx_data - (_fft_size * 2) interleaved re/im floats. On return 
+ *    the even indices hold the real time domain samples.
+ */
+void ESP32S3_FFT::inverse(float *cplx_data)
+{
+   uint16_t i;
+   const float scale = 1.0f / float(_fft_size);
+
+   for (i = 0; i < _fft_size; i++) 
+      cplx_data[2 * i + 1] = -cplx_data[2 * i + 1];
+
+   dsps_fft2r_fc32(cplx_data, _fft_size);
+   dsps_bit_rev_fc32(cplx_data, _fft_size);
+
+   for (i = 0; i < _fft_size; i++) {
+      cplx_data[2 * i] *= scale;
+      cplx_data[2 * i + 1] *= -scale;
    }
 }
 
@@ -183,6 +297,26 @@ void ESP32S3_FFT::end(void)
       free(fft_output);
       fft_output = nullptr;
    }
+   freeLanes();
+}
+
+
+/********************************************************************
+ * @brief Free the buffers of job lanes 1.. (lane 0 uses fft_buffer).
+ */
+void ESP32S3_FFT::freeLanes(void)
+{
+   for(uint8_t i = 1; i < JOBS_NUM_LANES; i++) {
+      if(lane_buffer[i])
+         free(lane_buffer[i]);
+      if(lane_output[i])
+         free(lane_output[i]);
+      lane_buffer[i] = nullptr;
+      lane_output[i] = nullptr;
+   }
+   lane_buffer[0] = fft_buffer;
+   lane_output[0] = fft_output;
+   _lanes = 1;
 }
 
 
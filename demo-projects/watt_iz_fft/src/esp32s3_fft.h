@@ -10,7 +10,12 @@
  * 3) This code is designed for the arduino style development environment. 
  * Developed using VSCode / PlatformIO.
  * 
- * Performance: FFT computed in approx 2ms for 1024 samples.
+ * Performance: FFT computed in approx 2ms for 1024 samples. Multi frame
+ * transforms (SPECTRAL_NO_SLIDING, SPECTRAL_SLIDING, SPECTRAL_AVERAGE over
+ * more than one block) can split their frames over both cores when the 
+ * job system (esp32s3_jobs.h) is running; each lane has its own buffers.
+ * The split is off ('parallel_frames') until its speedup is measured on 
+ * the target.
  * 
  */
 #pragma once
@@ -18,6 +23,7 @@
 #include <Arduino.h>
 #include "esp_dsp.h"
 #include "esp_heap_caps.h"
+#include "esp32s3_jobs.h"
 
 // FFT constants
 #define FFT_SAMPLING_FREQ  16000
@@ -45,7 +51,13 @@ class ESP32S3_FFT {
       fft_table_t * init(uint32_t fft_size, uint32_t fft_samples, uint8_t spectral_select); // call on 1st use or when changing parameters                  
       void end(void);      
       void compute(float *source_data, float *output_data, bool use_hann_window=true);  // call to perform FFT
+      void computeComplex(float *source_data, float *cplx_output, bool use_hann_window=true); // one block -> re/im pairs
+      void inverse(float *cplx_data);     // in-place inverse FFT. Real result in even indices
       float calcFreqBin(float sample_rate_hz, float fft_size);  // return freq / output data point
+      uint16_t size(void) { return _fft_size; }
+
+      // Tuneables
+      bool parallel_frames = false;       // true: split multi frame transforms over the job lanes. Set before init()
 
    private:
       uint16_t _fft_size;                 // fft block size - in powers of 2 (256, 512, 1024, etc.)
@@ -57,6 +69,14 @@ class ESP32S3_FFT {
       float *hann_window;                 // hann window to reduce spurious freq at start & end of input data
       float *fft_buffer;                  // internal working buffer for real & imaginary FFT values
       float *fft_output;                  // averaged FFT - same size as fft block
+      uint8_t _lanes;                     // job lanes with buffers, 1: frames run serially
+      float *lane_buffer[JOBS_NUM_LANES]; // per lane working buffer, [0] is fft_buffer
+      float *lane_output[JOBS_NUM_LANES]; // per lane magnitude sums, [0] is fft_output
+
+      void freeLanes(void);
+      void frames(float *source_data, float *output_data, bool use_hann_window, 
+               uint32_t first, uint32_t last, uint8_t lane);
+      static void frameJob(void *ctx, uint32_t begin, uint32_t end, uint8_t lane);
 };
 
 
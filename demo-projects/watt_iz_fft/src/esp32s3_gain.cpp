@@ -0,0 +1,125 @@
+/********************************************************************
+ * @brief esp32s3_gain.cpp source file
+ *
+ * @note Block ramped Q15 gain with optional soft knee limiter.
+ */
+#include "esp32s3_gain.h"
+
+
+/********************************************************************
+ * @brief Set the ramp time for gain changes.
+ * @param sample_rate - audio sample rate in Hz.
+ * @param ramp_ms - time for a gain change to complete.
+ */
+void ESP32S3_GAIN::init(float sample_rate, uint16_t ramp_ms)
+{
+   uint32_t blocks = uint32_t(sample_rate * ramp_ms / (1000.0f * GAIN_BLOCK_SIZE));
+   _ramp_blocks = (blocks > 0) ? blocks : 1;
+   _step = 0;
+   _target = _gain;
+}
+
+
+/********************************************************************
+ * @brief Ramp to a new gain over the ramp time.
+ * @param gain_q15 - 0 (mute) to GAIN_UNITY_Q15.
+ */
+void ESP32S3_GAIN::setGain(int16_t gain_q15)
+{
+   if(gain_q15 < 0) gain_q15 = 0;
+   _target = gain_q15;
+   _step = (_target - _gain) / int32_t(_ramp_blocks);
+   if(_step == 0 && _target != _gain)     // tiny change - finish next block
+      _step = _target - _gain;
+}
+
+
+/********************************************************************
+ * @brief Ramp to a volume of 0 - 100%.
+ */
+void ESP32S3_GAIN::setVolume(uint8_t percent)
+{
+   if(percent > 100) percent = 100;
+   setGain(int16_t((int32_t(percent) * GAIN_UNITY_Q15) / 100));
+}
+
+
+/********************************************************************
+ * @brief Change the gain immediately, e.g. before a stream starts.
+ */
+void ESP32S3_GAIN::jumpGain(int16_t gain_q15)
+{
+   if(gain_q15 < 0) gain_q15 = 0;
+   _gain = _target = gain_q15;
+   _step = 0;
+}
+
+
+/********************************************************************
+ * @brief Enable/disable the soft knee limiter.
+ * @param knee - start of the soft region as a fraction of full scale.
+ */
+void ESP32S3_GAIN::setLimiter(bool enab, float knee)
+{
+   _limit = enab;
+   _knee = kneeQ15(knee);
+}
+
+
+/********************************************************************
+ * @brief Apply gain (and limiter) to int16 samples.
+ * @param in - samples. May be read only (flash) when out != in.
+ * @param out - result, may be the same as 'in'.
+ * @param len - number of samples. Any length; the gain steps every
+ *    GAIN_BLOCK_SIZE samples while ramping.
+ */
+void ESP32S3_GAIN::apply(const int16_t *in, int16_t *out, uint32_t len)
+{
+   uint32_t done = 0;
+   while(done < len) {
+      uint32_t n = len - done;
+      if(_gain != _target) {              // ramping - one step per block
+         if(n > GAIN_BLOCK_SIZE) n = GAIN_BLOCK_SIZE;
+         _gain += _step;
+         if((_step > 0 && _gain > _target) || (_step < 0 && _gain < _target))
+            _gain = _target;
+      }
+      if(_gain != GAIN_UNITY_Q15)
+         dsps_mulc_s16(in + done, out + done, n, int16_t(_gain), 1, 1);
+      else if(in != out)                  // unity in place is a no-op
+         memcpy(out + done, in + done, n * sizeof(int16_t));
+      done += n;
+   }
+   if(_limit)
+      limit(out, len);
+}
+
+
+/********************************************************************
+ * @brief Soft knee limiter: |y| = knee + d*s/(s+d) above the knee.
+ */
+void ESP32S3_GAIN::limit(int16_t *buf, uint32_t len)
+{
+   for(uint32_t i = 0; i < len; i++) {
+      int32_t x = buf[i];
+      if(x > _knee || x < -_knee)
+         buf[i] = softKnee(x, _knee);
+   }
+}
+
+
+/********************************************************************
+ * @brief The limiter curve for any int32 value, e.g. a sum of sources
+ * that went past full scale. Below the knee x is returned as is.
+ * @param knee - Q15, see kneeQ15().
+ */
+int16_t ESP32S3_GAIN::softKnee(int32_t x, int32_t knee)
+{
+   int64_t a = (x < 0) ? -int64_t(x) : x;
+   if(a > knee) {
+      const int64_t span = 32767 - knee;
+      int64_t d = a - knee;
+      a = knee + (d * span) / (span + d);
+   }
+   return int16_t((x < 0) ? -a : a);
+}
@@ -0,0 +1,47 @@
+/********************************************************************
+ * @brief esp32s3_gain.h : Q15 volume/gain stage for int16 playback.
+ *
+ * @note Method:
+ * 1) Gain is a Q15 value (32767 = unity). Samples are scaled in blocks
+ * of GAIN_BLOCK_SIZE with dsps_mulc_s16 (SIMD on the S3).
+ * 2) A gain change is spread over 'ramp_ms'. The gain moves one equal
+ * step per block, so volume changes don't click.
+ * 3) Optional soft knee limiter. Above the knee, |y| = knee + d*s/(s+d)
+ * where d = |x| - knee and s = full scale - knee. The slope is 1 at the
+ * knee and the output approaches full scale but never reaches it. Only
+ * samples above the knee pay for the divide. softKnee() is the same curve
+ * on an int32 sum, for a mixer's conversion to int16.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_dsp.h"
+
+#define GAIN_BLOCK_SIZE          32       // samples per gain step (2ms @ 16KHz)
+#define GAIN_UNITY_Q15           32767
+
+class ESP32S3_GAIN {
+   public:
+      ESP32S3_GAIN(void) = default;
+      ~ESP32S3_GAIN(void) = default;
+
+      void init(float sample_rate=16000.0, uint16_t ramp_ms=20);
+      void setGain(int16_t gain_q15);     // ramp to a new Q15 gain
+      void setVolume(uint8_t percent);    // ramp to 0 - 100%
+      void jumpGain(int16_t gain_q15);    // change immediately (no ramp)
+      void setLimiter(bool enab, float knee=0.9);   // knee as fraction of full scale
+      void apply(int16_t *buf, uint32_t len) { apply(buf, buf, len); }   // in place
+      void apply(const int16_t *in, int16_t *out, uint32_t len);   // e.g. from flash
+      int16_t gain(void) { return int16_t(_gain); }
+      static int16_t softKnee(int32_t x, int32_t knee);   // int32 -> int16 through the knee
+      static int32_t kneeQ15(float knee) { return int32_t(constrain(knee, 0.1f, 0.99f) * 32767.0f); }
+
+   private:
+      int32_t _gain = GAIN_UNITY_Q15;     // gain used for the current block
+      int32_t _target = GAIN_UNITY_Q15;
+      int32_t _step = 0;                  // gain change per block
+      uint16_t _ramp_blocks = 10;
+      bool _limit = false;
+      int32_t _knee = 29490;
+      void limit(int16_t *buf, uint32_t len);
+};
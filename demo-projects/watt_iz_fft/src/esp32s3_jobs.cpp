@@ -0,0 +1,366 @@
+/********************************************************************
+ * @brief esp32s3_jobs.cpp source file
+ */
+#include "esp32s3_jobs.h"
+
+ESP32S3_JOBS jobs;
+
+#define JOBS_WAIT_FOREVER        UINT32_MAX
+#define JOBS_MASK                (JOBS_DEQUE_SIZE - 1)
+
+// A range is packed as begin << 16 | end
+static inline uint32_t rangePack(uint32_t begin, uint32_t end) { return (begin << 16) | end; }
+static inline uint32_t rangeBegin(uint32_t range) { return range >> 16; }
+static inline uint32_t rangeEnd(uint32_t range) { return range & 0xFFFF; }
+
+
+/********************************************************************
+ * @brief Owner: add a range at the bottom.
+ * @return false if the deque is full.
+ */
+bool JOB_DEQUE::push(uint32_t range)
+{
+   uint32_t b = _bottom.load(std::memory_order_relaxed);
+
+   if(int32_t(b - _top.load()) >= JOBS_DEQUE_SIZE)
+      return false;
+   _buf[b & JOBS_MASK].store(range, std::memory_order_relaxed);
+   _bottom.store(b + 1);                  // range visible first
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Owner: take the newest range. The last range is raced for
+ * with the thieves through 'top'.
+ */
+bool JOB_DEQUE::pop(uint32_t *range)
+{
+   uint32_t b = _bottom.load(std::memory_order_relaxed) - 1;
+   uint32_t t;
+   bool ok = true;
+
+   _bottom.store(b);                      // claim, then look at top
+   t = _top.load();
+   if(int32_t(b - t) < 0) {               // empty
+      _bottom.store(b + 1, std::memory_order_relaxed);
+      return false;
+   }
+   *range = _buf[b & JOBS_MASK].load(std::memory_order_relaxed);
+   if(b == t) {
+      ok = _top.compare_exchange_strong(t, t + 1);
+      _bottom.store(b + 1, std::memory_order_relaxed);
+   }
+   return ok;
+}
+
+
+/********************************************************************
+ * @brief Any lane: take the oldest (largest) range.
+ * @return false if empty or another lane took it first.
+ */
+bool JOB_DEQUE::steal(uint32_t *range)
+{
+   uint32_t t = _top.load();
+   uint32_t b = _bottom.load();
+
+   if(int32_t(b - t) <= 0)
+      return false;
+   *range = _buf[t & JOBS_MASK].load(std::memory_order_relaxed);
+   return _top.compare_exchange_strong(t, t + 1);
+}
+
+
+/********************************************************************
+ * @brief Lane wake up event
+ */
+#if defined(ESP_PLATFORM)
+bool JOB_EVENT::create(void)
+{
+   if(!_sem)
+      _sem = xSemaphoreCreateBinary();
+   return _sem != nullptr;
+}
+
+void JOB_EVENT::destroy(void)
+{
+   if(_sem)
+      vSemaphoreDelete(_sem);
+   _sem = nullptr;
+}
+
+void JOB_EVENT::signal(void)
+{
+   if(_sem)
+      xSemaphoreGive(_sem);
+}
+
+void JOB_EVENT::wait(uint32_t ms)
+{
+   TickType_t ticks = (ms == JOBS_WAIT_FOREVER) ? portMAX_DELAY : pdMS_TO_TICKS(ms);
+
+   if(_sem)
+      xSemaphoreTake(_sem, (ticks) ? ticks : 1);
+}
+#else
+bool JOB_EVENT::create(void) { return true; }
+
+void JOB_EVENT::destroy(void) { }
+
+void JOB_EVENT::signal(void)
+{
+   {
+      std::lock_guard<std::mutex> lock(_mtx);
+      _set = true;
+   }
+   _cv.notify_one();
+}
+
+void JOB_EVENT::wait(uint32_t ms)
+{
+   std::unique_lock<std::mutex> lock(_mtx);
+
+   if(ms == JOBS_WAIT_FOREVER)
+      _cv.wait(lock, [this] { return _set; });
+   else
+      _cv.wait_for(lock, std::chrono::milliseconds(ms), [this] { return _set; });
+   _set = false;
+}
+#endif
+
+
+/********************************************************************
+ * @brief Start one worker per core.
+ * @return false if a worker or its event can't be created.
+ */
+bool ESP32S3_JOBS::begin(void)
+{
+   uint8_t i;
+
+   if(_run.load())
+      return true;
+   for(i = 0; i < JOBS_NUM_LANES; i++) {
+      if(!_wake[i].create())
+         return false;
+   }
+   _run.store(true);
+   for(i = 0; i < JOBS_NUM_WORKERS; i++) {
+      _arg[i].jobs = this;
+      _arg[i].lane = i + 1;
+      _alive++;
+#if defined(ESP_PLATFORM)
+      if(xTaskCreatePinnedToCore(workerTask, "jobs", JOBS_WORKER_STACK, &_arg[i],
+               JOBS_WORKER_PRIORITY, &_task[i], i) != pdPASS) {
+         _alive--;
+         end();
+         return false;
+      }
+#else
+      _thread[i] = std::thread(workerTask, &_arg[i]);
+#endif
+   }
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Stop the workers. Call while no fork is active.
+ */
+void ESP32S3_JOBS::end(void)
+{
+   uint8_t i;
+
+   _run.store(false);
+   for(i = 0; i < JOBS_NUM_LANES; i++)
+      _wake[i].signal();
+#if defined(ESP_PLATFORM)
+   while(_alive.load() > 0)
+      vTaskDelay(1);
+#else
+   for(i = 0; i < JOBS_NUM_WORKERS; i++) {
+      if(_thread[i].joinable())
+         _thread[i].join();
+   }
+#endif
+   for(i = 0; i < JOBS_NUM_LANES; i++)
+      _wake[i].destroy();
+}
+
+
+/********************************************************************
+ * @brief Fork [0, count) over the lanes and join. fn() is called for
+ * sub ranges of at most 'grain' indices (larger only if a deque is
+ * full). Runs inline, on the calling lane, when the workers can't help.
+ */
+void ESP32S3_JOBS::parallelFor(uint32_t count, JobRange_cb fn, void *ctx, uint32_t grain)
+{
+   uint32_t range;
+   bool idle = false;
+
+   if(count == 0)
+      return;
+   if(grain == 0)
+      grain = 1;
+   if(!_run.load() || count <= grain || count > JOBS_MAX_COUNT ||
+            !_busy.compare_exchange_strong(idle, true)) {
+      fn(ctx, 0, count, currentLane());   // a job's own fork keeps its lane's buffers
+      return;
+   }
+#if defined(ESP_PLATFORM)
+   // Workers at the caller's priority: tasks in between can't hold up the join
+   UBaseType_t prio = uxTaskPriorityGet(NULL);
+   if(prio != JOBS_WORKER_PRIORITY)
+      setWorkerPriority(prio);
+#endif
+   _fn = fn;
+   _ctx = ctx;
+   _grain = grain;
+   _pending.store(count);
+
+   // The caller is lane 0: it splits the whole range (its pushes wake the
+   // workers), helps while there is a range to steal, then sleeps until the
+   // workers finish theirs. A stale signal (the caller finished the last 
+   // fork itself) only costs a loop.
+   run(0, rangePack(0, count));
+   while(_pending.load() > 0) {
+      if(take(0, &range))
+         run(0, range);
+      else
+         _wake[0].wait(JOBS_WAIT_FOREVER);
+   }
+#if defined(ESP_PLATFORM)
+   if(prio != JOBS_WORKER_PRIORITY)
+      setWorkerPriority(JOBS_WORKER_PRIORITY);
+#endif
+   _busy.store(false);
+}
+
+
+/********************************************************************
+ * @brief Lane of the calling thread: its worker's lane, else 0.
+ */
+uint8_t ESP32S3_JOBS::currentLane(void)
+{
+   for(uint8_t i = 0; i < JOBS_NUM_WORKERS; i++) {
+#if defined(ESP_PLATFORM)
+      if(_task[i] && _task[i] == xTaskGetCurrentTaskHandle())
+         return i + 1;
+#else
+      if(_thread[i].get_id() == std::this_thread::get_id())
+         return i + 1;
+#endif
+   }
+   return 0;
+}
+
+
+/********************************************************************
+ * @brief Set the priority of every worker (device only).
+ */
+void ESP32S3_JOBS::setWorkerPriority(uint32_t prio)
+{
+#if defined(ESP_PLATFORM)
+   for(uint8_t i = 0; i < JOBS_NUM_WORKERS; i++)
+      vTaskPrioritySet(_task[i], prio);
+#endif
+}
+
+
+/********************************************************************
+ * @brief Worker loop. Runs & steals ranges while there are any, else
+ * blocks until a push (or end()) wakes it.
+ */
+void ESP32S3_JOBS::workerTask(void *params)
+{
+   worker_arg_t *arg = (worker_arg_t *)params;
+
+   arg->jobs->worker(arg->lane);
+#if defined(ESP_PLATFORM)
+   vTaskDelete(NULL);
+#endif
+}
+
+
+void ESP32S3_JOBS::worker(uint8_t lane)
+{
+   uint32_t range;
+   uint8_t bit = 1u << lane;
+
+   while(_run.load()) {
+      if(take(lane, &range)) {
+         run(lane, range);
+         continue;
+      }
+      // Sleeping first, then look again: a push after the look sees the bit
+      _sleeping.fetch_or(bit);
+      if(take(lane, &range)) {
+         _sleeping.fetch_and(uint8_t(~bit));
+         run(lane, range);
+         continue;
+      }
+      _wake[lane].wait(JOBS_WAIT_FOREVER);   // end() signals too
+      _sleeping.fetch_and(uint8_t(~bit));
+   }
+   _alive--;
+}
+
+
+/********************************************************************
+ * @brief Wake one sleeping worker for a range just pushed. The bit is
+ * cleared here so further pushes wake the next one.
+ */
+void ESP32S3_JOBS::wakeOne(void)
+{
+   uint8_t sleeping = _sleeping.load();
+
+   while(sleeping) {
+      uint8_t lane = __builtin_ctz(sleeping);   // lowest sleeping lane
+      uint8_t bit = 1u << lane;
+      if(_sleeping.fetch_and(uint8_t(~bit)) & bit) {
+         _wake[lane].signal();
+         return;
+      }
+      sleeping = _sleeping.load();
+   }
+}
+
+
+/********************************************************************
+ * @brief Next range for 'lane': the newest of its own, else the oldest
+ * of another lane.
+ */
+bool ESP32S3_JOBS::take(uint8_t lane, uint32_t *range)
+{
+   uint8_t i;
+
+   if(_deque[lane].pop(range))
+      return true;
+   for(i = 1; i < JOBS_NUM_LANES; i++) {
+      if(_deque[(lane + i) % JOBS_NUM_LANES].steal(range))
+         return true;
+   }
+   return false;
+}
+
+
+/********************************************************************
+ * @brief Halve the range, pushing upper halves for other lanes, until
+ * 'grain' is left. Run that and count it done.
+ */
+void ESP32S3_JOBS::run(uint8_t lane, uint32_t range)
+{
+   uint32_t begin = rangeBegin(range);
+   uint32_t end = rangeEnd(range);
+   uint32_t mid;
+
+   while(end - begin > _grain) {
+      mid = begin + (end - begin) / 2;
+      if(!_deque[lane].push(rangePack(mid, end)))
+         break;
+      wakeOne();
+      end = mid;
+   }
+   _fn(_ctx, begin, end, lane);
+   if(_pending.fetch_sub(end - begin) == end - begin)
+      _wake[0].signal();                  // fork done
+}
@@ -0,0 +1,139 @@
+/********************************************************************
+ * @brief esp32s3_jobs.h : Small job system for data parallel DSP on
+ * both cores of the ESP32-S3.
+ *
+ * @note Method:
+ * 1) One worker per core (FreeRTOS tasks pinned to core 0 & 1, or
+ * std::thread on a host). The task that forks is a lane too, so there
+ * are JOBS_NUM_LANES lanes and each owns a work stealing deque.
+ * 2) A deque holds index ranges. Its owner pushes & pops at the bottom,
+ * other lanes steal from the top, where the largest ranges are (Chase-
+ * Lev, fixed size, ranges packed in one 32 bit word).
+ * 3) parallelFor(count, fn, ctx, grain) forks [0, count) and joins. The
+ * caller runs the whole range. A lane running a range larger than
+ * 'grain' keeps the lower half and pushes the upper half for the others
+ * to steal; each push wakes one sleeping worker. Once nothing is left to
+ * steal the caller sleeps until the last range is done. On the device
+ * the workers take the caller's priority for the fork, so a high
+ * priority caller never waits on a starved worker, and drop back to
+ * JOBS_WORKER_PRIORITY after the join.
+ * 4) Idle workers block on their event - no polling between or at the
+ * end of forks. A worker marks itself sleeping and looks at the deques
+ * once more before it blocks, so a push can't be missed.
+ * 5) fn(ctx, begin, end, lane) is called for each sub range. 'lane'
+ * (0: caller, 1..JOBS_NUM_WORKERS) names the thread running it, so jobs
+ * use per lane scratch buffers and take no locks.
+ * 6) One fork / join at a time. A parallelFor() from inside a job, from
+ * a second task while one runs, or before begin() runs inline, on the
+ * calling worker's lane (0 for any other task).
+ *
+ * Cost: one CAS per steal, one atomic add per finished range, a wake per
+ * push while a worker sleeps, and two priority changes per fork. Sub ranges
+ * worth ~0.5ms or more (one 1024 point FFT) split well.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+#if defined(ESP_PLATFORM)
+#include <Arduino.h>
+#else
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#endif
+
+#define JOBS_NUM_WORKERS         2        // one per core
+#define JOBS_NUM_LANES           (JOBS_NUM_WORKERS + 1)   // + the forking task
+#define JOBS_DEQUE_SIZE          64       // ranges per deque (power of 2)
+#define JOBS_MAX_COUNT           0xFFFF   // indices per fork (16 bit range ends)
+#define JOBS_WORKER_STACK        4096     // words
+#define JOBS_WORKER_PRIORITY     1        // between forks. During a fork: the caller's
+
+// Runs indices [begin, end) on 'lane'
+using JobRange_cb = void (*)(void *ctx, uint32_t begin, uint32_t end, uint8_t lane);
+
+
+/********************************************************************
+ * @brief Work stealing deque of index ranges. push & pop by the owner
+ * lane only, steal by any lane.
+ */
+class JOB_DEQUE {
+   public:
+      bool push(uint32_t range);
+      bool pop(uint32_t *range);
+      bool steal(uint32_t *range);
+
+   private:
+      std::atomic<uint32_t> _top{0};      // next to steal (free running)
+      std::atomic<uint32_t> _bottom{0};   // next to push (free running)
+      std::atomic<uint32_t> _buf[JOBS_DEQUE_SIZE];
+};
+
+
+/********************************************************************
+ * @brief Wakes a sleeping lane. Binary: signals while nobody waits
+ * collapse into one.
+ */
+class JOB_EVENT {
+   public:
+      bool create(void);
+      void destroy(void);
+      void signal(void);
+      void wait(uint32_t ms);
+
+   private:
+#if defined(ESP_PLATFORM)
+      SemaphoreHandle_t _sem = nullptr;
+#else
+      std::mutex _mtx;
+      std::condition_variable _cv;
+      bool _set = false;
+#endif
+};
+
+
+class ESP32S3_JOBS {
+   public:
+      ESP32S3_JOBS(void) = default;
+      ~ESP32S3_JOBS(void) { end(); }
+
+      bool begin(void);                   // start the workers
+      void end(void);                     // stop the workers, waits for them to exit
+      bool running(void) { return _run.load(); }
+      uint8_t lanes(void) { return JOBS_NUM_LANES; }
+      void parallelFor(uint32_t count, JobRange_cb fn, void *ctx, uint32_t grain=1);
+
+   private:
+      typedef struct {
+         ESP32S3_JOBS *jobs;
+         uint8_t lane;
+      } worker_arg_t ;
+
+      JOB_DEQUE _deque[JOBS_NUM_LANES];
+      JOB_EVENT _wake[JOBS_NUM_LANES];    // [0] wakes the caller when the fork is done
+      worker_arg_t _arg[JOBS_NUM_WORKERS];
+      std::atomic<bool> _run{false};      // workers alive
+      std::atomic<bool> _busy{false};     // a fork is active
+      std::atomic<uint32_t> _pending{0};  // indices of the fork not done yet
+      std::atomic<uint8_t> _alive{0};     // workers not exited
+      std::atomic<uint8_t> _sleeping{0};  // bit per worker lane blocked on its _wake
+      JobRange_cb _fn = nullptr;          // the fork, set before the workers are woken
+      void *_ctx = nullptr;
+      uint32_t _grain = 1;
+#if defined(ESP_PLATFORM)
+      TaskHandle_t _task[JOBS_NUM_WORKERS] = {};
+#else
+      std::thread _thread[JOBS_NUM_WORKERS];
+#endif
+
+      static void workerTask(void *params);
+      void worker(uint8_t lane);
+      bool take(uint8_t lane, uint32_t *range);   // own deque, else steal
+      void wakeOne(void);                 // a sleeping worker, after a push
+      uint8_t currentLane(void);          // of the calling thread, 0 if not a worker
+      void setWorkerPriority(uint32_t prio);
+      void run(uint8_t lane, uint32_t range);     // split, then call the job
+};
+
+extern ESP32S3_JOBS jobs;
@@ -0,0 +1,537 @@
+/********************************************************************
+ * @brief esp32s3_kws.cpp source file
+ *
+ * @note MFCC front end plus LB_Keogh / banded DTW template matcher.
+ */
+#include "esp32s3_kws.h"
+#include <float.h>
+#include "esp_timer.h"
+
+ESP32S3_KWS kws;
+
+#define KWS_SAMPLE_RATE          16000.0f
+#define KWS_MEL_LOW_HZ           100.0f
+#define KWS_MEL_HIGH_HZ          4000.0f
+#define KWS_TMPL_FLOATS          (KWS_NORM_FRAMES * KWS_NUM_CEPS)
+
+static inline float hzToMel(float hz) { return 2595.0f * log10f(1.0f + hz / 700.0f); }
+static inline float melToHz(float mel) { return 700.0f * (powf(10.0f, mel / 2595.0f) - 1.0f); }
+
+
+/********************************************************************
+ * @brief ESP32S3_KWS class constructor
+ */
+ESP32S3_KWS::ESP32S3_KWS(void)
+{
+   _enroll_word[0] = 0;
+}
+
+
+/********************************************************************
+ * @brief ESP32S3_KWS class destructor
+ */
+ESP32S3_KWS::~ESP32S3_KWS(void)
+{
+   end();
+}
+
+
+/********************************************************************
+ * @brief Allocate buffers, build the mel filterbank & DCT tables, and
+ *    load all templates from the library file (if it exists).
+ * @param library - path of the template library on the SD card.
+ * @return true if memory was allocated. A missing library is not an
+ *    error - it just means no templates have been enrolled yet.
+ */
+bool ESP32S3_KWS::init(const char *library)
+{
+   end();
+   _library = library;
+
+   if(!_fft.init(KWS_FFT_SIZE, KWS_FFT_SIZE, SPECTRAL_AVERAGE))
+      return false;
+
+   const uint32_t caps = MALLOC_CAP_SPIRAM;
+   _window = (float *) heap_caps_aligned_alloc(16, KWS_FFT_SIZE * sizeof(float), caps);
+   _in_hist = (float *) heap_caps_aligned_alloc(16, KWS_FFT_SIZE * sizeof(float), caps);
+   _win_buf = (float *) heap_caps_aligned_alloc(16, KWS_FFT_SIZE * sizeof(float), caps);
+   _cplx = (float *) heap_caps_aligned_alloc(16, KWS_FFT_SIZE * 2 * sizeof(float), caps);
+   _mel_lo = (float *) heap_caps_malloc((KWS_NUM_MEL + 2) * sizeof(float), caps);
+   _dct = (float *) heap_caps_malloc(KWS_NUM_CEPS * KWS_NUM_MEL * sizeof(float), caps);
+   _feat = (float *) heap_caps_malloc(KWS_HISTORY_FRAMES * KWS_NUM_CEPS * sizeof(float), caps);
+   _words = (char (*)[KWS_WORD_LEN]) heap_caps_malloc(KWS_MAX_TEMPLATES * KWS_WORD_LEN, caps);
+   _tmpl = (float *) heap_caps_malloc(KWS_MAX_TEMPLATES * KWS_TMPL_FLOATS * sizeof(float), caps);
+   _upper = (float *) heap_caps_malloc(KWS_MAX_TEMPLATES * KWS_TMPL_FLOATS * sizeof(float), caps);
+   _lower = (float *) heap_caps_malloc(KWS_MAX_TEMPLATES * KWS_TMPL_FLOATS * sizeof(float), caps);
+   _query = (float *) heap_caps_malloc(KWS_TMPL_FLOATS * sizeof(float), caps);
+   _dtw_rows = (float *) heap_caps_malloc(2 * (KWS_NORM_FRAMES + 1) * sizeof(float), caps);
+
+   if(!_window || !_in_hist || !_win_buf || !_cplx || !_mel_lo || !_dct || !_feat ||
+         !_words || !_tmpl || !_upper || !_lower || !_query || !_dtw_rows) {
+      end();
+      return false;
+   }
+
+   // Hann window
+   for(int i = 0; i < KWS_FFT_SIZE; i++)
+      _window[i] = 0.5f * (1.0f - cosf(2.0f * PI * i / KWS_FFT_SIZE));
+
+   // Mel band edges in fractional FFT bins
+   float mel_lo = hzToMel(KWS_MEL_LOW_HZ);
+   float mel_hi = hzToMel(KWS_MEL_HIGH_HZ);
+   for(int m = 0; m < KWS_NUM_MEL + 2; m++) {
+      float hz = melToHz(mel_lo + (mel_hi - mel_lo) * m / float(KWS_NUM_MEL + 1));
+      _mel_lo[m] = hz * KWS_FFT_SIZE / KWS_SAMPLE_RATE;
+   }
+
+   // DCT-II rows 1..KWS_NUM_CEPS
+   for(int c = 0; c < KWS_NUM_CEPS; c++) {
+      for(int m = 0; m < KWS_NUM_MEL; m++)
+         _dct[(c * KWS_NUM_MEL) + m] = cosf(PI * (c + 1) * (m + 0.5f) / KWS_NUM_MEL);
+   }
+
+   memset(_in_hist, 0, KWS_FFT_SIZE * sizeof(float));
+   _pending = 0;
+   _feat_wr = 0;
+   _in_segment = _end_pending = _vad_speech = false;
+   _floor = FLT_MAX;
+   _speech_start = _speech_end = _seg_end = 0;
+   _num_templates = 0;
+
+   /**
+    * @brief Load the template library
+    */
+   int32_t file_sz = sd.fsize(_library);
+   uint32_t offset = 0;
+   kws_template_hdr_t hdr;
+   while(file_sz > 0 && offset + sizeof(hdr) <= (uint32_t)file_sz && _num_templates < KWS_MAX_TEMPLATES) {
+      if(sd.readFile(_library, sizeof(hdr), offset, (uint8_t *)&hdr) != sizeof(hdr))
+         break;
+      if(hdr.magic != KWS_TEMPLATE_MAGIC || hdr.frames != KWS_NORM_FRAMES || hdr.ceps != KWS_NUM_CEPS)
+         break;                           // incompatible or corrupt library
+      offset += sizeof(hdr);
+      if(sd.readFile(_library, KWS_TMPL_FLOATS * sizeof(float), offset, (uint8_t *)_query) !=
+            KWS_TMPL_FLOATS * sizeof(float))
+         break;
+      offset += KWS_TMPL_FLOATS * sizeof(float);
+      hdr.word[KWS_WORD_LEN - 1] = 0;
+      addTemplate(hdr.word, _query);
+   }
+   _ready = true;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free internal buffer memory.
+ */
+void ESP32S3_KWS::end(void)
+{
+   void **bufs[] = { (void **)&_window, (void **)&_in_hist, (void **)&_win_buf, (void **)&_cplx,
+         (void **)&_mel_lo, (void **)&_dct, (void **)&_feat, (void **)&_words, (void **)&_tmpl,
+         (void **)&_upper, (void **)&_lower, (void **)&_query, (void **)&_dtw_rows };
+   for(void **b : bufs) {
+      if(*b) {
+         free(*b);
+         *b = nullptr;
+      }
+   }
+   _fft.end();
+   _ready = false;
+   _num_templates = 0;
+}
+
+
+/********************************************************************
+ * @brief Feed mic samples. A feature frame is produced every
+ *    KWS_HOP_SIZE samples. Any 'len' is accepted.
+ * @param time_us - esp_timer time of input[0] (capture time stamp), 0
+ *    if unknown: the time of the call is used, so end_us then leaves
+ *    out the buffering before it.
+ */
+void ESP32S3_KWS::pushAudio(const float *input, uint32_t len, int64_t time_us)
+{
+   uint32_t done = 0;
+
+   if(!_ready) return;
+   if(time_us == 0)
+      time_us = esp_timer_get_time() - int64_t(len * 1000000.0f / KWS_SAMPLE_RATE);
+   while(len > 0) {
+      uint32_t n = KWS_HOP_SIZE - _pending;
+      if(n > len) n = len;
+      memcpy(_in_hist + (KWS_FFT_SIZE - KWS_HOP_SIZE) + _pending, input, n * sizeof(float));
+      _pending += n;
+      input += n;
+      len -= n;
+      done += n;
+      if(_pending == KWS_HOP_SIZE) {
+         computeFrame(time_us + int64_t(done * 1000000.0f / KWS_SAMPLE_RATE));
+         memmove(_in_hist, _in_hist + KWS_HOP_SIZE, (KWS_FFT_SIZE - KWS_HOP_SIZE) * sizeof(float));
+         _pending = 0;
+      }
+   }
+}
+
+
+/********************************************************************
+ * @brief Compute one MFCC frame from the current sample history, mark
+ *    it speech / non-speech and end the segment after KWS_END_FRAMES
+ *    of non-speech.
+ * @param end_us - esp_timer time of the newest sample of the frame.
+ */
+void ESP32S3_KWS::computeFrame(int64_t end_us)
+{
+   float mel[KWS_NUM_MEL];
+   float energy = 0.0f;
+
+   dsps_mul_f32(_in_hist, _window, _win_buf, KWS_FFT_SIZE, 1, 1, 1);
+   _fft.computeComplex(_win_buf, _cplx, false);
+
+   // Triangular mel filters on the power spectrum
+   for(int m = 0; m < KWS_NUM_MEL; m++) {
+      float lo = _mel_lo[m], mid = _mel_lo[m + 1], hi = _mel_lo[m + 2];
+      float e = 0.0f;
+      for(int k = int(ceilf(lo)); k <= int(hi) && k <= KWS_FFT_SIZE / 2; k++) {
+         float w = (k <= mid) ? (k - lo) / (mid - lo) : (hi - k) / (hi - mid);
+         if(w <= 0.0f) continue;
+         float re = _cplx[2 * k], im = _cplx[2 * k + 1];
+         e += w * (re * re + im * im);
+      }
+      mel[m] = logf(e + 1.0f);
+      energy += e;
+   }
+
+   // DCT to cepstra
+   float *f = _feat + ((_feat_wr % KWS_HISTORY_FRAMES) * KWS_NUM_CEPS);
+   for(int c = 0; c < KWS_NUM_CEPS; c++) {
+      float acc = 0.0f;
+      dsps_dotprod_f32(&_dct[c * KWS_NUM_MEL], mel, &acc, KWS_NUM_MEL);
+      f[c] = acc;
+   }
+   _feat_wr++;
+
+   /**
+    * @brief Speech frame: above the noise floor and near the peak of the
+    * run (drops the reverb tail)
+    */
+   energy = logf(energy + 1.0f);
+   _floor = (energy < _floor) ? energy : _floor + KWS_FLOOR_RISE;
+   bool new_run = (_feat_wr - 1 - _speech_end >= KWS_END_FRAMES);
+   if(energy > _floor + KWS_SPEECH_LOG && (new_run || energy > _run_peak - KWS_PEAK_LOG)) {
+      if(new_run) {
+         _speech_start = _feat_wr - 1;
+         _run_peak = energy;
+      }
+      else if(energy > _run_peak)
+         _run_peak = energy;
+      _speech_end = _feat_wr;
+      _speech_end_us = end_us;
+      if(!_in_segment && _vad_speech && !_end_pending)
+         speechStart();                   // next word before the VAD ended
+   }
+   if(_in_segment && _speech_end > _seg_start && _feat_wr - _speech_end >= KWS_END_FRAMES)
+      endSegment();
+}
+
+
+/********************************************************************
+ * @brief Close the segment after its last speech frame.
+ */
+void ESP32S3_KWS::endSegment(void)
+{
+   uint32_t end = _speech_end + KWS_MARGIN_FRAMES;
+
+   _seg_end = (end < _feat_wr) ? end : _feat_wr;
+   _seg_end_us = _speech_end_us;
+   _in_segment = false;
+   _end_pending = (_speech_end > _seg_start);
+}
+
+
+/********************************************************************
+ * @brief Mark the start of a speech segment. The VAD triggers after the
+ *    onset, so the segment starts at the first speech frame of the
+ *    latest run (KWS_MARGIN_FRAMES earlier) if that run is recent and
+ *    not matched yet. A short word may already have ended by the time
+ *    the VAD frame arrives - it is ended at once.
+ */
+void ESP32S3_KWS::speechStart(void)
+{
+   if(!_ready) return;
+   uint32_t oldest = (_feat_wr > KWS_HISTORY_FRAMES) ? _feat_wr - KWS_HISTORY_FRAMES : 0;
+   uint32_t start = (_speech_start > KWS_MARGIN_FRAMES) ? _speech_start - KWS_MARGIN_FRAMES : 0;
+
+   _vad_speech = true;
+   if(_in_segment || _end_pending)
+      return;
+   if(_speech_end == 0 || _speech_start < _seg_end || _feat_wr - _speech_end > KWS_VAD_LAG_FRAMES)
+      start = _feat_wr;                   // no unmatched speech yet
+   _seg_start = (start > oldest) ? start : oldest;
+   _in_segment = true;
+   if(_speech_end > _seg_start && _feat_wr - _speech_end >= KWS_END_FRAMES)
+      endSegment();
+}
+
+
+/********************************************************************
+ * @brief Resample the ended segment [_seg_start, _seg_end) to
+ *    KWS_NORM_FRAMES and remove the cepstral mean (channel / mic
+ *    normalization).
+ * @return false if the segment is too short.
+ */
+bool ESP32S3_KWS::buildQuery(void)
+{
+   uint32_t oldest = (_feat_wr > KWS_HISTORY_FRAMES) ? _feat_wr - KWS_HISTORY_FRAMES : 0;
+   if(_seg_start < oldest)                // longer than history - keep the newest part
+      _seg_start = oldest;
+   uint32_t len = (_seg_end > _seg_start) ? _seg_end - _seg_start : 0;
+   if(len < KWS_MIN_FRAMES)
+      return false;
+
+   float mean[KWS_NUM_CEPS] = {0};
+   for(int i = 0; i < KWS_NORM_FRAMES; i++) {
+      float pos = float(i) * float(len - 1) / float(KWS_NORM_FRAMES - 1);
+      uint32_t i0 = uint32_t(pos);
+      uint32_t i1 = (i0 + 1 < len) ? i0 + 1 : i0;
+      float frac = pos - float(i0);
+      const float *f0 = _feat + (((_seg_start + i0) % KWS_HISTORY_FRAMES) * KWS_NUM_CEPS);
+      const float *f1 = _feat + (((_seg_start + i1) % KWS_HISTORY_FRAMES) * KWS_NUM_CEPS);
+      float *q = _query + (i * KWS_NUM_CEPS);
+      for(int c = 0; c < KWS_NUM_CEPS; c++) {
+         q[c] = f0[c] + frac * (f1[c] - f0[c]);
+         mean[c] += q[c];
+      }
+   }
+   for(int i = 0; i < KWS_NORM_FRAMES; i++) {
+      for(int c = 0; c < KWS_NUM_CEPS; c++)
+         _query[(i * KWS_NUM_CEPS) + c] -= mean[c] / KWS_NORM_FRAMES;
+   }
+   return true;
+}
+
+
+/********************************************************************
+ * @brief VAD end of speech. Ends a segment the detector hasn't ended
+ *    yet (speech up to the hangover) and matches like poll().
+ * @param result - receives the match. index == -1 if no match.
+ * @return true if a keyword was matched.
+ */
+bool ESP32S3_KWS::speechEnd(kws_result_t *result)
+{
+   _vad_speech = false;
+   if(_in_segment)
+      endSegment();
+   return poll(result);
+}
+
+
+/********************************************************************
+ * @brief Match an ended segment. If an enrollment is pending the
+ *    segment is saved as a template, else it is matched against the
+ *    template library. Call after each pushAudio().
+ * @param result - receives the match. index == -1 if no match.
+ * @return true if a keyword was matched.
+ */
+bool ESP32S3_KWS::poll(kws_result_t *result)
+{
+   result->index = -1;
+   result->word[0] = 0;
+   result->distance = FLT_MAX;
+   result->match_us = 0;
+   result->end_us = 0;
+   if(!_ready || !_end_pending) return false;
+   _end_pending = false;
+
+   int64_t t0 = esp_timer_get_time();
+   if(!buildQuery())
+      return false;
+
+   if(_enroll_pending) {
+      _enroll_pending = false;
+      if(saveTemplate(_enroll_word, _query))
+         addTemplate(_enroll_word, _query);
+      return false;
+   }
+   if(_num_templates == 0)
+      return false;
+
+   /**
+    * @brief Lower bound every template, then visit in ascending order
+    */
+   float lb[KWS_MAX_TEMPLATES];
+   uint8_t order[KWS_MAX_TEMPLATES];
+   for(uint16_t t = 0; t < _num_templates; t++) {
+      lb[t] = lowerBound(t);
+      int i = t;
+      while(i > 0 && lb[order[i - 1]] > lb[t]) {   // insertion sort by bound
+         order[i] = order[i - 1];
+         i--;
+      }
+      order[i] = t;
+   }
+
+   float best = FLT_MAX;
+   int16_t best_idx = -1;
+   for(uint16_t i = 0; i < _num_templates; i++) {
+      uint8_t t = order[i];
+      if(lb[t] >= best)
+         break;                           // no remaining template can win
+      float d = dtw(t, best);
+      if(d < best) {
+         best = d;
+         best_idx = t;
+      }
+   }
+
+   int64_t t1 = esp_timer_get_time();
+   result->distance = best / KWS_NORM_FRAMES;
+   result->match_us = uint32_t(t1 - t0);
+   result->end_us = uint32_t(t1 - _seg_end_us);
+   if(best_idx >= 0 && result->distance < match_threshold) {
+      result->index = best_idx;
+      strncpy(result->word, _words[best_idx], KWS_WORD_LEN - 1);
+      result->word[KWS_WORD_LEN - 1] = 0;
+      return true;
+   }
+   return false;
+}
+
+
+/********************************************************************
+ * @brief LB_Keogh lower bound of the query against template 't'.
+ */
+float ESP32S3_KWS::lowerBound(uint16_t t)
+{
+   const float *u = _upper + (t * KWS_TMPL_FLOATS);
+   const float *l = _lower + (t * KWS_TMPL_FLOATS);
+   float acc = 0.0f;
+   for(int i = 0; i < KWS_TMPL_FLOATS; i++) {
+      float q = _query[i];
+      if(q > u[i]) acc += (q - u[i]) * (q - u[i]);
+      else if(q < l[i]) acc += (l[i] - q) * (l[i] - q);
+   }
+   return acc;
+}
+
+
+/********************************************************************
+ * @brief Banded DTW between the query and template 't' with early
+ *    abandoning.
+ * @return Path cost, or FLT_MAX if abandoned.
+ */
+float ESP32S3_KWS::dtw(uint16_t t, float best_so_far)
+{
+   const float *tm = _tmpl + (t * KWS_TMPL_FLOATS);
+   float *prev = _dtw_rows;
+   float *cur = _dtw_rows + (KWS_NORM_FRAMES + 1);
+
+   for(int j = 0; j <= KWS_NORM_FRAMES; j++)
+      prev[j] = FLT_MAX;
+   prev[0] = 0.0f;
+
+   for(int i = 1; i <= KWS_NORM_FRAMES; i++) {
+      int j_lo = (i - KWS_BAND > 1) ? i - KWS_BAND : 1;
+      int j_hi = (i + KWS_BAND < KWS_NORM_FRAMES) ? i + KWS_BAND : KWS_NORM_FRAMES;
+      for(int j = 0; j <= KWS_NORM_FRAMES; j++)
+         cur[j] = FLT_MAX;
+      float row_min = FLT_MAX;
+      const float *q = _query + ((i - 1) * KWS_NUM_CEPS);
+      for(int j = j_lo; j <= j_hi; j++) {
+         const float *r = tm + ((j - 1) * KWS_NUM_CEPS);
+         float cost = 0.0f;
+         for(int c = 0; c < KWS_NUM_CEPS; c++) {
+            float d = q[c] - r[c];
+            cost += d * d;
+         }
+         float m = prev[j - 1];
+         if(prev[j] < m) m = prev[j];
+         if(cur[j - 1] < m) m = cur[j - 1];
+         cur[j] = (m == FLT_MAX) ? FLT_MAX : m + cost;
+         if(cur[j] < row_min) row_min = cur[j];
+      }
+      if(row_min >= best_so_far)
+         return FLT_MAX;                  // early abandon
+      float *tmp = prev;
+      prev = cur;
+      cur = tmp;
+   }
+   return prev[KWS_NORM_FRAMES];
+}
+
+
+/********************************************************************
+ * @brief Add a template to memory and build its LB_Keogh envelope.
+ */
+void ESP32S3_KWS::addTemplate(const char *word, const float *feat)
+{
+   if(_num_templates >= KWS_MAX_TEMPLATES) return;
+   uint16_t t = _num_templates;
+   float *tm = _tmpl + (t * KWS_TMPL_FLOATS);
+   float *u = _upper + (t * KWS_TMPL_FLOATS);
+   float *l = _lower + (t * KWS_TMPL_FLOATS);
+   memcpy(tm, feat, KWS_TMPL_FLOATS * sizeof(float));
+   strncpy(_words[t], word, KWS_WORD_LEN - 1);
+   _words[t][KWS_WORD_LEN - 1] = 0;
+
+   for(int i = 0; i < KWS_NORM_FRAMES; i++) {
+      int j_lo = (i - KWS_BAND > 0) ? i - KWS_BAND : 0;
+      int j_hi = (i + KWS_BAND < KWS_NORM_FRAMES - 1) ? i + KWS_BAND : KWS_NORM_FRAMES - 1;
+      for(int c = 0; c < KWS_NUM_CEPS; c++) {
+         float hi = -FLT_MAX, lo = FLT_MAX;
+         for(int j = j_lo; j <= j_hi; j++) {
+            float v = tm[(j * KWS_NUM_CEPS) + c];
+            if(v > hi) hi = v;
+            if(v < lo) lo = v;
+         }
+         u[(i * KWS_NUM_CEPS) + c] = hi;
+         l[(i * KWS_NUM_CEPS) + c] = lo;
+      }
+   }
+   _num_templates++;
+}
+
+
+/********************************************************************
+ * @brief Append a template record to the library file.
+ */
+bool ESP32S3_KWS::saveTemplate(const char *word, const float *feat)
+{
+   if(_num_templates >= KWS_MAX_TEMPLATES) return false;
+   kws_template_hdr_t hdr;
+   memset(&hdr, 0, sizeof(hdr));
+   hdr.magic = KWS_TEMPLATE_MAGIC;
+   strncpy(hdr.word, word, KWS_WORD_LEN - 1);
+   hdr.frames = KWS_NORM_FRAMES;
+   hdr.ceps = KWS_NUM_CEPS;
+   if(!sd.appendFile(_library, (uint8_t *)&hdr, sizeof(hdr)))
+      return false;
+   return sd.appendFile(_library, (uint8_t *)feat, KWS_TMPL_FLOATS * sizeof(float));
+}
+
+
+/********************************************************************
+ * @brief Request enrollment. The next speech segment seen by the
+ *    capture task is stored as a template for 'word'. Say the word
+ *    3 - 5 times (one enroll() per utterance) for reliable matching.
+ */
+bool ESP32S3_KWS::enroll(const char *word)
+{
+   if(!word || !word[0] || _num_templates >= KWS_MAX_TEMPLATES)
+      return false;
+   strncpy(_enroll_word, word, KWS_WORD_LEN - 1);
+   _enroll_word[KWS_WORD_LEN - 1] = 0;
+   _enroll_pending = true;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Delete the template library file and all loaded templates.
+ */
+bool ESP32S3_KWS::clearLibrary(void)
+{
+   _num_templates = 0;
+   if(sd.fexists(_library))
+      return sd.fremove(_library);
+   return true;
+}
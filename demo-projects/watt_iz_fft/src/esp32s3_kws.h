@@ -0,0 +1,149 @@
+/********************************************************************
+ * @brief esp32s3_kws.h : Template (DTW) keyword spotter for short
+ * command words such as "stop" or "louder".
+ *
+ * @note Method:
+ * 1) Mic audio is converted continuously into MFCC frames (512 point
+ * FFT, 16ms hop, 24 mel bands, cepstra c1..c12) kept in a short history.
+ * Each frame is also marked speech / non-speech by its energy against a
+ * tracked noise floor and the peak of the current run of speech.
+ * 2) The VAD start edge opens a segment at the first speech frame of the
+ * current run. The segment ends KWS_END_FRAMES after its last speech
+ * frame - long before the VAD hangover - or at the VAD end edge. Further
+ * words while the VAD still reports speech open new segments. The
+ * segment, cut to its speech frames plus KWS_MARGIN_FRAMES each side, is
+ * mean normalized and resampled to KWS_NORM_FRAMES frames.
+ * 3) Enrollment stores that segment as a template in a library file on
+ * the SD card. Recognition compares it against every template:
+ *    - LB_Keogh lower bounds are computed for all templates and the
+ *      templates are visited in ascending bound order.
+ *    - Sakoe-Chiba banded DTW abandons a template as soon as the best
+ *      cell in a row exceeds the best distance found so far, and the
+ *      search stops when the next lower bound exceeds it.
+ *
+ * The match runs from poll() once the segment has ended. kws_result_t
+ * reports the search time (match_us) and the time from the end of the
+ * last speech frame to the result (end_us), which includes the capture
+ * frame buffering when pushAudio() is given the frame's time stamp. A
+ * word's last samples wait for their capture frame, so captures with the
+ * spotter on use frames of at most KWS_MAX_CAPTURE_FRAME samples.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_dsp.h"
+#include "esp_heap_caps.h"
+#include "esp32s3_fft.h"
+#include "sd_lvgl_fs.h"
+
+// Keyword spotter constants
+#define KWS_FFT_SIZE             512
+#define KWS_HOP_SIZE             256      // 16ms per feature frame
+#define KWS_MAX_CAPTURE_FRAME    KWS_HOP_SIZE   // longest capture frame with the spotter on (end -> result < 100ms)
+#define KWS_NUM_MEL              24       // mel filter bands
+#define KWS_NUM_CEPS             12       // cepstral coeffs c1..c12 (c0 dropped)
+#define KWS_NORM_FRAMES          40       // segments & templates resampled to this length
+#define KWS_BAND                 4        // DTW band radius in frames (10%)
+#define KWS_HISTORY_FRAMES       160      // feature history (~2.5 secs)
+#define KWS_MARGIN_FRAMES        2        // frames kept before the first & after the last speech frame (< KWS_END_FRAMES)
+#define KWS_END_FRAMES           4        // non-speech frames that end a segment (80ms of silence with the window)
+#define KWS_VAD_LAG_FRAMES       12       // speech this recent is taken at the VAD start edge (192ms)
+#define KWS_SPEECH_LOG           2.3f     // speech frame: log energy above the noise floor (10 dB)
+#define KWS_PEAK_LOG             4.6f     // ... and within this of the run's peak (20 dB)
+#define KWS_FLOOR_RISE           0.01f    // noise floor rise per frame (log energy, ~2.7 dB/s)
+#define KWS_MIN_FRAMES           8        // shorter segments are ignored
+#define KWS_MAX_TEMPLATES        32
+#define KWS_WORD_LEN             16
+#define KWS_LIBRARY_FILE         "/kws_templates.bin"
+
+// Result of a keyword match
+typedef struct {
+   int16_t index;                         // template index, -1 if no match
+   char word[KWS_WORD_LEN];               // matched command word
+   float distance;                        // normalized DTW distance
+   uint32_t match_us;                     // time spent matching
+   uint32_t end_us;                       // end of speech to result
+} kws_result_t ;
+
+// Template record header in the library file. Followed by
+// frames * ceps floats.
+typedef struct {
+   uint32_t magic;                        // KWS_TEMPLATE_MAGIC
+   char word[KWS_WORD_LEN];
+   uint16_t frames;
+   uint16_t ceps;
+} kws_template_hdr_t ;
+
+#define KWS_TEMPLATE_MAGIC       0x3253574B  // 'KWS2' (segments cut at the last speech frame)
+
+class ESP32S3_KWS {
+   public:
+      ESP32S3_KWS(void);
+      ~ESP32S3_KWS(void);
+
+      bool init(const char *library=KWS_LIBRARY_FILE);   // alloc & load templates from SD
+      void end(void);
+      bool isReady(void) { return _ready; }
+      void pushAudio(const float *input, uint32_t len, int64_t time_us=0);   // continuous feature extraction
+      void speechStart(void);             // VAD speech start - begin a segment
+      bool speechEnd(kws_result_t *result);   // VAD speech end - end the segment, same as poll()
+      bool poll(kws_result_t *result);    // match (or enroll) a segment that has ended
+      bool enroll(const char *word);      // save the next segment as a template for 'word'
+      bool clearLibrary(void);            // delete all templates
+      uint16_t numTemplates(void) { return _num_templates; }
+
+      // Tuneables
+      float match_threshold = 80.0f;      // max distance per frame for a valid match (host test: same word < 50)
+
+   private:
+      ESP32S3_FFT _fft;
+      bool _ready = false;
+      const char *_library = KWS_LIBRARY_FILE;
+
+      // Feature extraction
+      float *_window = nullptr;           // hann window
+      float *_in_hist = nullptr;          // last KWS_FFT_SIZE samples
+      float *_win_buf = nullptr;
+      float *_cplx = nullptr;
+      float *_mel_lo = nullptr;           // mel band edges (fractional bins)
+      float *_dct = nullptr;              // [KWS_NUM_CEPS][KWS_NUM_MEL]
+      uint16_t _pending = 0;              // new samples since last frame
+      float *_feat = nullptr;             // [KWS_HISTORY_FRAMES][KWS_NUM_CEPS] ring
+      uint32_t _feat_wr = 0;              // frames produced (monotonic)
+      uint32_t _seg_start = 0;
+      uint32_t _seg_end = 0;              // one past the last frame of an ended segment
+      bool _in_segment = false;
+      bool _end_pending = false;          // a segment has ended, poll() matches it
+      bool _vad_speech = false;           // between VAD start & end edges
+
+      // Speech frame detector
+      float _floor = 0.0f;                // noise floor (log energy)
+      float _run_peak = 0.0f;             // loudest frame of the current speech run (log energy)
+      uint32_t _speech_start = 0;         // first speech frame of the current run
+      uint32_t _speech_end = 0;           // one past the last speech frame
+      int64_t _speech_end_us = 0;         // esp_timer time of the end of the last speech frame
+      int64_t _seg_end_us = 0;
+
+      // Templates
+      uint16_t _num_templates = 0;
+      char (*_words)[KWS_WORD_LEN] = nullptr;
+      float *_tmpl = nullptr;             // [KWS_MAX_TEMPLATES][KWS_NORM_FRAMES][KWS_NUM_CEPS]
+      float *_upper = nullptr;            // LB_Keogh envelopes, same layout
+      float *_lower = nullptr;
+      float *_query = nullptr;            // [KWS_NORM_FRAMES][KWS_NUM_CEPS]
+      float *_dtw_rows = nullptr;         // 2 x (KWS_NORM_FRAMES + 1)
+
+      // Enrollment request from another task
+      char _enroll_word[KWS_WORD_LEN];
+      volatile bool _enroll_pending = false;
+
+      void computeFrame(int64_t end_us);
+      void endSegment(void);
+      bool buildQuery(void);
+      void addTemplate(const char *word, const float *feat);
+      bool saveTemplate(const char *word, const float *feat);
+      float lowerBound(uint16_t t);
+      float dtw(uint16_t t, float best_so_far);
+};
+
+extern ESP32S3_KWS kws;
@@ -0,0 +1,191 @@
+/********************************************************************
+ * @brief esp32s3_latency.cpp source file
+ *
+ * @note Chirp generation & FFT cross correlation for the loopback
+ * latency measurement.
+ */
+#include "esp32s3_latency.h"
+
+
+/********************************************************************
+ * @brief Build the chirp and its spectrum.
+ * @param level - chirp peak, fraction of full scale.
+ */
+bool ESP32S3_LATENCY::init(float sample_rate, float level)
+{
+   const uint32_t N = LATENCY_FFT_SIZE;
+   uint32_t i;
+
+   end();
+   if(!_fft.init(N, N, SPECTRAL_AVERAGE))
+      return false;
+   _chirp = (int16_t *)heap_caps_malloc(LATENCY_CHIRP_LEN * sizeof(int16_t), MALLOC_CAP_SPIRAM);
+   _ref = (float *)heap_caps_aligned_alloc(16, N * 2 * sizeof(float), MALLOC_CAP_SPIRAM);
+   _cplx = (float *)heap_caps_aligned_alloc(16, N * 2 * sizeof(float), MALLOC_CAP_SPIRAM);
+   _seg = (float *)heap_caps_malloc(N * sizeof(float), MALLOC_CAP_SPIRAM);
+   if(!_chirp || !_ref || !_cplx || !_seg) {
+      end();
+      return false;
+   }
+
+   // Linear chirp F0 -> F1 with raised cosine edges
+   const float T = float(LATENCY_CHIRP_LEN) / sample_rate;
+   const float k = (LATENCY_CHIRP_F1 - LATENCY_CHIRP_F0) / T;   // Hz per sec
+   for(i = 0; i < LATENCY_CHIRP_LEN; i++) {
+      float t = float(i) / sample_rate;
+      float w = 1.0f;
+      uint32_t e = (i < LATENCY_CHIRP_LEN / 2) ? i : LATENCY_CHIRP_LEN - 1 - i;
+      if(e < LATENCY_FADE_LEN)
+         w = 0.5f * (1.0f - cosf(PI * float(e) / float(LATENCY_FADE_LEN)));
+      _chirp[i] = int16_t(32767.0f * level * w *
+               sinf(2.0f * PI * (LATENCY_CHIRP_F0 * t + 0.5f * k * t * t)));
+   }
+
+   // Reference spectrum of the zero padded chirp
+   for(i = 0; i < N; i++)
+      _seg[i] = (i < LATENCY_CHIRP_LEN) ? float(_chirp[i]) : 0.0f;
+   _fft.computeComplex(_seg, _ref, false);
+
+   _k0 = uint16_t(LATENCY_CHIRP_F0 * N / sample_rate);
+   _k1 = uint16_t(LATENCY_CHIRP_F1 * N / sample_rate) + 1;
+   if(_k1 > N / 2) _k1 = N / 2;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free the buffers.
+ */
+void ESP32S3_LATENCY::end(void)
+{
+   if(_chirp) {
+      heap_caps_free(_chirp);
+      _chirp = nullptr;
+   }
+   if(_ref) {
+      heap_caps_free(_ref);
+      _ref = nullptr;
+   }
+   if(_cplx) {
+      heap_caps_free(_cplx);
+      _cplx = nullptr;
+   }
+   if(_seg) {
+      heap_caps_free(_seg);
+      _seg = nullptr;
+   }
+   _fft.end();
+}
+
+
+/********************************************************************
+ * @brief Capture samples needed to search lags 0 .. max_lag: whole
+ * search blocks plus the chirp itself.
+ */
+uint32_t ESP32S3_LATENCY::windowLength(uint32_t max_lag)
+{
+   const uint32_t hop = LATENCY_FFT_SIZE - LATENCY_CHIRP_LEN;
+   return ((max_lag + hop) / hop) * hop + LATENCY_CHIRP_LEN;
+}
+
+
+/********************************************************************
+ * @brief Find the chirp in captured audio.
+ * @param capture - mic samples, lag 0 = capture[0].
+ * @param len - samples. Lags up to len - chirpLength() are searched.
+ * @param lag - chirp start in 'capture', fractional samples.
+ * @param par - optional, peak to average ratio of the correlation.
+ * @return false if no clear peak (< LATENCY_MIN_PAR) was found.
+ */
+bool ESP32S3_LATENCY::locate(const int16_t *capture, uint32_t len, float *lag, float *par)
+{
+   const uint32_t N = LATENCY_FFT_SIZE;
+   const uint32_t hop = N - LATENCY_CHIRP_LEN;
+   uint32_t h, i, avail, valid, count = 0, best_lag = 0;
+   float best = 0.0f, sum = 0.0f, y_m = 0.0f, y_p = 0.0f, v;
+
+   if(!_ref || len < LATENCY_CHIRP_LEN)
+      return false;
+
+   for(h = 0; h + LATENCY_CHIRP_LEN <= len; h += hop) {
+      avail = (len - h < N) ? len - h : N;
+      valid = avail - LATENCY_CHIRP_LEN + 1;   // lags with the whole chirp inside
+      if(valid > hop) valid = hop;
+
+      for(i = 0; i < N; i++)
+         _seg[i] = (i < avail) ? float(capture[h + i]) : 0.0f;
+      _fft.computeComplex(_seg, _cplx, false);
+
+      // Cross spectrum X * conj(R), whitened inside the chirp band
+      for(i = 0; i < N; i++) {
+         uint32_t k = (i <= N / 2) ? i : N - i;
+         float *c = &_cplx[2 * i];
+         if(k < _k0 || k > _k1) {
+            c[0] = c[1] = 0.0f;
+            continue;
+         }
+         float rr = _ref[2 * i], ri = _ref[2 * i + 1];
+         float re = c[0] * rr + c[1] * ri;
+         float im = c[1] * rr - c[0] * ri;
+         float mag = sqrtf(re * re + im * im) + 1e-12f;
+         c[0] = re / mag;
+         c[1] = im / mag;
+      }
+      _fft.inverse(_cplx);                // correlation in the even indices
+
+      for(i = 0; i < valid; i++) {
+         v = fabsf(_cplx[2 * i]);
+         sum += v;
+         count++;
+         if(v > best) {
+            best = v;
+            best_lag = h + i;
+            y_m = fabsf(_cplx[2 * ((i + N - 1) % N)]);   // lag -1 wraps (chirp starts faded)
+            y_p = fabsf(_cplx[2 * (i + 1)]);
+         }
+      }
+   }
+   if(count == 0 || sum <= 0.0f)
+      return false;
+
+   // Parabola through the peak & its neighbours
+   float d = 0.0f, den = y_m - 2.0f * best + y_p;
+   if(den < 0.0f) {
+      d = 0.5f * (y_m - y_p) / den;
+      d = constrain(d, -0.5f, 0.5f);
+   }
+   *lag = float(best_lag) + d;
+   v = best / (sum / float(count));
+   if(par)
+      *par = v;
+   return v >= LATENCY_MIN_PAR;
+}
+
+
+/********************************************************************
+ * @brief Mean, range and jitter of the accepted trials.
+ * @param lags - num_valid measured lags.
+ */
+void ESP32S3_LATENCY::summarize(const float *lags, uint16_t num_valid, uint16_t num_trials,
+         latency_result_t *result)
+{
+   float mean = 0.0f, var = 0.0f;
+   uint16_t i;
+
+   memset(result, 0, sizeof(latency_result_t));
+   result->trials = num_trials;
+   result->valid = num_valid;
+   if(num_valid == 0)
+      return;
+   result->min = result->max = lags[0];
+   for(i = 0; i < num_valid; i++) {
+      mean += lags[i];
+      if(lags[i] < result->min) result->min = lags[i];
+      if(lags[i] > result->max) result->max = lags[i];
+   }
+   mean /= float(num_valid);
+   for(i = 0; i < num_valid; i++)
+      var += (lags[i] - mean) * (lags[i] - mean);
+   result->mean = mean;
+   result->jitter = sqrtf(var / float(num_valid));
+}
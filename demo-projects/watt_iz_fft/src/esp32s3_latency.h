@@ -0,0 +1,70 @@
+/********************************************************************
+ * @brief esp32s3_latency.h : Loopback (speaker -> mic) latency
+ * measurement for the ESP32-S3 MCU.
+ *
+ * @note Method:
+ * 1) A known linear chirp (LATENCY_CHIRP_F0 - F1, raised cosine edges)
+ * is played through the normal playback path while the mic is captured.
+ * 2) locate() finds the chirp in the captured samples with an FFT cross
+ * correlation (GCC-PHAT): X * conj(R) is whitened to unit magnitude
+ * inside the chirp band and zeroed outside it, so the peak stays one
+ * sample wide in a reverberant room and out of band noise is ignored.
+ * 3) Long searches are split into LATENCY_FFT_SIZE blocks that overlap
+ * by the chirp length, each giving LATENCY_FFT_SIZE - chirp length
+ * valid (non wrapped) lags. The peak is refined to a fraction of a
+ * sample with a parabola through its neighbours.
+ * 4) A trial is accepted when the peak is at least LATENCY_MIN_PAR times
+ * the mean correlation magnitude. summarize() reports mean, range and
+ * jitter (standard deviation) over the accepted trials.
+ *
+ * Only the correlation needs the DSP library (via ESP32S3_FFT), so it
+ * can be checked on a host with synthetic delayed signals.
+ *
+ * Cost: 2 FFTs of LATENCY_FFT_SIZE per search block (~3072 lags).
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_dsp.h"
+#include "esp_heap_caps.h"
+#include "esp32s3_fft.h"
+
+#define LATENCY_FFT_SIZE         4096     // esp-dsp default max FFT size
+#define LATENCY_CHIRP_LEN        1024     // samples (64ms @ 16KHz)
+#define LATENCY_CHIRP_F0         300.0f   // Hz - small speakers have little below this
+#define LATENCY_CHIRP_F1         4000.0f  // Hz
+#define LATENCY_FADE_LEN         64       // raised cosine edges, samples
+#define LATENCY_MIN_PAR          10.0f    // min peak to average ratio of a valid trial
+
+// Result of a set of trials, in samples
+typedef struct {
+   uint16_t trials;                       // trials run
+   uint16_t valid;                        // trials with a clear peak
+   float mean;
+   float min;
+   float max;
+   float jitter;                          // standard deviation
+} latency_result_t ;
+
+class ESP32S3_LATENCY {
+   public:
+      ESP32S3_LATENCY(void) = default;
+      ~ESP32S3_LATENCY(void) { end(); }
+
+      bool init(float sample_rate=16000.0, float level=0.5);   // level 0 - 1.0 of full scale
+      void end(void);
+      const int16_t *chirp(void) { return _chirp; }
+      uint32_t chirpLength(void) { return LATENCY_CHIRP_LEN; }
+      uint32_t windowLength(uint32_t max_lag);   // capture samples to search lags 0 .. max_lag
+      bool locate(const int16_t *capture, uint32_t len, float *lag, float *par=nullptr);
+      static void summarize(const float *lags, uint16_t num_valid, uint16_t num_trials,
+               latency_result_t *result);
+
+   private:
+      int16_t *_chirp = nullptr;          // reference, played from PSRAM
+      float *_ref = nullptr;              // chirp spectrum, re/im pairs
+      float *_cplx = nullptr;             // work spectrum, re/im pairs
+      float *_seg = nullptr;              // one search block, float
+      uint16_t _k0 = 0, _k1 = 0;          // chirp band, FFT bins
+      ESP32S3_FFT _fft;
+};
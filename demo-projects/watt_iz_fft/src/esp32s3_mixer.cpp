@@ -0,0 +1,259 @@
+/********************************************************************
+ * @brief esp32s3_mixer.cpp source file
+ *
+ * @note Prioritized, ducking mixer of chunk fifo sources.
+ */
+#include "esp32s3_mixer.h"
+
+
+/********************************************************************
+ * @brief Attach the source rings and allocate the accumulator.
+ * @param rings - one ChunkRingFifo per source (int16 mono chunks).
+ * @param num_sources - up to MIX_MAX_SOURCES.
+ * @param max_block - largest 'len' passed to mix().
+ * @param cb - optional, called after a slot of a source is freed.
+ */
+bool ESP32S3_MIXER::init(ChunkRingFifo *rings, uint8_t num_sources, uint32_t max_block,
+         float sample_rate, MixRelease_cb cb)
+{
+   end();
+   if(num_sources > MIX_MAX_SOURCES)
+      num_sources = MIX_MAX_SOURCES;
+
+   _acc = (int32_t *)heap_caps_malloc(max_block * sizeof(int32_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+   _tmp = (int16_t *)heap_caps_malloc(max_block * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+   if(!_acc || !_tmp) {
+      end();
+      return false;
+   }
+   _max_block = max_block;
+   _hold_samples = uint32_t(sample_rate * MIX_DUCK_HOLD_MS / 1000.0f);
+   _cb = cb;
+
+   mix_source_cfg_t unity = { 0.0f, 0, 0.0f };
+   for(uint8_t i = 0; i < num_sources; i++) {
+      source_t &s = _src[i];
+      s.ring = &rings[i];
+      s.regions = false;
+      s.pulled = 0;
+      s.started = 0;
+      s.chunk = nullptr;
+      s.len = s.off = 0;
+      s.hold = 0;
+      s.ducked = false;
+      s.gain.init(sample_rate, MIX_DUCK_RAMP_MS);
+      setSource(i, unity);
+      s.gain.jumpGain(s.level_q15);
+   }
+   _num_sources = num_sources;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free the accumulator. Queued audio is left in the rings.
+ */
+void ESP32S3_MIXER::end(void)
+{
+   if(_acc) {
+      heap_caps_free(_acc);
+      _acc = nullptr;
+   }
+   if(_tmp) {
+      heap_caps_free(_tmp);
+      _tmp = nullptr;
+   }
+   _num_sources = 0;
+}
+
+
+/********************************************************************
+ * @brief Set the level, priority and ducking of one source.
+ */
+void ESP32S3_MIXER::setSource(uint8_t source, const mix_source_cfg_t &cfg)
+{
+   if(source >= MIX_MAX_SOURCES)
+      return;
+   source_t &s = _src[source];
+   s.cfg = cfg;
+   float level = powf(10.0f, constrain(cfg.gain_db, -90.0f, 0.0f) / 20.0f);
+   float duck = powf(10.0f, -fabsf(cfg.duck_db) / 20.0f);
+   s.level_q15 = int16_t(level * GAIN_UNITY_Q15);
+   s.duck_q15 = int16_t(level * duck * GAIN_UNITY_Q15);
+   s.gain.setGain((s.ducked) ? s.duck_q15 : s.level_q15);
+}
+
+
+/********************************************************************
+ * @brief Make a source take mix_region_t entries from its ring instead
+ * of audio chunks. Set before the source is used.
+ */
+void ESP32S3_MIXER::useRegions(uint8_t source, bool regions)
+{
+   if(source < MIX_MAX_SOURCES)
+      _src[source].regions = regions;
+}
+
+
+/********************************************************************
+ * @brief Soft knee the int32 sum instead of saturating it.
+ * @param knee - start of the soft region as a fraction of full scale.
+ */
+void ESP32S3_MIXER::setLimiter(bool enab, float knee)
+{
+   _limit = enab;
+   _knee = ESP32S3_GAIN::kneeQ15(knee);
+}
+
+
+/********************************************************************
+ * @brief Drop the queued audio of every source. Consumer side only.
+ */
+void ESP32S3_MIXER::clear(void)
+{
+   for(uint8_t i = 0; i < _num_sources; i++) 
+      clear(i);
+}
+
+
+/********************************************************************
+ * @brief Drop the queued audio of one source (e.g. a seek). Consumer 
+ * side only.
+ * @return samples dropped, so a producer counting samples can tell what
+ *    was never played.
+ */
+uint32_t ESP32S3_MIXER::clear(uint8_t source)
+{
+   uint32_t dropped = 0;
+   uint16_t bytes;
+   void *slot;
+
+   if(source >= _num_sources)
+      return 0;
+   source_t &s = _src[source];
+   if(s.chunk) {
+      dropped = s.len - s.off;
+      s.ring->release();
+      s.chunk = nullptr;
+   }
+   while((slot = s.ring->front(bytes)) != nullptr) {
+      dropped += (s.regions) ? ((const mix_region_t *)slot)->len : bytes / sizeof(int16_t);
+      s.ring->release();
+   }
+   s.hold = 0;
+   s.pulled = 0;
+   s.started = 0;
+   if(_cb) _cb(source);
+   return dropped;
+}
+
+
+/********************************************************************
+ * @brief Add up to 'len' samples of one source into the accumulator.
+ * @return samples added. Less than len if the source ran dry.
+ */
+uint32_t ESP32S3_MIXER::pull(source_t &s, uint8_t idx, int32_t *acc, uint32_t len)
+{
+   uint32_t n, k, done = 0;
+   uint16_t bytes;
+
+   while(done < len) {
+      if(!s.chunk) {
+         void *slot = s.ring->front(bytes);
+         if(!slot)
+            break;
+         if(s.regions) {                  // audio lives elsewhere (read only)
+            const mix_region_t *r = (const mix_region_t *)slot;
+            s.chunk = (int16_t *)r->pcm;
+            s.len = r->len;
+            if(s.started == 0)
+               s.started = r->stamp;
+         } else {
+            s.chunk = (int16_t *)slot;
+            s.len = bytes / sizeof(int16_t);
+         }
+         s.off = 0;
+      }
+      n = s.len - s.off;
+      if(n > len - done) n = len - done;
+
+      int16_t *src = s.chunk + s.off;
+      if(s.regions) {                     // level & ducking into the scratch block
+         s.gain.apply(src, _tmp, n);
+         src = _tmp;
+      }
+      else
+         s.gain.apply(src, n);            // level & ducking, in place in the slot
+      for(k = 0; k < n; k++)
+         acc[done + k] += src[k];
+
+      s.off += n;
+      done += n;
+      if(s.off >= s.len) {                // slot used up - back to its producer
+         s.ring->release();
+         s.chunk = nullptr;
+         if(_cb) _cb(idx);
+      }
+   }
+   return done;
+}
+
+
+/********************************************************************
+ * @brief Mix one block of all sources.
+ * @param out - int16 output block, always fully written (zero padded).
+ * @param len - samples, <= max_block.
+ * @return number of leading samples that carried source audio.
+ *    0 means every source was idle.
+ */
+uint32_t ESP32S3_MIXER::mix(int16_t *out, uint32_t len)
+{
+   uint8_t i, top = 0;
+   bool any = false;
+   uint32_t n, filled = 0;
+
+   if(!_acc || len > _max_block)
+      return 0;
+
+   // Highest priority among sources that have (or recently had) audio
+   for(i = 0; i < _num_sources; i++) {
+      source_t &s = _src[i];
+      if(s.chunk || !s.ring->isEmpty())
+         s.hold = _hold_samples;
+      if(s.hold > 0 && (!any || s.cfg.priority > top)) {
+         top = s.cfg.priority;
+         any = true;
+      }
+   }
+
+   // Duck sources below the top priority
+   for(i = 0; i < _num_sources; i++) {
+      source_t &s = _src[i];
+      bool duck = any && s.cfg.priority < top;
+      if(duck != s.ducked) {
+         s.ducked = duck;
+         s.gain.setGain((duck) ? s.duck_q15 : s.level_q15);
+      }
+   }
+
+   // Sum
+   memset(_acc, 0, len * sizeof(int32_t));
+   for(i = 0; i < _num_sources; i++) {
+      source_t &s = _src[i];
+      s.started = 0;
+      n = pull(s, i, _acc, len);
+      s.pulled = n;
+      if(n > filled) filled = n;
+      s.hold = (s.hold > len) ? s.hold - len : 0;
+   }
+
+   // To int16: saturate, or soft knee above the knee
+   for(n = 0; n < len; n++) {
+      int32_t x = _acc[n];
+      if(_limit)
+         out[n] = (x > _knee || x < -_knee) ? ESP32S3_GAIN::softKnee(x, _knee) : int16_t(x);
+      else
+         out[n] = (x > 32767) ? 32767 : ((x < -32768) ? -32768 : int16_t(x));
+   }
+   return filled;
+}
@@ -0,0 +1,103 @@
+/********************************************************************
+ * @brief esp32s3_mixer.h : Multi source mixer for the speaker.
+ *
+ * @note Method:
+ * 1) Each source is a ChunkRingFifo filled by its own producer (tone,
+ * WAV, stream...). The mixer is the consumer of every ring and pulls
+ * samples across chunk boundaries to build fixed size output blocks.
+ * 2) Each source has a level, a priority and a duck amount. While a
+ * higher priority source has audio (plus a short hold time so gaps
+ * between chunks don't pump), lower priority sources are attenuated by
+ * their duck amount. Level & duck changes ramp via ESP32S3_GAIN, which
+ * scales the samples in place in the fifo slot.
+ * 3) Sources are summed into a 32 bit accumulator and converted to int16
+ * once per block, so intermediate sums can't wrap. The conversion
+ * saturates, or with setLimiter() bends sums above the knee through the
+ * ESP32S3_GAIN soft knee, so overlapping sources are limited before
+ * anything is clipped.
+ * 4) A source can take regions instead of audio chunks (useRegions()).
+ * Its ring then carries mix_region_t {pointer, length} entries and the
+ * samples are read where they are (e.g. memory mapped flash); the gain
+ * writes to a scratch block instead of in place. A region's 'stamp' is
+ * reported by started() after the mix() that begins playing it, so a
+ * producer's trigger time travels with the audio it belongs to.
+ *
+ * Cost: one Q15 multiply and one add per sample per active source, plus
+ * one saturate per output sample (a divide for limited samples above the
+ * knee). Idle sources cost nothing.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "chunk_fifo.h"
+#include "esp32s3_gain.h"
+
+#define MIX_MAX_SOURCES          6
+#define MIX_DUCK_HOLD_MS         250      // ducking holds this long after the higher source stops
+#define MIX_DUCK_RAMP_MS         30       // level / duck ramp time
+
+// Per source mixing rules
+typedef struct {
+   float gain_db;                         // source level (<= 0)
+   uint8_t priority;                      // a higher priority source ducks lower ones
+   float duck_db;                         // attenuation while ducked
+} mix_source_cfg_t ;
+
+// Ring entry of a region source: audio played where it lies
+typedef struct {
+   const int16_t *pcm;                    // mono samples, read only
+   uint32_t len;                          // samples
+   uint32_t stamp;                        // producer's tag (e.g. trigger time), 0 = none
+} mix_region_t ;
+
+using MixRelease_cb = void (*)(uint8_t source);   // called after a source slot is freed
+
+class ESP32S3_MIXER {
+   public:
+      ESP32S3_MIXER(void) = default;
+      ~ESP32S3_MIXER(void) { end(); }
+
+      bool init(ChunkRingFifo *rings, uint8_t num_sources, uint32_t max_block,
+               float sample_rate=16000.0, MixRelease_cb cb=nullptr);
+      void end(void);
+      void setSource(uint8_t source, const mix_source_cfg_t &cfg);
+      void useRegions(uint8_t source, bool regions=true);   // ring holds mix_region_t entries
+      void setLimiter(bool enab, float knee=0.9);   // soft knee on the sum, knee as fraction of full scale
+      const mix_source_cfg_t & getSource(uint8_t source) { return _src[source].cfg; }
+      uint32_t mix(int16_t *out, uint32_t len);   // ret samples that carried source audio, 0 = all idle
+      void clear(void);                   // drop queued audio of every source
+      uint32_t clear(uint8_t source);     // drop one source, ret samples dropped
+      bool isActive(uint8_t source) { return _src[source].hold > 0; }
+      uint32_t pulled(uint8_t source) { return _src[source].pulled; }   // leading samples in the last mix()
+      uint32_t started(uint8_t source) { return _src[source].started; }   // stamp of a region begun in the last mix()
+
+   private:
+      typedef struct {
+         ChunkRingFifo *ring;
+         bool regions;                    // ring carries mix_region_t
+         int16_t *chunk;                  // slot (or region) being consumed
+         uint32_t len;                    // samples in 'chunk'
+         uint32_t off;                    // samples already mixed
+         mix_source_cfg_t cfg;
+         ESP32S3_GAIN gain;
+         int16_t level_q15;               // level when not ducked
+         int16_t duck_q15;                // level when ducked
+         bool ducked;
+         uint32_t hold;                   // samples left in the active / hold period
+         uint32_t pulled;                 // samples taken in the last mix()
+         uint32_t started;                // first non zero region stamp begun in the last mix()
+      } source_t ;
+
+      source_t _src[MIX_MAX_SOURCES];
+      uint8_t _num_sources = 0;
+      int32_t *_acc = nullptr;            // accumulator, max_block samples
+      int16_t *_tmp = nullptr;            // gain output of region sources, max_block samples
+      uint32_t _max_block = 0;
+      uint32_t _hold_samples = 0;
+      bool _limit = false;                // soft knee instead of saturating the sum
+      int32_t _knee = 29490;
+      MixRelease_cb _cb = nullptr;
+
+      uint32_t pull(source_t &s, uint8_t idx, int32_t *acc, uint32_t len);
+};
@@ -0,0 +1,215 @@
+/********************************************************************
+ * @brief esp32s3_ns.cpp source file
+ *
+ * @note STFT noise suppressor using the ESP32S3_FFT wrapper.
+ */
+#include "esp32s3_ns.h"
+#include <float.h>
+
+
+/********************************************************************
+ * @brief ESP32S3_NOISE_SUPPRESS class constructor
+ */
+ESP32S3_NOISE_SUPPRESS::ESP32S3_NOISE_SUPPRESS(void) { }
+
+
+/********************************************************************
+ * @brief ESP32S3_NOISE_SUPPRESS class destructor
+ */
+ESP32S3_NOISE_SUPPRESS::~ESP32S3_NOISE_SUPPRESS(void)
+{
+   end();                                 // free internal buffer memory
+}
+
+
+/********************************************************************
+ * @brief Allocate working buffers and init the FFT engine.
+ * @param max_frame_samples - largest number of samples that will be
+ *    passed to process() in one call. Determines the size of the
+ *    magnitude store shared with the VAD.
+ * @return true if all memory was allocated.
+ */
+bool ESP32S3_NOISE_SUPPRESS::init(uint32_t max_frame_samples)
+{
+   end();                                 // free any previous buffers
+
+   if(!_fft.init(NS_FFT_SIZE, NS_FFT_SIZE, SPECTRAL_AVERAGE))
+      return false;
+
+   _max_blocks = (max_frame_samples + NS_HOP_SIZE - 1) / NS_HOP_SIZE;
+   const uint32_t caps = MALLOC_CAP_SPIRAM;
+   _window = (float *) heap_caps_aligned_alloc(16, NS_FFT_SIZE * sizeof(float), caps);
+   _in_hist = (float *) heap_caps_aligned_alloc(16, NS_FFT_SIZE * sizeof(float), caps);
+   _win_buf = (float *) heap_caps_aligned_alloc(16, NS_FFT_SIZE * sizeof(float), caps);
+   _cplx = (float *) heap_caps_aligned_alloc(16, NS_FFT_SIZE * 2 * sizeof(float), caps);
+   _ola = (float *) heap_caps_aligned_alloc(16, NS_HOP_SIZE * sizeof(float), caps);
+   _psmooth = (float *) heap_caps_aligned_alloc(16, NS_NUM_BINS * sizeof(float), caps);
+   _sub_min = (float *) heap_caps_aligned_alloc(16, NS_NUM_BINS * sizeof(float), caps);
+   _win_min = (float *) heap_caps_aligned_alloc(16, NS_MIN_SUBWINDOWS * NS_NUM_BINS * sizeof(float), caps);
+   _clean_prev = (float *) heap_caps_aligned_alloc(16, NS_NUM_BINS * sizeof(float), caps);
+   _mags = (float *) heap_caps_aligned_alloc(16, _max_blocks * NS_NUM_BINS * sizeof(float), caps);
+
+   if(!_window || !_in_hist || !_win_buf || !_cplx || !_ola || !_psmooth ||
+         !_sub_min || !_win_min || !_clean_prev || !_mags) {
+      end();
+      return false;
+   }
+
+   // Periodic sqrt-hann. Analysis * synthesis == hann which sums to 1.0 at 50% overlap
+   for(int i = 0; i < NS_FFT_SIZE; i++) {
+      _window[i] = sqrtf(0.5f * (1.0f - cosf(2.0f * PI * i / NS_FFT_SIZE)));
+   }
+   reset();
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free internal buffer memory. init() must be called before
+ *    any more calls to process().
+ */
+void ESP32S3_NOISE_SUPPRESS::end(void)
+{
+   float **bufs[] = { &_window, &_in_hist, &_win_buf, &_cplx, &_ola, &_psmooth,
+         &_sub_min, &_win_min, &_clean_prev, &_mags };
+   for(float **b : bufs) {
+      if(*b) {
+         free(*b);
+         *b = nullptr;
+      }
+   }
+   _fft.end();
+   _max_blocks = 0;
+   _num_blocks = 0;
+}
+
+
+/********************************************************************
+ * @brief Clear signal history and restart the noise estimate. Call
+ *    this at the start of every new capture.
+ */
+void ESP32S3_NOISE_SUPPRESS::reset(void)
+{
+   if(!_in_hist) return;
+   memset(_in_hist, 0, NS_FFT_SIZE * sizeof(float));
+   memset(_ola, 0, NS_HOP_SIZE * sizeof(float));
+   memset(_clean_prev, 0, NS_NUM_BINS * sizeof(float));
+   memset(_mags, 0, _max_blocks * NS_NUM_BINS * sizeof(float));
+   for(int k = 0; k < NS_NUM_BINS; k++) {
+      _psmooth[k] = 0.0f;
+      _sub_min[k] = FLT_MAX;
+   }
+   for(int k = 0; k < NS_MIN_SUBWINDOWS * NS_NUM_BINS; k++)
+      _win_min[k] = FLT_MAX;
+   _hop_count = 0;
+   _subwin_idx = 0;
+   _num_blocks = 0;
+}
+
+
+/********************************************************************
+ * @brief Suppress stationary noise in a block of audio.
+ * @param input - ptr to float samples (int16 scale).
+ * @param output - ptr to float output. May be the same as input.
+ * @param len - number of samples. Must be a multiple of NS_HOP_SIZE
+ *    and <= the max_frame_samples passed to init().
+ * @return Number of spectral blocks produced (see magnitude()).
+ */
+uint16_t ESP32S3_NOISE_SUPPRESS::process(float *input, float *output, uint32_t len)
+{
+   // Tuneables for the noise estimate
+   const float PSMOOTH_ALPHA  = 0.85f;    // power smoothing per hop
+   const float MIN_BIAS       = 1.5f;     // minimum statistics bias compensation
+   constexpr float EPSILON    = 1e-6f;
+
+   uint32_t t0 = micros();
+   uint16_t blocks = len / NS_HOP_SIZE;
+   if(!_cplx || blocks > _max_blocks) {
+      _num_blocks = 0;
+      return 0;
+   }
+
+   for(uint16_t b = 0; b < blocks; b++) {
+      float *in = input + (b * NS_HOP_SIZE);
+      float *out = output + (b * NS_HOP_SIZE);
+      float *mag = _mags + (b * NS_NUM_BINS);
+
+      // Slide the analysis history by one hop and append new samples
+      memmove(_in_hist, _in_hist + NS_HOP_SIZE, (NS_FFT_SIZE - NS_HOP_SIZE) * sizeof(float));
+      memcpy(_in_hist + (NS_FFT_SIZE - NS_HOP_SIZE), in, NS_HOP_SIZE * sizeof(float));
+
+      // Analysis window & forward FFT
+      dsps_mul_f32(_in_hist, _window, _win_buf, NS_FFT_SIZE, 1, 1, 1);
+      _fft.computeComplex(_win_buf, _cplx, false);
+
+      // Close the current min statistics sub window?
+      bool end_subwin = (++_hop_count % NS_MIN_SUBWINDOW_LEN) == 0;
+
+      for(int k = 0; k < NS_NUM_BINS; k++) {
+         float re = _cplx[2 * k];
+         float im = _cplx[2 * k + 1];
+         float pw = re * re + im * im;
+
+         // Minimum statistics noise estimate
+         _psmooth[k] = (_hop_count == 1) ? pw :
+               PSMOOTH_ALPHA * _psmooth[k] + (1.0f - PSMOOTH_ALPHA) * pw;
+         if(_psmooth[k] < _sub_min[k])
+            _sub_min[k] = _psmooth[k];
+         float pmin = _sub_min[k];
+         for(int u = 0; u < NS_MIN_SUBWINDOWS; u++) {
+            float m = _win_min[(u * NS_NUM_BINS) + k];
+            if(m < pmin) pmin = m;
+         }
+         if(end_subwin) {
+            _win_min[(_subwin_idx * NS_NUM_BINS) + k] = _sub_min[k];
+            _sub_min[k] = _psmooth[k];
+         }
+         float noise = (MIN_BIAS * pmin) + EPSILON;
+
+         // Decision-directed a priori SNR & Wiener gain
+         float snr_post = pw / noise;
+         float snr_prio = dd_alpha * (_clean_prev[k] / noise) +
+               (1.0f - dd_alpha) * ((snr_post > 1.0f) ? snr_post - 1.0f : 0.0f);
+         float gain = snr_prio / (1.0f + snr_prio);
+         if(gain < gain_floor) gain = gain_floor;
+
+         _clean_prev[k] = gain * gain * pw;
+         mag[k] = gain * sqrtf(pw);
+
+         // Apply gain to bin k and its mirror image
+         _cplx[2 * k] *= gain;
+         _cplx[2 * k + 1] *= gain;
+         if(k > 0 && k < NS_NUM_BINS - 1) {
+            int m = NS_FFT_SIZE - k;
+            _cplx[2 * m] *= gain;
+            _cplx[2 * m + 1] *= gain;
+         }
+      }
+      if(end_subwin)
+         _subwin_idx = (_subwin_idx + 1) % NS_MIN_SUBWINDOWS;
+
+      // Inverse FFT, synthesis window, & overlap-add
+      _fft.inverse(_cplx);
+      for(int i = 0; i < NS_HOP_SIZE; i++) {
+         out[i] = (_cplx[2 * i] * _window[i]) + _ola[i];
+         _ola[i] = _cplx[2 * (i + NS_HOP_SIZE)] * _window[i + NS_HOP_SIZE];
+      }
+   }
+   _num_blocks = blocks;
+   _process_us = micros() - t0;
+   return blocks;
+}
+
+
+/********************************************************************
+ * @brief Return the cleaned magnitude spectrum of one block from the
+ *    last call to process(). Block 'b' covers input samples
+ *    [(b-1) * NS_HOP_SIZE, (b+1) * NS_HOP_SIZE) of that call.
+ * @return ptr to NS_NUM_BINS floats, or NULL if block is out of range.
+ */
+float *ESP32S3_NOISE_SUPPRESS::magnitude(uint16_t block)
+{
+   if(block >= _num_blocks)
+      return nullptr;
+   return _mags + (block * NS_NUM_BINS);
+}
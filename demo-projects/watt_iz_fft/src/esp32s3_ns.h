@@ -0,0 +1,68 @@
+/********************************************************************
+ * @brief esp32s3_ns.h : STFT noise suppressor for the ESP32-S3 MCU.
+ *
+ * @note Method:
+ * 1) 512 point FFT, 50% overlap (hop 256), sqrt-Hann analysis and
+ * synthesis windows so overlap-add reconstructs the signal exactly.
+ * 2) Noise power is tracked per bin with a minimum statistics estimate
+ * (smoothed power, minimum over ~1.5 secs of sub windows). This follows
+ * slow changes like fans & HVAC but ignores speech bursts.
+ * 3) Gain per bin is a decision-directed Wiener gain with a floor to
+ * limit 'musical noise'.
+ * 4) The cleaned magnitude spectra of each block are kept so the VAD
+ * can use them directly instead of running its own FFTs.
+ *
+ * Output is delayed by one hop (16ms @ 16KHz) relative to the input.
+ *
+ * Cost: one forward and one inverse 512 point FFT per hop. lastProcessUs()
+ * reports the measured time of the most recent process() call.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_dsp.h"
+#include "esp_heap_caps.h"
+#include "esp32s3_fft.h"
+
+// Noise suppressor constants
+#define NS_FFT_SIZE              512      // analysis block (32ms @ 16KHz)
+#define NS_HOP_SIZE              (NS_FFT_SIZE / 2)
+#define NS_NUM_BINS              ((NS_FFT_SIZE / 2) + 1)   // DC .. Nyquist
+#define NS_MIN_SUBWINDOWS        6        // min statistics: sub windows in search window
+#define NS_MIN_SUBWINDOW_LEN     16       // min statistics: hops per sub window (256ms)
+
+class ESP32S3_NOISE_SUPPRESS {
+   public:
+      ESP32S3_NOISE_SUPPRESS(void);
+      ~ESP32S3_NOISE_SUPPRESS(void);
+
+      bool init(uint32_t max_frame_samples);    // call before first process() or when frame size grows
+      void end(void);
+      void reset(void);                   // restart noise estimate - call at start of each capture
+      uint16_t process(float *input, float *output, uint32_t len);   // len must be a multiple of NS_HOP_SIZE
+      float *magnitude(uint16_t block);   // cleaned magnitude spectrum (NS_NUM_BINS) of a block of last process()
+      uint16_t numBlocks(void) { return _num_blocks; }
+      uint32_t lastProcessUs(void) { return _process_us; }
+
+      // Tuneables
+      float gain_floor = 0.12f;           // ~ -18db max attenuation
+      float dd_alpha = 0.96f;             // decision-directed smoothing
+
+   private:
+      ESP32S3_FFT _fft;                   // shared FFT wrapper
+      uint16_t _max_blocks = 0;           // blocks per frame allocated for magnitude store
+      uint16_t _num_blocks = 0;           // blocks produced by last process()
+      uint32_t _hop_count = 0;            // hops processed since reset
+      uint8_t _subwin_idx = 0;            // current min statistics sub window
+      uint32_t _process_us = 0;           // cpu time of last process() call
+      float *_window = nullptr;           // sqrt-hann window
+      float *_in_hist = nullptr;          // last NS_FFT_SIZE input samples
+      float *_win_buf = nullptr;          // windowed input
+      float *_cplx = nullptr;             // complex spectrum (re/im pairs)
+      float *_ola = nullptr;              // overlap-add tail
+      float *_psmooth = nullptr;          // smoothed power per bin
+      float *_sub_min = nullptr;          // min of current sub window
+      float *_win_min = nullptr;          // [NS_MIN_SUBWINDOWS][NS_NUM_BINS] sub window minima
+      float *_clean_prev = nullptr;       // previous clean power (decision-directed)
+      float *_mags = nullptr;             // [_max_blocks][NS_NUM_BINS] clean magnitude spectra
+};
@@ -0,0 +1,390 @@
+/********************************************************************
+ * @brief esp32s3_playlist.cpp source file
+ *
+ * @note Gapless / crossfaded playback of a list of WAV tracks.
+ */
+#include "esp32s3_playlist.h"
+
+
+/********************************************************************
+ * @brief Allocate the read-ahead rings (PSRAM) and the decode buffers.
+ * @param out_rate - output sample rate, mono.
+ * @param max_block - largest 'len' passed to fill().
+ * @param read_bytes - raw bytes per decode (max).
+ * @param ring_depth, ring_bytes - read-ahead ring of each track slot.
+ * @param wake - optional, a ring slot or a track slot was freed.
+ * @param mark - optional, a track starts being heard.
+ */
+bool ESP32S3_PLAYLIST::init(uint32_t out_rate, uint32_t max_block, uint32_t read_bytes,
+         uint16_t ring_depth, uint16_t ring_bytes, PlaylistWake_cb wake, PlaylistMark_cb mark)
+{
+   end();
+   _read = (uint8_t *)heap_caps_aligned_alloc(4, read_bytes, MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+   _xfade = (int16_t *)heap_caps_malloc(max_block * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+   if(!_read || !_xfade) {
+      end();
+      return false;
+   }
+   for(playlist_track_t &t : _track) {
+      t.pcm = (int16_t *)heap_caps_malloc(max_block * sizeof(int16_t), MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      if(!t.pcm || !t.ring.create(ring_depth, ring_bytes)) {
+         end();
+         return false;
+      }
+   }
+   _out_rate = out_rate;
+   _max_block = max_block;
+   _read_bytes = read_bytes;
+   _wake = wake;
+   _mark = mark;
+   clear();
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free the rings and buffers.
+ */
+void ESP32S3_PLAYLIST::end(void)
+{
+   for(playlist_track_t &t : _track) {
+      t.ring.destroy();
+      t.wav.end();
+      if(t.pcm) {
+         heap_caps_free(t.pcm);
+         t.pcm = nullptr;
+      }
+      t.state = TRACK_FREE;
+      t.eof = true;
+      t.buffered = 0;
+   }
+   if(_read) {
+      heap_caps_free(_read);
+      _read = nullptr;
+   }
+   if(_xfade) {
+      heap_caps_free(_xfade);
+      _xfade = nullptr;
+   }
+   _pending = 0;
+   _max_block = 0;
+}
+
+
+/********************************************************************
+ * @brief Start a new list. Both slots must be FREE (see clear()).
+ * @param xfade_len - crossfade between tracks, samples. 0 = gapless.
+ */
+void ESP32S3_PLAYLIST::begin(uint32_t xfade_len)
+{
+   _xfade_len = xfade_len;
+   _pending = 0;
+   _cur = 0;
+   _fade_pos = 0;
+}
+
+
+/********************************************************************
+ * @brief Empty both slots and drop the list. Engine side, only while
+ * the loader is stopped.
+ */
+void ESP32S3_PLAYLIST::clear(void)
+{
+   for(uint8_t i = 0; i < PLAYLIST_SLOTS; i++)
+      reset(i);
+   _pending = 0;
+   _cur = 0;
+   _fade_pos = 0;
+}
+
+
+/********************************************************************
+ * @brief Empty a track slot so the loader can reuse it. Engine side,
+ * only while the loader isn't writing to this slot.
+ */
+void ESP32S3_PLAYLIST::reset(uint8_t slot)
+{
+   playlist_track_t &t = _track[slot];
+
+   t.ring.clear();
+   t.wav.end();
+   t.rd_off = 0;
+   t.consumed = 0;
+   t.pcm_len = t.pcm_off = 0;
+   t.skip = t.start = 0;
+   t.marked = false;
+   t.buffered = 0;
+   t.eof = true;
+   t.state = TRACK_FREE;                  // last - hands the slot to the loader
+}
+
+
+/********************************************************************
+ * @brief Parse a file into a FREE slot and set up conversion to mono at
+ * the output rate. Loader side. The loader then streams the audio data
+ * (info().data_offset on, info().data_bytes long) into the slot's ring.
+ * @return false if it isn't a playable file. The slot is then
+ *    TRACK_FAILED and the engine skips it.
+ */
+bool ESP32S3_PLAYLIST::open(uint8_t slot, WavRead_cb read, void *ctx, uint32_t file_bytes)
+{
+   playlist_track_t &t = _track[slot];
+
+   t.rd_off = 0;
+   t.consumed = 0;
+   t.pcm_len = t.pcm_off = 0;
+   t.skip = t.start = 0;
+   t.marked = false;
+   t.buffered = 0;
+   t.eof = true;
+   if(!read || !t.wav.open(read, ctx, _out_rate, _read_bytes, _max_block, file_bytes) ||
+            t.wav.info().data_bytes == 0) {
+      t.state = TRACK_FAILED;
+      return false;
+   }
+   t.eof = false;
+   t.state = TRACK_READY;
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Restart the playing track at the block holding 'ms'. Engine
+ * side, only while the loader is stopped. The caller reloads the ring
+ * from the returned offset and sets 'eof'.
+ * @return data offset (from info().data_offset) to read from.
+ */
+uint32_t ESP32S3_PLAYLIST::seek(uint32_t ms)
+{
+   playlist_track_t &a = _track[_cur];
+   const wav_info_t &info = a.wav.info();
+   uint32_t frame, offset, skip;
+
+   _fade_pos = 0;
+   frame = uint32_t(uint64_t(ms) * info.sample_rate / 1000);
+   offset = a.wav.seek(frame, &skip);
+   if(offset > info.data_bytes)
+      offset = info.data_bytes;
+   if(frame > info.total_frames)
+      frame = info.total_frames;
+   a.ring.clear();
+   a.buffered = 0;
+   a.rd_off = 0;
+   a.pcm_len = a.pcm_off = 0;
+   a.consumed = offset;
+   a.skip = uint32_t(uint64_t(skip) * _out_rate / info.sample_rate);
+   a.start = uint32_t(uint64_t(frame) * _out_rate / info.sample_rate);
+   a.marked = false;
+   return offset;
+}
+
+
+/********************************************************************
+ * @brief Track length in output samples.
+ */
+uint32_t ESP32S3_PLAYLIST::length(playlist_track_t &t)
+{
+   const wav_info_t &info = t.wav.info();
+   if(info.sample_rate == 0)
+      return 0;
+   return uint32_t(uint64_t(info.total_frames) * _out_rate / info.sample_rate);
+}
+
+
+/********************************************************************
+ * @brief Copy up to 'len' read-ahead bytes of a track to 'dst'.
+ * @return bytes copied. Less than len only at the end of the data.
+ *    0 if the data isn't buffered yet.
+ */
+uint32_t ESP32S3_PLAYLIST::read(playlist_track_t &t, uint8_t *dst, uint32_t len)
+{
+   uint32_t n, done = 0;
+   uint16_t slot_len;
+   uint8_t *slot;
+
+   if(t.buffered < len && !t.eof)         // wait for whole frames
+      return 0;
+   while(done < len && (slot = (uint8_t *)t.ring.front(slot_len)) != nullptr) {
+      n = slot_len - t.rd_off;
+      if(n > len - done) n = len - done;
+      memcpy(dst + done, slot + t.rd_off, n);
+      t.rd_off += n;
+      done += n;
+      if(t.rd_off >= slot_len) {          // slot used up - back to the loader
+         t.ring.release();
+         t.rd_off = 0;
+         if(_wake)
+            _wake();
+      }
+   }
+   t.buffered -= done;
+   return done;
+}
+
+
+/********************************************************************
+ * @brief Output samples left in a track (estimate for the crossfade).
+ */
+uint32_t ESP32S3_PLAYLIST::left(playlist_track_t &t)
+{
+   const wav_info_t &info = t.wav.info();
+   uint64_t frames = uint64_t(info.data_bytes - t.consumed) / info.block_align * info.frames_per_block;
+   return uint32_t(frames * _out_rate / info.sample_rate) + (t.pcm_len - t.pcm_off);
+}
+
+
+/********************************************************************
+ * @brief Take up to 'len' decoded samples of a track, decoding more
+ * from its ring as needed.
+ * @param ended - set true when the track has no more audio.
+ * @return samples copied. Less than len if the track ended, or its data
+ *    isn't buffered yet.
+ */
+uint32_t ESP32S3_PLAYLIST::pull(playlist_track_t &t, int16_t *dst, uint32_t len, bool &ended)
+{
+   uint32_t n, want, done = 0;
+   int32_t got;
+
+   ended = false;
+   while(done < len) {
+      if(t.pcm_off >= t.pcm_len) {        // decode the next block
+         want = t.wav.readSize();         // whole frames / ADPCM blocks
+         if(want > t.wav.info().data_bytes - t.consumed)
+            want = t.wav.info().data_bytes - t.consumed;
+         got = (want > 0) ? read(t, _read, want) : 0;
+         if(got == 0) {
+            ended = (want == 0 || (t.eof && t.buffered == 0));
+            break;                        // ended, or the loader wakes us
+         }
+         t.consumed += got;
+         t.pcm_len = t.wav.decode(_read, got, t.pcm);
+         t.pcm_off = 0;
+         if(t.skip > 0) {                 // seek landed inside this block
+            t.pcm_off = (t.skip < t.pcm_len) ? t.skip : t.pcm_len;
+            t.skip -= t.pcm_off;
+         }
+         continue;
+      }
+      n = t.pcm_len - t.pcm_off;
+      if(n > len - done) n = len - done;
+      memcpy(dst + done, t.pcm + t.pcm_off, n * sizeof(int16_t));
+      t.pcm_off += n;
+      done += n;
+   }
+   return done;
+}
+
+
+/********************************************************************
+ * @brief Track 't' is heard from 'offset' of the block being filled.
+ */
+void ESP32S3_PLAYLIST::heard(playlist_track_t &t, uint32_t offset)
+{
+   if(_mark)
+      _mark(t, offset);
+   t.marked = true;
+}
+
+
+/********************************************************************
+ * @brief The current track has ended: free its slot and move on to the
+ * next one.
+ */
+void ESP32S3_PLAYLIST::next(void)
+{
+   reset(_cur);
+   if(_wake)                              // slot free for the file after next
+      _wake();
+   _cur ^= 1;
+   _fade_pos = 0;
+   if(_pending) _pending--;
+}
+
+
+/********************************************************************
+ * @brief Fill an output block from the list. Near the end of a track,
+ * if a crossfade is set and the next track is loaded, both are mixed
+ * with linear fade out / fade in gains. Engine side.
+ * @return samples filled. Less than 'len' when the list ended or the
+ *    loader is behind - call again when it has read more.
+ */
+uint32_t ESP32S3_PLAYLIST::fill(int16_t *out, uint32_t len)
+{
+   uint32_t k, m, n = 0, left_a, xf;
+   int32_t g;
+   bool ended, b_ended;                   // b_ended: next track has no audio at all
+
+   if(len > _max_block) len = _max_block;
+   while(n < len && _pending > 0) {
+      playlist_track_t &a = _track[_cur];
+      playlist_track_t &b = _track[_cur ^ 1];
+
+      if(a.state == TRACK_FAILED) {       // unplayable file - skip it
+         next();
+         continue;
+      }
+      if(a.state != TRACK_READY)          // still opening
+         break;
+
+      m = len - n;
+      left_a = left(a);
+      xf = 0;                             // crossfade length, no longer than the next track
+      if(_xfade_len > 0 && _pending > 1 && b.state == TRACK_READY) {
+         xf = left(b);
+         if(xf > _xfade_len) xf = _xfade_len;
+      }
+      else if(_xfade_len > 0 && _pending > 1 && b.state == TRACK_FREE) {
+         if(left_a > _xfade_len) {        // next track not open yet: stop at the latest fade start
+            if(m > left_a - _xfade_len) m = left_a - _xfade_len;
+         }
+         else if(a.eof)                   // loader is on the next track - wait for it
+            break;
+      }
+      k = 0;
+      if(_fade_pos > 0 || (xf > 0 && left_a <= xf)) {
+         if(_fade_pos == 0)               // starting: no longer than what's left of a
+            _fade_len = (left_a < xf) ? left_a : xf;
+         if(_fade_len > 0) {
+            k = pull(b, _xfade, m, b_ended);
+            if(k == 0 && !b_ended)        // next track not buffered yet - don't play a
+               break;                     // past the fade start, wait for the loader
+         }
+      }
+
+      if(k > 0) {
+         /**
+          * @brief Crossfade: b leads, a follows sample for sample
+          */
+         if(!b.marked)                    // b is heard from here on
+            heard(b, n);
+         m = pull(a, out + n, k, ended);
+         for(uint32_t i = 0; i < k; i++) {
+            g = int32_t(((_fade_pos + i) << 15) / _fade_len);   // Q15 fade in gain
+            if(g > 32768 || i >= m) g = 32768;   // a ended (or is late): b at full level
+            int32_t va = (i < m) ? out[n + i] : 0;
+            out[n + i] = int16_t(va + (((_xfade[i] - va) * g) >> 15));
+         }
+         _fade_pos += k;
+         a.start += m;
+         b.start += k;
+         n += k;
+         if(ended)                        // a has faded out
+            next();
+      }
+      else {
+         // Gapless: stop short of the crossfade start so it begins on time
+         if(xf > 0 && left_a > xf && m > left_a - xf)
+            m = left_a - xf;
+         k = pull(a, out + n, m, ended);
+         if(k > 0 && !a.marked)
+            heard(a, n);
+         a.start += k;
+         n += k;
+         if(ended)
+            next();
+         else if(k == 0)                  // waiting for the loader
+            break;
+      }
+   }
+   return n;
+}
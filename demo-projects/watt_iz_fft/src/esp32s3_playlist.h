@@ -0,0 +1,107 @@
+/********************************************************************
+ * @brief esp32s3_playlist.h : Gapless / crossfaded playback of a list
+ * of WAV tracks. The engine side of the WAV voice.
+ *
+ * @note Method:
+ * 1) Two track slots ping-pong. A loader task opens the next file of
+ * the list into the free slot and streams its raw data into the slot's
+ * read-ahead ring (ring producer). The engine decodes from the ring of
+ * the playing slot (ring consumer). 'state' hands a slot over: the
+ * loader fills FREE slots, the engine frees them again.
+ * 2) fill() builds one output block across track boundaries. When a
+ * track ends the rest of the block comes from the next one, so tracks
+ * are spliced sample accurately. Unplayable files are skipped.
+ * 3) With a crossfade, once the samples left in the playing track drop
+ * to the crossfade length (no longer than the next track either), the
+ * next track leads and the playing one follows sample for sample, with
+ * linear Q15 fade out / fade in gains. If the next track isn't open or
+ * buffered yet at the fade start, fill() waits there for the loader
+ * rather than play the current one on unfaded.
+ * 4) Callbacks tell the owner when the loader has work (a ring slot or
+ * a track slot was freed) and when a track starts being heard ('offset'
+ * into the block being filled), for play position tracking.
+ *
+ * Cost: one copy per output sample, plus a multiply per sample while
+ * crossfading. Decoding is ESP32S3_WAV's.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include "esp_heap_caps.h"
+#include "chunk_fifo.h"
+#include "esp32s3_wav.h"
+
+#define PLAYLIST_SLOTS           2        // the playing track & the next one
+
+enum {
+   TRACK_FREE=0,                          // loader may use the slot
+   TRACK_READY,                           // parsed - data streaming into 'ring'
+   TRACK_FAILED,                          // not a playable file - engine skips it
+};
+
+// One track slot. 'ring' producer, 'buffered' & 'eof' belong to the loader.
+typedef struct {
+   ChunkRingFifo ring;                    // raw file data
+   ESP32S3_WAV wav;                       // format info & converter
+   std::atomic<uint8_t> state;            // TRACK_xxx
+   std::atomic<bool> eof;                 // all data is in the ring
+   std::atomic<uint32_t> buffered;        // bytes in the ring, not yet consumed
+   // Engine side
+   uint16_t rd_off;                       // bytes used of the front ring slot
+   uint32_t consumed;                     // audio data bytes taken from the ring
+   int16_t *pcm = nullptr;                // decoded, not yet played (max_block)
+   uint16_t pcm_len;
+   uint16_t pcm_off;
+   uint32_t skip;                         // decoded samples to drop (seek inside a block)
+   uint32_t start;                        // track position of the next sample to play
+   bool marked;                           // owner was told the track is heard
+} playlist_track_t ;
+
+using PlaylistWake_cb = void (*)(void);   // the loader has a slot to fill
+using PlaylistMark_cb = void (*)(playlist_track_t &t, uint32_t offset);   // 't' heard from 'offset'
+
+class ESP32S3_PLAYLIST {
+   public:
+      ESP32S3_PLAYLIST(void) = default;
+      ~ESP32S3_PLAYLIST(void) { end(); }
+
+      bool init(uint32_t out_rate, uint32_t max_block, uint32_t read_bytes, uint16_t ring_depth,
+               uint16_t ring_bytes, PlaylistWake_cb wake=nullptr, PlaylistMark_cb mark=nullptr);
+      void end(void);
+      // Engine side
+      void begin(uint32_t xfade_len);     // new list, crossfade in samples (0 = splice)
+      void queued(void) { _pending++; }   // one more file handed to the loader
+      void unqueue(void) { if(_pending) _pending--; }   // a queued file was dropped
+      void clear(void);                   // empty both slots, nothing pending
+      void reset(uint8_t slot);           // empty one slot, hand it to the loader
+      uint32_t seek(uint32_t ms);         // ret data offset the playing track reloads from
+      uint32_t fill(int16_t *out, uint32_t len);   // ret samples, 0 = nothing buffered yet
+      uint8_t pending(void) { return _pending; }
+      uint8_t current(void) { return _cur; }
+      playlist_track_t & track(uint8_t slot) { return _track[slot]; }
+      uint32_t length(playlist_track_t &t);         // output samples
+      // Loader side
+      bool open(uint8_t slot, WavRead_cb read, void *ctx, uint32_t file_bytes);
+
+   private:
+      playlist_track_t _track[PLAYLIST_SLOTS];
+      uint8_t _cur = 0;                   // slot of the track playing
+      uint8_t _pending = 0;               // tracks queued & not yet finished
+      uint32_t _xfade_len = 0;            // crossfade, samples. 0 = gapless splice
+      uint32_t _fade_len = 0;             // length of the current crossfade (<= both tracks)
+      uint32_t _fade_pos = 0;             // samples into the current crossfade
+      uint32_t _out_rate = 16000;
+      uint32_t _max_block = 0;
+      uint32_t _read_bytes = 0;
+      uint8_t *_read = nullptr;           // raw data for one decode
+      int16_t *_xfade = nullptr;          // incoming track during a crossfade
+      PlaylistWake_cb _wake = nullptr;
+      PlaylistMark_cb _mark = nullptr;
+
+      uint32_t read(playlist_track_t &t, uint8_t *dst, uint32_t len);
+      uint32_t pull(playlist_track_t &t, int16_t *dst, uint32_t len, bool &ended);
+      uint32_t left(playlist_track_t &t);
+      void heard(playlist_track_t &t, uint32_t offset);
+      void next(void);
+};
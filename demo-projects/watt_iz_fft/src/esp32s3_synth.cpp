@@ -0,0 +1,257 @@
+/********************************************************************
+ * @brief esp32s3_synth.cpp source file
+ *
+ * @note Phase accumulator wavetable oscillators with a gated envelope.
+ */
+#include "esp32s3_synth.h"
+#include <ctype.h>
+#include <string.h>
+
+// One sine cycle, Q15, plus a guard entry so index+1 never wraps
+static const int16_t SINE_LUT[(1 << SYNTH_LUT_BITS) + 1] = {
+        0,    804,   1608,   2410,   3212,   4011,   4808,   5602,   6393,   7179,   7962,   8739,
+     9512,  10278,  11039,  11793,  12539,  13279,  14010,  14732,  15446,  16151,  16846,  17530,
+    18204,  18868,  19519,  20159,  20787,  21403,  22005,  22594,  23170,  23731,  24279,  24811,
+    25329,  25832,  26319,  26790,  27245,  27683,  28105,  28510,  28898,  29268,  29621,  29956,
+    30273,  30571,  30852,  31113,  31356,  31580,  31785,  31971,  32137,  32285,  32412,  32521,
+    32609,  32678,  32728,  32757,  32767,  32757,  32728,  32678,  32609,  32521,  32412,  32285,
+    32137,  31971,  31785,  31580,  31356,  31113,  30852,  30571,  30273,  29956,  29621,  29268,
+    28898,  28510,  28105,  27683,  27245,  26790,  26319,  25832,  25329,  24811,  24279,  23731,
+    23170,  22594,  22005,  21403,  20787,  20159,  19519,  18868,  18204,  17530,  16846,  16151,
+    15446,  14732,  14010,  13279,  12539,  11793,  11039,  10278,   9512,   8739,   7962,   7179,
+     6393,   5602,   4808,   4011,   3212,   2410,   1608,    804,      0,   -804,  -1608,  -2410,
+    -3212,  -4011,  -4808,  -5602,  -6393,  -7179,  -7962,  -8739,  -9512, -10278, -11039, -11793,
+   -12539, -13279, -14010, -14732, -15446, -16151, -16846, -17530, -18204, -18868, -19519, -20159,
+   -20787, -21403, -22005, -22594, -23170, -23731, -24279, -24811, -25329, -25832, -26319, -26790,
+   -27245, -27683, -28105, -28510, -28898, -29268, -29621, -29956, -30273, -30571, -30852, -31113,
+   -31356, -31580, -31785, -31971, -32137, -32285, -32412, -32521, -32609, -32678, -32728, -32757,
+   -32767, -32757, -32728, -32678, -32609, -32521, -32412, -32285, -32137, -31971, -31785, -31580,
+   -31356, -31113, -30852, -30571, -30273, -29956, -29621, -29268, -28898, -28510, -28105, -27683,
+   -27245, -26790, -26319, -25832, -25329, -24811, -24279, -23731, -23170, -22594, -22005, -21403,
+   -20787, -20159, -19519, -18868, -18204, -17530, -16846, -16151, -15446, -14732, -14010, -13279,
+   -12539, -11793, -11039, -10278,  -9512,  -8739,  -7962,  -7179,  -6393,  -5602,  -4808,  -4011,
+    -3212,  -2410,  -1608,   -804,      0
+};
+
+// DTMF keypad: row & column frequencies
+static const char DTMF_KEYS[] = "123A456B789C*0#D";
+static const float DTMF_ROW[4] = { 697.0f, 770.0f, 852.0f, 941.0f };
+static const float DTMF_COL[4] = { 1209.0f, 1336.0f, 1477.0f, 1633.0f };
+
+
+/********************************************************************
+ * @brief Set the sample rate and remove all voices.
+ */
+void ESP32S3_SYNTH::init(float sample_rate)
+{
+   _sample_rate = sample_rate;
+   int32_t ramp = int32_t(sample_rate * SYNTH_ENV_MS / 1000.0f);
+   _env_step = 32767 / ((ramp > 0) ? ramp : 1);
+   clear();
+}
+
+
+/********************************************************************
+ * @brief Remove all voices and return to an always-on gate.
+ */
+void ESP32S3_SYNTH::clear(void)
+{
+   _num_voices = 0;
+   _env = 0;
+   setCadence(nullptr, 0);
+}
+
+
+/********************************************************************
+ * @brief Convert Hz to a 32 bit phase increment.
+ */
+uint32_t ESP32S3_SYNTH::freqToInc(float freq)
+{
+   if(freq < 0.0f) freq = 0.0f;
+   if(freq > _sample_rate / 2) freq = _sample_rate / 2;
+   return uint32_t((double(freq) * 4294967296.0) / double(_sample_rate));
+}
+
+
+/********************************************************************
+ * @brief Add a steady tone.
+ * @param freq - frequency in Hz.
+ * @param amp - peak level of this voice (int16 scale).
+ * @return false if all voices are in use.
+ */
+bool ESP32S3_SYNTH::addTone(float freq, int16_t amp)
+{
+   return addSweep(freq, freq, 0.0f, amp);
+}
+
+
+/********************************************************************
+ * @brief Add a tone that glides linearly from f_start to f_end.
+ * @param sweep_secs - glide time. 0 = steady tone at f_start.
+ * @param repeat - true: jump back to f_start and glide again (siren),
+ *    false: hold f_end.
+ */
+bool ESP32S3_SYNTH::addSweep(float f_start, float f_end, float sweep_secs, int16_t amp, bool repeat)
+{
+   if(_num_voices >= SYNTH_MAX_VOICES)
+      return false;
+
+   voice_t &v = _voice[_num_voices++];
+   v.phase = 0;
+   v.inc = v.inc_start = freqToInc(f_start);
+   v.amp = amp;
+   v.sweep_len = uint32_t(sweep_secs * _sample_rate);
+   v.sweep_left = v.sweep_len;
+   v.sweep_repeat = repeat;
+   v.inc_delta = 0;
+   if(v.sweep_len > 0)
+      v.inc_delta = int32_t((int64_t(freqToInc(f_end)) - int64_t(v.inc_start)) / int64_t(v.sweep_len));
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Add the two tones of a DTMF key. Each tone gets half of 'amp'.
+ */
+bool ESP32S3_SYNTH::addDtmf(char key, int16_t amp)
+{
+   const char *p = strchr(DTMF_KEYS, toupper(key));
+   if(!p || *p == '\0' || _num_voices + 2 > SYNTH_MAX_VOICES)
+      return false;
+   uint8_t k = p - DTMF_KEYS;
+   addTone(DTMF_ROW[k / 4], amp / 2);
+   return addTone(DTMF_COL[k % 4], amp / 2);
+}
+
+
+/********************************************************************
+ * @brief Gate the voices with a looping on/off cadence.
+ * @param steps - cadence steps (must stay valid while rendering), 
+ *    nullptr for always on.
+ */
+void ESP32S3_SYNTH::setCadence(const synth_step_t *steps, uint16_t num_steps)
+{
+   _steps = (num_steps > 0) ? steps : nullptr;
+   _num_steps = (_steps) ? num_steps : 0;
+   _step = 0;
+   if(_steps) {
+      _gate = _steps[0].gate;
+      _step_left = uint32_t(_steps[0].ms * _sample_rate / 1000.0f);
+   } else {
+      _gate = true;
+      _step_left = 0;
+   }
+}
+
+
+/********************************************************************
+ * @brief Ramp the envelope down and keep it there.
+ */
+void ESP32S3_SYNTH::noteOff(void)
+{
+   _steps = nullptr;
+   _num_steps = 0;
+   _gate = false;
+}
+
+
+/********************************************************************
+ * @brief Advance to the next cadence step.
+ */
+void ESP32S3_SYNTH::nextStep(void)
+{
+   if(++_step >= _num_steps) 
+      _step = 0;
+   _gate = _steps[_step].gate;
+   _step_left = uint32_t(_steps[_step].ms * _sample_rate / 1000.0f);
+}
+
+
+/********************************************************************
+ * @brief Add one voice to a block of the accumulator. Phase and
+ * increment stay in registers, steady voices skip the sweep update.
+ */
+void ESP32S3_SYNTH::renderVoice(voice_t &v, int32_t *acc, uint32_t len)
+{
+   const uint32_t idx_shift = 32 - SYNTH_LUT_BITS;
+   uint32_t phase = v.phase, inc = v.inc;
+   int32_t amp = v.amp;
+
+   if(v.sweep_left == 0) {
+      for(uint32_t i = 0; i < len; i++) {
+         uint32_t idx = phase >> idx_shift;
+         int32_t frac = (phase >> (idx_shift - 16)) & 0xFFFF;
+         int32_t s0 = SINE_LUT[idx];
+         acc[i] += ((s0 + (((SINE_LUT[idx + 1] - s0) * frac) >> 16)) * amp) >> 15;
+         phase += inc;
+      }
+      v.phase = phase;
+      return;
+   }
+   uint32_t left = v.sweep_left;
+   for(uint32_t i = 0; i < len; i++) {
+      uint32_t idx = phase >> idx_shift;
+      int32_t frac = (phase >> (idx_shift - 16)) & 0xFFFF;
+      int32_t s0 = SINE_LUT[idx];
+      acc[i] += ((s0 + (((SINE_LUT[idx + 1] - s0) * frac) >> 16)) * amp) >> 15;
+      phase += inc;
+      if(left > 0) {
+         inc += v.inc_delta;
+         if(--left == 0 && v.sweep_repeat) {
+            inc = v.inc_start;
+            left = v.sweep_len;
+         }
+      }
+   }
+   v.phase = phase;
+   v.inc = inc;
+   v.sweep_left = left;
+}
+
+
+/********************************************************************
+ * @brief Render mono int16 samples. Voices are summed a SYNTH_BLOCK at
+ * a time, then the cadence & envelope run over the sum (a plain clamp
+ * while the tone is steadily on).
+ * @param out - destination (e.g. a playback fifo slot).
+ * @param len - number of samples.
+ */
+void ESP32S3_SYNTH::render(int16_t *out, uint32_t len)
+{
+   int32_t acc[SYNTH_BLOCK];
+
+   while(len > 0) {
+      uint32_t n = (len < SYNTH_BLOCK) ? len : SYNTH_BLOCK;
+
+      // Oscillators
+      memset(acc, 0, n * sizeof(int32_t));
+      for(uint8_t v = 0; v < _num_voices; v++)
+         renderVoice(_voice[v], acc, n);
+
+      // Cadence & envelope
+      if(!_steps && _gate && _env == 32767) {
+         for(uint32_t i = 0; i < n; i++) {
+            int32_t a = int32_t((int64_t(acc[i]) * 32767) >> 15);
+            out[i] = int16_t((a > 32767) ? 32767 : (a < -32768) ? -32768 : a);
+         }
+      } else {
+         for(uint32_t i = 0; i < n; i++) {
+            if(_steps && _step_left-- == 0)
+               nextStep();
+            if(_gate && _env < 32767) {
+               _env += _env_step;
+               if(_env > 32767) _env = 32767;
+            } else if(!_gate && _env > 0) {
+               _env -= _env_step;
+               if(_env < 0) _env = 0;
+            }
+            int32_t a = int32_t((int64_t(acc[i]) * _env) >> 15);
+            if(a > 32767) a = 32767;
+            if(a < -32768) a = -32768;
+            out[i] = int16_t(a);
+         }
+      }
+      out += n;
+      len -= n;
+   }
+}
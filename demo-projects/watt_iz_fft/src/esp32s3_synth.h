@@ -0,0 +1,76 @@
+/********************************************************************
+ * @brief esp32s3_synth.h : Wavetable tone synthesizer for ring tones,
+ * alarms, DTMF, chords and sweeps.
+ *
+ * @note Method:
+ * 1) Each voice is a 32 bit phase accumulator. The increment is
+ * freq * 2^32 / sample_rate, so the pitch is exact (resolution better
+ * than 0.00001 Hz) and non integer periods don't drift.
+ * 2) The top 8 bits of the phase index a 256 entry sine table in flash.
+ * The next 16 bits linearly interpolate to the following entry.
+ * 3) Sweeps add a fixed delta to the increment every sample.
+ * 4) Voices are summed SYNTH_BLOCK samples at a time and multiplied by
+ * an envelope. A cadence (a list of gate on/off steps) drives the
+ * envelope with short linear attack and release ramps, so gating
+ * doesn't click.
+ *
+ * Cost: one interpolated table read per voice and sample, all integer.
+ */
+#pragma once
+
+#include <Arduino.h>
+
+#define SYNTH_MAX_VOICES         4
+#define SYNTH_LUT_BITS           8        // 256 entry sine table
+#define SYNTH_ENV_MS             4        // attack / release ramp time
+#define SYNTH_BLOCK              64       // samples summed per voice pass
+
+// One cadence step. Cadences loop from the last step back to the first.
+typedef struct {
+   uint16_t ms;                           // step duration
+   uint8_t gate;                          // 1 = tone on, 0 = silent
+} synth_step_t ;
+
+class ESP32S3_SYNTH {
+   public:
+      ESP32S3_SYNTH(void) = default;
+      ~ESP32S3_SYNTH(void) = default;
+
+      void init(float sample_rate=16000.0);
+      void clear(void);                   // remove all voices, steady gate
+      bool addTone(float freq, int16_t amp);   // amp is peak level (int16 scale)
+      bool addSweep(float f_start, float f_end, float sweep_secs, int16_t amp, bool repeat=false);
+      bool addDtmf(char key, int16_t amp);     // two voices for '0'-'9', '*', '#', 'A'-'D'
+      void setCadence(const synth_step_t *steps, uint16_t num_steps);   // nullptr = always on
+      void noteOff(void);                 // release ramp to silence
+      void render(int16_t *out, uint32_t len);
+
+   private:
+      typedef struct {
+         uint32_t phase;
+         uint32_t inc;                    // phase increment per sample
+         int32_t inc_delta;               // sweep: added to inc every sample
+         uint32_t inc_start;              // sweep restart value
+         uint32_t sweep_left;             // samples left in the sweep
+         uint32_t sweep_len;              // 0 = no sweep
+         bool sweep_repeat;
+         int16_t amp;
+      } voice_t ;
+
+      float _sample_rate = 16000.0f;
+      voice_t _voice[SYNTH_MAX_VOICES];
+      uint8_t _num_voices = 0;
+
+      // Envelope & cadence
+      const synth_step_t *_steps = nullptr;
+      uint16_t _num_steps = 0;
+      uint16_t _step = 0;
+      uint32_t _step_left = 0;            // samples left in the current step
+      bool _gate = true;
+      int32_t _env = 0;                   // Q15 envelope level
+      int32_t _env_step = 512;            // Q15 change per sample while ramping
+
+      uint32_t freqToInc(float freq);
+      void nextStep(void);
+      void renderVoice(voice_t &v, int32_t *acc, uint32_t len);
+};
@@ -0,0 +1,411 @@
+/********************************************************************
+ * @brief esp32s3_wav.cpp source file
+ *
+ * @note Streaming RIFF/WAV parser & converter to 16 bit mono.
+ */
+#include "esp32s3_wav.h"
+
+// IMA ADPCM step size & index adjust tables
+static const int16_t IMA_STEP[89] = {
+   7, 8, 9, 10, 11, 12, 13, 14, 16, 17, 19, 21, 23, 25, 28, 31, 34, 37, 41, 45,
+   50, 55, 60, 66, 73, 80, 88, 97, 107, 118, 130, 143, 157, 173, 190, 209, 230,
+   253, 279, 307, 337, 371, 408, 449, 494, 544, 598, 658, 724, 796, 876, 963,
+   1060, 1166, 1282, 1411, 1552, 1707, 1878, 2066, 2272, 2499, 2749, 3024, 3327,
+   3660, 4026, 4428, 4871, 5358, 5894, 6484, 7132, 7845, 8630, 9493, 10442,
+   11487, 12635, 13899, 15289, 16818, 18500, 20350, 22385, 24623, 27086, 29794,
+   32767 };
+static const int8_t IMA_INDEX[8] = { -1, -1, -1, -1, 2, 4, 6, 8 };
+
+static inline uint16_t rd16(const uint8_t *p) { return uint16_t(p[0] | (p[1] << 8)); }
+static inline uint32_t rd32(const uint8_t *p) { return uint32_t(rd16(p)) | (uint32_t(rd16(p + 2)) << 16); }
+
+
+/********************************************************************
+ * @brief Walk the RIFF chunks and fill the format info. Only chunk
+ * headers and 'fmt ' are read.
+ * @param read - reads bytes at a file offset.
+ * @param ctx - passed to 'read' (e.g. the File).
+ * @param file_bytes - file size if known, 0 = unknown. The data size is
+ *    clamped to the file.
+ * @return false if not a WAV file, or an unsupported format.
+ */
+bool ESP32S3_WAV::parse(WavRead_cb read, void *ctx, uint32_t file_bytes)
+{
+   uint8_t hdr[40];
+   uint32_t size, len, off = 12;
+   bool have_fmt = false;
+   wav_info_t &w = _info;
+
+   memset(&w, 0, sizeof(wav_info_t));
+   if(read(ctx, hdr, 12, 0) != 12 || memcmp(hdr, "RIFF", 4) != 0 || memcmp(hdr + 8, "WAVE", 4) != 0)
+      return false;
+
+   for(uint16_t i = 0; i < WAV_MAX_CHUNKS; i++) {
+      if(read(ctx, hdr, 8, off) != 8)     // ran out of file before 'data'
+         return false;
+      size = rd32(hdr + 4);
+      off += 8;
+
+      if(memcmp(hdr, "fmt ", 4) == 0) {
+         len = (size < sizeof(hdr)) ? size : sizeof(hdr);
+         if(len < 16 || read(ctx, hdr, len, off) != int32_t(len))
+            return false;
+         w.format = rd16(hdr);
+         w.channels = rd16(hdr + 2);
+         w.sample_rate = rd32(hdr + 4);
+         w.block_align = rd16(hdr + 12);
+         w.bits = rd16(hdr + 14);
+         if(w.format == WAV_FMT_EXTENSIBLE && len >= 26)
+            w.format = rd16(hdr + 24);    // first 2 bytes of the sub format GUID
+         if(w.format == WAV_FMT_IMA_ADPCM && len >= 20)
+            w.frames_per_block = rd16(hdr + 18);
+         have_fmt = true;
+      }
+      else if(memcmp(hdr, "data", 4) == 0) {
+         if(!have_fmt)
+            return false;
+         w.data_offset = off;
+         w.data_bytes = size;
+         if(file_bytes) {
+            if(off > file_bytes)
+               return false;
+            if(size > file_bytes - off)   // truncated, or a size never filled in
+               w.data_bytes = file_bytes - off;
+         }
+         break;
+      }
+      off += size + (size & 1);           // chunks are word aligned
+   }
+   if(w.data_offset == 0)
+      return false;
+
+   /**
+    * @brief Validate the format and fill in the derived fields
+    */
+   if(w.channels == 0 || w.sample_rate < 4000 || w.sample_rate > 96000)
+      return false;
+   switch(w.format) {
+      case WAV_FMT_PCM:
+         if(w.bits != 8 && w.bits != 16 && w.bits != 24 && w.bits != 32)
+            return false;
+         w.block_align = w.channels * (w.bits / 8);
+         w.frames_per_block = 1;
+         w.total_frames = w.data_bytes / w.block_align;
+         break;
+
+      case WAV_FMT_FLOAT:
+         if(w.bits != 32)
+            return false;
+         w.block_align = w.channels * 4;
+         w.frames_per_block = 1;
+         w.total_frames = w.data_bytes / w.block_align;
+         break;
+
+      case WAV_FMT_IMA_ADPCM:
+         if(w.bits != 4 || w.block_align <= 4 * w.channels)
+            return false;
+         if(w.frames_per_block == 0)
+            w.frames_per_block = (w.block_align - 4 * w.channels) * 2 / w.channels + 1;
+         len = w.data_bytes % w.block_align;   // short last block
+         w.total_frames = (w.data_bytes / w.block_align) * w.frames_per_block;
+         if(len > 4u * w.channels)
+            w.total_frames += 1 + (len - 4 * w.channels) * 2 / w.channels;
+         break;
+
+      default:
+         return false;
+   }
+   w.duration_ms = uint32_t(uint64_t(w.total_frames) * 1000 / w.sample_rate);
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Parse the file and set up the converter.
+ * @param out_rate - output sample rate. The file is resampled if needed.
+ * @param max_in_bytes - size of the raw buffer passed to decode().
+ * @param max_out_samples - size of the output buffer passed to decode().
+ * @param file_bytes - file size if known, see parse().
+ */
+bool ESP32S3_WAV::open(WavRead_cb read, void *ctx, uint32_t out_rate, uint32_t max_in_bytes,
+         uint32_t max_out_samples, uint32_t file_bytes)
+{
+   uint32_t blocks, frames;
+
+   end();
+   if(!parse(read, ctx, file_bytes) || out_rate == 0 || max_out_samples < 4)
+      return false;
+
+   // Whole frames / blocks that fit both buffers
+   _step = uint32_t((uint64_t(_info.sample_rate) << 16) / out_rate);
+   if(_step == 0x10000)
+      frames = max_out_samples;
+   else
+      frames = uint32_t((uint64_t(max_out_samples - 2) * _step) >> 16);
+   blocks = frames / _info.frames_per_block;
+   if(blocks > max_in_bytes / _info.block_align)
+      blocks = max_in_bytes / _info.block_align;
+   if(blocks == 0)                        // ADPCM block larger than the buffers
+      return false;
+   _read_bytes = blocks * _info.block_align;
+
+   _pos = 0x10000;                        // first output = first input sample
+   _prev = 0;
+   if(_step != 0x10000) {
+      _mono = (int16_t *)heap_caps_malloc(blocks * _info.frames_per_block * sizeof(int16_t),
+               MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      if(!_mono)
+         return false;
+   }
+
+   // Decimating: Butterworth low pass, one biquad per pole pair
+   if(_step > 0x10000) {
+      _flt = (float *)heap_caps_malloc(blocks * _info.frames_per_block * sizeof(float),
+               MALLOC_CAP_INTERNAL | MALLOC_CAP_8BIT);
+      if(!_flt) {
+         end();
+         return false;
+      }
+      float fc = WAV_AA_CUTOFF * out_rate / _info.sample_rate;
+      for(uint8_t k = 0; k < WAV_AA_SECTIONS; k++) {
+         float q = 1.0f / (2.0f * cosf(float(PI) * (2 * k + 1) / (4 * WAV_AA_SECTIONS)));
+         dsps_biquad_gen_lpf_f32(_aa_coef[k], fc, q);
+      }
+      memset(_aa_w, 0, sizeof(_aa_w));
+   }
+   return true;
+}
+
+
+/********************************************************************
+ * @brief Free the resampler & anti-alias scratch buffers.
+ */
+void ESP32S3_WAV::end(void)
+{
+   if(_mono) {
+      heap_caps_free(_mono);
+      _mono = nullptr;
+   }
+   if(_flt) {
+      heap_caps_free(_flt);
+      _flt = nullptr;
+   }
+   _read_bytes = 0;
+}
+
+
+/********************************************************************
+ * @brief Prepare to decode from another position. The next decode()
+ * must start at the returned offset.
+ * @param frame - input frame (sample per channel) to seek to.
+ * @param skip_frames - frames of the first decoded block before 'frame'
+ *    (ADPCM blocks hold many frames, PCM always gives 0).
+ * @return data offset (from 'data_offset') of the frame / block holding
+ *    'frame'.
+ */
+uint32_t ESP32S3_WAV::seek(uint32_t frame, uint32_t *skip_frames)
+{
+   if(frame > _info.total_frames)
+      frame = _info.total_frames;
+   uint32_t block = frame / _info.frames_per_block;
+   *skip_frames = frame - block * _info.frames_per_block;
+
+   _pos = 0x10000;                        // resampler restarts on the new block
+   _prev = 0;
+   memset(_aa_w, 0, sizeof(_aa_w));
+   return block * _info.block_align;
+}
+
+
+/********************************************************************
+ * @brief Convert raw audio data to 16 bit mono at the output rate.
+ * @param in - raw data, starting on a frame / block boundary. 2 byte
+ *    aligned.
+ * @param in_bytes - <= readSize(). Trailing partial frames are ignored.
+ * @param out - output buffer, 'max_out_samples' long.
+ * @return number of output samples.
+ */
+uint32_t ESP32S3_WAV::decode(const uint8_t *in, uint32_t in_bytes, int16_t *out)
+{
+   int16_t *mono = (_mono) ? _mono : out;
+   uint32_t bytes, n = 0;
+
+   if(_read_bytes == 0)
+      return 0;
+   if(in_bytes > _read_bytes)
+      in_bytes = _read_bytes;
+
+   if(_info.format == WAV_FMT_IMA_ADPCM) {
+      while(in_bytes > 4u * _info.channels) {
+         bytes = (in_bytes < _info.block_align) ? in_bytes : _info.block_align;
+         n += imaBlock(in, bytes, mono + n);
+         in += bytes;
+         in_bytes -= bytes;
+      }
+   }
+   else
+      n = toMono(in, in_bytes / _info.block_align, mono);
+
+   if(_flt)
+      antiAlias(mono, n);
+   return (_mono) ? resample(mono, n, out) : n;
+}
+
+
+/********************************************************************
+ * @brief Read one sample of each format as int16.
+ */
+static inline int32_t pcm8(const uint8_t *p) { return (int32_t(p[0]) - 128) << 8; }
+static inline int32_t pcm24(const uint8_t *p) { return int16_t(rd16(p + 1)); }
+static inline int32_t pcm32(const uint8_t *p) { return int16_t(rd16(p + 2)); }
+static inline int32_t flt32(const uint8_t *p)
+{
+   float f;
+   memcpy(&f, p, sizeof(float));
+   f *= 32767.0f;
+   return (f > 32767.0f) ? 32767 : ((f < -32768.0f) ? -32768 : int32_t(f));
+}
+
+
+/********************************************************************
+ * @brief Convert 'frames' of the first one or two channels, averaging
+ * them when there are two or more.
+ */
+template <int32_t (*SAMPLE)(const uint8_t *)>
+static void framesToMono(const uint8_t *in, uint32_t frames, uint16_t frame_bytes,
+         uint16_t smp_bytes, bool stereo, int16_t *out)
+{
+   if(stereo) {
+      for(uint32_t i = 0; i < frames; i++, in += frame_bytes)
+         out[i] = int16_t((SAMPLE(in) + SAMPLE(in + smp_bytes)) >> 1);
+   } else {
+      for(uint32_t i = 0; i < frames; i++, in += frame_bytes)
+         out[i] = int16_t(SAMPLE(in));
+   }
+}
+
+
+/********************************************************************
+ * @brief PCM & float frames to 16 bit mono.
+ * @return number of samples written.
+ */
+uint32_t ESP32S3_WAV::toMono(const uint8_t *in, uint32_t frames, int16_t *out)
+{
+   const uint16_t fb = _info.block_align;
+   const bool stereo = (_info.channels > 1);
+
+   if(frames == 0)
+      return 0;
+   switch(_info.bits) {
+      case 16:
+         if(stereo)                       // (L + R) >> 1, channel stride
+            dsps_add_s16((const int16_t *)in, (const int16_t *)in + 1, out, frames,
+                     _info.channels, _info.channels, 1, 1);
+         else
+            memmove(out, in, frames * sizeof(int16_t));
+         break;
+
+      case 8:
+         framesToMono<pcm8>(in, frames, fb, 1, stereo, out);
+         break;
+
+      case 24:
+         framesToMono<pcm24>(in, frames, fb, 3, stereo, out);
+         break;
+
+      case 32:
+         if(_info.format == WAV_FMT_FLOAT)
+            framesToMono<flt32>(in, frames, fb, 4, stereo, out);
+         else
+            framesToMono<pcm32>(in, frames, fb, 4, stereo, out);
+         break;
+   }
+   return frames;
+}
+
+
+/********************************************************************
+ * @brief Expand one IMA ADPCM block (or a short last block) to mono.
+ * The first two channels are decoded and averaged.
+ * @return number of samples written.
+ */
+uint32_t ESP32S3_WAV::imaBlock(const uint8_t *blk, uint32_t bytes, int16_t *out)
+{
+   const uint32_t ch = _info.channels;
+   const uint32_t nch = (ch > 2) ? 2 : ch;
+   uint32_t c, k, b, samples;
+
+   if(bytes <= 4 * ch)
+      return 0;
+   samples = 1 + ((bytes - 4 * ch) / (4 * ch)) * 8;
+   if(samples > _info.frames_per_block)
+      samples = _info.frames_per_block;
+
+   for(c = 0; c < nch; c++) {
+      const uint8_t *hdr = blk + 4 * c;
+      const uint8_t *d = blk + 4 * ch + 4 * c;   // 4 byte groups interleaved by channel
+      int32_t pred = int16_t(rd16(hdr));
+      int32_t idx = (hdr[2] > 88) ? 88 : hdr[2];
+
+      out[0] = (c == 0) ? int16_t(pred) : int16_t((out[0] + pred) >> 1);
+      for(k = 1; k < samples; d += 4 * ch) {
+         for(b = 0; b < 8 && k < samples; b++, k++) {
+            uint8_t nib = (b & 1) ? (d[b >> 1] >> 4) : (d[b >> 1] & 0x0F);
+            int32_t step = IMA_STEP[idx];
+            int32_t diff = step >> 3;
+            if(nib & 1) diff += step >> 2;
+            if(nib & 2) diff += step >> 1;
+            if(nib & 4) diff += step;
+            pred += (nib & 8) ? -diff : diff;
+            pred = (pred > 32767) ? 32767 : ((pred < -32768) ? -32768 : pred);
+            idx += IMA_INDEX[nib & 7];
+            idx = (idx < 0) ? 0 : ((idx > 88) ? 88 : idx);
+            out[k] = (c == 0) ? int16_t(pred) : int16_t((out[k] + pred) >> 1);
+         }
+      }
+   }
+   return samples;
+}
+
+
+/********************************************************************
+ * @brief Anti-alias low pass in place, ahead of decimation.
+ */
+void ESP32S3_WAV::antiAlias(int16_t *buf, uint32_t len)
+{
+   uint32_t i;
+
+   for(i = 0; i < len; i++)
+      _flt[i] = buf[i];
+   for(uint8_t k = 0; k < WAV_AA_SECTIONS; k++)
+      dsps_biquad_f32_aes3(_flt, _flt, len, _aa_coef[k], _aa_w[k]);
+   for(i = 0; i < len; i++) {
+      float f = _flt[i];
+      buf[i] = (f >= 32767.0f) ? 32767 : ((f <= -32768.0f) ? -32768 : int16_t(lrintf(f)));
+   }
+}
+
+
+/********************************************************************
+ * @brief Linear interpolation resampler. Position 0 is the last sample
+ * of the previous block, 1 is in[0].
+ * @return number of samples written.
+ */
+uint32_t ESP32S3_WAV::resample(const int16_t *in, uint32_t len, int16_t *out)
+{
+   uint32_t i, n = 0;
+   int32_t a, b;
+
+   if(len == 0)
+      return 0;
+   while((_pos >> 16) < len) {
+      i = _pos >> 16;
+      a = (i == 0) ? _prev : in[i - 1];
+      b = in[i];
+      out[n++] = int16_t(a + (((b - a) * int32_t((_pos & 0xFFFF) >> 1)) >> 15));
+      _pos += _step;
+   }
+   _pos -= len << 16;
+   _prev = in[len - 1];
+   return n;
+}
@@ -0,0 +1,100 @@
+/********************************************************************
+ * @brief esp32s3_wav.h : Streaming RIFF/WAV parser and converter to
+ * 16 bit mono at the playback sample rate.
+ *
+ * @note Method:
+ * 1) open() walks the RIFF chunk list one 8 byte chunk header at a
+ * time through a read callback, so nothing but the headers is read.
+ * 'fmt ' is decoded, 'data' gives the audio offset & size, and every
+ * other chunk (LIST, fact, cue, ...) is skipped, including the pad
+ * byte after odd sized chunks. WAVE_FORMAT_EXTENSIBLE is resolved to
+ * its sub format. When the caller knows the file size, a 'data' size
+ * past the end of the file (truncated copies, streaming writers that
+ * leave 0xFFFFFFFF) is cut to what the file holds.
+ * 2) decode() converts whole frames (or whole ADPCM blocks) from a raw
+ * input buffer. Each sample format has its own block loop: 16 bit PCM
+ * is copied, 8/24/32 bit PCM and float keep the top 16 bits, IMA ADPCM
+ * is expanded with the standard step table.
+ * 3) Stereo 16 bit is downmixed with dsps_add_s16 (L+R)>>1 using stride
+ * 2 (SIMD on the S3). Other formats average the first two channels
+ * while converting.
+ * 4) If the file rate differs from the output rate, a Q16 linear
+ * interpolator resamples the mono block. The last input sample and the
+ * fractional position carry over to the next block, so block edges are
+ * seamless.
+ * 5) Going down in rate (44.1/48KHz -> 16KHz), the mono block first
+ * goes through an anti-alias low pass: WAV_AA_SECTIONS biquads of a
+ * Butterworth at WAV_AA_CUTOFF of the output rate (dsps_biquad_f32,
+ * SIMD on the S3). Linear interpolation alone folds everything above
+ * the output Nyquist back into the audio band. Filter state carries
+ * over between blocks and is cleared by seek().
+ *
+ * Cost: one pass per input frame for the format conversion, plus one
+ * multiply per output sample when resampling, plus WAV_AA_SECTIONS
+ * biquads per input sample when decimating.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include "esp_heap_caps.h"
+#include "esp_dsp.h"
+
+// RIFF format tags
+#define WAV_FMT_PCM              0x0001
+#define WAV_FMT_IMA_ADPCM        0x0011
+#define WAV_FMT_FLOAT            0x0003
+#define WAV_FMT_EXTENSIBLE       0xFFFE
+
+#define WAV_MAX_CHUNKS           32       // give up after this many non audio chunks
+#define WAV_AA_SECTIONS          4        // anti-alias biquads (8th order Butterworth)
+#define WAV_AA_CUTOFF            0.45f    // anti-alias corner, fraction of the output rate
+
+// Reads 'len' bytes at file 'offset'. Returns bytes read, <= 0 on error.
+using WavRead_cb = int32_t (*)(void *ctx, uint8_t *buf, uint32_t len, uint32_t offset);
+
+// Format & duration of a WAV file
+typedef struct {
+   uint16_t format;                       // WAV_FMT_xxx (extensible resolved to its sub format)
+   uint16_t channels;
+   uint32_t sample_rate;                  // Hz
+   uint16_t bits;                         // bits per sample (4 for IMA ADPCM)
+   uint16_t block_align;                  // bytes per frame, or per ADPCM block
+   uint16_t frames_per_block;             // 1, or samples per channel in an ADPCM block
+   uint32_t data_offset;                  // file offset of the audio data
+   uint32_t data_bytes;                   // audio data size
+   uint32_t total_frames;                 // samples per channel
+   uint32_t duration_ms;
+} wav_info_t ;
+
+class ESP32S3_WAV {
+   public:
+      ESP32S3_WAV(void) = default;
+      ~ESP32S3_WAV(void) { end(); }
+
+      bool parse(WavRead_cb read, void *ctx, uint32_t file_bytes=0);   // read the chunk list only
+      bool open(WavRead_cb read, void *ctx, uint32_t out_rate, uint32_t max_in_bytes,
+               uint32_t max_out_samples, uint32_t file_bytes=0);
+      void end(void);
+      uint32_t readSize(void) { return _read_bytes; }   // input bytes per decode() call
+      uint32_t decode(const uint8_t *in, uint32_t in_bytes, int16_t *out);   // ret output samples
+      uint32_t seek(uint32_t frame, uint32_t *skip_frames);   // ret block aligned data offset
+      const wav_info_t & info(void) { return _info; }
+
+   private:
+      wav_info_t _info = {};
+      uint32_t _read_bytes = 0;           // whole frames / blocks that fit the in & out limits
+      // Resampler
+      int16_t *_mono = nullptr;           // mono scratch when resampling
+      uint32_t _step = 0x10000;           // Q16 input frames per output sample
+      uint32_t _pos = 0;                  // Q16 position, 0 = '_prev'
+      int16_t _prev = 0;                  // last input sample of the previous block
+      // Anti-alias low pass, decimation only
+      float *_flt = nullptr;              // float scratch, nullptr = no filter
+      float _aa_coef[WAV_AA_SECTIONS][5];
+      float _aa_w[WAV_AA_SECTIONS][2];
+
+      uint32_t toMono(const uint8_t *in, uint32_t frames, int16_t *out);
+      uint32_t imaBlock(const uint8_t *blk, uint32_t bytes, int16_t *out);
+      void antiAlias(int16_t *buf, uint32_t len);
+      uint32_t resample(const int16_t *in, uint32_t len, int16_t *out);
+};
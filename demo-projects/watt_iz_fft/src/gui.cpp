@@ -364,13 +364,23 @@ void startFFTScan(float cutoff_freq, float qfactor)
 #define FS              16000
 #define NUM_AVG         16                // blocks to average
 #define SCAN_FFT_SIZE   1024
+#define SCAN_SAMPLES    (NUM_AVG * SCAN_FFT_SIZE)
 #define QFACTOR         0.5               // 0.5 -> 1.0
 
-   static float x[SCAN_FFT_SIZE], y[SCAN_FFT_SIZE];              // white noise - time domain
-   static float X[2*SCAN_FFT_SIZE], Y[2*SCAN_FFT_SIZE];          // FFT buffers
    static float Px[SCAN_FFT_SIZE/2+1], Py[SCAN_FFT_SIZE/2+1];    // accumulate power (0..Nyquist) 
    static lv_coord_t plot_pts[SCAN_FFT_SIZE/2+1];
 
+   // White noise x & filtered y (time domain), and their FFT frames X & Y, in PSRAM
+   float *x = (float *)heap_caps_malloc(2 * SCAN_SAMPLES * sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+   float *X = (float *)heap_caps_malloc(2 * SCAN_SAMPLES * sizeof(float), MALLOC_CAP_SPIRAM | MALLOC_CAP_32BIT);
+   if(!x || !X) {
+      heap_caps_free(x);
+      heap_caps_free(X);
+      return;
+   }
+   float *y = x + SCAN_SAMPLES;
+   float *Y = X + SCAN_SAMPLES;
+
    ESP32S3_LP_FILTER lp_filter;
 
    // Initialize the low pass filter
@@ -378,9 +388,9 @@ void startFFTScan(float cutoff_freq, float qfactor)
    // *** Last parameter 'Qfactor' == 0.5 <smoother cutoff rate>, 1.0 <sharper cutoff rate>
    lp_filter.init(cutoff_freq, AUDIO_SAMPLE_RATE, qfactor);
 
-   // Initialize the fft engine
+   // Initialize the fft engine: one frame per block, the frames are split over both cores
    ESP32S3_FFT afft;                      // FFT object
-   fft_table_t *fft_table = afft.init(SCAN_FFT_SIZE, SCAN_FFT_SIZE, SPECTRAL_AVERAGE); 
+   fft_table_t *fft_table = afft.init(SCAN_FFT_SIZE, SCAN_SAMPLES, SPECTRAL_NO_SLIDING); 
 
    // clear accumulators
    for (int c=0; c<=SCAN_FFT_SIZE/2; c++) { 
@@ -388,11 +398,12 @@ void startFFTScan(float cutoff_freq, float qfactor)
       Py[c]=0; 
    }
 
+   // The filter state runs on from block to block, so all blocks are filtered first
    for (int blk=0; blk<NUM_AVG; blk++) {     // take averaged samples
 
       // Generate white noise block
       for (int wn=0; wn<SCAN_FFT_SIZE; wn++) {
-         x[wn] = frand11();
+         x[blk * SCAN_FFT_SIZE + wn] = frand11();
       }
 
       // optional warm-up (recommended at least once after coeff/state reset)
@@ -400,18 +411,20 @@ void startFFTScan(float cutoff_freq, float qfactor)
       // dsps_biquad_f32_aes3(x, y, N, coeffs, w);
 
       // Apply filter to x data. x is unfiltered, y is filtered
-      lp_filter.apply(x, y, SCAN_FFT_SIZE);     
+      lp_filter.apply(&x[blk * SCAN_FFT_SIZE], &y[blk * SCAN_FFT_SIZE], SCAN_FFT_SIZE);     
+   }
 
-      // FFT X
-      afft.compute(x, X, true);           // compute fft for X (unfiltered data)
+   // FFT X
+   afft.compute(x, X, true);              // compute fft frames for X (unfiltered data)
 
-      // FFT Y
-      afft.compute(y, Y, true);           // compute fft for Y (filtered data)
+   // FFT Y
+   afft.compute(y, Y, true);              // compute fft frames for Y (filtered data)
 
-      // Accumulate power (0..N/2)
+   // Accumulate power (0..N/2)
+   for (int blk=0; blk<NUM_AVG; blk++) {
       for (int j=0; j<=SCAN_FFT_SIZE/2; j++) {
-         Px[j] += X[j];
-         Py[j] += Y[j];
+         Px[j] += X[blk * SCAN_FFT_SIZE + j];
+         Py[j] += Y[blk * SCAN_FFT_SIZE + j];
       }
    }
 
@@ -431,6 +444,8 @@ void startFFTScan(float cutoff_freq, float qfactor)
 
    // Free FFT memory
    afft.end();
+   heap_caps_free(x);
+   heap_caps_free(X);
 }
 
 
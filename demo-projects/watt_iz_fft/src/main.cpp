@@ -49,6 +49,13 @@ void setup(void)
       Serial.println(F("ERROR: Failed to init Audio!"));
    }
 
+   /**
+    * Start the job workers (one per core) for multi frame DSP (ESP32S3_FFT parallel_frames)
+    */
+   if(!jobs.begin()) {
+      Serial.println(F("ERROR: Failed to start job workers!"));
+   }
+
    /**
     * Initialize graphics, backlight dimming, touch screen, and demo widgets
     */                    
@@ -135,6 +142,14 @@ void setup(void)
       strip.Show();
    }
 
+   /**
+    * Preload UI sound effects into PSRAM (ids are SFX_xxx)
+    */
+   if(sd_ok) {
+      const char *sfx_files[SFX_NUM_BOOT] = SFX_BOOT_FILES;
+      audio.loadSfxBank(sfx_files, SFX_NUM_BOOT);
+   }
+
    /**
     * @brief Check if there is a firmware upgrade to be loaded 
     */
@@ -0,0 +1,50 @@
+/********************************************************************
+ * @brief seqlock.h : Single writer / many reader sequence lock.
+ *
+ * @note The writer never blocks. Readers copy the data and retry if
+ * the sequence number changed (or was odd = write in progress) while
+ * they were copying. Suited to small structs that are written often
+ * and read by tasks on either core, e.g. capture status snapshots.
+ */
+#pragma once
+
+#include <Arduino.h>
+#include <atomic>
+#include <string.h>
+
+template <typename T>
+class SeqLock {
+   public:
+      // Publish a new value. Only one task may call write().
+      void write(const T &value) {
+         uint32_t seq = _seq.load(std::memory_order_relaxed);
+         _seq.store(seq + 1, std::memory_order_relaxed);    // odd == write in progress
+         std::atomic_thread_fence(std::memory_order_release);
+         memcpy(&_data, &value, sizeof(T));
+         _seq.store(seq + 2, std::memory_order_release);
+      }
+
+      // Copy a consistent value. Returns its version (number of writes).
+      uint32_t read(T *out) const {
+         uint32_t s1, s2;
+         uint8_t tries = 0;
+         while(true) {
+            s1 = _seq.load(std::memory_order_acquire);
+            memcpy(out, &_data, sizeof(T));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            s2 = _seq.load(std::memory_order_relaxed);
+            if(!(s1 & 1) && s1 == s2)
+               break;
+            if(++tries > 4)                // writer preempted mid write - let it run
+               vTaskDelay(1);
+         }
+         return s1 >> 1;
+      }
+
+      // Number of completed writes
+      uint32_t version(void) const { return _seq.load(std::memory_order_acquire) >> 1; }
+
+   private:
+      std::atomic<uint32_t> _seq{0};
+      T _data{};
+};
@@ -0,0 +1,101 @@
+/********************************************************************
+ * @brief host_test.h : checks, timing and test signals shared by the
+ * host unit tests.
+ *
+ * @note Each test is one program. CHECK() records a failure and goes
+ * on, so every figure is still printed; main() returns testResult().
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+#include <algorithm>
+#include <chrono>
+
+static int test_failures = 0;
+
+#define CHECK(cond, ...) do { \
+      if(!(cond)) { \
+         printf("FAIL %s:%d: ", __FILE__, __LINE__); \
+         printf(__VA_ARGS__); \
+         printf("\n"); \
+         test_failures++; \
+      } \
+   } while(0)
+
+static inline int testResult(const char *name)
+{
+   printf("%s: %s\n", name, (test_failures) ? "FAILED" : "passed");
+   return (test_failures) ? 1 : 0;
+}
+
+// Wall time in us
+static inline double nowUs(void)
+{
+   using namespace std::chrono;
+   return duration<double, std::micro>(steady_clock::now().time_since_epoch()).count();
+}
+
+// Deterministic white noise, uniform -1 .. 1
+struct TestNoise {
+   uint32_t state;
+   explicit TestNoise(uint32_t seed=1) : state(seed) { }
+   float next(void)
+   {
+      state = state * 1664525u + 1013904223u;
+      return float(int32_t(state)) / 2147483648.0f;
+   }
+};
+
+// Power ratio in dB
+static inline double dB(double num, double den)
+{
+   return 10.0 * log10((num + 1e-20) / (den + 1e-20));
+}
+
+/********************************************************************
+ * @brief Speech like test signal: voiced syllables (harmonics of a
+ * gliding pitch, shaped by two formant peaks) separated by pauses.
+ * @param level - peak amplitude (int16 scale).
+ * @param active - optional, 1 where a syllable plays.
+ */
+static inline void speechLike(std::vector<float> &out, uint32_t rate, float level, uint32_t seed,
+         std::vector<uint8_t> *active=nullptr)
+{
+   TestNoise rnd(seed);
+   uint32_t n = 0;
+   double phase = 0.0;
+
+   if(active)
+      active->assign(out.size(), 0);
+   std::fill(out.begin(), out.end(), 0.0f);
+   while(n < out.size()) {
+      uint32_t syl = uint32_t(rate * (0.18 + 0.12 * (rnd.next() + 1.0)));   // 180 - 420ms
+      uint32_t gap = uint32_t(rate * (0.15 + 0.15 * (rnd.next() + 1.0)));   // 150 - 450ms
+      double f0a = 110.0 + 40.0 * (rnd.next() + 1.0), f0b = f0a * (0.8 + 0.2 * (rnd.next() + 1.0));
+      double fm1 = 500.0 + 250.0 * (rnd.next() + 1.0), fm2 = 1200.0 + 600.0 * (rnd.next() + 1.0);
+      for(uint32_t i = 0; i < syl && n < out.size(); i++, n++) {
+         double t = double(i) / syl;
+         double f0 = f0a + (f0b - f0a) * t;
+         double env = sin(M_PI * t);
+         double s = 0.0;
+         phase += 2.0 * M_PI * f0 / rate;
+         for(int h = 1; h * f0 < 0.45 * rate; h++) {
+            double f = h * f0;
+            double g = 1.0 / (1.0 + pow((f - fm1) / 150.0, 2)) + 0.5 / (1.0 + pow((f - fm2) / 250.0, 2));
+            s += g * sin(h * phase) / h;
+         }
+         out[n] = float(env * s);
+         if(active)
+            (*active)[n] = 1;
+      }
+      n += gap;
+   }
+   float peak = 0.0f;
+   for(float v : out)
+      peak = std::max(peak, fabsf(v));
+   for(float &v : out)
+      v *= level / peak;
+}
@@ -0,0 +1,65 @@
+/********************************************************************
+ * @brief host_wav.h : WAV file input for the host runners that take
+ * recordings (test_aec, test_graph).
+ *
+ * @note The file goes through the firmware parser (ESP32S3_WAV), so
+ * any format the WAV voice plays is accepted and comes out as 16 bit
+ * mono at the requested rate. Tests including this list esp32s3_wav.cpp
+ * in their sources.
+ */
+#pragma once
+
+#include "esp32s3_wav.h"
+#include "host_test.h"
+
+#define HOST_WAV_IN_BYTES        4096     // raw bytes per decode()
+#define HOST_WAV_OUT_SAMPLES     2048     // output buffer per decode()
+
+static int32_t hostFileRead(void *ctx, uint8_t *buf, uint32_t len, uint32_t offset)
+{
+   const std::vector<uint8_t> &f = *(const std::vector<uint8_t> *)ctx;
+   if(offset >= f.size())
+      return 0;
+   len = std::min<uint32_t>(len, f.size() - offset);
+   memcpy(buf, f.data() + offset, len);
+   return int32_t(len);
+}
+
+/********************************************************************
+ * @brief Read a whole WAV file as mono float samples (int16 scale) at
+ * 'rate'. Prints the reason and returns false if it can't be read.
+ */
+static inline bool loadWav(const char *path, uint32_t rate, std::vector<float> &out)
+{
+   std::vector<uint8_t> f, raw(HOST_WAV_IN_BYTES);
+   std::vector<int16_t> blk(HOST_WAV_OUT_SAMPLES);
+   ESP32S3_WAV wav;
+   uint8_t buf[4096];
+   size_t n;
+
+   FILE *fp = fopen(path, "rb");
+   if(!fp) {
+      printf("%s: can't open\n", path);
+      return false;
+   }
+   while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+      f.insert(f.end(), buf, buf + n);
+   fclose(fp);
+   if(!wav.open(hostFileRead, &f, rate, HOST_WAV_IN_BYTES, HOST_WAV_OUT_SAMPLES, f.size())) {
+      printf("%s: not a WAV file the parser takes\n", path);
+      return false;
+   }
+   const wav_info_t &info = wav.info();
+   printf("%s: %u Hz, %u ch, %u bit, %u ms\n", path, info.sample_rate, info.channels, info.bits,
+            info.duration_ms);
+   out.clear();
+   uint32_t pos = info.data_offset, end = pos + info.data_bytes;
+   while(pos < end) {
+      uint32_t len = std::min(wav.readSize(), end - pos);
+      hostFileRead(&f, raw.data(), len, pos);
+      uint32_t got = wav.decode(raw.data(), len, blk.data());
+      out.insert(out.end(), blk.begin(), blk.begin() + got);
+      pos += len;
+   }
+   return true;
+}
@@ -0,0 +1,49 @@
+/********************************************************************
+ * @brief Arduino.h : host shim for the DSP unit tests. Provides only
+ * what the DSP modules use from the Arduino core.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <stdarg.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include "esp_timer.h"
+
+using std::min;
+using std::max;
+
+#ifndef PI
+#define PI                       3.1415926535897932384626433832795
+#endif
+#define IRAM_ATTR
+#define F(s)                     (s)
+
+template<class T, class L, class H> static inline T constrain(T x, L lo, H hi)
+{
+   return (x < lo) ? T(lo) : (x > hi) ? T(hi) : x;
+}
+
+static inline uint32_t micros(void) { return uint32_t(esp_timer_get_time()); }
+static inline uint32_t millis(void) { return uint32_t(esp_timer_get_time() / 1000); }
+
+// Serial monitor -> stdout
+struct HostSerial {
+   void begin(unsigned long) { }
+   void print(const char *s) { fputs(s, stdout); }
+   void println(const char *s="") { puts(s); }
+   int printf(const char *fmt, ...) __attribute__((format(printf, 2, 3)))
+   {
+      va_list ap;
+      va_start(ap, fmt);
+      int n = vprintf(fmt, ap);
+      va_end(ap);
+      return n;
+   }
+};
+inline HostSerial Serial;
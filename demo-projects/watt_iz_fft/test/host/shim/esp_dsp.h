@@ -0,0 +1,27 @@
+/********************************************************************
+ * @brief esp_dsp.h : host shim. Portable (ANSI) versions of the esp-dsp
+ * functions the DSP modules use, same names, arguments and results -
+ * including the bit reversed output of dsps_fft2r_fc32.
+ */
+#pragma once
+
+#include <stdint.h>
+
+typedef int esp_err_t;
+#define ESP_OK                   0
+#define ESP_FAIL                 -1
+#define CONFIG_DSP_MAX_FFT_SIZE  4096
+
+esp_err_t dsps_fft2r_init_fc32(float *fft_table_buff, int table_size);
+esp_err_t dsps_fft2r_fc32(float *data, int N);
+esp_err_t dsps_bit_rev_fc32(float *data, int N);
+esp_err_t dsps_mul_f32(const float *input1, const float *input2, float *output, int len,
+         int step1, int step2, int step_out);
+esp_err_t dsps_dotprod_f32(const float *src1, const float *src2, float *dest, int len);
+esp_err_t dsps_biquad_gen_lpf_f32(float *coeffs, float f, float qFactor);
+esp_err_t dsps_biquad_f32(const float *input, float *output, int len, float *coef, float *w);
+#define dsps_biquad_f32_aes3     dsps_biquad_f32
+esp_err_t dsps_add_s16(const int16_t *input1, const int16_t *input2, int16_t *output, int len,
+         int step1, int step2, int step_out, int shift);
+esp_err_t dsps_mulc_s16(const int16_t *input, int16_t *output, int len, int16_t C,
+         int step_in, int step_out);
@@ -0,0 +1,143 @@
+/********************************************************************
+ * @brief esp_dsp_host.cpp : portable esp-dsp functions for the host
+ * tests. The radix-2 FFT follows the esp-dsp ANSI code: one table of
+ * bit reversed twiddles for CONFIG_DSP_MAX_FFT_SIZE serves every
+ * smaller size, and the output is left in bit reversed order.
+ */
+#include "esp_dsp.h"
+#include <math.h>
+
+static float w_table[CONFIG_DSP_MAX_FFT_SIZE];
+
+static void bitRev(float *data, int N)
+{
+   int j = 0;
+
+   for(int i = 1; i < N - 1; i++) {
+      int k = N >> 1;
+      while(j >= k) {
+         j -= k;
+         k >>= 1;
+      }
+      j += k;
+      if(i < j) {
+         float re = data[2 * i], im = data[2 * i + 1];
+         data[2 * i] = data[2 * j];
+         data[2 * i + 1] = data[2 * j + 1];
+         data[2 * j] = re;
+         data[2 * j + 1] = im;
+      }
+   }
+}
+
+esp_err_t dsps_fft2r_init_fc32(float *fft_table_buff, int table_size)
+{
+   static const bool ready = [] {
+      const int n = CONFIG_DSP_MAX_FFT_SIZE;
+      for(int i = 0; i < n / 2; i++) {
+         w_table[2 * i] = cosf(2.0f * float(M_PI) * i / n);
+         w_table[2 * i + 1] = sinf(2.0f * float(M_PI) * i / n);
+      }
+      bitRev(w_table, n / 2);
+      return true;
+   }();
+   return (ready && table_size <= CONFIG_DSP_MAX_FFT_SIZE) ? ESP_OK : ESP_FAIL;
+}
+
+esp_err_t dsps_fft2r_fc32(float *data, int N)
+{
+   int ie = 1;
+
+   for(int N2 = N / 2; N2 > 0; N2 >>= 1) {
+      int ia = 0;
+      for(int j = 0; j < ie; j++) {
+         float c = w_table[2 * j];
+         float s = w_table[2 * j + 1];
+         for(int i = 0; i < N2; i++) {
+            int m = ia + N2;
+            float re = c * data[2 * m] + s * data[2 * m + 1];
+            float im = c * data[2 * m + 1] - s * data[2 * m];
+            data[2 * m] = data[2 * ia] - re;
+            data[2 * m + 1] = data[2 * ia + 1] - im;
+            data[2 * ia] += re;
+            data[2 * ia + 1] += im;
+            ia++;
+         }
+         ia += N2;
+      }
+      ie <<= 1;
+   }
+   return ESP_OK;
+}
+
+esp_err_t dsps_bit_rev_fc32(float *data, int N)
+{
+   bitRev(data, N);
+   return ESP_OK;
+}
+
+esp_err_t dsps_mul_f32(const float *input1, const float *input2, float *output, int len,
+         int step1, int step2, int step_out)
+{
+   for(int i = 0; i < len; i++)
+      output[i * step_out] = input1[i * step1] * input2[i * step2];
+   return ESP_OK;
+}
+
+esp_err_t dsps_dotprod_f32(const float *src1, const float *src2, float *dest, int len)
+{
+   float acc = 0.0f;
+
+   for(int i = 0; i < len; i++)
+      acc += src1[i] * src2[i];
+   *dest = acc;
+   return ESP_OK;
+}
+
+esp_err_t dsps_biquad_gen_lpf_f32(float *coeffs, float f, float qFactor)
+{
+   if(qFactor <= 0.0001f)
+      qFactor = 0.0001f;
+   float w0 = 2.0f * float(M_PI) * f;
+   float c = cosf(w0);
+   float alpha = sinf(w0) / (2.0f * qFactor);
+   float a0 = 1.0f + alpha;
+
+   coeffs[0] = ((1.0f - c) / 2.0f) / a0;
+   coeffs[1] = (1.0f - c) / a0;
+   coeffs[2] = coeffs[0];
+   coeffs[3] = (-2.0f * c) / a0;
+   coeffs[4] = (1.0f - alpha) / a0;
+   return ESP_OK;
+}
+
+esp_err_t dsps_biquad_f32(const float *input, float *output, int len, float *coef, float *w)
+{
+   for(int i = 0; i < len; i++) {
+      float d0 = input[i] - coef[3] * w[0] - coef[4] * w[1];
+      output[i] = coef[0] * d0 + coef[1] * w[0] + coef[2] * w[1];
+      w[1] = w[0];
+      w[0] = d0;
+   }
+   return ESP_OK;
+}
+
+esp_err_t dsps_add_s16(const int16_t *input1, const int16_t *input2, int16_t *output, int len,
+         int step1, int step2, int step_out, int shift)
+{
+   for(int i = 0; i < len; i++) {
+      int32_t acc = int32_t(input1[i * step1]) + int32_t(input2[i * step2]);
+      output[i * step_out] = int16_t(acc >> shift);
+   }
+   return ESP_OK;
+}
+
+esp_err_t dsps_mulc_s16(const int16_t *input, int16_t *output, int len, int16_t C,
+         int step_in, int step_out)
+{
+   for(int i = 0; i < len; i++) {
+      int32_t acc = int32_t(input[i * step_in]) * int32_t(C);
+      output[i * step_out] = int16_t(acc >> 15);
+   }
+   return ESP_OK;
+}
@@ -0,0 +1,20 @@
+/********************************************************************
+ * @brief esp_heap_caps.h : host shim, every capability is the C heap.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <stdlib.h>
+
+#define MALLOC_CAP_32BIT         (1 << 1)
+#define MALLOC_CAP_8BIT          (1 << 2)
+#define MALLOC_CAP_DMA           (1 << 3)
+#define MALLOC_CAP_SPIRAM        (1 << 10)
+#define MALLOC_CAP_INTERNAL      (1 << 11)
+
+static inline void *heap_caps_malloc(size_t size, uint32_t caps) { return malloc(size); }
+static inline void heap_caps_free(void *ptr) { free(ptr); }
+static inline void *heap_caps_aligned_alloc(size_t alignment, size_t size, uint32_t caps)
+{
+   return aligned_alloc(alignment, (size + alignment - 1) / alignment * alignment);
+}
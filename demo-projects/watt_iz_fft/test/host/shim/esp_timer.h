@@ -0,0 +1,18 @@
+/********************************************************************
+ * @brief esp_timer.h : host shim, microseconds of a monotonic clock.
+ * Tests that feed audio faster than real time add the audio's duration
+ * to esp_timer_host_offset, so time stamps advance like a live capture.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <chrono>
+
+inline int64_t esp_timer_host_offset = 0;
+
+inline int64_t esp_timer_get_time(void)        // one t0 for every translation unit
+{
+   using namespace std::chrono;
+   static const steady_clock::time_point t0 = steady_clock::now();
+   return duration_cast<microseconds>(steady_clock::now() - t0).count() + esp_timer_host_offset;
+}
@@ -0,0 +1,47 @@
+/********************************************************************
+ * @brief sd_lvgl_fs.h : host shim, the high level SD file calls on an
+ * in-memory file table.
+ */
+#pragma once
+
+#include <stdint.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <vector>
+
+class SD_FILE_SYS {
+   public:
+      bool writeFile(const char *path, uint8_t *data, uint32_t len)
+      {
+         _files[path].assign(data, data + len);
+         return true;
+      }
+      uint32_t readFile(const char *path, uint32_t len, uint32_t offset, uint8_t *ptr)
+      {
+         auto f = _files.find(path);
+         if(f == _files.end() || offset >= f->second.size())
+            return 0;
+         if(len > f->second.size() - offset)
+            len = f->second.size() - offset;
+         memcpy(ptr, f->second.data() + offset, len);
+         return len;
+      }
+      bool appendFile(const char *path, uint8_t *data, uint32_t len)
+      {
+         _files[path].insert(_files[path].end(), data, data + len);
+         return true;
+      }
+      bool fremove(const char *filename) { return _files.erase(filename) > 0; }
+      bool fexists(const char *filename) { return _files.count(filename) > 0; }
+      int32_t fsize(const char *filename)
+      {
+         auto f = _files.find(filename);
+         return (f == _files.end()) ? -1 : int32_t(f->second.size());
+      }
+
+   private:
+      std::map<std::string, std::vector<uint8_t>> _files;
+};
+
+inline SD_FILE_SYS sd;
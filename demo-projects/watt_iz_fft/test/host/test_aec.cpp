@@ -0,0 +1,278 @@
+/********************************************************************
+ * @brief test_aec.cpp : echo canceller convergence, ERLE & the double
+ * talk / divergence freeze on the host.
+ *
+ * @note A synthetic room: the far-end signal is delayed (DMA + air) and
+ * filtered by a decaying random impulse response with a direct path,
+ * plus a little mic noise. Three runs through ESP32S3_ECHO_CANCEL:
+ * 1) Far end only - bulk delay estimate, time to 10 dB ERLE, steady
+ * ERLE.
+ * 2) Double talk - near-end speech over the echo. The near end must
+ * come through, and ERLE after it must be within 4 dB of the steady one.
+ * 3) Echo path change - the room flips sign (speaker moved). The error
+ * now exceeds the mic, so the canceller must pass the mic through
+ * (e_en > 1.5 d_en fallback) instead of adding echo, then re-converge.
+ *
+ * build/test_aec far.wav mic.wav runs a recorded pair instead: the
+ * far-end signal the speaker played and the mic capture made while it
+ * played, from the start of playback. It prints the bulk delay, ERLE
+ * per second and overall (far-end active blocks, near-end speech
+ * included) and the process() time against the frame time.
+ */
+#include "esp32s3_aec.h"
+#include "host_test.h"
+#include "host_wav.h"
+
+#define RATE                     16000
+#define FRAME                    512      // samples per process() call
+#define BULK_DELAY               1500     // speaker -> mic delay (~94ms)
+#define ROOM_TAPS                600      // echo tail after the bulk delay
+#define WIN                      (RATE / 4)   // ERLE measure window (250ms)
+
+static std::vector<float> room(float sign)
+{
+   std::vector<float> h(ROOM_TAPS);
+   TestNoise rnd(11);
+
+   for(int n = 0; n < ROOM_TAPS; n++)
+      h[n] = 0.3f * expf(-n / 120.0f) * rnd.next();
+   h[0] = 0.5f;                           // direct path
+   h[37] += 0.25f;                        // table reflection
+   for(float &v : h)
+      v *= sign;
+   return h;
+}
+
+// mic[n] = sum h[k] * ref[n - BULK_DELAY - k] (+ near) + noise, room switches at 'change'
+static void makeMic(const std::vector<float> &ref, const std::vector<float> &near,
+         std::vector<float> &mic, std::vector<float> &echo, uint32_t change=UINT32_MAX)
+{
+   std::vector<float> h1 = room(1.0f), h2 = room(-0.8f);
+   TestNoise rnd(23);
+
+   for(uint32_t n = 0; n < ref.size(); n++) {
+      const std::vector<float> &h = (n < change) ? h1 : h2;
+      float y = 0.0f;
+      for(int k = 0; k < ROOM_TAPS; k++) {
+         int32_t i = int32_t(n) - BULK_DELAY - k;
+         if(i >= 0)
+            y += h[k] * ref[i];
+      }
+      echo[n] = y;
+      mic[n] = y + near[n] + 10.0f * rnd.next();
+   }
+}
+
+typedef struct {
+   std::vector<float> out;
+   std::vector<uint8_t> passed;           // per block: output == mic (pass through or empty filter)
+   uint32_t worse_blocks;                 // blocks with output energy > 1.5x mic
+   double us;                             // mean process() time per FRAME
+} aec_run_t;
+
+static void runAec(ESP32S3_ECHO_CANCEL &aec, std::vector<float> mic, const std::vector<float> &ref,
+         aec_run_t &r)
+{
+   double t_us = 0.0;
+   uint32_t frames = 0;
+
+   r.out.assign(mic.size(), 0.0f);
+   r.passed.assign(mic.size() / AEC_BLOCK_SIZE, 0);
+   r.worse_blocks = 0;
+   aec.reset();
+   for(uint32_t pos = 0; pos + FRAME <= mic.size(); pos += FRAME, frames++) {
+      std::vector<float> d(mic.begin() + pos, mic.begin() + pos + FRAME);
+      double t0 = nowUs();
+      aec.process(d.data(), &ref[pos], &r.out[pos], FRAME);
+      t_us += nowUs() - t0;
+      for(uint32_t b = 0; b < FRAME; b += AEC_BLOCK_SIZE) {
+         double d_en = 0.0, e_en = 0.0;
+         bool same = true;
+         for(uint32_t i = pos + b; i < pos + b + AEC_BLOCK_SIZE; i++) {
+            d_en += double(mic[i]) * mic[i];
+            e_en += double(r.out[i]) * r.out[i];
+            same &= (r.out[i] == mic[i]);
+         }
+         r.passed[(pos + b) / AEC_BLOCK_SIZE] = same;
+         r.worse_blocks += (e_en > 1.5 * d_en + 1.0);
+      }
+   }
+   r.us = t_us / frames;
+}
+
+// ERLE of 'out' against 'mic' over [from, to), far-end active samples only. NAN if none.
+static double erle(const std::vector<float> &mic, const std::vector<float> &out,
+         const std::vector<uint8_t> &active, uint32_t from, uint32_t to)
+{
+   double d = 0.0, e = 0.0;
+   uint32_t n = 0;
+   for(uint32_t i = from; i < to && i < mic.size(); i++) {
+      if(i >= BULK_DELAY && active[i - BULK_DELAY]) {
+         d += double(mic[i]) * mic[i];
+         e += double(out[i]) * out[i];
+         n++;
+      }
+   }
+   return (n > WIN / 4) ? dB(d, e) : NAN;
+}
+
+// Blocks passed through in [from, to)
+static uint32_t passedBlocks(const aec_run_t &r, uint32_t from, uint32_t to)
+{
+   uint32_t n = 0;
+   for(uint32_t b = from / AEC_BLOCK_SIZE; b < to / AEC_BLOCK_SIZE && b < r.passed.size(); b++)
+      n += r.passed[b];
+   return n;
+}
+
+// First time (secs) from which every window after 'from' holds 'target' dB
+static double converged(const std::vector<float> &mic, const std::vector<float> &out,
+         const std::vector<uint8_t> &active, uint32_t from, uint32_t to, double target)
+{
+   double t = -1.0;
+   for(uint32_t w = from; w + WIN <= to; w += WIN) {
+      double e = erle(mic, out, active, w, w + WIN);
+      if(std::isnan(e))
+         continue;
+      if(e < target)
+         t = -1.0;
+      else if(t < 0.0)
+         t = double(w - from) / RATE;
+   }
+   return t;
+}
+
+/********************************************************************
+ * @brief Recorded far-end / mic pair, no checks: the figures are printed.
+ */
+static int runRecorded(const char *far_path, const char *mic_path)
+{
+   std::vector<float> ref, mic;
+   ESP32S3_ECHO_CANCEL aec;
+   aec_run_t r;
+
+   if(!loadWav(far_path, RATE, ref) || !loadWav(mic_path, RATE, mic) || !aec.init())
+      return 1;
+   uint32_t len = std::min(ref.size(), mic.size()) / FRAME * FRAME;
+   ref.resize(len);
+   mic.resize(len);
+   runAec(aec, mic, ref, r);
+
+   // Far-end active blocks, as the canceller sees them (after the bulk delay)
+   float thr = aec.ref_active_rms * aec.ref_active_rms * AEC_BLOCK_SIZE;
+   int32_t delay = aec.delaySamples();
+   double d_all = 0.0, e_all = 0.0, d_late = 0.0, e_late = 0.0;
+   printf("second   ERLE dB   far-end active\n");
+   for(uint32_t w = 0; w + RATE <= len; w += RATE) {
+      double d = 0.0, e = 0.0;
+      uint32_t act = 0, blocks = 0;
+      for(uint32_t b = w; b < w + RATE; b += AEC_BLOCK_SIZE, blocks++) {
+         double x_en = 0.0, d_en = 0.0, e_en = 0.0;
+         for(uint32_t i = b; i < b + AEC_BLOCK_SIZE && i < len; i++) {
+            float x = (int32_t(i) >= delay) ? ref[i - delay] : 0.0f;
+            x_en += x * x;
+            d_en += double(mic[i]) * mic[i];
+            e_en += double(r.out[i]) * r.out[i];
+         }
+         if(x_en > thr) {
+            d += d_en;
+            e += e_en;
+            act++;
+         }
+      }
+      d_all += d;
+      e_all += e;
+      if(w >= len / 2) {
+         d_late += d;
+         e_late += e;
+      }
+      if(act)
+         printf("%6u %9.1f %8u%%\n", w / RATE, dB(d, e), act * 100 / blocks);
+      else
+         printf("%6u         -       0%%\n", w / RATE);
+   }
+   double frame_us = 1e6 * FRAME / RATE;
+   printf("recorded pair: %.1f s, delay %d samples (%.1f ms), ERLE over far-end active blocks %.1f dB, "
+            "second half %.1f dB (erleDb %.1f), %u blocks passed through, %u louder than the mic\n",
+            double(len) / RATE, delay, 1000.0 * delay / RATE, dB(d_all, e_all), dB(d_late, e_late),
+            aec.erleDb(), passedBlocks(r, 0, len), r.worse_blocks);
+   printf("cpu          : %.0f us / %d samples (%.1f%% of %.0f ms) on this host\n", r.us, FRAME,
+            100.0 * r.us / frame_us, frame_us / 1000.0);
+   aec.end();
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   if(argc > 2)
+      return runRecorded(argv[1], argv[2]);
+
+   const uint32_t len = RATE * 24;
+   std::vector<float> ref(len), near(len, 0.0f), mic(len), echo(len), tmp(len);
+   std::vector<uint8_t> active, near_active;
+   ESP32S3_ECHO_CANCEL aec;
+   aec_run_t r, base;
+
+   CHECK(aec.init(), "init");
+   speechLike(ref, RATE, 12000.0f, 3, &active);
+
+   /**
+    * @brief 1) Far end only
+    */
+   makeMic(ref, near, mic, echo);
+   runAec(aec, mic, ref, r);
+   double t10 = converged(mic, r.out, active, 0, len, 10.0);
+   double steady = erle(mic, r.out, active, len - 8 * RATE, len);
+   printf("far end only : delay %d (true %d), 10 dB ERLE after %.2f s, steady ERLE %.1f dB "
+            "(erleDb %.1f), %.0f us / %d samples\n", aec.delaySamples(), BULK_DELAY, t10, steady,
+            aec.erleDb(), r.us, FRAME);
+   CHECK(aec.delaySamples() <= BULK_DELAY && aec.delaySamples() > BULK_DELAY - AEC_BLOCK_SIZE,
+            "bulk delay %d", aec.delaySamples());
+   CHECK(t10 >= 0.0 && t10 < 8.0, "no convergence to 10 dB (%.2f s)", t10);
+   CHECK(steady > 15.0, "steady ERLE %.1f dB", steady);
+   CHECK(r.worse_blocks == 0, "%u blocks louder than the mic", r.worse_blocks);
+   base = r;
+
+   /**
+    * @brief 2) Double talk from 10 to 16 secs
+    */
+   speechLike(tmp, RATE, 9000.0f, 41, &near_active);
+   for(uint32_t i = 10 * RATE; i < 16 * RATE; i++)
+      near[i] = tmp[i];
+   makeMic(ref, near, mic, echo);
+   runAec(aec, mic, ref, r);
+   double dt_err = 0.0, dt_near = 0.0, dt_echo = 0.0;
+   for(uint32_t i = 10 * RATE; i < 16 * RATE; i++) {
+      double e = r.out[i] - near[i];
+      dt_err += e * e;
+      dt_near += double(near[i]) * near[i];
+      dt_echo += double(echo[i]) * echo[i];
+   }
+   double dt_in = dB(dt_near, dt_echo);
+   double dt_out = dB(dt_near, dt_err);
+   double after = erle(mic, r.out, active, 16 * RATE + WIN, 20 * RATE);
+   printf("double talk  : near / echo %.1f dB in, %.1f dB out, ERLE after double talk %.1f dB\n",
+            dt_in, dt_out, after);
+   CHECK(dt_out > dt_in + 6.0, "double talk: near end SNR %.1f -> %.1f dB", dt_in, dt_out);
+   CHECK(after > steady - 4.0, "filter damaged by double talk (%.1f dB, steady %.1f dB)", after, steady);
+   CHECK(r.worse_blocks == 0, "%u blocks louder than the mic", r.worse_blocks);
+
+   /**
+    * @brief 3) Echo path flips at 12 secs
+    */
+   std::fill(near.begin(), near.end(), 0.0f);
+   makeMic(ref, near, mic, echo, 12 * RATE);
+   runAec(aec, mic, ref, r);
+   uint32_t fb_change = passedBlocks(r, 12 * RATE, 13 * RATE);
+   uint32_t fb_base = passedBlocks(base, 12 * RATE, 13 * RATE);
+   double t_re = converged(mic, r.out, active, 12 * RATE, len, 10.0);
+   printf("path change  : %u of %u blocks passed through in the next second (%u unchanged), "
+            "%u louder than the mic, 10 dB ERLE again after %.2f s\n", fb_change, RATE / AEC_BLOCK_SIZE,
+            fb_base, r.worse_blocks, t_re);
+   CHECK(fb_change > fb_base, "divergence fallback never engaged");
+   CHECK(r.worse_blocks == 0, "%u blocks louder than the mic", r.worse_blocks);
+   CHECK(t_re >= 0.0 && t_re < 6.0, "no re-convergence after the path change (%.2f s)", t_re);
+
+   aec.end();
+   return testResult("test_aec");
+}
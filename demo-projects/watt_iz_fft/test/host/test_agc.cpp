@@ -0,0 +1,245 @@
+/********************************************************************
+ * @brief test_agc.cpp : ESP32S3_AGC level steps, noise gate, gain ramp
+ * and limiter, and its cost on the host.
+ *
+ * @note The input is a 500 Hz tone (whole periods per AGC_BLOCK_SIZE
+ * block, so every block RMS is exact) stepping between levels, run in
+ * AGC_BLOCK_SIZE blocks through both presets:
+ * 1) Level steps - quiet, loud, quiet. The output block level must
+ * settle within SETTLE_DB of the target in the number of blocks the
+ * attack / release time constant gives (+-1 block), and the gain never
+ * leaves min_gain_db .. max_gain_db.
+ * 2) Gate - noise below gate_dbfs freezes the gain (no pumping) and is
+ * attenuated by gate_atten_db; the tone after it starts at the target.
+ * 3) Gain ramp - the per sample gain (output / input) changes linearly
+ * across each block: no sample to sample step larger than the largest
+ * block change spread over the block, and no jump at block edges.
+ * 4) Limiter - full scale square & sine at the highest gain: no output
+ * past int16 full scale (the encode node's cast never clamps or wraps),
+ * sign kept.
+ * 5) Cost - us per block and per 1024 sample capture frame against the
+ * frame time. Host figures use the ANSI dsps_dotprod_f32.
+ */
+#include "esp32s3_agc.h"
+#include "host_test.h"
+
+#define RATE                     16000
+#define TONE_HZ                  500.0    // 32 samples per period, 8 per block
+#define SETTLE_DB                1.0      // settled: output level within this of the final level
+#define FRAME                    1024     // capture frame for the cost figure
+#define BENCH_SAMPLES            (RATE * 600)   // 10 minutes of audio
+
+#define QUIET_DBFS               -45.0f
+#define LOUD_DBFS                -30.0f
+#define NOISE_DBFS               -70.0f
+
+typedef struct {
+   float dbfs;                            // input RMS
+   uint32_t blocks;
+   bool noise;                            // white noise instead of the tone
+} segment_t ;
+
+static double blockDbfs(const float *x, uint32_t n)
+{
+   double e = 0.0;
+   for(uint32_t i = 0; i < n; i++)
+      e += double(x[i]) * x[i];
+   return 10.0 * log10(e / n / (32767.0 * 32767.0) + 1e-20);
+}
+
+static std::vector<float> makeInput(const std::vector<segment_t> &segs)
+{
+   std::vector<float> x;
+   TestNoise rnd(9);
+   uint32_t n = 0;
+
+   for(const segment_t &s : segs) {
+      double rms = 32767.0 * pow(10.0, s.dbfs / 20.0);
+      for(uint32_t i = 0; i < s.blocks * AGC_BLOCK_SIZE; i++, n++) {
+         if(s.noise)
+            x.push_back(float(rms * sqrt(3.0) * rnd.next()));   // uniform: peak = rms * sqrt(3)
+         else
+            x.push_back(float(rms * sqrt(2.0) * sin(2.0 * M_PI * TONE_HZ * n / RATE)));
+      }
+   }
+   return x;
+}
+
+// Blocks for the output to settle from a 'from_db' gain error: one gain update per block,
+// plus the block that ramps up to the settled gain
+static int predictBlocks(double from_db, double coef)
+{
+   if(fabs(from_db) <= SETTLE_DB)
+      return 1;
+   return int(ceil(log(SETTLE_DB / fabs(from_db)) / log(1.0 - coef))) + 1;
+}
+
+// First block from 'from' after which every block up to 'to' is within SETTLE_DB of 'final'
+static int settledAfter(const std::vector<double> &lvl, uint32_t from, uint32_t to, double final_db)
+{
+   int at = -1;
+   for(uint32_t b = from; b < to; b++) {
+      if(fabs(lvl[b] - final_db) > SETTLE_DB)
+         at = -1;
+      else if(at < 0)
+         at = int(b - from) + 1;
+   }
+   return at;
+}
+
+static void runPreset(const char *name, const agc_config_t &cfg)
+{
+   const uint32_t Q1 = 188, LOUD = 125, Q2 = 250, NOISE = 125, Q3 = 63;
+   std::vector<segment_t> segs = { { QUIET_DBFS, Q1, false }, { LOUD_DBFS, LOUD, false },
+            { QUIET_DBFS, Q2, false }, { NOISE_DBFS, NOISE, true }, { QUIET_DBFS, Q3, false } };
+   std::vector<float> in = makeInput(segs), out(in.size());
+   const uint32_t blocks = in.size() / AGC_BLOCK_SIZE;
+   std::vector<double> lvl(blocks), gain(blocks);
+   std::vector<uint8_t> gated(blocks);
+   ESP32S3_AGC agc;
+
+   agc.init(cfg, float(RATE));
+   for(uint32_t b = 0; b < blocks; b++) {
+      agc.apply(&in[b * AGC_BLOCK_SIZE], &out[b * AGC_BLOCK_SIZE], AGC_BLOCK_SIZE);
+      lvl[b] = blockDbfs(&out[b * AGC_BLOCK_SIZE], AGC_BLOCK_SIZE);
+      gain[b] = agc.gainDb();
+      gated[b] = agc.isGated();
+   }
+
+   /**
+    * @brief 1) Level steps
+    */
+   const double block_ms = 1000.0 * AGC_BLOCK_SIZE / RATE;
+   const double c_att = 1.0 - exp(-block_ms / cfg.attack_ms), c_rel = 1.0 - exp(-block_ms / cfg.release_ms);
+   auto want = [&](double in_db) {
+      return std::min(std::max(cfg.target_dbfs - in_db, double(cfg.min_gain_db)), double(cfg.max_gain_db));
+   };
+   double g_quiet = want(QUIET_DBFS), g_loud = want(LOUD_DBFS);
+   int att = settledAfter(lvl, Q1, Q1 + LOUD, LOUD_DBFS + g_loud);
+   int rel = settledAfter(lvl, Q1 + LOUD, Q1 + LOUD + Q2, QUIET_DBFS + g_quiet);
+   int att_pred = predictBlocks(g_quiet - g_loud, c_att), rel_pred = predictBlocks(g_loud - g_quiet, c_rel);
+   double g_min = *std::min_element(gain.begin(), gain.end()), g_max = *std::max_element(gain.begin(), gain.end());
+   printf("%s: target %.0f dBFS, gain %.1f .. %.1f dB\n", name, cfg.target_dbfs, g_min, g_max);
+   printf("   attack  %+.0f dB step: settled in %d blocks (%.0f ms), %d predicted by %.0f ms\n",
+            LOUD_DBFS - QUIET_DBFS, att, att * block_ms, att_pred, cfg.attack_ms);
+   printf("   release %+.0f dB step: settled in %d blocks (%.0f ms), %d predicted by %.0f ms\n",
+            QUIET_DBFS - LOUD_DBFS, rel, rel * block_ms, rel_pred, cfg.release_ms);
+   CHECK(att > 0 && abs(att - att_pred) <= 1, "%s: attack settled in %d blocks, %d predicted", name, att, att_pred);
+   CHECK(rel > 0 && abs(rel - rel_pred) <= 1, "%s: release settled in %d blocks, %d predicted", name, rel, rel_pred);
+   CHECK(g_min >= cfg.min_gain_db - 1e-3 && g_max <= cfg.max_gain_db + 1e-3, "%s: gain %.2f .. %.2f dB out of range",
+            name, g_min, g_max);
+
+   /**
+    * @brief 2) Gate
+    */
+   const uint32_t n0 = Q1 + LOUD + Q2, n1 = n0 + NOISE;
+   uint32_t not_gated = 0;
+   double drift = 0.0, gate_err = 0.0;
+   for(uint32_t b = n0; b < n1; b++) {
+      not_gated += !gated[b];
+      drift = std::max(drift, fabs(gain[b] - gain[n0 - 1]));
+      if(b > n0)                          // past the ramp into the gate
+         gate_err = std::max(gate_err, fabs(lvl[b] - (blockDbfs(&in[b * AGC_BLOCK_SIZE], AGC_BLOCK_SIZE) +
+                  gain[n0 - 1] - cfg.gate_atten_db)));
+   }
+   double resume = lvl[n1 + 1] - (QUIET_DBFS + g_quiet);   // past the ramp out of the gate
+   printf("   gate    %.0f dBFS noise: %u of %u blocks not gated, gain drift %.3f dB, level off %.2f dB, "
+            "tone after it %+.2f dB from target\n", NOISE_DBFS, not_gated, NOISE, drift, gate_err, resume);
+   CHECK(not_gated == 0, "%s: %u noise blocks not gated", name, not_gated);
+   CHECK(drift == 0.0, "%s: gain moved %.3f dB on noise", name, drift);
+   CHECK(gate_err < 0.5, "%s: gated level off by %.2f dB", name, gate_err);
+   CHECK(fabs(resume) < SETTLE_DB, "%s: tone after the gate %.2f dB from target", name, resume);
+
+   /**
+    * @brief 3) Gain ramp: per sample gain of the tone (skipping its zero crossings and the
+    * samples the limiter bends)
+    */
+   const float knee = cfg.limiter_knee * 32767.0f;
+   double max_block = 0.0, max_slope = 0.0, prev_end = NAN;
+   int32_t i0 = -1;
+   double g0 = 0.0;
+   for(uint32_t b = 0; b < blocks; b++) {
+      if(b >= n0 && b <= n1)
+         continue;                        // noise & its gate ramps
+      double g_end = NAN;
+      for(uint32_t i = b * AGC_BLOCK_SIZE; i < (b + 1) * AGC_BLOCK_SIZE; i++) {
+         if(fabsf(in[i]) < 50.0f || fabsf(out[i]) > knee)
+            continue;
+         double g = double(out[i]) / in[i];
+         if(i0 >= 0 && uint32_t(i0) >= (b > 0 ? (b - 1) * AGC_BLOCK_SIZE : 0))
+            max_slope = std::max(max_slope, fabs(g - g0) / (int32_t(i) - i0));
+         i0 = int32_t(i);
+         g0 = g_end = g;
+      }
+      if(!std::isnan(prev_end) && !std::isnan(g_end))
+         max_block = std::max(max_block, fabs(g_end - prev_end));
+      prev_end = g_end;
+   }
+   double per_sample = max_block / AGC_BLOCK_SIZE, step_db = 0.0;
+   for(uint32_t b = 1; b < blocks; b++)
+      step_db = std::max(step_db, fabs(gain[b] - gain[b - 1]));
+   printf("   ramp    largest block gain change %.3f (%.1f dB, a stepped gain's jump), largest per sample "
+            "%.5f (%.5f spread over the block)\n", max_block, step_db, max_slope, per_sample);
+   CHECK(max_slope <= per_sample * 1.01 + 1e-6, "%s: gain steps %.5f per sample, ramp allows %.5f", name,
+            max_slope, per_sample);
+}
+
+int main(void)
+{
+   agc_config_t record = AGC_CONFIG_RECORD, intercom = AGC_CONFIG_INTERCOM;
+
+   /**
+    * @brief 1) - 3) Both presets
+    */
+   runPreset("record", record);
+   runPreset("intercom", intercom);
+
+   /**
+    * @brief 4) Limiter at the highest gain
+    */
+   ESP32S3_AGC agc;
+   agc_config_t hot = record;
+   hot.initial_gain_db = hot.max_gain_db;
+   hot.min_gain_db = hot.max_gain_db;      // hold the highest gain on a full scale input
+   agc.init(hot, float(RATE));
+   std::vector<float> in(AGC_BLOCK_SIZE * 64), out(in.size());
+   for(uint32_t i = 0; i < in.size(); i++) {
+      bool square = (i < in.size() / 2);
+      in[i] = (square) ? ((i / 16) & 1) ? -32768.0f : 32767.0f
+               : float(32767.0 * sin(2.0 * M_PI * TONE_HZ * i / RATE));
+   }
+   agc.apply(in.data(), out.data(), in.size());
+   float peak = 0.0f;
+   uint32_t flipped = 0, over = 0;
+   for(uint32_t i = 0; i < in.size(); i++) {
+      peak = std::max(peak, fabsf(out[i]));
+      over += (out[i] > 32767.0f || out[i] < -32767.0f);
+      flipped += (in[i] != 0.0f && (in[i] < 0.0f) != (out[i] < 0.0f));
+   }
+   printf("limiter : full scale in at %.0f dB gain, peak out %.1f, %u samples past full scale, %u sign flips\n",
+            agc.gainDb(), peak, over, flipped);
+   CHECK(over == 0 && peak <= 32767.0f, "limiter: %u samples past full scale (peak %.1f)", over, peak);
+   CHECK(flipped == 0, "limiter: %u samples changed sign", flipped);
+
+   /**
+    * @brief 5) Cost
+    */
+   agc.init(record, float(RATE));
+   std::vector<float> speech(RATE * 10), buf(FRAME);
+   speechLike(speech, RATE, 8000.0f, 5);
+   double t_us = 0.0;
+   uint32_t frames = 0;
+   for(uint32_t done = 0; done < BENCH_SAMPLES; done += FRAME, frames++) {
+      uint32_t pos = done % (speech.size() - FRAME);
+      memcpy(buf.data(), &speech[pos], FRAME * sizeof(float));
+      double t0 = nowUs();
+      agc.apply(buf.data(), buf.data(), FRAME);
+      t_us += nowUs() - t0;
+   }
+   double frame_us = t_us / frames, budget_us = 1e6 * FRAME / RATE;
+   printf("cost    : %.1f us / %u sample frame (%.2f%% of %.0f ms), %.1f us / block on this host\n",
+            frame_us, FRAME, 100.0 * frame_us / budget_us, budget_us / 1000.0,
+            frame_us * AGC_BLOCK_SIZE / FRAME);
+   CHECK(frame_us < 0.05 * budget_us, "AGC takes %.1f us of a %.0f us frame", frame_us, budget_us);
+   return testResult("test_agc");
+}
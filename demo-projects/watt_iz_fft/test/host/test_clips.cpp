@@ -0,0 +1,208 @@
+/********************************************************************
+ * @brief test_clips.cpp : Clip bank images from tools/pack_clips.py
+ * read back with the firmware's parser (clip_bank.h).
+ *
+ * @note WAV files are written to build/clips and packed by the script,
+ * then the image is checked with clipBankParse() / clipBankFind() the
+ * way ESP32S3_CLIPS reads mapped flash:
+ * 1) Every clip is found by name, 16KHz mono PCM16, 4 byte aligned. A
+ * 16KHz mono clip comes back sample for sample, a 44.1KHz stereo one at
+ * the resampled length. Names that aren't in the bank aren't found.
+ * 2) Corrupt images (magic, sizes, offsets, unterminated names, short
+ * reads) are refused.
+ * 3) The script sizes the image against the partition table: an image
+ * larger than the 'clips' partition of a given table is refused.
+ * Skipped with a note if python3 can't run the script.
+ *
+ *    build/test_clips clips.bin        list an image instead (host reader)
+ */
+#include "clip_bank.h"
+#include "host_test.h"
+#include <string>
+#include <sys/stat.h>
+
+#define PACK_CLIPS               "../../tools/pack_clips.py"
+#define WORK_DIR                 "build/clips"
+#define OUT_RATE                 16000
+
+typedef std::vector<uint8_t> file_t;
+
+static void put16(file_t &f, uint16_t v) { f.push_back(v & 0xFF); f.push_back(v >> 8); }
+static void put32(file_t &f, uint32_t v) { put16(f, v & 0xFFFF); put16(f, v >> 16); }
+
+static bool writeFile(const std::string &path, const file_t &f)
+{
+   FILE *fp = fopen(path.c_str(), "wb");
+   if(!fp)
+      return false;
+   bool ok = (fwrite(f.data(), 1, f.size(), fp) == f.size());
+   fclose(fp);
+   return ok;
+}
+
+static file_t readFile(const char *path)
+{
+   file_t f;
+   FILE *fp = fopen(path, "rb");
+   if(!fp)
+      return f;
+   uint8_t buf[4096];
+   size_t n;
+   while((n = fread(buf, 1, sizeof(buf), fp)) > 0)
+      f.insert(f.end(), buf, buf + n);
+   fclose(fp);
+   return f;
+}
+
+// 16 bit PCM WAV, interleaved 'pcm'
+static file_t makeWav(const std::vector<int16_t> &pcm, uint16_t ch, uint32_t rate)
+{
+   file_t f;
+   uint32_t bytes = pcm.size() * 2;
+   f.insert(f.end(), { 'R', 'I', 'F', 'F' });
+   put32(f, 36 + bytes);
+   f.insert(f.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+   put32(f, 16);
+   put16(f, 1);
+   put16(f, ch);
+   put32(f, rate);
+   put32(f, rate * ch * 2);
+   put16(f, ch * 2);
+   put16(f, 16);
+   f.insert(f.end(), { 'd', 'a', 't', 'a' });
+   put32(f, bytes);
+   for(int16_t v : pcm)
+      put16(f, uint16_t(v));
+   return f;
+}
+
+static int pack(const std::string &args)
+{
+   std::string cmd = "python3 " PACK_CLIPS " " + args + " > " WORK_DIR "/pack.log 2>&1";
+   int rc = system(cmd.c_str());
+   return (rc == -1) ? -1 : WEXITSTATUS(rc);
+}
+
+/********************************************************************
+ * @brief Host reader: print the clips of an image, as the firmware sees it.
+ */
+static int listImage(const char *path)
+{
+   file_t img = readFile(path);
+   const clip_bank_hdr_t *hdr = clipBankParse(img.data(), img.size());
+   if(!hdr) {
+      printf("%s: not a valid clip bank image (%zu bytes)\n", path, img.size());
+      return 1;
+   }
+   printf("%u clips, %u bytes\n", hdr->num_clips, hdr->image_bytes);
+   const clip_entry_t *e = (const clip_entry_t *)(img.data() + sizeof(clip_bank_hdr_t));
+   for(uint16_t i = 0; i < hdr->num_clips; i++, e++) {
+      bool found = (clipBankFind(img.data(), e->name) == e);
+      printf("  %-31s offset 0x%06X  %6u bytes  %5u ms  %s\n", e->name, e->offset, e->bytes,
+               uint32_t(uint64_t(e->bytes) * 1000 / (2 * e->channels * e->sample_rate)),
+               (found) ? "" : "NOT FOUND BY NAME");
+   }
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   if(argc > 1)
+      return listImage(argv[1]);
+
+   mkdir("build", 0755);
+   mkdir(WORK_DIR, 0755);
+
+   /**
+    * @brief Clips: 16KHz mono (bit exact), 44.1KHz stereo, a single sample
+    */
+   std::vector<int16_t> beep(1234), alarm(44100 * 2), tick = { 1000 };
+   for(uint32_t i = 0; i < beep.size(); i++)
+      beep[i] = int16_t(20000.0 * sin(2.0 * M_PI * 1000.0 * i / OUT_RATE));
+   for(uint32_t i = 0; i < alarm.size(); i += 2)
+      alarm[i] = alarm[i + 1] = int16_t(8000.0 * sin(2.0 * M_PI * 440.0 * (i / 2) / 44100));
+   CHECK(writeFile(WORK_DIR "/beep.wav", makeWav(beep, 1, OUT_RATE)) &&
+            writeFile(WORK_DIR "/alarm.wav", makeWav(alarm, 2, 44100)) &&
+            writeFile(WORK_DIR "/tick.wav", makeWav(tick, 1, OUT_RATE)), "writing " WORK_DIR);
+
+   int rc = pack("-o " WORK_DIR "/clips.bin " WORK_DIR "/tick.wav " WORK_DIR "/beep.wav " WORK_DIR "/alarm.wav");
+   if(rc == 127 || rc == -1) {
+      printf("python3 not available - pack_clips.py checks skipped\n");
+      return testResult("test_clips");
+   }
+   CHECK(rc == 0, "pack_clips.py failed (%d), see " WORK_DIR "/pack.log", rc);
+   file_t img = readFile(WORK_DIR "/clips.bin");
+
+   /**
+    * @brief 1) Read back through the firmware parser
+    */
+   const clip_bank_hdr_t *hdr = clipBankParse(img.data(), img.size());
+   CHECK(hdr && hdr->num_clips == 3 && hdr->image_bytes == img.size(), "image refused or wrong header");
+   if(!hdr)
+      return testResult("test_clips");
+   struct { const char *name; uint32_t samples; const std::vector<int16_t> *exact; } want[] = {
+      { "alarm", uint32_t(alarm.size() / 2 * OUT_RATE / 44100), nullptr },
+      { "beep", uint32_t(beep.size()), &beep },
+      { "tick", 1, &tick },
+   };
+   printf("clip      samples   want  rate  ch  offset\n");
+   for(auto &w : want) {
+      const clip_entry_t *e = clipBankFind(img.data(), w.name);
+      CHECK(e, "%s not found", w.name);
+      if(!e)
+         continue;
+      uint32_t samples = e->bytes / 2;
+      printf("%-8s %8u %6u %5u  %2u  0x%04X\n", w.name, samples, w.samples, e->sample_rate,
+               e->channels, e->offset);
+      CHECK(e->format == CLIP_FMT_PCM16 && e->channels == 1 && e->sample_rate == OUT_RATE,
+               "%s: not 16KHz mono PCM16", w.name);
+      CHECK((e->offset & 3) == 0, "%s: audio not 4 byte aligned", w.name);
+      CHECK(samples == w.samples, "%s: %u samples, want %u", w.name, samples, w.samples);
+      if(w.exact && samples == w.exact->size())
+         CHECK(memcmp(img.data() + e->offset, w.exact->data(), e->bytes) == 0, "%s: audio differs", w.name);
+   }
+   for(const char *name : { "", "al", "alarmx", "beeq", "zzz" })
+      CHECK(!clipBankFind(img.data(), name), "'%s' found", name);
+
+   /**
+    * @brief 2) Corrupt images are refused
+    */
+   auto refused = [&](const char *what, void (*spoil)(file_t &), uint32_t size) {
+      file_t bad = img;
+      spoil(bad);
+      CHECK(!clipBankParse(bad.data(), (size) ? size : bad.size()), "%s accepted", what);
+   };
+   clip_entry_t *first = (clip_entry_t *)(img.data() + sizeof(clip_bank_hdr_t));
+   uint32_t first_off = first->offset;
+   refused("bad magic", [](file_t &b) { b[0] ^= 1; }, 0);
+   refused("newer version", [](file_t &b) { ((clip_bank_hdr_t *)b.data())->version++; }, 0);
+   refused("image past the partition", [](file_t &) { }, img.size() - 1);
+   refused("index past the image", [](file_t &b) { ((clip_bank_hdr_t *)b.data())->num_clips = 0x7FFF; }, 0);
+   refused("misaligned clip", [](file_t &b) { ((clip_entry_t *)(b.data() + 16))->offset += 2; }, 0);
+   refused("clip past the image", [](file_t &b) {
+            clip_entry_t *e = (clip_entry_t *)(b.data() + 16);
+            e->bytes = ((clip_bank_hdr_t *)b.data())->image_bytes - e->offset + 1; }, 0);
+   refused("clip inside the index", [](file_t &b) { ((clip_entry_t *)(b.data() + 16))->offset = 16; }, 0);
+   refused("unterminated name", [](file_t &b) { memset(((clip_entry_t *)(b.data() + 16))->name, 'x', CLIP_NAME_LEN); }, 0);
+   CHECK(!clipBankParse(nullptr, 0) && !clipBankParse(img.data(), 15), "short read accepted");
+   CHECK(first->offset == first_off, "original image modified");
+
+   /**
+    * @brief 3) Partition size comes from the partition table
+    */
+   std::string csv = "# Name, Type, SubType, Offset, Size, Flags\n"
+            "clips,   data, 0x40,    0x10000, " + std::to_string(img.size() - 4) + ",\n";
+   CHECK(writeFile(WORK_DIR "/small.csv", file_t(csv.begin(), csv.end())), "writing the table");
+   rc = pack("--partitions " WORK_DIR "/small.csv -o " WORK_DIR "/big.bin " WORK_DIR "/tick.wav "
+            WORK_DIR "/beep.wav " WORK_DIR "/alarm.wav");
+   CHECK(rc != 0, "image larger than the table's clips partition was packed");
+   csv = "clips, data, 0x40, 0x10000, 1M,\n";
+   CHECK(writeFile(WORK_DIR "/big.csv", file_t(csv.begin(), csv.end())), "writing the table");
+   rc = pack("--partitions " WORK_DIR "/big.csv -o " WORK_DIR "/big.bin " WORK_DIR "/beep.wav");
+   CHECK(rc == 0, "1M partition refused");
+   printf("partition : %zu byte image refused by a %zu byte 'clips' partition, packed into 1M\n",
+            img.size(), img.size() - 4);
+
+   listImage(WORK_DIR "/clips.bin");
+   return testResult("test_clips");
+}
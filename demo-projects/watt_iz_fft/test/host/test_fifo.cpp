@@ -0,0 +1,159 @@
+/********************************************************************
+ * @brief test_fifo.cpp : ChunkRingFifo sizing and a two thread
+ * producer / consumer stress run on the host.
+ *
+ * @note The producer writes chunks of varying length (0 .. chunkBytes)
+ * whose payload is derived from a sequence number, alternating push()
+ * with acquire()/commit(). The consumer alternates pop() with
+ * front()/release() and checks every chunk arrives once, in order, with
+ * its length and payload intact. Small depths keep both sides hitting
+ * the full & empty edges. clear() is not used: it is a consumer side
+ * drop and would only hide lost chunks.
+ */
+#include "chunk_fifo.h"
+#include "host_test.h"
+#include <thread>
+
+#define STRESS_CHUNKS            500000   // chunks per run
+#define CHUNK_BYTES              64
+
+static uint16_t chunkLen(uint32_t seq) { return (seq * 2654435761u >> 24) % (CHUNK_BYTES + 1); }
+static uint8_t chunkByte(uint32_t seq, uint16_t i) { return uint8_t(seq * 31 + i * 7); }
+
+static void fill(uint8_t *p, uint32_t seq, uint16_t len)
+{
+   for(uint16_t i = 0; i < len; i++)
+      p[i] = chunkByte(seq, i);
+   if(len >= 4)
+      memcpy(p, &seq, 4);
+}
+
+// Payload check, 'seq' is the expected sequence number
+static bool same(const uint8_t *p, uint32_t seq, uint16_t len)
+{
+   uint32_t got;
+   if(len != chunkLen(seq))
+      return false;
+   if(len >= 4) {
+      memcpy(&got, p, 4);
+      if(got != seq)
+         return false;
+   }
+   for(uint16_t i = 4; i < len; i++) {
+      if(p[i] != chunkByte(seq, i))
+         return false;
+   }
+   return true;
+}
+
+typedef struct {
+   uint32_t bad;                          // chunks out of order / corrupted
+   uint32_t full, empty;                  // producer / consumer found no slot
+   double us;
+} stress_t;
+
+static stress_t stress(uint16_t depth)
+{
+   ChunkRingFifo fifo;
+   stress_t r = {};
+
+   CHECK(fifo.create(depth, CHUNK_BYTES), "create(%u)", depth);
+   double t0 = nowUs();
+   std::thread producer([&] {
+      uint8_t tmp[CHUNK_BYTES];
+      for(uint32_t seq = 0; seq < STRESS_CHUNKS; ) {
+         uint16_t len = chunkLen(seq);
+         bool ok;
+         if(seq & 1) {
+            uint8_t *p = (uint8_t *)fifo.acquire();
+            if(p)
+               fill(p, seq, len);
+            ok = p && fifo.commit(len);
+         }
+         else {
+            fill(tmp, seq, len);
+            ok = fifo.push(tmp, len);
+         }
+         if(ok)
+            seq++;
+         else {
+            r.full++;
+            std::this_thread::yield();
+         }
+      }
+   });
+   uint8_t tmp[CHUNK_BYTES];
+   for(uint32_t seq = 0; seq < STRESS_CHUNKS; ) {
+      uint16_t len = 0;
+      bool ok;
+      if(seq & 2) {
+         const uint8_t *p = (const uint8_t *)fifo.front(len);
+         ok = (p != nullptr);
+         if(ok) {
+            r.bad += !same(p, seq, len);
+            fifo.release();
+         }
+      }
+      else {
+         ok = fifo.pop(tmp, len);
+         if(ok)
+            r.bad += !same(tmp, seq, len);
+      }
+      if(ok)
+         seq++;
+      else {
+         r.empty++;
+         std::this_thread::yield();
+      }
+   }
+   producer.join();
+   r.us = nowUs() - t0;
+   CHECK(fifo.isEmpty(), "depth %u: %u chunks left over", depth, fifo.count());
+   return r;
+}
+
+int main(void)
+{
+   ChunkRingFifo fifo;
+
+   /**
+    * @brief Sizing: powers of two are exact, others round up, the
+    * limits are refused instead of looping or wrapping.
+    */
+   CHECK(fifo.create(4, CHUNK_BYTES) && fifo.capacity() == 4, "depth 4 -> %u", fifo.capacity());
+   CHECK(fifo.create(5, CHUNK_BYTES) && fifo.capacity() == 8, "depth 5 -> %u", fifo.capacity());
+   CHECK(fifo.create(1, CHUNK_BYTES) && fifo.capacity() == 1, "depth 1 -> %u", fifo.capacity());
+   CHECK(fifo.create(FIFO_MAX_CHUNKS, 4) && fifo.capacity() == FIFO_MAX_CHUNKS,
+            "depth %u -> %u", FIFO_MAX_CHUNKS, fifo.capacity());
+   CHECK(!fifo.create(FIFO_MAX_CHUNKS + 1, 4), "depth %u accepted", FIFO_MAX_CHUNKS + 1);
+   CHECK(!fifo.create(UINT16_MAX, 4), "depth %u accepted", UINT16_MAX);
+   CHECK(!fifo.create(0, 4), "depth 0 accepted");
+   CHECK(!fifo.create(4, UINT16_MAX), "slot of %u bytes accepted", UINT16_MAX);
+   CHECK(fifo.capacity() == 0 && !fifo.acquire(), "refused create left storage");
+
+   /**
+    * @brief Full & empty edges on one thread
+    */
+   uint8_t tmp[CHUNK_BYTES] = {};
+   uint16_t len;
+   CHECK(fifo.create(4, CHUNK_BYTES), "create(4)");
+   for(int i = 0; i < 4; i++)
+      CHECK(fifo.push(tmp, 8), "push %d", i);
+   CHECK(fifo.isFull() && !fifo.push(tmp, 8) && !fifo.acquire(), "push into a full fifo");
+   CHECK(!fifo.push(tmp, CHUNK_BYTES + 1), "oversized push");
+   for(int i = 0; i < 4; i++)
+      CHECK(fifo.pop(tmp, len) && len == 8, "pop %d", i);
+   CHECK(fifo.isEmpty() && !fifo.pop(tmp, len) && !fifo.front(len), "pop from an empty fifo");
+
+   /**
+    * @brief Two threads
+    */
+   printf("depth  chunks    bad     full    empty  ns / chunk\n");
+   for(uint16_t depth : { 1, 2, 4, 64 }) {
+      stress_t r = stress(depth);
+      printf("%5u  %6u  %5u  %7u  %7u  %10.1f\n", depth, STRESS_CHUNKS, r.bad, r.full, r.empty,
+               r.us * 1000.0 / STRESS_CHUNKS);
+      CHECK(r.bad == 0, "depth %u: %u chunks out of order or corrupted", depth, r.bad);
+   }
+   return testResult("test_fifo");
+}
@@ -0,0 +1,175 @@
+/********************************************************************
+ * @brief test_gain.cpp : ESP32S3_GAIN & the mixer's soft knee against
+ * a floating point reference, and their throughput on the host.
+ *
+ * @note Reference: y = x * g / 32768 per sample, the gain stepping once
+ * per GAIN_BLOCK_SIZE block from the old to the new gain, and the knee
+ * |y| = k + d*s/(s+d) in double precision. The fixed point results must
+ * stay within 1 LSB of it. Throughput is samples per second through
+ * apply() at unity, at a fixed gain, while ramping and with the limiter,
+ * and through a mixer block with the soft knee. Host figures use the
+ * ANSI dsps_mulc_s16, the S3 runs the SIMD one.
+ */
+#include "esp32s3_gain.h"
+#include "esp32s3_mixer.h"
+#include "host_test.h"
+
+#define RATE                     16000
+#define BLOCK                    512      // samples per apply(), one speaker DMA buffer
+#define BENCH_SAMPLES            (RATE * 600)   // 10 minutes of audio per figure
+
+// Reference knee curve for any sum
+static double refKnee(double x, double knee)
+{
+   double a = fabs(x);
+   if(a > knee) {
+      double s = 32767.0 - knee, d = a - knee;
+      a = knee + d * s / (s + d);
+   }
+   return (x < 0) ? -a : a;
+}
+
+static double msps(double samples, double us) { return samples / us; }
+
+int main(void)
+{
+   std::vector<int16_t> in(BLOCK), out(BLOCK);
+   ESP32S3_GAIN g;
+   TestNoise rnd(5);
+
+   for(int16_t &v : in)
+      v = int16_t(32767.0f * rnd.next());
+
+   /**
+    * @brief Fixed gain: within 1 LSB of x * g / 32768
+    */
+   g.init(RATE, 20);
+   double err = 0.0;
+   for(int16_t gq : { int16_t(GAIN_UNITY_Q15), int16_t(16384), int16_t(1000), int16_t(0) }) {
+      g.jumpGain(gq);
+      g.apply(in.data(), out.data(), BLOCK);
+      for(int i = 0; i < BLOCK; i++) {
+         double ref = (gq == GAIN_UNITY_Q15) ? in[i] : double(in[i]) * gq / 32768.0;
+         err = std::max(err, fabs(out[i] - ref));
+      }
+   }
+   CHECK(err <= 1.0, "fixed gain off by %.2f LSB", err);
+
+   /**
+    * @brief Ramp: one equal step per block, monotonic, done in the ramp time
+    */
+   const int32_t g0 = 4000, g1 = 30000;
+   const uint32_t ramp_blocks = RATE * 20 / (1000 * GAIN_BLOCK_SIZE);
+   std::vector<int16_t> dc(BLOCK, 20000), ramp(BLOCK * 4);
+   g.jumpGain(g0);
+   g.setGain(g1);
+   for(int b = 0; b < 4; b++)
+      g.apply(dc.data(), &ramp[b * BLOCK], BLOCK);
+   double ramp_err = 0.0;
+   bool monotonic = true;
+   for(uint32_t i = 0; i < ramp.size(); i++) {
+      uint32_t blk = i / GAIN_BLOCK_SIZE + 1;   // the first block already takes one step
+      double gain = (blk >= ramp_blocks) ? g1 : g0 + double(g1 - g0) * blk / ramp_blocks;
+      ramp_err = std::max(ramp_err, fabs(ramp[i] - 20000.0 * gain / 32768.0));
+      monotonic &= (i == 0 || ramp[i] >= ramp[i - 1]);
+   }
+   printf("ramp      : %u blocks of %u samples, %.2f LSB from the reference, end %d (target %.0f)\n",
+            ramp_blocks, GAIN_BLOCK_SIZE, ramp_err, ramp.back(), 20000.0 * g1 / 32768.0);
+   CHECK(monotonic, "ramp not monotonic");
+   // integer steps lose up to ramp_blocks LSB of gain before the last step
+   CHECK(ramp_err <= 2.0, "ramp %.2f LSB from the reference", ramp_err);
+   CHECK(g.gain() == g1, "ramp ended at %d, not %d", g.gain(), g1);
+
+   /**
+    * @brief Knee over the whole range a 6 source sum can take
+    */
+   const int32_t knee = ESP32S3_GAIN::kneeQ15(0.9f);
+   double knee_err = 0.0;
+   int32_t max_step = 0, peak = 0;
+   int16_t prev = ESP32S3_GAIN::softKnee(-MIX_MAX_SOURCES * 32768, knee);
+   for(int32_t x = -MIX_MAX_SOURCES * 32768 + 1; x <= MIX_MAX_SOURCES * 32767; x++) {
+      int16_t y = ESP32S3_GAIN::softKnee(x, knee);
+      knee_err = std::max(knee_err, fabs(y - refKnee(x, knee)));
+      max_step = std::max(max_step, int32_t(y) - prev);
+      peak = std::max(peak, int32_t(abs(y)));
+      CHECK(y >= prev, "knee not monotonic at %d", x);
+      if(y < prev)
+         break;
+      prev = y;
+   }
+   printf("knee      : %.2f LSB from the reference, max slope %d, peak %d at %d x full scale\n",
+            knee_err, max_step, peak, MIX_MAX_SOURCES);
+   CHECK(knee_err <= 1.0, "knee %.2f LSB from the reference", knee_err);
+   CHECK(max_step <= 1, "knee slope %d > 1", max_step);
+   CHECK(peak < 32767, "knee reaches full scale");
+
+   /**
+    * @brief Mixer: two loud sources overlapping are bent, not clipped
+    */
+   ChunkRingFifo rings[2];
+   ESP32S3_MIXER mixer;
+   std::vector<int16_t> a(BLOCK), b(BLOCK), soft(BLOCK), hard(BLOCK);
+   for(int i = 0; i < BLOCK; i++) {
+      a[i] = int16_t(26000.0 * sin(2.0 * M_PI * 440.0 * i / RATE));
+      b[i] = int16_t(26000.0 * sin(2.0 * M_PI * 660.0 * i / RATE));
+   }
+   for(ChunkRingFifo &r : rings)
+      CHECK(r.create(4, BLOCK * sizeof(int16_t)), "ring");
+   CHECK(mixer.init(rings, 2, BLOCK, RATE), "mixer init");
+   uint32_t clipped[2] = {}, bent = 0;
+   double mix_err = 0.0;
+   for(int pass = 0; pass < 2; pass++) {
+      std::vector<int16_t> &o = (pass) ? soft : hard;
+      mixer.setLimiter(pass == 1, 0.9f);
+      rings[0].push(a.data(), BLOCK * sizeof(int16_t));
+      rings[1].push(b.data(), BLOCK * sizeof(int16_t));
+      mixer.mix(o.data(), BLOCK);
+      for(int i = 0; i < BLOCK; i++) {
+         int32_t sum = int32_t(a[i]) + b[i];
+         clipped[pass] += (o[i] == 32767 || o[i] == -32768);
+         if(pass) {
+            mix_err = std::max(mix_err, fabs(o[i] - refKnee(sum, knee)));
+            bent += (abs(sum) > knee);
+         }
+      }
+   }
+   printf("mixer     : %u of %u samples past the knee, %u clipped when saturating, %u with the knee "
+            "(%.2f LSB from the reference)\n", bent, BLOCK, clipped[0], clipped[1], mix_err);
+   CHECK(clipped[0] > 0, "test signal never clips");
+   CHECK(clipped[1] == 0, "%u samples clipped with the soft knee", clipped[1]);
+   CHECK(mix_err <= 1.0, "mixer knee %.2f LSB from the reference", mix_err);
+
+   /**
+    * @brief Throughput
+    */
+   printf("throughput (host, Msamples/s):\n");
+   struct { const char *name; int16_t gain; bool ramp, limit; } bench[] = {
+      { "unity (copy)", int16_t(GAIN_UNITY_Q15), false, false },
+      { "fixed gain", 16384, false, false },
+      { "ramping", 16384, true, false },
+      { "fixed gain + limiter", 32000, false, true },
+   };
+   for(auto &bc : bench) {               // in -> out, as for a region source
+      g.setLimiter(bc.limit, 0.5f);       // ~half the samples past the knee
+      g.jumpGain(bc.gain);
+      double t0 = nowUs();
+      for(uint32_t n = 0; n < BENCH_SAMPLES; n += BLOCK) {
+         if(bc.ramp && (n / BLOCK) % 8 == 0)
+            g.setGain((g.gain() > 16384) ? 8000 : 30000);
+         g.apply(in.data(), out.data(), BLOCK);
+      }
+      printf("   %-22s %8.1f\n", bc.name, msps(BENCH_SAMPLES, nowUs() - t0));
+   }
+   g.setLimiter(false);
+   mixer.setLimiter(true, 0.9f);
+   double t0 = nowUs();
+   for(uint32_t n = 0; n < BENCH_SAMPLES; n += BLOCK) {
+      rings[0].push(a.data(), BLOCK * sizeof(int16_t));
+      rings[1].push(b.data(), BLOCK * sizeof(int16_t));
+      mixer.mix(soft.data(), BLOCK);
+   }
+   printf("   %-22s %8.1f  (%u of %u samples past the knee)\n", "mix 2 sources + knee",
+            msps(BENCH_SAMPLES, nowUs() - t0), bent, BLOCK);
+   mixer.end();
+   return testResult("test_gain");
+}
@@ -0,0 +1,186 @@
+/********************************************************************
+ * @brief test_graph.cpp : capture DSP graph of the low latency intercom
+ * profile, per stage timing against INTERCOM_LL_BUDGET_US.
+ *
+ * @note The graphs are built in buildCaptureGraph() order from the
+ * same nodes, fed speech with a speaker echo by a source callback:
+ * 1) Frame size rules - at 160 samples (10ms) the echo canceller and
+ * noise suppressor can't run and add() refuses them; at 256 (16ms,
+ * INTERCOM_LL_DSP_SAMPLES_PER_FRAME) every node runs.
+ * 2) Per node average & max us (graph stats()) and the latency model of
+ * a delivered frame: frame length + average DSP (the newest frame is
+ * delivered at once). DMA wake and SD / memory delivery are device only,
+ * see AUDIO::getCaptureLatency(). The model must fit the 40ms budget.
+ * Max us on the host includes preemption by other processes.
+ * 3) The sliding window VAD finds the speech of the test signal.
+ *
+ * build/test_graph file.wav [samples_per_frame] runs a recording through
+ * the same profiles (or all nodes at one frame size) and prints each
+ * node's avg / max us per frame. The echo canceller gets a silent
+ * reference, there are no checks.
+ */
+#include "esp32s3_dsp_graph.h"
+#include "host_wav.h"
+
+#define RATE                     16000
+#define BUDGET_US                40000    // INTERCOM_LL_BUDGET_US
+#define SECONDS                  8
+
+typedef struct {
+   const std::vector<float> *mic;
+   const std::vector<float> *ref;
+   uint32_t pos;
+} test_source_t ;
+
+static bool testSource(dsp_frame_t &f, void *ctx)
+{
+   test_source_t *src = (test_source_t *)ctx;
+   if(src->pos + f.len > src->mic->size())
+      return false;
+   memcpy(f.pcm, src->mic->data() + src->pos, f.len * sizeof(float));
+   if(f.ref)
+      memcpy(f.ref, src->ref->data() + src->pos, f.len * sizeof(float));
+   f.time_us = esp_timer_get_time();
+   src->pos += f.len;
+   return true;
+}
+
+typedef struct {
+   DSP_SOURCE_NODE source;
+   DSP_AEC_NODE aec;
+   DSP_LP_NODE lowpass;
+   DSP_NS_NODE ns;
+   DSP_VAD_NODE vad;
+   DSP_AGC_NODE agc;
+   DSP_ENCODE_NODE encode;
+} test_graph_t ;
+
+/********************************************************************
+ * @brief Run one profile. Returns false if a node was refused.
+ * @param budget_us - first sample to frame available, 0 = none.
+ * @param checks - false: a recording, print only.
+ */
+static bool runProfile(const char *name, uint32_t len, bool dsp, uint32_t budget_us, test_source_t &src,
+         bool checks=true)
+{
+   ESP32S3_DSP_GRAPH graph;
+   test_graph_t *g = new test_graph_t;
+   dsp_frame_t frame;
+   dsp_node_stats_t st[DSP_GRAPH_MAX_NODES];
+   uint32_t frames = 0, speech = 0, hits = 0;
+   bool ok = true;
+
+   graph.begin(len, float(RATE));
+   g->source.setup(testSource, &src, DSP_PORT_PCM | ((dsp) ? DSP_PORT_REF : 0));
+   ok &= graph.add(&g->source);
+   if(dsp)
+      ok &= graph.add(&g->aec);
+   g->lowpass.setup(3800.0f, 0.707f);
+   ok &= graph.add(&g->lowpass);
+   if(dsp)
+      ok &= graph.add(&g->ns);
+   ok &= graph.add(&g->vad);
+   g->agc.setup(AGC_CONFIG_INTERCOM);
+   ok &= graph.add(&g->agc);
+   ok &= graph.add(&g->encode);
+   CHECK(ok || !checks, "%s: node refused at %u samples", name, len);
+
+   src.pos = 0;
+   while(graph.run(frame)) {
+      frames++;
+      speech += (frame.speech) ? 1 : 0;
+      hits += frame.hits;
+   }
+   uint8_t n = graph.stats(st, DSP_GRAPH_MAX_NODES);
+   uint32_t dsp_avg = 0, dsp_max = 0;
+   printf("%s: %u samples (%.0f ms), %u frames, speech in %u, %u VAD hits\n", name, len,
+            1000.0 * len / RATE, frames, speech, hits);
+   printf("   node        avg us   max us  (per frame)\n");
+   for(uint8_t i = 0; i < n; i++) {
+      printf("   %-9s %8u %8u\n", st[i].name, st[i].avg_us, st[i].max_us);
+      if(i == 0)
+         continue;                        // source: the test callback, not the mic wait
+      dsp_avg += st[i].avg_us;
+      dsp_max += st[i].max_us;
+   }
+   uint32_t frame_us = uint32_t(uint64_t(len) * 1000000 / RATE);
+   printf("   latency   frame %u + dsp %u = %u us", frame_us, dsp_avg, frame_us + dsp_avg);
+   if(budget_us)
+      printf(" of %u", budget_us);
+   printf(" (dsp max %u us)\n", dsp_max);
+   if(checks) {
+      CHECK(budget_us == 0 || frame_us + dsp_avg < budget_us, "%s: %u us over the %u us budget", name,
+               frame_us + dsp_avg, budget_us);
+      CHECK(frames == src.mic->size() / len, "%s: %u of %zu frames", name, frames, src.mic->size() / len);
+      CHECK(speech > 0 && speech < frames, "%s: VAD speech in %u of %u frames", name, speech, frames);
+   }
+   graph.end();
+   delete g;
+   return ok;
+}
+
+/********************************************************************
+ * @brief Time the graph on a WAV recording (mono 16KHz after the
+ * parser). 'len' 0: the profiles of main(), else every node that runs
+ * at that frame size.
+ */
+static int runRecording(const char *path, uint32_t len)
+{
+   std::vector<float> mic, ref;
+
+   if(!loadWav(path, RATE, mic))
+      return 1;
+   ref.assign(mic.size(), 0.0f);          // no speaker reference in a recording
+   test_source_t src = { &mic, &ref, 0 };
+   if(len) {
+      runProfile("all nodes", len, (len % AEC_BLOCK_SIZE) == 0, 0, src, false);
+      return 0;
+   }
+   runProfile("intercom LL", 160, false, BUDGET_US, src, false);
+   runProfile("intercom LL + AEC/NS", 256, true, BUDGET_US, src, false);
+   runProfile("intercom", 1024, true, 0, src, false);
+   runProfile("record", 2048, false, 0, src, false);
+   return 0;
+}
+
+int main(int argc, char **argv)
+{
+   if(argc > 1)
+      return runRecording(argv[1], (argc > 2) ? uint32_t(atoi(argv[2])) : 0);
+
+   std::vector<float> near(RATE * SECONDS), far(RATE * SECONDS), mic(RATE * SECONDS);
+   std::vector<uint8_t> active;
+   TestNoise rnd(3);
+
+   // Near end speech, far end speech echoed back after 40ms, mic noise
+   speechLike(near, RATE, 8000.0f, 17, &active);
+   speechLike(far, RATE, 6000.0f, 29);
+   for(uint32_t n = 0; n < mic.size(); n++)
+      mic[n] = near[n] + ((n >= 640) ? 0.3f * far[n - 640] : 0.0f) + 30.0f * rnd.next();
+   test_source_t src = { &mic, &far, 0 };
+
+   /**
+    * @brief 1) Frame size rules
+    */
+   {
+      ESP32S3_DSP_GRAPH graph;
+      test_graph_t *g = new test_graph_t;
+      graph.begin(160, float(RATE));
+      g->source.setup(testSource, &src, DSP_PORT_PCM | DSP_PORT_REF);
+      CHECK(graph.add(&g->source), "source refused");
+      CHECK(!graph.add(&g->aec), "AEC accepted at 160 samples");
+      CHECK(!graph.add(&g->ns), "NS accepted at 160 samples");
+      CHECK(graph.add(&g->vad), "sliding VAD refused at 160 samples");
+      graph.end();
+      delete g;
+   }
+
+   /**
+    * @brief 2) & 3) Low latency profiles, and the standard intercom one for reference
+    */
+   runProfile("intercom LL", 160, false, BUDGET_US, src);
+   runProfile("intercom LL + AEC/NS", 256, true, BUDGET_US, src);
+   runProfile("intercom", 1024, true, 0, src);
+   runProfile("record", 2048, false, 0, src);   // VAD's own multi block FFT
+   return testResult("test_graph");
+}
@@ -0,0 +1,196 @@
+/********************************************************************
+ * @brief test_jobs.cpp : fork / join job system (ESP32S3_JOBS) against
+ * a serial reference, and the multi frame FFT split over its lanes.
+ *
+ * @note Checks:
+ * 1) parallelFor() over counts & grains, and random forks: every index
+ * runs exactly once, sub ranges are no larger than the grain, and the
+ * result equals the serial loop.
+ * 2) Inline cases: a fork from inside a job, a fork of more than
+ * JOBS_MAX_COUNT, a fork before begin() and two tasks forking at once
+ * all complete, lane numbers stay in range.
+ * 3) Multi frame FFT (16 x 1024 NO_SLIDING, AVERAGE): the split result
+ * ('parallel_frames' on, also with jobs stopped) equals the serial one
+ * (the default), and the time of both. The speedup is only meaningful with more than one host
+ * CPU.
+ * 4) Idle lanes block: a fork whose two ranges sleep IDLE_MS leaves a
+ * worker with nothing to steal; the process uses under IDLE_CPU_US of
+ * CPU meanwhile (no polling).
+ */
+#include "esp32s3_jobs.h"
+#include "esp32s3_fft.h"
+#include "host_test.h"
+#include <thread>
+#include <time.h>
+
+#define IDLE_MS                  500      // fork length of the idle check
+#define IDLE_CPU_US              2000     // process CPU time allowed during it
+
+typedef struct {
+   std::vector<std::atomic<uint32_t>> *visits;
+   std::vector<double> *out;
+   uint32_t grain;
+   std::atomic<uint32_t> oversize;        // sub ranges larger than the grain
+   std::atomic<uint32_t> bad_lane;
+   std::atomic<uint32_t> lanes;           // bit per lane that ran a range
+} fork_t ;
+
+static double work(uint32_t i) { return sin(0.001 * i) * sqrt(double(i) + 1.0); }
+
+static void forkJob(void *ctx, uint32_t begin, uint32_t end, uint8_t lane)
+{
+   fork_t *f = (fork_t *)ctx;
+
+   if(end - begin > f->grain)
+      f->oversize++;
+   if(lane >= JOBS_NUM_LANES)
+      f->bad_lane++;
+   else
+      f->lanes |= 1u << lane;
+   for(uint32_t i = begin; i < end; i++) {
+      (*f->visits)[i]++;
+      (*f->out)[i] = work(i);
+   }
+}
+
+// One fork against the serial loop. 'split': not an inline case. Ret lanes used (bit mask)
+static uint32_t checkFork(uint32_t count, uint32_t grain, const char *what, bool split=true)
+{
+   std::vector<std::atomic<uint32_t>> visits(count);
+   std::vector<double> out(count, 0.0);
+   fork_t f = { &visits, &out, (grain) ? grain : 1, {0}, {0}, {0} };
+   uint32_t wrong = 0, twice = 0;
+
+   jobs.parallelFor(count, forkJob, &f, grain);
+   for(uint32_t i = 0; i < count; i++) {
+      if(visits[i].load() != 1)
+         twice++;
+      if(out[i] != work(i))
+         wrong++;
+   }
+   CHECK(twice == 0 && wrong == 0, "%s: count %u grain %u: %u indices not run once, %u differ",
+            what, count, grain, twice, wrong);
+   CHECK(f.bad_lane == 0, "%s: lane out of range", what);
+   CHECK(f.oversize == 0 || !split, "%s: count %u: %u ranges over grain %u", what, count,
+            f.oversize.load(), grain);
+   return f.lanes.load();
+}
+
+// A job that forks again: must run inline on its own lane
+static std::atomic<uint32_t> nested_bad{0};
+static void innerJob(void *ctx, uint32_t begin, uint32_t end, uint8_t lane)
+{
+   if(lane != *(uint8_t *)ctx)
+      nested_bad++;
+}
+
+static void outerJob(void *ctx, uint32_t begin, uint32_t end, uint8_t lane)
+{
+   for(uint32_t i = begin; i < end; i++)
+      jobs.parallelFor(8, innerJob, &lane, 1);
+}
+
+static void sleepJob(void *ctx, uint32_t begin, uint32_t end, uint8_t lane)
+{
+   std::this_thread::sleep_for(std::chrono::milliseconds(IDLE_MS));
+}
+
+static double cpuUs(void)
+{
+   timespec ts;
+   clock_gettime(CLOCK_PROCESS_CPUTIME_ID, &ts);
+   return ts.tv_sec * 1e6 + ts.tv_nsec / 1e3;
+}
+
+static double timeFft(ESP32S3_FFT &fft, std::vector<float> &in, std::vector<float> &out, int reps)
+{
+   double t0 = nowUs();
+   for(int r = 0; r < reps; r++)
+      fft.compute(in.data(), out.data(), true);
+   return (nowUs() - t0) / reps;
+}
+
+int main(void)
+{
+   uint32_t lanes = 0;
+
+   CHECK(checkFork(1000, 10, "before begin", false) == 0x01, "fork before begin left lane 0");
+   CHECK(jobs.begin(), "begin failed");
+   CHECK(jobs.running() && jobs.lanes() == JOBS_NUM_LANES, "not running");
+
+   /**
+    * @brief 1) Against the serial loop
+    */
+   for(uint32_t count : { 1u, 2u, 3u, 7u, 64u, 1000u, 4097u, uint32_t(JOBS_MAX_COUNT) }) {
+      for(uint32_t grain : { 0u, 1u, 3u, 64u, 1000u })
+         lanes |= checkFork(count, grain, "fork");
+   }
+   TestNoise rnd(5);
+   for(int n = 0; n < 500; n++) {
+      uint32_t count = 1 + uint32_t((rnd.next() + 1.0f) * 0.5f * 20000.0f);
+      uint32_t grain = 1 + uint32_t((rnd.next() + 1.0f) * 0.5f * 64.0f);
+      lanes |= checkFork(count, grain, "random fork");
+   }
+   printf("forks     : lanes used 0x%X of %u\n", lanes, JOBS_NUM_LANES);
+
+   /**
+    * @brief 2) Inline cases
+    */
+   CHECK(checkFork(JOBS_MAX_COUNT + 10, 100, "oversize fork", false) == 0x01, "oversize fork left lane 0");
+   jobs.parallelFor(64, outerJob, nullptr, 1);
+   CHECK(nested_bad == 0, "%u nested forks left their lane", nested_bad.load());
+   std::thread second([] { for(int n = 0; n < 50; n++) checkFork(3000, 7, "second task", false); });
+   for(int n = 0; n < 50; n++)
+      checkFork(3000, 5, "first task", false);
+   second.join();
+
+   /**
+    * @brief 4) Idle lanes block
+    */
+   double c0 = cpuUs(), t0 = nowUs();
+   jobs.parallelFor(2, sleepJob, nullptr, 1);
+   double idle_cpu = cpuUs() - c0;
+   printf("idle      : %.0f ms fork of 2 sleeping ranges, %.0f us CPU\n", (nowUs() - t0) / 1000.0, idle_cpu);
+   CHECK(idle_cpu < IDLE_CPU_US, "%.0f us CPU while lanes were idle", idle_cpu);
+
+   /**
+    * @brief 3) Multi frame FFT, split against serial
+    */
+   const uint32_t N = 1024, FRAMES = 16;
+   std::vector<float> in(N * FRAMES), split(N * FRAMES), serial(N * FRAMES), stopped(N * FRAMES), avg_split(N), avg_serial(N);
+   for(uint32_t i = 0; i < in.size(); i++)
+      in[i] = 3000.0f * sinf(0.07f * i) + 500.0f * rnd.next();
+   double t_split, t_serial, a_split, a_serial;
+   {
+      ESP32S3_FFT frames, average, frames_serial, average_serial;
+      frames.parallel_frames = true;
+      average.parallel_frames = true;
+      CHECK(frames.init(N, N * FRAMES, SPECTRAL_NO_SLIDING), "fft init failed");
+      CHECK(average.init(N, N * FRAMES, SPECTRAL_AVERAGE), "fft init failed");
+      CHECK(frames_serial.init(N, N * FRAMES, SPECTRAL_NO_SLIDING), "fft init failed");
+      CHECK(average_serial.init(N, N * FRAMES, SPECTRAL_AVERAGE), "fft init failed");
+      t_split = timeFft(frames, in, split, 20);
+      a_split = timeFft(average, in, avg_split, 20);
+      t_serial = timeFft(frames_serial, in, serial, 20);
+      a_serial = timeFft(average_serial, in, avg_serial, 20);
+      jobs.end();                         // split lanes run inline from here
+      frames.compute(in.data(), stopped.data(), true);
+   }
+   CHECK(memcmp(stopped.data(), serial.data(), split.size() * sizeof(float)) == 0,
+            "NO_SLIDING: split with jobs stopped differs from serial");
+   CHECK(memcmp(split.data(), serial.data(), split.size() * sizeof(float)) == 0,
+            "NO_SLIDING: split differs from serial");
+   double err = 0.0;
+   for(uint32_t i = 0; i < N; i++)
+      err = std::max(err, double(fabsf(avg_split[i] - avg_serial[i]) / (fabsf(avg_serial[i]) + 1e-3f)));
+   CHECK(err < 1e-5, "AVERAGE: split differs from serial by %.2e", err);
+   unsigned cpus = std::thread::hardware_concurrency();
+   printf("fft       : %u x %u NO_SLIDING %.0f us split, %.0f us serial (x%.2f)\n", FRAMES, N, t_split,
+            t_serial, t_serial / t_split);
+   printf("            %u x %u AVERAGE    %.0f us split, %.0f us serial (x%.2f)\n", FRAMES, N, a_split,
+            a_serial, a_serial / a_split);
+   printf("            %u host CPU(s)%s\n", cpus, (cpus < 2) ? " - no speedup possible here" : "");
+   if(cpus >= 2)
+      CHECK(t_serial / t_split > 1.1, "no speedup on %u CPUs", cpus);
+   return testResult("test_jobs");
+}
@@ -0,0 +1,222 @@
+/********************************************************************
+ * @brief test_kws.cpp : keyword spotter accuracy, match time versus
+ * library size and end of speech to result latency on the host.
+ *
+ * @note Each synthetic "word" is 1 - 3 voiced syllables with its own
+ * pitch & formant glides. Utterances vary tempo (+-15%), pitch (+-10%),
+ * formants (+-3%) and level, with mic noise around them. Every word is
+ * enrolled 3 times, then spoken 4 more times, and 4 words that were
+ * never enrolled are spoken 4 times each. The VAD is simulated at
+ * capture frame granularity: the start edge ~100ms after the onset, the
+ * end edge after the 384ms hangover. The test reports:
+ *    accuracy       - utterances matched to the right word
+ *    false acc.     - unknown words matched to any word
+ *    match us       - search time (lower bounds + DTW)
+ *    end -> result  - from the true end of the word to the result, with
+ *                     the capture frame buffering (the word's last
+ *                     frame is processed when the frame is complete).
+ *                     Under 100ms with KWS_MAX_CAPTURE_FRAME frames, the
+ *                     longest startCapture() uses with the spotter on,
+ *                     and with 10ms low latency frames.
+ *    end_us         - the spotter's own figure, from its last speech frame
+ */
+#include "esp32s3_kws.h"
+#include "host_test.h"
+#include <float.h>
+#include <string>
+
+#define RATE                     16000
+#define VAD_START_MS             100      // VAD start edge after the onset
+#define VAD_HANGOVER_MS          384      // VAD end edge after the word
+#define LEAD_MS                  400      // noise before the word
+#define TAIL_MS                  700      // noise after the word (> hangover + a frame)
+#define ENROLL_PER_WORD          3
+#define TESTS_PER_WORD           4
+#define OOV_WORDS                4        // words never enrolled
+
+typedef struct {
+   float dur;                             // secs
+   float f0a, f0b;                        // pitch glide
+   float f1a, f1b, f2a, f2b;              // formant glides
+} syllable_t;
+
+static std::vector<syllable_t> wordShape(int id)
+{
+   TestNoise rnd(1000 + id * 7919);
+   std::vector<syllable_t> syl(1 + (id % 3));
+   auto uni = [&](float lo, float hi) { return lo + (hi - lo) * 0.5f * (rnd.next() + 1.0f); };
+
+   for(syllable_t &s : syl) {
+      s.dur = uni(0.12f, 0.26f);
+      s.f0a = uni(100.0f, 180.0f);
+      s.f0b = s.f0a * uni(0.75f, 1.2f);
+      s.f1a = uni(300.0f, 900.0f);
+      s.f1b = uni(300.0f, 900.0f);
+      s.f2a = uni(900.0f, 2500.0f);
+      s.f2b = uni(900.0f, 2500.0f);
+   }
+   return syl;
+}
+
+/********************************************************************
+ * @brief One utterance of word 'id': noise, the word, noise.
+ * @return word start & end sample in 'out'.
+ */
+static void speak(int id, uint32_t seed, std::vector<float> &out, uint32_t &start, uint32_t &end)
+{
+   TestNoise rnd(seed);
+   auto uni = [&](float lo, float hi) { return lo + (hi - lo) * 0.5f * (rnd.next() + 1.0f); };
+   float tempo = uni(0.85f, 1.15f), pitch = uni(0.9f, 1.1f), level = uni(4000.0f, 9000.0f);
+   float fj = uni(0.97f, 1.03f);
+   double phase = 0.0;
+
+   out.assign(RATE * LEAD_MS / 1000, 0.0f);
+   start = out.size();
+   for(const syllable_t &s : wordShape(id)) {
+      uint32_t n = uint32_t(s.dur * tempo * RATE);
+      if(out.size() > start)
+         out.insert(out.end(), uint32_t(0.03f * tempo * RATE), 0.0f);   // 30ms closure
+      for(uint32_t i = 0; i < n; i++) {
+         double t = double(i) / n;
+         double f0 = pitch * (s.f0a + (s.f0b - s.f0a) * t);
+         double fm1 = fj * (s.f1a + (s.f1b - s.f1a) * t), fm2 = fj * (s.f2a + (s.f2b - s.f2a) * t);
+         double v = 0.0;
+         phase += 2.0 * M_PI * f0 / RATE;
+         for(int h = 1; h * f0 < 4000.0; h++) {
+            double f = h * f0;
+            double g = 1.0 / (1.0 + pow((f - fm1) / 120.0, 2)) + 0.6 / (1.0 + pow((f - fm2) / 200.0, 2));
+            v += g * sin(h * phase);
+         }
+         out.push_back(float(level * 0.25 * sin(M_PI * t) * v));
+      }
+   }
+   end = out.size();
+   out.insert(out.end(), RATE * TAIL_MS / 1000, 0.0f);
+   for(float &v : out)
+      v += 30.0f * rnd.next();
+}
+
+typedef struct {
+   bool done;                             // a segment was matched (or enrolled)
+   bool by_vad_end;                       // ... only at the VAD end edge
+   kws_result_t r;
+   double lat_ms;                         // true end of word to result
+} said_t;
+
+/********************************************************************
+ * @brief Feed one utterance in capture frames, as the capture task does.
+ */
+static said_t say(ESP32S3_KWS &kws, const std::vector<float> &a, uint32_t start, uint32_t end,
+         uint32_t frame)
+{
+   uint32_t vad_on = start + RATE * VAD_START_MS / 1000;
+   uint32_t vad_off = end + RATE * VAD_HANGOVER_MS / 1000;
+   bool started = false;
+   said_t s = {};
+
+   for(uint32_t pos = 0; pos + frame <= a.size() && !s.done; pos += frame) {
+      uint32_t frame_end = pos + frame;
+      esp_timer_host_offset += int64_t(frame) * 1000000 / RATE;   // live capture: the frame just completed
+      int64_t t_frame = esp_timer_get_time() - int64_t(frame) * 1000000 / RATE;
+
+      kws.pushAudio(&a[pos], frame, t_frame);
+      if(!started && frame_end >= vad_on) {
+         kws.speechStart();
+         started = true;
+      }
+      if(started && frame_end >= vad_off) {
+         kws.speechEnd(&s.r);
+         s.by_vad_end = true;
+      }
+      else
+         kws.poll(&s.r);
+      s.done = (s.r.distance < FLT_MAX);  // searched, matched or not
+      if(s.done)
+         s.lat_ms = (double(frame_end) - end) * 1000.0 / RATE + s.r.match_us / 1000.0;
+      else if(s.by_vad_end)
+         break;
+   }
+   return s;
+}
+
+typedef struct {
+   uint16_t templates;
+   uint32_t frame;
+   float accuracy;
+   double match_us, match_max_us;
+   double end_ms, end_max_ms;
+   double lat_ms, lat_max_ms;
+   uint16_t by_vad_end;
+   uint16_t false_accept;                 // unknown words matched
+} kws_run_t;
+
+static kws_run_t run(ESP32S3_KWS &kws, int words, uint32_t frame)
+{
+   std::vector<float> a;
+   uint32_t start, end, n = 0, ok = 0;
+   kws_run_t res = {};
+
+   kws.clearLibrary();
+   for(int w = 0; w < words; w++) {
+      for(int k = 0; k < ENROLL_PER_WORD; k++) {
+         kws.enroll(("w" + std::to_string(w)).c_str());
+         speak(w, 100 * w + k + 1, a, start, end);
+         say(kws, a, start, end, frame);
+      }
+   }
+   res.templates = kws.numTemplates();
+   res.frame = frame;
+   for(int w = 0; w < words; w++) {
+      for(int k = 0; k < TESTS_PER_WORD; k++, n++) {
+         speak(w, 50000 + 100 * w + k, a, start, end);
+         said_t s = say(kws, a, start, end, frame);
+         ok += (s.r.index >= 0 && std::string(s.r.word) == "w" + std::to_string(w));
+         res.match_us += s.r.match_us;
+         res.match_max_us = std::max(res.match_max_us, double(s.r.match_us));
+         res.end_ms += s.r.end_us / 1000.0;
+         res.end_max_ms = std::max(res.end_max_ms, s.r.end_us / 1000.0);
+         res.lat_ms += s.lat_ms;
+         res.lat_max_ms = std::max(res.lat_max_ms, s.lat_ms);
+         res.by_vad_end += s.by_vad_end;
+      }
+   }
+   for(int w = words; w < words + OOV_WORDS; w++) {
+      for(int k = 0; k < TESTS_PER_WORD; k++) {
+         speak(w, 50000 + 100 * w + k, a, start, end);
+         said_t s = say(kws, a, start, end, frame);
+         res.false_accept += (s.r.index >= 0);
+      }
+   }
+   res.accuracy = 100.0f * ok / n;
+   res.match_us /= n;
+   res.end_ms /= n;
+   res.lat_ms /= n;
+   return res;
+}
+
+int main(void)
+{
+   ESP32S3_KWS kws;
+
+   CHECK(kws.init("/kws_test.bin"), "init");
+   printf("frame  templates  accuracy  false acc.  match us (mean / max)  end->result ms (mean / max)  "
+            "end_us ms  VAD end\n");
+   for(uint32_t frame : { uint32_t(KWS_MAX_CAPTURE_FRAME), 160u }) {
+      for(int words : { 2, 4, 8, 10 }) {
+         if(frame == 160 && words != 10)
+            continue;                     // low latency profile: full library only
+         kws_run_t r = run(kws, words, frame);
+         printf("%5u  %9u  %7.1f%%  %4u / %2u   %8.0f / %6.0f        %6.1f / %6.1f            %6.1f  %7u\n",
+                  r.frame, r.templates, r.accuracy, r.false_accept, OOV_WORDS * TESTS_PER_WORD, r.match_us,
+                  r.match_max_us, r.lat_ms, r.lat_max_ms, r.end_ms, r.by_vad_end);
+         CHECK(r.templates == words * ENROLL_PER_WORD, "%u templates enrolled", r.templates);
+         CHECK(r.accuracy >= 90.0f, "%d words: accuracy %.1f%%", words, r.accuracy);
+         CHECK(r.false_accept == 0, "%d words: %u unknown words matched", words, r.false_accept);
+         CHECK(r.by_vad_end == 0, "%u segments waited for the VAD hangover", r.by_vad_end);
+         CHECK(r.lat_max_ms < 100.0, "%u sample frames: %.1f ms end to result", r.frame, r.lat_max_ms);
+         CHECK(r.end_max_ms < r.lat_max_ms + 50.0, "end_us %.1f ms vs %.1f ms", r.end_max_ms, r.lat_max_ms);
+      }
+   }
+   kws.end();
+   return testResult("test_kws");
+}
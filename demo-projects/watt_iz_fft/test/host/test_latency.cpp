@@ -0,0 +1,151 @@
+/********************************************************************
+ * @brief test_latency.cpp : loopback latency search (ESP32S3_LATENCY)
+ * on synthetic captures.
+ *
+ * @note The capture is the played chirp, delayed and scaled, plus
+ * white noise. locate() must find the delay:
+ * 1) Clean delays - integer lags across search block boundaries and to
+ * the end of a windowLength() capture, plus fractional lags (windowed
+ * sinc delay) refined by the parabola to a fraction of a sample.
+ * 2) Noise - the chirp is found down to -10 dB SNR over its length, and
+ * noise alone is refused (peak to average < LATENCY_MIN_PAR).
+ * 3) Echo - a room with a direct path, strong early reflections and a
+ * decaying tail: the direct path is reported, not a reflection.
+ * 4) summarize() - mean, range and jitter of a known set.
+ */
+#include "esp32s3_latency.h"
+#include "host_test.h"
+
+#define RATE                     16000
+#define MAX_LAG                  8000     // 500ms search
+
+// capture[n] = gain * chirp[n - delay] + noise, fractional 'delay' by windowed sinc
+static std::vector<int16_t> makeCapture(const int16_t *chirp, uint32_t len, double delay, float gain,
+         float noise, uint32_t seed, const std::vector<float> *room=nullptr)
+{
+   std::vector<float> y(len, 0.0f);
+   std::vector<float> h = (room) ? *room : std::vector<float>(1, 1.0f);
+   int32_t d = int32_t(floor(delay));
+   double frac = delay - d;
+   TestNoise rnd(seed);
+
+   for(uint32_t k = 0; k < h.size(); k++) {
+      if(h[k] == 0.0f)
+         continue;
+      for(int32_t i = 0; i < LATENCY_CHIRP_LEN; i++) {
+         if(frac == 0.0) {
+            int32_t n = d + int32_t(k) + i;
+            if(n >= 0 && n < int32_t(len))
+               y[n] += h[k] * chirp[i];
+            continue;
+         }
+         for(int32_t t = -16; t <= 16; t++) {   // sinc taps, Hann window
+            int32_t n = d + int32_t(k) + i + t;
+            if(n < 0 || n >= int32_t(len))
+               continue;
+            double x = t - frac;
+            double w = 0.5 + 0.5 * cos(M_PI * x / 17.0);
+            y[n] += h[k] * chirp[i] * float(w * sin(M_PI * x) / (M_PI * x));
+         }
+      }
+   }
+   std::vector<int16_t> cap(len);
+   for(uint32_t n = 0; n < len; n++)
+      cap[n] = int16_t(constrain(gain * y[n] + noise * rnd.next(), -32768.0f, 32767.0f));
+   return cap;
+}
+
+int main(void)
+{
+   ESP32S3_LATENCY lat;
+   CHECK(lat.init(RATE, 0.5f), "init failed");
+   const int16_t *chirp = lat.chirp();
+   const uint32_t len = lat.windowLength(MAX_LAG);
+   const uint32_t hop = LATENCY_FFT_SIZE - LATENCY_CHIRP_LEN;
+   float lag = 0.0f, par = 0.0f;
+   bool ok;
+
+   CHECK(len >= MAX_LAG + LATENCY_CHIRP_LEN, "window %u too short for lag %u", len, MAX_LAG);
+   printf("window %u samples (%.0f ms) for lags 0 .. %u\n", len, 1000.0 * len / RATE, MAX_LAG);
+
+   /**
+    * @brief 1) Clean delays, integer & fractional
+    */
+   printf("delay        lag      error    par\n");
+   double us = 0.0;
+   uint32_t runs = 0;
+   for(double delay : { 0.0, 1.0, 777.0, double(hop - 1), double(hop), double(hop + 1),
+            double(2 * hop + 5), double(len - LATENCY_CHIRP_LEN), 1234.25, 1234.5, 4321.75 }) {
+      std::vector<int16_t> cap = makeCapture(chirp, len, delay, 0.3f, 30.0f, 5);
+      double t0 = nowUs();
+      ok = lat.locate(cap.data(), len, &lag, &par);
+      us += nowUs() - t0;
+      runs++;
+      double err = lag - delay;
+      printf("%9.2f %9.2f %+9.3f %6.1f\n", delay, lag, err, par);
+      CHECK(ok, "delay %.2f: refused (par %.1f)", delay, par);
+      CHECK(fabs(err) <= ((delay == floor(delay)) ? 0.05 : 0.25), "delay %.2f: found %.3f", delay, lag);
+   }
+   printf("locate    : %.2f ms per %u sample capture\n", us / runs / 1000.0, len);
+
+   /**
+    * @brief 2) Noise - SNR over the chirp length
+    */
+   double chirp_pow = 0.0;
+   for(uint32_t i = 0; i < LATENCY_CHIRP_LEN; i++)
+      chirp_pow += double(chirp[i]) * chirp[i];
+   chirp_pow /= LATENCY_CHIRP_LEN;
+   printf("snr dB       lag      error    par\n");
+   for(double snr : { 20.0, 10.0, 0.0, -5.0, -10.0 }) {
+      float gain = 0.3f;
+      // uniform noise of peak 'a' has power a^2 / 3
+      float a = float(sqrt(3.0 * gain * gain * chirp_pow / pow(10.0, snr / 10.0)));
+      std::vector<int16_t> cap = makeCapture(chirp, len, 2345.0, gain, a, 7);
+      ok = lat.locate(cap.data(), len, &lag, &par);
+      printf("%6.0f %12.2f %+9.3f %6.1f\n", snr, lag, lag - 2345.0, par);
+      CHECK(ok && fabs(lag - 2345.0) <= 0.5, "%.0f dB SNR: found %.2f (par %.1f)", snr, lag, par);
+   }
+   for(uint32_t seed = 1; seed <= 5; seed++) {
+      std::vector<int16_t> cap = makeCapture(chirp, len, 0.0, 0.0f, 3000.0f, seed);
+      ok = lat.locate(cap.data(), len, &lag, &par);
+      printf("noise only %u: par %.1f %s\n", seed, par, (ok) ? "ACCEPTED" : "refused");
+      CHECK(!ok, "noise only (seed %u) accepted at %.2f, par %.1f", seed, lag, par);
+   }
+   std::vector<int16_t> silence(len, 0);
+   CHECK(!lat.locate(silence.data(), len, &lag, &par), "silence accepted");
+   CHECK(!lat.locate(silence.data(), LATENCY_CHIRP_LEN - 1, &lag), "capture shorter than the chirp accepted");
+
+   /**
+    * @brief 3) Echo - direct path plus reflections & a tail
+    */
+   std::vector<float> room(1200, 0.0f);
+   TestNoise rnd(31);
+   for(uint32_t k = 1; k < room.size(); k++)
+      room[k] = 0.25f * expf(-float(k) / 250.0f) * rnd.next();
+   room[0] = 1.0f;                        // direct path
+   room[45] = 0.7f;                       // table
+   room[160] = -0.6f;                     // wall
+   room[410] = 0.5f;                      // ceiling
+   for(double delay : { 1500.0, 1500.5, double(hop - 20) }) {
+      std::vector<int16_t> cap = makeCapture(chirp, len, delay, 0.15f, 100.0f, 9, &room);
+      ok = lat.locate(cap.data(), len, &lag, &par);
+      printf("echo %7.1f: lag %9.2f, error %+.3f, par %.1f\n", delay, lag, lag - delay, par);
+      CHECK(ok && fabs(lag - delay) <= 0.25, "echo: direct path %.1f, found %.2f", delay, lag);
+   }
+
+   /**
+    * @brief 4) summarize()
+    */
+   latency_result_t res;
+   const float lags[] = { 100.0f, 102.0f, 98.0f, 100.0f };
+   ESP32S3_LATENCY::summarize(lags, 4, 6, &res);
+   CHECK(res.trials == 6 && res.valid == 4, "trials %u valid %u", res.trials, res.valid);
+   CHECK(res.mean == 100.0f && res.min == 98.0f && res.max == 102.0f, "mean %.2f range %.2f - %.2f",
+            res.mean, res.min, res.max);
+   CHECK(fabsf(res.jitter - sqrtf(2.0f)) < 1e-4f, "jitter %.4f", res.jitter);
+   ESP32S3_LATENCY::summarize(lags, 0, 3, &res);
+   CHECK(res.trials == 3 && res.valid == 0 && res.mean == 0.0f && res.jitter == 0.0f, "no valid trials");
+
+   lat.end();
+   return testResult("test_latency");
+}
@@ -0,0 +1,167 @@
+/********************************************************************
+ * @brief test_mixer.cpp : ESP32S3_MIXER summing, ducking and region
+ * sources, and mix() throughput versus active sources on the host.
+ *
+ * @note Sources are fed chunks that don't line up with the output
+ * blocks, so pull() crosses chunk boundaries inside a block. Checks:
+ * 1) Unity sources sum exactly across chunk boundaries, and the count of
+ * leading samples with audio is right when a source runs dry.
+ * 2) A higher priority source ducks a lower one by its duck_db within
+ * the ramp, and the level comes back after the hold time.
+ * 3) A region source (mix_region_t) reads read-only audio in place, and
+ * each region's stamp comes back from the mix() that starts playing it.
+ * Throughput is mix() of 512 sample blocks with 1 - 5 sources at a
+ * fixed, non unity level (the gain multiply runs) and with the soft knee.
+ */
+#include "esp32s3_mixer.h"
+#include "host_test.h"
+
+#define RATE                     16000
+#define BLOCK                    512      // mix() block, one speaker DMA buffer
+#define CHUNK                    320      // source chunk, deliberately not a divisor of BLOCK
+#define SOURCES                  5
+#define BENCH_SAMPLES            (RATE * 300)   // 5 minutes of audio per figure
+
+static ChunkRingFifo rings[SOURCES];
+
+// Queue 'n' samples of 'pcm' to a chunk source, CHUNK at a time
+static void feed(uint8_t src, const int16_t *pcm, uint32_t n)
+{
+   for(uint32_t off = 0; off < n; off += CHUNK) {
+      uint32_t len = std::min<uint32_t>(CHUNK, n - off);
+      CHECK(rings[src].push(pcm + off, len * sizeof(int16_t)), "source %u full", src);
+   }
+}
+
+static double rms(const int16_t *x, uint32_t n)
+{
+   double e = 0.0;
+   for(uint32_t i = 0; i < n; i++)
+      e += double(x[i]) * x[i];
+   return sqrt(e / n);
+}
+
+int main(void)
+{
+   ESP32S3_MIXER mixer;
+   std::vector<int16_t> tone(BLOCK * 4), out(BLOCK);
+   const mix_source_cfg_t unity = { 0.0f, 1, 0.0f };
+
+   for(uint32_t i = 0; i < tone.size(); i++)
+      tone[i] = int16_t(8000.0 * sin(2.0 * M_PI * 500.0 * i / RATE));
+   for(ChunkRingFifo &r : rings)
+      CHECK(r.create(8, CHUNK * sizeof(int16_t)), "ring");
+   CHECK(mixer.init(rings, SOURCES, BLOCK, RATE), "init");
+
+   /**
+    * @brief 1) Exact sum across chunk boundaries, partial last block
+    */
+   std::vector<int16_t> a(BLOCK + 200), b(BLOCK);
+   for(uint32_t i = 0; i < a.size(); i++)
+      a[i] = int16_t(i * 37);
+   for(uint32_t i = 0; i < b.size(); i++)
+      b[i] = int16_t(-int32_t(i) * 11);
+   feed(0, a.data(), a.size());
+   feed(1, b.data(), b.size());
+   uint32_t filled = mixer.mix(out.data(), BLOCK);
+   uint32_t wrong = 0;
+   for(uint32_t i = 0; i < BLOCK; i++)
+      wrong += (out[i] != int16_t(a[i] + b[i]));
+   filled = mixer.mix(out.data(), BLOCK);
+   for(uint32_t i = 0; i < BLOCK; i++)
+      wrong += (out[i] != ((i < 200) ? a[BLOCK + i] : 0));
+   CHECK(wrong == 0, "%u samples summed wrong", wrong);
+   CHECK(filled == 200, "%u leading samples reported, 200 queued", filled);
+   CHECK(mixer.mix(out.data(), BLOCK) == 0, "idle mixer reports audio");
+
+   /**
+    * @brief 2) Ducking: source 1 (priority 2) ducks source 0 by 12 dB
+    */
+   mixer.setSource(0, { 0.0f, 1, 12.0f });
+   mixer.setSource(1, { 0.0f, 2, 0.0f });
+   for(int i = 0; i < 40; i++)
+      mixer.mix(out.data(), BLOCK);       // holds from 1) run out
+   std::vector<int16_t> mixed;
+   for(int blk = 0; blk < 30; blk++) {   // ~1 s: source 1 plays blocks 4 - 7
+      feed(0, tone.data(), BLOCK);
+      if(blk >= 4 && blk < 8) {
+         std::vector<int16_t> quiet(BLOCK, 0);
+         feed(1, quiet.data(), BLOCK);    // silent but queued: it's the priority that ducks
+      }
+      mixer.mix(out.data(), BLOCK);
+      mixed.insert(mixed.end(), out.begin(), out.end());
+   }
+   double full = rms(&mixed[0], BLOCK * 4);
+   double ducked = rms(&mixed[BLOCK * 6], BLOCK);                   // after the 30 ms ramp
+   double held = rms(&mixed[BLOCK * 8], BLOCK);                     // within the 250 ms hold
+   double back = rms(&mixed[BLOCK * 25], BLOCK * 4);                // hold + ramp over
+   printf("ducking   : %.1f dB while ducked (target -12), %.1f dB in the hold, %.1f dB after\n",
+            20.0 * log10(ducked / full), 20.0 * log10(held / full), 20.0 * log10(back / full));
+   CHECK(fabs(20.0 * log10(ducked / full) + 12.0) < 0.5, "ducked level");
+   CHECK(fabs(20.0 * log10(held / full) + 12.0) < 0.5, "hold released early");
+   CHECK(fabs(20.0 * log10(back / full)) < 0.1, "level did not come back");
+   mixer.setSource(0, unity);
+   mixer.setSource(1, unity);
+   for(int i = 0; i < 40; i++)
+      mixer.mix(out.data(), BLOCK);       // ramps & holds settle
+
+   /**
+    * @brief 3) Region source: audio read where it lies, level applied
+    */
+   const std::vector<int16_t> rom(tone);  // stands in for mapped flash
+   ChunkRingFifo &reg = rings[2];
+   mix_region_t r = { rom.data(), uint32_t(BLOCK + 100) };
+   mixer.useRegions(2);
+   CHECK(reg.reconfigure(4, sizeof(mix_region_t)), "region ring");
+   mixer.setSource(2, { -6.0f, 1, 0.0f });
+   for(int i = 0; i < 40; i++)
+      mixer.mix(out.data(), BLOCK);       // level ramp done
+   CHECK(reg.push(&r, sizeof(r)), "region push");
+   uint32_t got = mixer.mix(out.data(), BLOCK);
+   got += mixer.mix(out.data(), BLOCK);
+   double region_db = 20.0 * log10(rms(out.data(), 100) / rms(&rom[BLOCK], 100));
+   bool untouched = std::equal(rom.begin(), rom.end(), tone.begin());
+   printf("region    : %u samples mixed, %.2f dB (set -6), source %s\n", got, region_db,
+            (untouched) ? "untouched" : "WRITTEN");
+   CHECK(got == BLOCK + 100, "region mixed %u samples", got);
+   CHECK(fabs(region_db + 6.0) < 0.1, "region level %.2f dB", region_db);
+   CHECK(untouched, "region audio was written");
+   mix_region_t r1 = { rom.data(), uint32_t(BLOCK + 100), 111 }, r2 = { rom.data(), 50, 222 };
+   CHECK(reg.push(&r1, sizeof(r1)) && reg.push(&r2, sizeof(r2)), "region push");
+   uint32_t stamp[3];
+   for(uint32_t &st : stamp) {
+      mixer.mix(out.data(), BLOCK);
+      st = mixer.started(2);
+   }
+   printf("stamps    : %u, %u, %u from three mix() calls (111 starts in the 1st, 222 in the 2nd)\n",
+            stamp[0], stamp[1], stamp[2]);
+   CHECK(stamp[0] == 111 && stamp[1] == 222 && stamp[2] == 0, "region stamps out of step");
+   CHECK(reg.reconfigure(8, CHUNK * sizeof(int16_t)), "ring");
+   mixer.useRegions(2, false);
+
+   /**
+    * @brief Throughput versus active sources
+    */
+   printf("sources  us / block  Msamples/s  (host, %u sample blocks, -3 dB level)\n", BLOCK);
+   for(int knee = 0; knee < 2; knee++) {
+      mixer.setLimiter(knee, 0.9f);
+      for(uint8_t n = 1; n <= SOURCES; n++) {
+         for(uint8_t i = 0; i < SOURCES; i++)
+            mixer.setSource(i, { -3.0f, 1, 0.0f });
+         for(int i = 0; i < 40; i++)
+            mixer.mix(out.data(), BLOCK);
+         double t_us = 0.0;
+         for(uint32_t done = 0; done < BENCH_SAMPLES; done += BLOCK) {
+            for(uint8_t i = 0; i < n; i++)
+               feed(i, tone.data(), BLOCK);
+            double t0 = nowUs();
+            mixer.mix(out.data(), BLOCK);
+            t_us += nowUs() - t0;
+         }
+         double per = t_us / (BENCH_SAMPLES / BLOCK);
+         printf("%7u%s  %10.2f  %10.1f\n", n, (knee) ? "+k" : "  ", per, BLOCK / per);
+      }
+   }
+   mixer.end();
+   return testResult("test_mixer");
+}
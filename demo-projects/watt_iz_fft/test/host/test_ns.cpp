@@ -0,0 +1,125 @@
+/********************************************************************
+ * @brief test_ns.cpp : noise suppressor quality & cost on the host.
+ *
+ * @note Speech like syllables are mixed with stationary noises (white,
+ * fan: low pass noise + motor hum, HVAC: brown noise) at 0, 5 and 10 dB.
+ * Each mix runs through ESP32S3_NOISE_SUPPRESS in capture frames. After
+ * the noise estimate settles the test reports:
+ *    SNR in / out  - against the clean speech (output is one hop late)
+ *    pause atten.  - noise power removed where no syllable plays
+ *    us / frame    - host time of one process() call
+ * A clean input must come through nearly unchanged.
+ */
+#include "esp32s3_ns.h"
+#include "host_test.h"
+
+#define RATE                     16000
+#define FRAME                    1536     // capture frame (96ms)
+#define SECONDS                  20
+#define SETTLE_SECONDS           3        // min statistics window is ~1.5s
+
+enum { NOISE_WHITE, NOISE_FAN, NOISE_HVAC };
+static const char *noise_names[] = { "white", "fan", "hvac" };
+
+static void makeNoise(std::vector<float> &n, int type, uint32_t seed)
+{
+   TestNoise rnd(seed);
+   float lp = 0.0f, br = 0.0f;
+
+   for(uint32_t i = 0; i < n.size(); i++) {
+      float w = rnd.next();
+      switch(type) {
+         case NOISE_WHITE:
+            n[i] = w;
+            break;
+         case NOISE_FAN:                  // broadband rumble + blade / motor hum
+            lp += 0.1f * (w - lp);
+            n[i] = 3.0f * lp + 0.3f * sinf(2.0f * float(M_PI) * 120.0f * i / RATE) + 
+                  0.15f * sinf(2.0f * float(M_PI) * 240.0f * i / RATE);
+            break;
+         case NOISE_HVAC:                 // brown noise, leaky
+            br = 0.995f * br + 0.05f * w;
+            n[i] = br;
+            break;
+      }
+   }
+}
+
+static double power(const std::vector<float> &v, uint32_t from, uint32_t to, 
+         const std::vector<uint8_t> *mask=nullptr, uint8_t want=0)
+{
+   double p = 0.0;
+   for(uint32_t i = from; i < to; i++) {
+      if(!mask || (*mask)[i] == want)
+         p += double(v[i]) * v[i];
+   }
+   return p;
+}
+
+// Run the suppressor over 'in', output aligned to the input (hop delay removed)
+static double runNs(ESP32S3_NOISE_SUPPRESS &ns, const std::vector<float> &in, std::vector<float> &out)
+{
+   std::vector<float> buf(in.size() + FRAME);
+   std::vector<float> frame(FRAME);
+   double t_us = 0.0;
+   uint32_t frames = 0;
+
+   ns.reset();
+   for(uint32_t pos = 0; pos + FRAME <= buf.size(); pos += FRAME, frames++) {
+      for(uint32_t i = 0; i < FRAME; i++)
+         frame[i] = (pos + i < in.size()) ? in[pos + i] : 0.0f;
+      double t0 = nowUs();
+      ns.process(frame.data(), buf.data() + pos, FRAME);
+      t_us += nowUs() - t0;
+   }
+   out.assign(buf.begin() + NS_HOP_SIZE, buf.begin() + NS_HOP_SIZE + in.size());
+   return t_us / frames;
+}
+
+int main(void)
+{
+   const uint32_t len = RATE * SECONDS, from = RATE * SETTLE_SECONDS;
+   std::vector<float> clean(len), noise(len), mix(len), out(len), err(len);
+   std::vector<uint8_t> active;
+   ESP32S3_NOISE_SUPPRESS ns;
+   double us = 0.0;
+
+   CHECK(ns.init(FRAME), "init");
+   speechLike(clean, RATE, 8000.0f, 7, &active);
+
+   // Clean speech in pauses of digital silence: overlap-add must be transparent
+   us = runNs(ns, clean, out);
+   for(uint32_t i = 0; i < len; i++)
+      err[i] = out[i] - clean[i];
+   double recon = dB(power(clean, from, len), power(err, from, len));
+   printf("clean input: reconstruction SNR %.1f dB, %.0f us / %d sample frame\n", recon, us, FRAME);
+   CHECK(recon > 25.0, "clean speech distorted (%.1f dB)", recon);
+
+   printf("noise  SNR in   SNR out  gain   pause atten   us/frame\n");
+   for(int type = NOISE_WHITE; type <= NOISE_HVAC; type++) {
+      makeNoise(noise, type, 100 + type);
+      for(float snr_in : { 0.0f, 5.0f, 10.0f }) {
+         double scale = sqrt(power(clean, 0, len) / (power(noise, 0, len) * pow(10.0, snr_in / 10.0)));
+         for(uint32_t i = 0; i < len; i++)
+            mix[i] = clean[i] + float(scale * noise[i]);
+
+         for(uint32_t i = 0; i < len; i++)
+            err[i] = mix[i] - clean[i];
+         double s_in = dB(power(clean, from, len), power(err, from, len));
+
+         us = runNs(ns, mix, out);
+         for(uint32_t i = 0; i < len; i++)
+            err[i] = out[i] - clean[i];
+         double s_out = dB(power(clean, from, len), power(err, from, len));
+         double atten = dB(power(mix, from, len, &active, 0), power(out, from, len, &active, 0));
+         printf("%-6s %5.1f    %5.1f   %+5.1f      %5.1f dB    %6.0f\n", noise_names[type], s_in, s_out, 
+                  s_out - s_in, atten, us);
+         CHECK(atten > 10.0, "%s @ %.0f dB: pause attenuation %.1f dB", noise_names[type], snr_in, atten);
+         if(snr_in <= 5.0f)
+            CHECK(s_out - s_in > 3.0, "%s @ %.0f dB: SNR gain %.1f dB", noise_names[type], snr_in, s_out - s_in);
+         CHECK(s_out - s_in > 0.0, "%s @ %.0f dB: SNR got worse", noise_names[type], snr_in);
+      }
+   }
+   ns.end();
+   return testResult("test_ns");
+}
@@ -0,0 +1,300 @@
+/********************************************************************
+ * @brief test_playlist.cpp : ESP32S3_PLAYLIST splicing and crossfading
+ * of WAV tracks (the WAV voice's wavStep()), with a simulated loader.
+ *
+ * @note The clips are consecutive pieces of one sine, so a gapless
+ * splice must give back that sine sample for sample - any dropped,
+ * repeated or inserted sample at a track boundary shows. The loader
+ * runs between engine blocks the way taskWavPrefetch does (open into
+ * the FREE slot, stream aligned reads into its ring, skip files that
+ * won't parse), either with no limit, or rationed to one read every
+ * few blocks so the engine runs dry. Checks:
+ * 1) Gapless: output == the sine, for mono and stereo clips, a clip
+ * shorter than a block and an unplayable file in the list, with a fast
+ * and a starved loader. Marks land on the track boundaries.
+ * 2) Crossfade: output matches an integer model of the linear Q15
+ * fade (length min(xfade, left of a, next track)), and no sample step
+ * in a fade is larger than the two tones and the level change allow.
+ * The rationed loader here just keeps pace, so the next track is often
+ * opened or buffered after its fade should have started: the fades
+ * must still start on time (the engine waits, it doesn't play on).
+ */
+#include "esp32s3_playlist.h"
+#include "host_test.h"
+
+#define RATE                     16000
+#define BLOCK                    512      // fill() block, one WAV fifo slot
+#define READ_BYTES               4096     // raw bytes per decode, as the WAV voice
+#define RING_DEPTH               4
+#define RING_BYTES               2048     // read-ahead slot, deliberately small
+#define LEVEL                    12000.0
+#define XFADE_MS                 50
+
+typedef std::vector<uint8_t> file_t;
+
+typedef struct {
+   std::vector<file_t *> list;            // playlist
+   size_t next;                           // next file to open
+   uint8_t load;                          // slot being loaded
+   file_t *file[PLAYLIST_SLOTS];
+   uint32_t pos[PLAYLIST_SLOTS];
+   uint32_t end[PLAYLIST_SLOTS];
+} loader_t ;
+
+typedef struct {
+   uint32_t at;                           // output sample
+   uint32_t pos;                          // track position
+} mark_t ;
+
+static std::vector<mark_t> marks;
+static uint32_t played;                   // output samples before the block being filled
+static uint32_t wakes;
+
+static void onWake(void) { wakes++; }
+static void onMark(playlist_track_t &t, uint32_t offset) { marks.push_back({ played + offset, t.start }); }
+
+static int32_t memRead(void *ctx, uint8_t *buf, uint32_t len, uint32_t offset)
+{
+   const file_t &f = *(const file_t *)ctx;
+   if(offset >= f.size())
+      return 0;
+   len = std::min<uint32_t>(len, f.size() - offset);
+   memcpy(buf, f.data() + offset, len);
+   return int32_t(len);
+}
+
+static void put16(file_t &f, uint16_t v) { f.push_back(v & 0xFF); f.push_back(v >> 8); }
+static void put32(file_t &f, uint32_t v) { put16(f, v & 0xFFFF); put16(f, v >> 16); }
+
+// 16 bit PCM WAV of samples [from, from + len) of a sine, both channels the same
+static file_t makeClip(double hz, uint32_t from, uint32_t len, uint16_t ch)
+{
+   file_t f;
+   uint32_t bytes = len * ch * 2;
+   f.insert(f.end(), { 'R', 'I', 'F', 'F' });
+   put32(f, 36 + bytes);
+   f.insert(f.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+   put32(f, 16);
+   put16(f, WAV_FMT_PCM);
+   put16(f, ch);
+   put32(f, RATE);
+   put32(f, RATE * ch * 2);
+   put16(f, ch * 2);
+   put16(f, 16);
+   f.insert(f.end(), { 'd', 'a', 't', 'a' });
+   put32(f, bytes);
+   for(uint32_t i = from; i < from + len; i++)
+      for(uint16_t c = 0; c < ch; c++)
+         put16(f, uint16_t(int16_t(lrint(LEVEL * sin(2.0 * M_PI * hz * i / RATE)))));
+   return f;
+}
+
+static std::vector<int16_t> sine(double hz, uint32_t from, uint32_t len)
+{
+   std::vector<int16_t> x(len);
+   for(uint32_t i = 0; i < len; i++)
+      x[i] = int16_t(lrint(LEVEL * sin(2.0 * M_PI * hz * (from + i) / RATE)));
+   return x;
+}
+
+/********************************************************************
+ * @brief One pass of the loader, as taskWavPrefetch: up to 'reads' ring
+ * slots (0 = until it has to wait).
+ */
+static void loaderRun(ESP32S3_PLAYLIST &pl, loader_t &ld, uint32_t reads)
+{
+   uint32_t done = 0, len;
+   uint8_t *slot;
+
+   while(reads == 0 || done < reads) {
+      playlist_track_t &t = pl.track(ld.load);
+      const uint8_t s = ld.load;
+
+      if(t.state == TRACK_FREE) {
+         if(ld.next >= ld.list.size())
+            break;
+         file_t *f = ld.list[ld.next++];
+         if(!pl.open(s, memRead, f, f->size())) {
+            ld.load ^= 1;
+            continue;
+         }
+         ld.file[s] = f;
+         ld.pos[s] = t.wav.info().data_offset;
+         ld.end[s] = ld.pos[s] + t.wav.info().data_bytes;
+      }
+      else if(t.state == TRACK_READY && !t.eof) {
+         if((slot = (uint8_t *)t.ring.acquire()) == nullptr)
+            break;
+         len = RING_BYTES - (ld.pos[s] % RING_BYTES);
+         if(len > ld.end[s] - ld.pos[s]) len = ld.end[s] - ld.pos[s];
+         memRead(ld.file[s], slot, len, ld.pos[s]);
+         t.ring.commit(len);
+         ld.pos[s] += len;
+         t.buffered += len;
+         done++;
+         if(ld.pos[s] >= ld.end[s]) {
+            t.eof = true;
+            ld.load ^= 1;
+         }
+      }
+      else
+         break;
+   }
+}
+
+/********************************************************************
+ * @brief Play a list to the end.
+ * @param every - the loader runs every 'every' blocks for up to 'reads'
+ *    ring slots. 0 = every block, no limit.
+ * @param stalls - blocks that came back short while the list went on.
+ */
+static std::vector<int16_t> play(ESP32S3_PLAYLIST &pl, std::vector<file_t *> list, uint32_t xfade,
+         uint32_t every, uint32_t reads, uint32_t *stalls)
+{
+   loader_t ld = {};
+   std::vector<int16_t> out, blk(BLOCK);
+
+   ld.list = list;
+   marks.clear();
+   played = 0;
+   *stalls = 0;
+   pl.clear();
+   pl.begin(xfade);
+   for(size_t i = 0; i < list.size(); i++)
+      pl.queued();
+   for(uint32_t b = 0; pl.pending() > 0 && b < 100000; b++) {
+      if(every == 0)
+         loaderRun(pl, ld, 0);
+      else if(b % every == 0)
+         loaderRun(pl, ld, reads);
+      uint32_t n = pl.fill(blk.data(), BLOCK);
+      out.insert(out.end(), blk.begin(), blk.begin() + n);
+      played += n;
+      *stalls += (n < BLOCK && pl.pending() > 0);
+   }
+   CHECK(pl.pending() == 0, "list never finished");
+   return out;
+}
+
+/********************************************************************
+ * @brief Integer model of the crossfade: each track fades into the next
+ * over min(xfade, what is left of it, the next track's length).
+ */
+static std::vector<int16_t> modelFade(const std::vector<std::vector<int16_t>> &clips, uint32_t xfade,
+         std::vector<uint32_t> *starts)
+{
+   std::vector<int16_t> out;
+   const std::vector<int16_t> *a = &clips[0];
+   uint32_t pa = 0;
+
+   starts->assign(1, 0);
+   for(size_t c = 1; c < clips.size(); c++) {
+      const std::vector<int16_t> &b = clips[c];
+      uint32_t left = a->size() - pa, xf = std::min<uint32_t>(xfade, b.size());
+      if(left > xf) {
+         out.insert(out.end(), a->begin() + pa, a->end() - xf);
+         pa = a->size() - xf;
+         left = xf;
+      }
+      starts->push_back(out.size());
+      for(uint32_t i = 0; i < left; i++) {
+         int32_t g = int32_t((i << 15) / left), va = (*a)[pa + i];
+         out.push_back(int16_t(va + (((b[i] - va) * g) >> 15)));
+      }
+      a = &b;
+      pa = left;
+   }
+   out.insert(out.end(), a->begin() + pa, a->end());
+   return out;
+}
+
+int main(void)
+{
+   ESP32S3_PLAYLIST pl;
+   uint32_t stalls;
+
+   CHECK(pl.init(RATE, BLOCK, READ_BYTES, RING_DEPTH, RING_BYTES, onWake, onMark), "init");
+
+   /**
+    * @brief 1) Gapless: consecutive pieces of one sine come back as the sine
+    */
+   const double hz = 441.0;
+   const uint32_t len[] = { 12345, 777, 40001, 5000 };
+   const uint16_t ch[] = { 1, 1, 2, 1 };
+   std::vector<file_t> clips;
+   std::vector<uint32_t> bounds;
+   uint32_t total = 0;
+   for(int i = 0; i < 4; i++) {
+      clips.push_back(makeClip(hz, total, len[i], ch[i]));
+      bounds.push_back(total);
+      total += len[i];
+   }
+   file_t junk(300, 0x55);                // not a RIFF file
+   file_t empty = makeClip(hz, 0, 0, 1);  // no audio data
+   std::vector<file_t *> list = { &clips[0], &clips[1], &junk, &clips[2], &empty, &clips[3] };
+   std::vector<int16_t> ref = sine(hz, 0, total);
+
+   printf("splice    loader        samples   off by   max err  stalls  marks\n");
+   for(uint32_t every : { 0u, 3u }) {
+      std::vector<int16_t> out = play(pl, list, 0, every, 1, &stalls);
+      uint32_t err = 0;
+      for(uint32_t i = 0; i < std::min(out.size(), ref.size()); i++)
+         err = std::max<uint32_t>(err, abs(out[i] - ref[i]));
+      int32_t off = int32_t(out.size()) - int32_t(ref.size());
+      bool marks_ok = (marks.size() == bounds.size());
+      for(size_t i = 0; marks_ok && i < bounds.size(); i++)
+         marks_ok = (marks[i].at == bounds[i] && marks[i].pos == 0);
+      printf("          %-12s %8zu  %7d  %8u  %6u  %s\n", (every) ? "1 read / 3" : "unlimited",
+               out.size(), off, err, stalls, (marks_ok) ? "on the boundaries" : "WRONG");
+      CHECK(off == 0, "%d samples gained at the splices", off);
+      CHECK(err <= 1, "spliced output %u LSB from the sine", err);
+      CHECK(marks_ok, "%zu marks, not on the track boundaries", marks.size());
+      if(every)
+         CHECK(stalls > 0, "starved loader never stalled the engine");
+   }
+   CHECK(wakes > 0, "loader never woken");
+
+   /**
+    * @brief 2) Crossfade: different tones, a track shorter than the fade
+    */
+   const uint32_t xfade = RATE * XFADE_MS / 1000;
+   const double fhz[] = { 441.0, 660.0, 1000.0, 300.0 };
+   const uint32_t flen[] = { 9000, 500, 7000, 6000 };
+   std::vector<std::vector<int16_t>> fpcm;
+   std::vector<file_t> fclips;
+   std::vector<file_t *> flist;
+   for(int i = 0; i < 4; i++) {
+      fpcm.push_back(sine(fhz[i], 0, flen[i]));
+      fclips.push_back(makeClip(fhz[i], 0, flen[i], 1));
+   }
+   for(file_t &f : fclips)
+      flist.push_back(&f);
+   std::vector<uint32_t> starts;
+   std::vector<int16_t> fref = modelFade(fpcm, xfade, &starts);
+   // steepest a sample step can be in a fade: both tones + the level change
+   double max_slope = 0.0;
+   for(double f : fhz)
+      max_slope = std::max(max_slope, LEVEL * 2.0 * M_PI * f / RATE);
+
+   printf("crossfade loader        samples   model   max err  max step (limit)  stalls\n");
+   for(uint32_t every : { 0u, 2u }) {
+      std::vector<int16_t> out = play(pl, flist, xfade, every, 1, &stalls);
+      uint32_t err = 0;
+      for(uint32_t i = 0; i < std::min(out.size(), fref.size()); i++)
+         err = std::max<uint32_t>(err, abs(out[i] - fref[i]));
+      double step = 0.0, limit = 2.0 * max_slope + 2.0 * LEVEL / 500.0 + 2.0;
+      for(uint32_t i = 1; i < out.size(); i++)
+         step = std::max(step, fabs(double(out[i]) - out[i - 1]));
+      printf("          %-12s %8zu %8zu  %8u  %8.0f (%.0f)  %6u\n", (every) ? "1 read / 2" : "unlimited",
+               out.size(), fref.size(), err, step, limit, stalls);
+      CHECK(out.size() == fref.size(), "%zu samples, model %zu", out.size(), fref.size());
+      CHECK(err == 0, "crossfade %u LSB from the model", err);
+      CHECK(step <= limit, "click: step %.0f > %.0f", step, limit);
+      bool marks_ok = (marks.size() == starts.size());
+      for(size_t i = 0; marks_ok && i < starts.size(); i++)
+         marks_ok = (marks[i].at == starts[i]);
+      CHECK(marks_ok, "%zu crossfade marks, not at the fade starts", marks.size());
+   }
+   pl.end();
+   return testResult("test_playlist");
+}
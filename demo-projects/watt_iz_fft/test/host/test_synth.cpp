@@ -0,0 +1,323 @@
+/********************************************************************
+ * @brief test_synth.cpp : ESP32S3_SYNTH pitch, chords, DTMF and sweeps,
+ * and its cost against the per sample sin() loop it replaced.
+ *
+ * @note Output is rendered in TONE_CHUNK sample slots as taskPlayTone()
+ * does, and measured after the attack ramp. Tone amplitudes come from a
+ * joint least squares fit of DC plus a sine & cosine at each expected
+ * frequency; what the fit leaves is noise & distortion (SINAD).
+ * 1) Pitch - steady tones, frequency from interpolated zero crossings
+ * over 10 seconds within PITCH_HZ of the request. The old loop's error
+ * (its period rounded to whole samples) is printed beside it.
+ * 2) Chord - four voices: each at its amplitude, SINAD over MIN_SINAD_DB,
+ * no clipping.
+ * 3) DTMF - every key: its row & column tones at half the amplitude,
+ * the other six DTMF tones below MIN_SINAD_DB.
+ * 4) Sweeps - frequency over 20ms windows of zero crossings follows the
+ * linear glide within SWEEP_ERR, then holds the end frequency, or
+ * restarts (siren).
+ * 5) Cost - the old double precision sin(j * ratio) loop against render()
+ * for the same tones, best second of BENCH_SECS. The host's FPU does
+ * double precision, so render() need only be MIN_HOST_SPEEDUP times
+ * faster here; the ESP32-S3 FPU is single precision and runs the old
+ * loop's double math in software, where the target is over 10x.
+ */
+#include "esp32s3_synth.h"
+#include "host_test.h"
+
+#define RATE                     16000
+#define TONE_CHUNK               1024     // taskPlayTone slot (I2S_DMA_BUFR_LEN)
+#define VOL_NORM                 30.0     // old taskPlayTone volume -> int16 scale
+#define SKIP_SAMPLES             (RATE / 50)   // 20ms: past the attack ramp
+#define PITCH_HZ                 0.01     // steady tone frequency error bound
+#define MIN_SINAD_DB             70.0
+#define MIN_HOST_SPEEDUP         2.0      // old loop / render() time on a double precision FPU
+#define SWEEP_WIN                (RATE / 50)   // 20ms sweep frequency windows
+#define SWEEP_ERR                0.0005   // sweep frequency error bound (relative)
+#define BENCH_SECS               10
+
+// Render 'samples' from the synth in taskPlayTone slots
+static std::vector<float> render(ESP32S3_SYNTH &syn, uint32_t samples)
+{
+   std::vector<int16_t> slot(TONE_CHUNK);
+   std::vector<float> out;
+
+   while(out.size() < samples) {
+      uint32_t n = std::min<uint32_t>(TONE_CHUNK, samples - out.size());
+      syn.render(slot.data(), n);
+      out.insert(out.end(), slot.begin(), slot.begin() + n);
+   }
+   return out;
+}
+
+/********************************************************************
+ * @brief The replaced taskPlayTone loop, one voice per frequency: a
+ * double precision sin() per sample and voice, the period rounded to
+ * whole samples.
+ */
+static void oldTone(const std::vector<float> &freqs, float volume, int16_t *out, uint32_t len)
+{
+   std::vector<int> j(freqs.size(), 0), period(freqs.size());
+   std::vector<float> ratio(freqs.size());
+
+   for(size_t v = 0; v < freqs.size(); v++) {
+      period[v] = int(round(float(RATE) / freqs[v]));
+      ratio[v] = (PI * 2) * freqs[v] / float(RATE);
+   }
+   for(uint32_t i = 0; i < len; i++) {
+      int32_t acc = 0;
+      for(size_t v = 0; v < freqs.size(); v++) {
+         acc += int16_t(volume * sin(j[v] * ratio[v]) * VOL_NORM);
+         if(++j[v] >= period[v])
+            j[v] = 0;
+      }
+      out[i] = int16_t(constrain(acc, -32768, 32767));
+   }
+}
+
+// Frequency the synth's 32 bit phase increment gives for a float request
+static double synthHz(double freq)
+{
+   return double(uint32_t(double(float(freq)) * 4294967296.0 / RATE)) * RATE / 4294967296.0;
+}
+
+// Upward zero crossing times (samples, linearly interpolated) from 'from'
+static std::vector<double> crossings(const std::vector<float> &x, uint32_t from)
+{
+   std::vector<double> t;
+   for(uint32_t n = from + 1; n < x.size(); n++) {
+      if(x[n - 1] < 0.0f && x[n] >= 0.0f)
+         t.push_back(n - 1 + double(-x[n - 1]) / double(x[n] - x[n - 1]));
+   }
+   return t;
+}
+
+// Mean frequency over whole periods between the first & last crossing
+static double zeroCrossHz(const std::vector<float> &x, uint32_t from)
+{
+   std::vector<double> t = crossings(x, from);
+   return (t.size() < 2) ? 0.0 : (t.size() - 1) * double(RATE) / (t.back() - t.front());
+}
+
+/********************************************************************
+ * @brief Least squares fit of DC plus a sine & cosine at each of 'hz'
+ * to x[from..].
+ * @param amp - receives each tone's amplitude.
+ * @return SINAD: fitted tone power over the residual, dB.
+ */
+static double fitTones(const std::vector<float> &x, uint32_t from, const std::vector<double> &hz,
+         std::vector<double> &amp)
+{
+   const size_t K = 1 + 2 * hz.size();
+   std::vector<double> A(K * K, 0.0), b(K, 0.0), c(K), phi(K);
+
+   for(uint32_t n = from; n < x.size(); n++) {
+      phi[0] = 1.0;
+      for(size_t k = 0; k < hz.size(); k++) {
+         double w = 2.0 * M_PI * hz[k] * n / RATE;
+         phi[1 + 2 * k] = cos(w);
+         phi[2 + 2 * k] = sin(w);
+      }
+      for(size_t r = 0; r < K; r++) {
+         b[r] += phi[r] * x[n];
+         for(size_t q = 0; q < K; q++)
+            A[r * K + q] += phi[r] * phi[q];
+      }
+   }
+   // Gaussian elimination with partial pivoting
+   for(size_t col = 0; col < K; col++) {
+      size_t piv = col;
+      for(size_t r = col + 1; r < K; r++) {
+         if(fabs(A[r * K + col]) > fabs(A[piv * K + col]))
+            piv = r;
+      }
+      for(size_t q = 0; q < K; q++)
+         std::swap(A[col * K + q], A[piv * K + q]);
+      std::swap(b[col], b[piv]);
+      for(size_t r = col + 1; r < K; r++) {
+         double m = A[r * K + col] / A[col * K + col];
+         for(size_t q = col; q < K; q++)
+            A[r * K + q] -= m * A[col * K + q];
+         b[r] -= m * b[col];
+      }
+   }
+   for(size_t r = K; r-- > 0; ) {
+      double s = b[r];
+      for(size_t q = r + 1; q < K; q++)
+         s -= A[r * K + q] * c[q];
+      c[r] = s / A[r * K + r];
+   }
+   amp.resize(hz.size());
+   for(size_t k = 0; k < hz.size(); k++)
+      amp[k] = hypot(c[1 + 2 * k], c[2 + 2 * k]);
+
+   double sig = 0.0, err = 0.0;
+   for(uint32_t n = from; n < x.size(); n++) {
+      double y = c[0];
+      for(size_t k = 0; k < hz.size(); k++) {
+         double w = 2.0 * M_PI * hz[k] * n / RATE;
+         y += c[1 + 2 * k] * cos(w) + c[2 + 2 * k] * sin(w);
+      }
+      sig += (y - c[0]) * (y - c[0]);
+      err += (x[n] - y) * (x[n] - y);
+   }
+   return dB(sig, err);
+}
+
+/********************************************************************
+ * @brief Largest frequency error of a sweep, relative to the expected
+ * frequency. Frequency is measured over whole periods in SWEEP_WIN
+ * windows (a single period's crossings are too coarse at high pitch).
+ * @param expect - Hz at a time (secs).
+ * @param wrap_secs - repeat period, windows straddling a restart are
+ *    skipped. 0 = no repeat.
+ */
+template<class F> static double sweepError(const std::vector<float> &x, F expect, double wrap_secs)
+{
+   std::vector<double> t = crossings(x, SKIP_SAMPLES);
+   double worst = 0.0;
+
+   for(size_t a = 0, i = 1; i < t.size(); i++) {
+      if(t[i] - t[a] < SWEEP_WIN)
+         continue;
+      double mid = 0.5 * (t[i] + t[a]) / RATE;
+      if(wrap_secs <= 0.0 || floor(t[a] / RATE / wrap_secs) == floor(t[i] / RATE / wrap_secs)) {
+         double f = (i - a) * double(RATE) / (t[i] - t[a]);
+         worst = std::max(worst, fabs(f - expect(mid)) / expect(mid));
+      }
+      a = i;
+   }
+   return worst;
+}
+
+typedef struct {
+   const char *name;
+   std::vector<float> freqs;
+} bench_t ;
+
+int main(void)
+{
+   ESP32S3_SYNTH syn;
+   std::vector<double> amp;
+   std::vector<float> x;
+
+   syn.init(RATE);
+
+   /**
+    * @brief 1) Pitch of steady tones
+    */
+   printf("pitch     request Hz   synth Hz   error Hz   old loop Hz   SINAD dB\n");
+   for(double f : { 100.0, 440.0, 1000.0, 1234.5, 2750.3, 3999.9 }) {
+      syn.clear();
+      syn.addTone(f, 12000);
+      x = render(syn, RATE * 10);
+      double hz = zeroCrossHz(x, SKIP_SAMPLES);
+      double sinad = fitTones(x, SKIP_SAMPLES, { synthHz(f) }, amp);
+      std::vector<int16_t> old(RATE * 10);
+      oldTone({ float(f) }, 12000.0f / VOL_NORM, old.data(), old.size());
+      double old_hz = zeroCrossHz(std::vector<float>(old.begin(), old.end()), 0);
+      printf("          %10.1f %10.4f %10.5f %13.2f %10.1f\n", f, hz, hz - f, old_hz, sinad);
+      CHECK(fabs(hz - f) < PITCH_HZ, "%.1f Hz tone measured %.4f Hz", f, hz);
+      CHECK(fabs(amp[0] - 12000.0) < 12000.0 * 0.005, "%.1f Hz tone amplitude %.0f", f, amp[0]);
+      CHECK(sinad > MIN_SINAD_DB, "%.1f Hz tone SINAD %.1f dB", f, sinad);
+   }
+
+   /**
+    * @brief 2) Chord: C major 7th, four voices
+    */
+   const std::vector<double> chord = { 261.63, 329.63, 392.00, 493.88 };
+   syn.clear();
+   for(double f : chord)
+      CHECK(syn.addTone(f, 7000), "voice %.2f Hz not added", f);
+   CHECK(!syn.addTone(1000.0f, 7000), "fifth voice added");
+   x = render(syn, RATE * 2);
+   std::vector<double> chord_hz;
+   for(double f : chord)
+      chord_hz.push_back(synthHz(f));
+   double sinad = fitTones(x, SKIP_SAMPLES, chord_hz, amp);
+   float peak = 0.0f;
+   for(float v : x)
+      peak = std::max(peak, fabsf(v));
+   printf("chord     %.2f / %.2f / %.2f / %.2f Hz: amplitude %.0f / %.0f / %.0f / %.0f, SINAD %.1f dB, "
+            "peak %.0f\n", chord[0], chord[1], chord[2], chord[3], amp[0], amp[1], amp[2], amp[3], sinad, peak);
+   for(size_t k = 0; k < chord.size(); k++)
+      CHECK(fabs(amp[k] - 7000.0) < 7000.0 * 0.005, "chord voice %.2f Hz amplitude %.0f", chord[k], amp[k]);
+   CHECK(sinad > MIN_SINAD_DB, "chord SINAD %.1f dB", sinad);
+   CHECK(peak <= 4 * 7000.0f && peak > 0.9f * 4 * 7000.0f, "chord peak %.0f", peak);
+
+   /**
+    * @brief 3) DTMF, every key
+    */
+   const char *keys = "123A456B789C*0#D";
+   const std::vector<double> dtmf = { 697.0, 770.0, 852.0, 941.0, 1209.0, 1336.0, 1477.0, 1633.0 };
+   std::vector<double> dtmf_hz;
+   for(double f : dtmf)
+      dtmf_hz.push_back(synthHz(f));
+   double worst_amp = 0.0, worst_other = -200.0;
+   for(int k = 0; k < 16; k++) {
+      syn.clear();
+      CHECK(syn.addDtmf(keys[k], 16000), "key %c not added", keys[k]);
+      x = render(syn, RATE / 10);         // 100ms digit
+      fitTones(x, SKIP_SAMPLES, dtmf_hz, amp);
+      for(int t = 0; t < 8; t++) {
+         bool on = (t == k / 4) || (t == 4 + k % 4);
+         if(on)
+            worst_amp = std::max(worst_amp, fabs(amp[t] - 8000.0) / 8000.0);
+         else
+            worst_other = std::max(worst_other, 20.0 * log10(amp[t] / 8000.0 + 1e-12));
+      }
+   }
+   CHECK(!syn.addDtmf('X', 16000), "key X accepted");
+   printf("dtmf      16 keys: tone amplitude within %.3f%%, other DTMF tones %.1f dB\n", 100.0 * worst_amp,
+            worst_other);
+   CHECK(worst_amp < 0.005, "DTMF tone amplitude off by %.3f%%", 100.0 * worst_amp);
+   CHECK(worst_other < -MIN_SINAD_DB, "DTMF other tone at %.1f dB", worst_other);
+
+   /**
+    * @brief 4) Sweeps
+    */
+   syn.clear();
+   syn.addSweep(300.0f, 3000.0f, 1.0f, 12000);
+   x = render(syn, RATE * 2);
+   double glide = sweepError(x, [](double t) { return (t < 1.0) ? 300.0 + 2700.0 * t : 3000.0; }, 0.0);
+   double hold = zeroCrossHz(std::vector<float>(x.begin() + RATE * 1.1, x.end()), 0);
+   syn.clear();
+   syn.addSweep(1200.0f, 600.0f, 0.5f, 12000, true);
+   x = render(syn, RATE * 2);
+   double siren = sweepError(x, [](double t) { return 1200.0 - 600.0 * fmod(t, 0.5) / 0.5; }, 0.5);
+   printf("sweep     300 -> 3000 Hz in 1 s: largest error %.3f%%, then %.3f Hz held\n", 100.0 * glide, hold);
+   printf("          1200 -> 600 Hz siren, 0.5 s repeat: largest error %.3f%%\n", 100.0 * siren);
+   CHECK(glide < SWEEP_ERR, "sweep off the glide by %.3f%%", 100.0 * glide);
+   CHECK(fabs(hold - 3000.0) < 0.1, "sweep end held at %.3f Hz", hold);
+   CHECK(siren < SWEEP_ERR, "siren off the glide by %.3f%%", 100.0 * siren);
+
+   /**
+    * @brief 5) Cost against the old loop
+    */
+   printf("cost      tones           old sin() ns/sample   synth ns/sample   speedup\n");
+   const bench_t bench[] = {
+      { "1 kHz tone", { 1000.0f } },
+      { "DTMF 5", { 770.0f, 1336.0f } },
+      { "4 voice chord", { 261.63f, 329.63f, 392.0f, 493.88f } },
+   };
+   std::vector<int16_t> buf(RATE);
+   for(const bench_t &b : bench) {
+      double t_old = 1e30, t_syn = 1e30;
+      syn.clear();
+      for(float f : b.freqs)
+         syn.addTone(f, int16_t(3000 / b.freqs.size()));
+      for(int r = 0; r < BENCH_SECS; r++) {    // best second of each
+         double t0 = nowUs();
+         oldTone(b.freqs, 100.0f / b.freqs.size(), buf.data(), buf.size());
+         t_old = std::min(t_old, nowUs() - t0);
+         t0 = nowUs();
+         for(uint32_t i = 0; i < buf.size(); i += TONE_CHUNK)
+            syn.render(buf.data() + i, std::min<uint32_t>(TONE_CHUNK, buf.size() - i));
+         t_syn = std::min(t_syn, nowUs() - t0);
+      }
+      double ns_old = 1000.0 * t_old / buf.size(), ns_syn = 1000.0 * t_syn / buf.size();
+      printf("          %-15s %19.2f %17.2f %8.1fx\n", b.name, ns_old, ns_syn, ns_old / ns_syn);
+      CHECK(ns_old / ns_syn > MIN_HOST_SPEEDUP, "%s: synth only %.1fx faster", b.name, ns_old / ns_syn);
+   }
+   return testResult("test_synth");
+}
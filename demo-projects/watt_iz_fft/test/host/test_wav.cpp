@@ -0,0 +1,184 @@
+/********************************************************************
+ * @brief test_wav.cpp : ESP32S3_WAV rate conversion to 16KHz (pass
+ * band, aliasing, block continuity), the 'data' size clamp, and decode
+ * throughput on the host.
+ *
+ * @note WAV files are built in memory and read through the same
+ * callback interface as the SD card. Aliasing is the output level of a
+ * tone above the output Nyquist (all of it is folded back), relative to
+ * the input level. The same figure without the anti-alias low pass is
+ * computed with a plain linear interpolator, which is what decode() did
+ * before the filter.
+ */
+#include "esp32s3_wav.h"
+#include "host_test.h"
+
+#define OUT_RATE                 16000
+#define IN_BYTES                 4096     // raw bytes per decode(), as the WAV voice
+#define OUT_SAMPLES              512      // output buffer per decode()
+#define TONE_SECS                2
+#define LEVEL                    16000.0
+
+typedef std::vector<uint8_t> file_t;
+
+static int32_t memRead(void *ctx, uint8_t *buf, uint32_t len, uint32_t offset)
+{
+   const file_t &f = *(const file_t *)ctx;
+   if(offset >= f.size())
+      return 0;
+   len = std::min<uint32_t>(len, f.size() - offset);
+   memcpy(buf, f.data() + offset, len);
+   return int32_t(len);
+}
+
+static void put16(file_t &f, uint16_t v) { f.push_back(v & 0xFF); f.push_back(v >> 8); }
+static void put32(file_t &f, uint32_t v) { put16(f, v & 0xFFFF); put16(f, v >> 16); }
+
+// 16 bit PCM WAV of 'pcm' (interleaved), 'data' size field overridable
+static file_t makeWav(const std::vector<int16_t> &pcm, uint16_t ch, uint32_t rate,
+         uint32_t data_field=0)
+{
+   file_t f;
+   uint32_t bytes = pcm.size() * 2;
+   f.insert(f.end(), { 'R', 'I', 'F', 'F' });
+   put32(f, 36 + bytes);
+   f.insert(f.end(), { 'W', 'A', 'V', 'E', 'f', 'm', 't', ' ' });
+   put32(f, 16);
+   put16(f, WAV_FMT_PCM);
+   put16(f, ch);
+   put32(f, rate);
+   put32(f, rate * ch * 2);
+   put16(f, ch * 2);
+   put16(f, 16);
+   f.insert(f.end(), { 'd', 'a', 't', 'a' });
+   put32(f, (data_field) ? data_field : bytes);
+   for(int16_t v : pcm)
+      put16(f, uint16_t(v));
+   return f;
+}
+
+static std::vector<int16_t> tone(double hz, uint32_t rate, uint16_t ch)
+{
+   std::vector<int16_t> pcm(size_t(rate) * TONE_SECS * ch);
+   for(size_t i = 0; i < pcm.size(); i++)
+      pcm[i] = int16_t(LEVEL * sin(2.0 * M_PI * hz * double(i / ch) / rate));
+   return pcm;
+}
+
+// Decode the whole file, reading 'in_bytes' at a time
+static std::vector<int16_t> decodeAll(file_t &f, uint32_t in_bytes, double *us=nullptr)
+{
+   ESP32S3_WAV wav;
+   std::vector<int16_t> out, blk(OUT_SAMPLES);
+   std::vector<uint8_t> raw(in_bytes);
+
+   CHECK(wav.open(memRead, &f, OUT_RATE, in_bytes, OUT_SAMPLES, f.size()), "open");
+   uint32_t pos = wav.info().data_offset, end = pos + wav.info().data_bytes;
+   double t = 0.0;
+   while(pos < end) {
+      uint32_t len = std::min(wav.readSize(), end - pos);
+      memRead(&f, raw.data(), len, pos);
+      double t0 = nowUs();
+      uint32_t n = wav.decode(raw.data(), len, blk.data());
+      t += nowUs() - t0;
+      out.insert(out.end(), blk.begin(), blk.begin() + n);
+      pos += len;
+   }
+   if(us)
+      *us = t;
+   return out;
+}
+
+// Old behaviour: linear interpolation only
+static std::vector<int16_t> linearOnly(const std::vector<int16_t> &in, uint32_t rate)
+{
+   std::vector<int16_t> out;
+   for(double p = 0.0; p + 1.0 < in.size(); p += double(rate) / OUT_RATE) {
+      size_t i = size_t(p);
+      out.push_back(int16_t(in[i] + (in[i + 1] - in[i]) * (p - i)));
+   }
+   return out;
+}
+
+// Level in dB re the input tone, skipping the filter start up
+static double levelDb(const std::vector<int16_t> &x)
+{
+   double e = 0.0;
+   size_t from = OUT_RATE / 10;
+   for(size_t i = from; i < x.size(); i++)
+      e += double(x[i]) * x[i];
+   return dB(e / (x.size() - from), LEVEL * LEVEL / 2.0);
+}
+
+int main(void)
+{
+   /**
+    * @brief Pass band & aliasing, 44.1 and 48KHz mono
+    */
+   printf("rate   tone Hz   out dB   old dB   (out tone Hz)\n");
+   for(uint32_t rate : { 44100u, 48000u }) {
+      for(double hz : { 1000.0, 3400.0, 6000.0, 9000.0, 12000.0, 16000.0, 20000.0 }) {
+         std::vector<int16_t> pcm = tone(hz, rate, 1);
+         file_t f = makeWav(pcm, 1, rate);
+         double db = levelDb(decodeAll(f, IN_BYTES));
+         double old_db = levelDb(linearOnly(pcm, rate));
+         double alias = fabs(hz - OUT_RATE * round(hz / OUT_RATE));
+         printf("%5u  %7.0f  %7.1f  %7.1f   (%.0f)\n", rate, hz, db, old_db, alias);
+         if(hz <= 3400.0)
+            CHECK(fabs(db) < 0.5, "%u Hz: %.0f Hz pass band %.2f dB", rate, hz, db);
+         else if(hz < 8000.0)
+            CHECK(db > -3.0, "%u Hz: %.0f Hz pass band %.2f dB", rate, hz, db);
+         else if(hz < 10000.0)
+            CHECK(db < -15.0, "%u Hz: %.0f Hz aliases at %.1f dB", rate, hz, db);
+         else
+            CHECK(db < -40.0, "%u Hz: %.0f Hz aliases at %.1f dB", rate, hz, db);
+      }
+   }
+
+   /**
+    * @brief Block size must not change the output (filter state carries over)
+    */
+   file_t f = makeWav(tone(2500.0, 44100, 2), 2, 44100);
+   std::vector<int16_t> a = decodeAll(f, IN_BYTES), b = decodeAll(f, 1000);
+   uint32_t diff = (a.size() == b.size()) ? 0 : 1;
+   for(size_t i = 0; i < a.size() && i < b.size(); i++)
+      diff += (a[i] != b[i]);
+   printf("blocks    : %zu / %zu samples, %u differ between 4096 and 1000 byte reads\n",
+            a.size(), b.size(), diff);
+   CHECK(diff == 0, "output depends on the read size");
+
+   /**
+    * @brief 'data' size clamp
+    */
+   std::vector<int16_t> pcm = tone(1000.0, 16000, 1);
+   file_t ff = makeWav(pcm, 1, 16000, 0xFFFFFFFF);
+   ESP32S3_WAV wav;
+   CHECK(wav.parse(memRead, &ff, ff.size()) && wav.info().data_bytes == pcm.size() * 2 &&
+            wav.info().total_frames == pcm.size(), "streamed size: %u bytes", wav.info().data_bytes);
+   CHECK(wav.parse(memRead, &ff) && wav.info().data_bytes == 0xFFFFFFFF, "size unknown: kept as is");
+   file_t ft = makeWav(pcm, 1, 16000);
+   ft.resize(ft.size() - 1001);           // truncated copy, odd length
+   CHECK(wav.parse(memRead, &ft, ft.size()) && wav.info().data_bytes == pcm.size() * 2 - 1001 &&
+            wav.info().total_frames == (pcm.size() * 2 - 1001) / 2, "truncated: %u bytes",
+            wav.info().data_bytes);
+   printf("clamp     : 0xFFFFFFFF -> %u bytes, 1001 bytes short -> %u of %zu frames\n",
+            uint32_t(pcm.size() * 2), wav.info().total_frames, pcm.size());
+   CHECK(!wav.parse(memRead, &ft, 40), "data offset past the end of the file");
+
+   /**
+    * @brief Throughput (input frames per second)
+    */
+   printf("decode    : input Msamples/s on the host\n");
+   struct { uint32_t rate; uint16_t ch; } bench[] = { { 16000, 1 }, { 44100, 2 }, { 48000, 1 } };
+   for(auto &bc : bench) {
+      file_t fb = makeWav(tone(440.0, bc.rate, bc.ch), bc.ch, bc.rate);
+      double us = 0.0, total = 0.0;
+      for(int rep = 0; rep < 10; rep++) {
+         decodeAll(fb, IN_BYTES, &us);
+         total += us;
+      }
+      printf("   %5u Hz %u ch -> 16KHz mono  %8.1f\n", bc.rate, bc.ch,
+               10.0 * bc.rate * TONE_SECS / total);
+   }
+   return testResult("test_wav");
+}
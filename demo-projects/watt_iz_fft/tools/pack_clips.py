@@ -0,0 +1,172 @@
+#!/usr/bin/env python3
+"""
+pack_clips.py : Build a clip bank image for the 'clips' flash partition.
+
+Usage:
+   pack_clips.py -o clips.bin beep.wav alarm.wav ...
+   pack_clips.py --list clips.bin
+   pack_clips.py --partitions my_partitions.csv -o clips.bin ...
+
+Each WAV file becomes a clip named after the file (without extension).
+Audio is converted to 16 bit mono at 16KHz - the playback format - so the
+firmware can mix it straight from mapped flash (AUDIO::playClip()).
+
+Image layout (see src/clip_bank.h):
+   header      16 bytes   magic "CLPB", version, num_clips, image_bytes
+   index       48 bytes per clip, sorted by name
+   audio       each clip 4 byte aligned
+
+The image must fit the 'clips' partition, and is flashed at its offset.
+Both are read from the partition table (default esp32s3_partitions.csv
+next to tools/), and the esptool command is printed:
+   esptool.py --chip esp32s3 write_flash <offset> clips.bin
+"""
+import argparse
+import array
+import csv
+import os
+import struct
+import sys
+import wave
+
+CLIP_BANK_MAGIC = 0x42504C43
+CLIP_BANK_VERSION = 1
+CLIP_NAME_LEN = 32
+CLIP_FMT_PCM16 = 1
+PARTITION_LABEL = 'clips'
+PARTITIONS_CSV = os.path.join(os.path.dirname(os.path.abspath(__file__)), '..', 'esp32s3_partitions.csv')
+OUT_RATE = 16000
+
+HDR = struct.Struct('<IHHII')
+ENTRY = struct.Struct('<%dsIIIBBH' % CLIP_NAME_LEN)
+
+
+def parse_size(field):
+    """Partition table number: decimal, 0x hex, or with a K / M suffix."""
+    field = field.strip()
+    scale = {'K': 1024, 'M': 1024 * 1024}.get(field[-1:].upper(), 1)
+    if scale > 1:
+        field = field[:-1]
+    return int(field, 0) * scale
+
+
+def read_partition(path, label=PARTITION_LABEL):
+    """Return (offset, size) of a partition in an ESP-IDF partition table.
+    offset is None if the table leaves it to be assigned."""
+    with open(path, newline='') as f:
+        for row in csv.reader(f):
+            row = [c.strip() for c in row]
+            if not row or row[0].startswith('#') or row[0] != label:
+                continue
+            if len(row) < 5 or not row[4]:
+                raise ValueError('%s: %s partition has no size' % (path, label))
+            offset = parse_size(row[3]) if row[3] else None
+            return offset, parse_size(row[4])
+    raise ValueError('%s: no %s partition' % (path, label))
+
+
+def read_wav(path):
+    """Return the file as 16 bit mono samples at OUT_RATE."""
+    with wave.open(path, 'rb') as w:
+        channels, width, rate = w.getnchannels(), w.getsampwidth(), w.getframerate()
+        raw = w.readframes(w.getnframes())
+    if width == 1:                          # unsigned 8 bit
+        pcm = [(b - 128) << 8 for b in raw]
+    elif width == 2:
+        pcm = array.array('h', raw)
+        if sys.byteorder != 'little':
+            pcm.byteswap()
+    elif width in (3, 4):                   # keep the top 16 bits
+        pcm = [int.from_bytes(raw[i + width - 2:i + width], 'little', signed=True)
+               for i in range(0, len(raw), width)]
+    else:
+        raise ValueError('%s: unsupported sample width %d' % (path, width))
+
+    # Average the channels down to mono
+    mono = [sum(pcm[i:i + channels]) // channels for i in range(0, len(pcm), channels)]
+
+    # Linear resample to the playback rate
+    if rate != OUT_RATE and mono:
+        n = len(mono) * OUT_RATE // rate
+        step = rate / OUT_RATE
+        out = []
+        for i in range(n):
+            pos = i * step
+            j = int(pos)
+            a = mono[j]
+            b = mono[j + 1] if j + 1 < len(mono) else a
+            out.append(int(round(a + (b - a) * (pos - j))))
+        mono = out
+    return array.array('h', [max(-32768, min(32767, s)) for s in mono])
+
+
+def pack(files, partition_size):
+    clips = {}
+    for path in files:
+        name = os.path.splitext(os.path.basename(path))[0]
+        if len(name.encode()) >= CLIP_NAME_LEN:
+            raise ValueError('%s: name longer than %d chars' % (name, CLIP_NAME_LEN - 1))
+        if name in clips:
+            raise ValueError('%s: duplicate clip name' % name)
+        pcm = read_wav(path)
+        if sys.byteorder != 'little':
+            pcm.byteswap()
+        clips[name] = pcm.tobytes()
+
+    names = sorted(clips, key=lambda s: s.encode())   # firmware uses strncmp order
+    offset = HDR.size + ENTRY.size * len(names)
+    index, data = b'', b''
+    for name in names:
+        pad = (-offset) % 4
+        data += b'\0' * pad
+        offset += pad
+        audio = clips[name]
+        index += ENTRY.pack(name.encode(), offset, len(audio), OUT_RATE, CLIP_FMT_PCM16, 1, 0)
+        data += audio
+        offset += len(audio)
+
+    image = HDR.pack(CLIP_BANK_MAGIC, CLIP_BANK_VERSION, len(names), offset, 0) + index + data
+    if len(image) > partition_size:
+        raise ValueError('image is %d bytes, partition holds %d' % (len(image), partition_size))
+    return image
+
+
+def list_image(path):
+    with open(path, 'rb') as f:
+        img = f.read()
+    magic, version, num, size, _ = HDR.unpack_from(img, 0)
+    if magic != CLIP_BANK_MAGIC or version != CLIP_BANK_VERSION:
+        raise ValueError('%s: not a clip bank image' % path)
+    print('%d clips, %d bytes' % (num, size))
+    for i in range(num):
+        name, offset, nbytes, rate, fmt, ch, _ = ENTRY.unpack_from(img, HDR.size + i * ENTRY.size)
+        ms = nbytes * 1000 // (2 * ch * rate)
+        print('  %-31s offset 0x%06X  %6d bytes  %5d ms' % (name.rstrip(b'\0').decode(), offset, nbytes, ms))
+
+
+def main():
+    ap = argparse.ArgumentParser(description='Build a clip bank image from WAV files.')
+    ap.add_argument('-o', '--output', default='clips.bin', help='image file (default clips.bin)')
+    ap.add_argument('--list', metavar='IMAGE', help='print the clips of an image and exit')
+    ap.add_argument('--partitions', metavar='CSV', default=PARTITIONS_CSV,
+                    help='partition table with the %s partition (default %s)' %
+                    (PARTITION_LABEL, os.path.relpath(PARTITIONS_CSV)))
+    ap.add_argument('wavs', nargs='*', help='WAV files, one clip each')
+    args = ap.parse_args()
+
+    if args.list:
+        list_image(args.list)
+        return
+    if not args.wavs:
+        ap.error('no WAV files given')
+    offset, size = read_partition(args.partitions)
+    image = pack(args.wavs, size)
+    with open(args.output, 'wb') as f:
+        f.write(image)
+    print('%s: %d clips, %d bytes of %d' % (args.output, len(args.wavs), len(image), size))
+    if offset is not None:
+        print('flash: esptool.py --chip esp32s3 write_flash 0x%X %s' % (offset, args.output))
+
+
+if __name__ == '__main__':
+    main()